@@ -0,0 +1,57 @@
+#ifndef ADAPTIVE_TILE_SIZE // just to make IDE shut up
+#define ADAPTIVE_TILE_SIZE 16
+#endif
+
+// Adaptive sampling - new paths take the pixels of the tiles in the schedule made by AdaptiveSampling on the CPU,
+// every tile of the schedule is a pass over its pixels. The error of the tiles comes from the mean and the second
+// moment of the displayed luminance of their pixels, the moment is kept in the second slice of the output.
+
+float luminance(float3 color)
+{
+	return dot(color, float3(0.2126, 0.7152, 0.0722));
+}
+
+// tiles along a side of the image
+uint tileCount(uint pixels)
+{
+	return (pixels + ADAPTIVE_TILE_SIZE - 1) / ADAPTIVE_TILE_SIZE;
+}
+
+// every other bit from the lowest one, x of a Morton code
+uint compactBits(uint value)
+{
+	value &= 0x55555555;
+	value = (value ^ (value >> 1)) & 0x33333333;
+	value = (value ^ (value >> 2)) & 0x0f0f0f0f;
+	value = (value ^ (value >> 4)) & 0x00ff00ff;
+	value = (value ^ (value >> 8)) & 0x0000ffff;
+	return value;
+}
+
+// pixels of the tile inside of the image, the same as AdaptiveSampling::tilePixels
+uint tilePixels(uint tile, uint2 size)
+{
+	uint2 corner = uint2(tile % tileCount(size.x), tile / tileCount(size.x)) * ADAPTIVE_TILE_SIZE;
+	uint2 extent = min(size - corner, ADAPTIVE_TILE_SIZE);
+	return extent.x * extent.y;
+}
+
+// pixel at the position in the pass over the tile by rows or along the Morton curve, the same as AdaptiveSampling::tilePixel,
+// tiles over the edge of the image go by rows over their pixels inside of it
+uint2 tilePixel(uint tile, uint position, uint2 size, bool morton)
+{
+	uint2 corner = uint2(tile % tileCount(size.x), tile / tileCount(size.x)) * ADAPTIVE_TILE_SIZE;
+	uint2 extent = min(size - corner, ADAPTIVE_TILE_SIZE);
+
+	if (extent.x < ADAPTIVE_TILE_SIZE || extent.y < ADAPTIVE_TILE_SIZE)
+		return corner + uint2(position % extent.x, position / extent.x);
+
+	uint2 offset = morton ? uint2(compactBits(position), compactBits(position >> 1)) : uint2(position % ADAPTIVE_TILE_SIZE, position / ADAPTIVE_TILE_SIZE);
+	return corner + offset;
+}
+
+// standard error of the mean of a pixel, the same as AdaptiveSampling::pixelError
+float pixelError(float mean, float moment, uint samples)
+{
+	return samples > 0 ? sqrt(max(moment - mean * mean, 0) / samples) : 0;
+}
@@ -0,0 +1,43 @@
+#include "structs.h"
+#include "adaptive.h"
+
+////////////////////////////////////////////
+
+cbuffer Cam : register(b0)
+{
+	Camera cam;
+};
+
+////////////////////////////////////////////
+
+RWTexture2DArray<float4> output : register(u0);
+RWByteAddressBuffer tileErrors : register(u6);
+
+////////////////////////////////////////////
+
+
+// error of every tile for AdaptiveSampling, the largest error and the fewest samples of its pixels
+[numthreads(NUM_THREADS, 1, 1)]
+void main(uint3 gid : SV_GroupID, uint tid : SV_GroupIndex)
+{
+	uint2 size = uint2(1.0 / cam.pixelSize.x, 1.0 / cam.pixelSize.y);
+	uint tile = tid + NUM_THREADS * gid.x;
+	
+	if (tile >= tileCount(size.x) * tileCount(size.y))
+		return;
+	
+	float error = 0;
+	uint samples = 0xffffffff;
+	
+	for (uint i = 0; i < tilePixels(tile, size); i++)
+	{
+		uint2 coord = tilePixel(tile, i, size, false);
+		float4 pixel = output[uint3(coord, 0)];
+		uint sampleCount = asuint(pixel.a);
+		
+		error = max(error, pixelError(luminance(pixel.rgb), output[uint3(coord, 1)].x, sampleCount));
+		samples = min(samples, sampleCount);
+	}
+	
+	tileErrors.Store2(tile * 8, uint2(asuint(error), samples));
+}
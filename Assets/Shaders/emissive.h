@@ -0,0 +1,27 @@
+// Triangles of the emissive materials collected by Scene::createEmissives with an alias table over their power,
+// the area times the largest emission component. They are lights next to the spheres - shadow rays pick a triangle
+// by the table and a uniform point on it, extension rays hitting one weight its emission against that sample.
+// It needs lightTable.h for the alias table.
+
+StructuredBuffer<EmissiveTriangle> emissives : register(t89);
+StructuredBuffer<LightTableEntry> emissiveTable : register(t90);
+
+// probability the light sample goes to the emissive triangles, the spheres and the environment take the rest
+float emissiveSelection()
+{
+	return cam.emissiveCount > 0 ? 1.0 / lightStrategies() : 0.0;
+}
+
+// emissive triangle picked by its power and the probability it's picked with, zero without them
+uint sampleEmissiveTable(float u, out float pdf)
+{
+	return sampleAliasTable(emissiveTable, cam.emissiveCount, u, pdf);
+}
+
+// probability per solid angle of the light sample at a point of an emissive triangle, the pick by the area cancels
+// with the uniform point on it, so it's given by the emission of the material alone, cosine is at the triangle
+float emissivePdf(float3 emission, float distance, float cosine)
+{
+	float power = max(emission.x, max(emission.y, emission.z));
+	return emissiveSelection() * power / cam.emissivePower * distance * distance / max(cosine, EPSILON);
+}
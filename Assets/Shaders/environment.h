@@ -0,0 +1,78 @@
+// Equirectangular HDR environment map of EnvironmentMap with alias tables over its cells, the table of the rows first
+// and the tables of the cells of every row after it, weighted by the luminance times the sine of the polar angle.
+// Shadow rays pick a row, a cell of it and a uniform point of the cell, extension rays leaving the scene weight the map
+// against that sample. Without a map the environment is the constant color of the camera and it's never sampled.
+// It needs lightTable.h for the alias table.
+
+Texture2D<float3> environmentMap : register(t91);
+StructuredBuffer<LightTableEntry> environmentTable : register(t92);
+
+// probability the light sample goes to the environment, the spheres and the emissive triangles take the rest
+float environmentSelection()
+{
+	return cam.environmentCells.x > 0 ? 1.0 / lightStrategies() : 0.0;
+}
+
+// texture coordinates of the direction, v goes from the top
+float2 environmentUV(float3 direction)
+{
+	float u = atan2(direction.z, direction.x) / (2.0 * PI) + 0.5 + cam.environmentRotation;
+	return float2(u - floor(u), acos(clamp(direction.y, -1.0, 1.0)) / PI);
+}
+
+float3 environmentDirection(float2 uv)
+{
+	float phi = 2.0 * PI * (uv.x - 0.5 - cam.environmentRotation);
+	float theta = PI * uv.y;
+	return float3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+}
+
+// the nearest texel, the tables are constant over a cell too
+float3 environmentRadiance(float3 direction)
+{
+	if (cam.environmentCells.x == 0)
+		return cam.envColor;
+
+	uint width, height;
+	environmentMap.GetDimensions(width, height);
+
+	uint2 texel = min(uint2(environmentUV(direction) * float2(width, height)), uint2(width - 1, height - 1));
+	return environmentMap.Load(uint3(texel, 0)) * cam.environmentIntensity;
+}
+
+// probability per solid angle of a point of the cell, the pick of the strategy included,
+// a uniform point of the texture coordinates goes to the sphere by the sine of the polar angle
+float environmentCellPdf(uint2 cell, float v)
+{
+	uint2 cells = cam.environmentCells;
+	float pdf = environmentTable[cell.y].pdf * environmentTable[cells.y + cell.y * cells.x + cell.x].pdf;
+	float sine = sin(PI * v);
+
+	return sine > 0.0 ? environmentSelection() * pdf * cells.x * cells.y / (2.0 * PI * PI * sine) : 0.0;
+}
+
+// probability per solid angle of the light sample in the direction, zero without the map
+float environmentPdf(float3 direction)
+{
+	uint2 cells = cam.environmentCells;
+	if (cells.x == 0)
+		return 0.0;
+
+	float2 uv = environmentUV(direction);
+	return environmentCellPdf(min(uint2(uv * cells), cells - 1), uv.y);
+}
+
+// direction picked by the tables, u picks the row, r.x the cell of the row and the position in it with r.y
+float3 sampleEnvironment(float u, float2 r, out float pdf)
+{
+	uint2 cells = cam.environmentCells;
+	float rowPdf, cellPdf, remainder;
+
+	uint y = sampleAliasTable(environmentTable, 0, cells.y, u, rowPdf, remainder);
+	uint x = sampleAliasTable(environmentTable, cells.y + y * cells.x, cells.x, r.x, cellPdf, remainder);
+
+	float2 uv = (float2(x, y) + float2(remainder, r.y)) / float2(cells);
+	pdf = rowPdf > 0.0 && cellPdf > 0.0 ? environmentCellPdf(uint2(x, y), uv.y) : 0.0;
+
+	return environmentDirection(uv);
+}
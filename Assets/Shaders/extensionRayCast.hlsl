@@ -7,7 +7,9 @@ struct State
     Ray ray;
     float3 hitPoint;
     float3 baryCoord;
-    Triangle tri;
+    int triangle; // index of the hit triangle, it's loaded after the traversal
+    uint instance;
+    uint pathLength; // for the texture footprint of the masked triangles
 };
 
 ////////////////////////////////////////////
@@ -23,10 +25,16 @@ RWByteAddressBuffer pathState : register(u1);
 RWByteAddressBuffer queue : register(u2);
 RWByteAddressBuffer queueCounters : register(u3);
 
-StructuredBuffer<BVHNode> tree : register(t0);
-StructuredBuffer<Triangle> indices : register(t1);
-Buffer<float3> vertices : register(t2);
 StructuredBuffer<Light> lights : register(t3);
+StructuredBuffer<Instance> instances : register(t8);
+
+#include "geometry.h"
+#include "lightTree.h"
+
+SamplerState samplerState : register(s0);
+
+#include "virtualTexture.h"
+#include "opacity.h"
 
 ////////////////////////////////////////////
 
@@ -35,11 +43,11 @@ static State state;
 ////////////////////////////////////////////
 
 
-bool rayTriangleIntersection(float3 v0, float3 v1, float3 v2, inout float distance)
+// hit of the triangle closer than the distance, its distance and barycentric coordinates u, v
+bool rayTriangleIntersection(float3 v0, float3 e1, float3 e2, float distance, out float3 hit)
 {
-    float3 e1 = v1 - v0;
-    float3 e2 = v2 - v0;
-	
+    hit = float3(0, 0, 0);
+
     float3 pvec = cross(state.ray.direction, e2);
     float det = dot(e1, pvec);
 
@@ -60,20 +68,9 @@ bool rayTriangleIntersection(float3 v0, float3 v1, float3 v2, inout float distan
         return false;
 	
     float t = dot(e2, qvec) * invDet;
+    hit = float3(t, u, v);
 	
-    if (t >= 0/*t > EPSILON && t < 1 / EPSILON*/) // ray intersection
-    {
-        float3 pp = state.ray.origin + state.ray.direction * t;
-
-        if (t < distance)
-        {
-            distance = t;
-            state.hitPoint = pp;
-            state.baryCoord = float3(1 - u - v, u, v);
-            return true;
-        }
-    }
-    return false;
+    return t >= 0/*t > EPSILON && t < 1 / EPSILON*/ && t < distance; // ray intersection
 }
 
 float rayAABBIntersection(float3 minbox, float3 maxbox, Ray r)
@@ -100,31 +97,62 @@ float rayBVHIntersection()
     stack[ptr++] = -1;
     float distance = FLT_MAX;
 
+    Ray worldRay = state.ray;
+    int instance = -1; // instance being traversed, -1 in the top level BVH
+    uint instanceDepth = 0; // stack depth the instance was entered at
+
 	// early test
-    BVHNode node = tree[0];
+    BVHNode node = loadNode(0);
     if (rayAABBIntersection(node.min, node.max, state.ray) > 0.0)
     {
         for (int idx = 0; idx > -1;)
         {
-            node = tree[idx];
+            node = loadNode(idx);
 
             if (node.isLeaf)
             {
+                if (instance < 0)
+                {
+                    // top level leaf - continue in the mesh BVH with the ray in object space of the instance
+                    instance = node.leftIndex;
+                    instanceDepth = ptr;
+                    state.ray = transformRay(instances[instance], worldRay);
+                    idx = instances[instance].root;
+                    continue;
+                }
+
+                uint mesh = instances[instance].mesh;
+
                 for (int i = node.leftIndex; i < node.rightIndex; i++)
                 {
-                    uint3 ii = indices[i].vtix;
-                    float3 v0 = vertices[ii.x];
-                    float3 v1 = vertices[ii.y];
-                    float3 v2 = vertices[ii.z];
+                    TrianglePositions tri = loadTrianglePositions(i, mesh);
+                    float3 hit;
 
-                    if (rayTriangleIntersection(v0, v1, v2, distance))
-                        state.tri = indices[i];
+                    if (!rayTriangleIntersection(tri.v0, tri.e1, tri.e2, distance, hit))
+                        continue;
+
+                    // the masked triangles are cut out by their alpha, the material is read only in the scenes which have them
+                    [branch] if (cam.opacityFlags & MASKED_TRIANGLE)
+                    {
+                        uint material = loadTriangleMaterial(i, mesh);
+
+                        [branch] if (material & MASKED_TRIANGLE)
+                        {
+                            if (alphaCutout(material, i, mesh, tri, hit.yz, hit.x, state.pathLength))
+                                continue;
+                        }
+                    }
+
+                    distance = hit.x;
+                    state.baryCoord = float3(1 - hit.y - hit.z, hit.y, hit.z);
+                    state.triangle = i;
+                    state.instance = instance;
                 }
             }
             else
             {
-                BVHNode left = tree[node.leftIndex];
-                BVHNode right = tree[node.rightIndex];
+                BVHNode left = loadNode(node.leftIndex);
+                BVHNode right = loadNode(node.rightIndex);
 
                 float leftHit = rayAABBIntersection(left.min, left.max, state.ray);
                 float rightHit = rayAABBIntersection(right.min, right.max, state.ray);
@@ -144,7 +172,9 @@ float rayBVHIntersection()
                         deferred = node.rightIndex;
                     }
 
-                    stack[ptr++] = deferred;
+                    // never full for the depths checked at the load, the far child is dropped rather than written past it
+                    if (ptr < STACKSIZE)
+                        stack[ptr++] = deferred;
                     continue;
                 }
                 else if (leftHit > 0.0)
@@ -158,6 +188,14 @@ float rayBVHIntersection()
                     continue;
                 }
             }
+
+            // mesh BVH finished, back to the world ray
+            if (instance >= 0 && ptr == instanceDepth)
+            {
+                instance = -1;
+                state.ray = worldRay;
+            }
+
             idx = stack[--ptr];
         }
     }
@@ -167,30 +205,7 @@ float rayBVHIntersection()
 
 void rayLightIntersection(inout uint lightIndex, inout float distance)
 {
-	for (uint i = 0; i < cam.lightCount; i++)
-	{
-		float3 position = lights[i].position - state.ray.origin;
-		float radius2 = lights[i].radius * lights[i].radius;
-			
-		float tca = dot(position, state.ray.direction);
-		float d2 = dot(position, position) - tca * tca;
-			
-		if (d2 > radius2)
-			continue;
-			
-		float thc = sqrt(radius2 - d2);
-		float t0 = tca - thc;
-		float t1 = tca + thc;
- 
-		if (t0 < 0)
-			t0 = t1; // if t0 is negative, let's use t1 instead
- 
-		if (t0 > 0.0f && t0 < distance)
-		{
-			distance = t0;
-			lightIndex = i + 1;
-		}
-	}
+	intersectLightTree(state.ray, lightIndex, distance);
 }
 
 
@@ -212,15 +227,21 @@ void main(uint3 gid : SV_GroupID, uint tid : SV_GroupIndex) // TODO does it need
 
 		state.ray.origin = _pstate_rayOrigin;
 		state.ray.direction = _pstate_rayDirection;
+		state.pathLength = _pstate_pathLength;
 		
         float distance = rayBVHIntersection(); // TODO maybe traverse more than one path
 		
 		if (distance < FLT_MAX)
         {
+			// distance along the world ray is the same as along the instance one
+			state.hitPoint = state.ray.origin + state.ray.direction * distance;
+			
 			_set_pstate_surfacePoint(state.hitPoint);
 			_set_pstate_baryCoord(state.baryCoord);
+			_set_pstate_instance(state.instance);
 			
-			uint4 tri = uint4(state.tri.vtix, state.tri.materialID);
+			Triangle hit = loadTriangle(state.triangle, instances[state.instance].mesh);
+			uint4 tri = uint4(hit.vtix, hit.materialID);
 			_set_pstate_triangle(tri);
 		}
 		
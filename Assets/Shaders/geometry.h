@@ -0,0 +1,145 @@
+#ifndef NODE_CHUNK_BITS // just to make IDE shut up
+#define NODE_CHUNK_BITS 23
+#define TRIANGLE_CHUNK_BITS 25
+#define VERTEX_CHUNK_BITS 25
+#define PROPERTIES_CHUNK_BITS 24
+#define POSITION_CHUNK_BITS 23
+#define PRECOMPUTED_TRIANGLES 1
+#define COMPRESSED_GEOMETRY 0
+#endif
+
+// Scene geometry is split into up to 16 chunks of 2^*_CHUNK_BITS elements per buffer, every chunk is a separate view,
+// so scenes aren't limited by the size of a single buffer. Shader model 5 can't index an array of buffers
+// by a variable, loads pick the chunk by a switch. The first chunk keeps the original register, the others follow t8,
+// precomputed triangle positions take t69-t84.
+// Compressed geometry keeps the registers with packed elements, the decoding of every mesh takes t85.
+
+#define CHUNK_CASE(name, chunk) case chunk: return name##chunk[i];
+
+#define CHUNKED_BUFFER(Type, Element, name, load, bits, r0, r1, r2, r3, r4, r5, r6, r7, r8, r9, r10, r11, r12, r13, r14, r15) \
+	Type name##0 : register(r0); Type name##1 : register(r1); Type name##2 : register(r2); Type name##3 : register(r3); \
+	Type name##4 : register(r4); Type name##5 : register(r5); Type name##6 : register(r6); Type name##7 : register(r7); \
+	Type name##8 : register(r8); Type name##9 : register(r9); Type name##10 : register(r10); Type name##11 : register(r11); \
+	Type name##12 : register(r12); Type name##13 : register(r13); Type name##14 : register(r14); Type name##15 : register(r15); \
+	\
+	Element load(uint index) \
+	{ \
+		uint i = index & ((1u << bits) - 1); \
+		[branch] switch (index >> bits) \
+		{ \
+		CHUNK_CASE(name, 1) CHUNK_CASE(name, 2) CHUNK_CASE(name, 3) CHUNK_CASE(name, 4) CHUNK_CASE(name, 5) \
+		CHUNK_CASE(name, 6) CHUNK_CASE(name, 7) CHUNK_CASE(name, 8) CHUNK_CASE(name, 9) CHUNK_CASE(name, 10) \
+		CHUNK_CASE(name, 11) CHUNK_CASE(name, 12) CHUNK_CASE(name, 13) CHUNK_CASE(name, 14) CHUNK_CASE(name, 15) \
+		default: return name##0[i]; \
+		} \
+	}
+
+CHUNKED_BUFFER(StructuredBuffer<BVHNode>, BVHNode, tree, loadNode, NODE_CHUNK_BITS,
+	t0, t9, t10, t11, t12, t13, t14, t15, t16, t17, t18, t19, t20, t21, t22, t23)
+
+#if COMPRESSED_GEOMETRY
+CHUNKED_BUFFER(StructuredBuffer<uint2>, uint2, indices, loadPackedTriangle, TRIANGLE_CHUNK_BITS,
+	t1, t24, t25, t26, t27, t28, t29, t30, t31, t32, t33, t34, t35, t36, t37, t38)
+
+CHUNKED_BUFFER(Buffer<uint2>, uint2, vertices, loadPackedVertex, VERTEX_CHUNK_BITS,
+	t2, t39, t40, t41, t42, t43, t44, t45, t46, t47, t48, t49, t50, t51, t52, t53)
+
+CHUNKED_BUFFER(StructuredBuffer<uint2>, uint2, triParams, loadPackedParameters, PROPERTIES_CHUNK_BITS,
+	t4, t54, t55, t56, t57, t58, t59, t60, t61, t62, t63, t64, t65, t66, t67, t68)
+
+StructuredBuffer<MeshGeometry> meshes : register(t85);
+
+// three 21 bit integers in 64 bits, the layout of BVHWrapper::Packed3x21
+uint3 unpack3x21(uint2 p)
+{
+	return uint3(p.x & 0x1FFFFF, (p.x >> 21 | p.y << 11) & 0x1FFFFF, (p.y >> 10) & 0x1FFFFF);
+}
+
+// vertex indices of the mesh are made global like the uncompressed ones, the material is the same for the whole mesh
+Triangle loadTriangle(uint i, uint mesh)
+{
+	MeshGeometry geometry = meshes[mesh];
+	Triangle tri;
+	tri.vtix = unpack3x21(loadPackedTriangle(i)) + geometry.vertexOffset;
+	tri.materialID = geometry.material & ~TRIANGLE_FLAGS;
+	return tri;
+}
+
+// material index with the opacity flags in its top bits, the packed triangles have no room for them, it's the one of the mesh
+uint loadTriangleMaterial(uint i, uint mesh)
+{
+	return meshes[mesh].material;
+}
+
+// position quantized to the bounds of the mesh
+float3 loadVertex(uint i, uint mesh)
+{
+	MeshGeometry geometry = meshes[mesh];
+	return geometry.origin + float3(unpack3x21(loadPackedVertex(i))) * geometry.scale;
+}
+
+// octahedral normal in two 16 bit snorms, texture coordinates in two halfs
+TriangleParameters loadTriangleParameters(uint i)
+{
+	uint2 packed = loadPackedParameters(i);
+	float2 octahedral = max(float2(int2(asint(packed.x << 16), asint(packed.x)) >> 16) / 32767.0, -1.0);
+
+	// unfolding of the lower hemisphere
+	float3 normal = float3(octahedral, 1.0 - abs(octahedral.x) - abs(octahedral.y));
+	float t = saturate(-normal.z);
+	normal.xy += normal.xy >= 0.0 ? -t : t;
+
+	TriangleParameters params = (TriangleParameters)0;
+	params.normal = normalize(normal);
+	params.texCoord = f16tof32(uint2(packed.y, packed.y >> 16));
+	return params;
+}
+#else
+CHUNKED_BUFFER(StructuredBuffer<Triangle>, Triangle, indices, loadTriangleIndices, TRIANGLE_CHUNK_BITS,
+	t1, t24, t25, t26, t27, t28, t29, t30, t31, t32, t33, t34, t35, t36, t37, t38)
+
+CHUNKED_BUFFER(Buffer<float3>, float3, vertices, loadVertexPosition, VERTEX_CHUNK_BITS,
+	t2, t39, t40, t41, t42, t43, t44, t45, t46, t47, t48, t49, t50, t51, t52, t53)
+
+CHUNKED_BUFFER(StructuredBuffer<TriangleParameters>, TriangleParameters, triParams, loadTriangleParameters, PROPERTIES_CHUNK_BITS,
+	t4, t54, t55, t56, t57, t58, t59, t60, t61, t62, t63, t64, t65, t66, t67, t68)
+
+// the mesh is needed only to decode the compressed geometry
+Triangle loadTriangle(uint i, uint mesh)
+{
+	Triangle tri = loadTriangleIndices(i);
+	tri.materialID &= ~TRIANGLE_FLAGS;
+	return tri;
+}
+
+// material index with the opacity flags in its top bits
+uint loadTriangleMaterial(uint i, uint mesh)
+{
+	return loadTriangleIndices(i).materialID;
+}
+
+float3 loadVertex(uint i, uint mesh)
+{
+	return loadVertexPosition(i);
+}
+#endif
+
+#if PRECOMPUTED_TRIANGLES
+CHUNKED_BUFFER(StructuredBuffer<TrianglePositions>, TrianglePositions, triPositions, loadPrecomputedPositions, POSITION_CHUNK_BITS,
+	t69, t70, t71, t72, t73, t74, t75, t76, t77, t78, t79, t80, t81, t82, t83, t84)
+#endif
+
+// vertex and edges of the i-th triangle of the indices in the given mesh, a single load if they are precomputed, four otherwise
+TrianglePositions loadTrianglePositions(uint i, uint mesh)
+{
+#if PRECOMPUTED_TRIANGLES
+	return loadPrecomputedPositions(i);
+#else
+	Triangle tri = loadTriangle(i, mesh);
+	TrianglePositions positions;
+	positions.v0 = loadVertex(tri.vtix.x, mesh);
+	positions.e1 = loadVertex(tri.vtix.y, mesh) - positions.v0;
+	positions.e2 = loadVertex(tri.vtix.z, mesh) - positions.v0;
+	return positions;
+#endif
+}
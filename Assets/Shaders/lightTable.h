@@ -0,0 +1,55 @@
+#ifndef LIGHT_TREE_SELECTION // just to make IDE shut up
+#define LIGHT_TREE_SELECTION 1
+#endif
+
+// Alias table over the power of the lights built by AliasTable, it has an entry per light or none if all of them are black.
+// It picks a light in constant time but ignores where the shading point is, see LIGHT_TREE_SELECTION.
+
+StructuredBuffer<LightTableEntry> lightTable : register(t87);
+
+// element of the count entries of the table from the offset picked by a uniform random number and the probability it's picked with,
+// the part of the number left over by the pick is uniform again and given in the remainder
+uint sampleAliasTable(StructuredBuffer<LightTableEntry> table, uint offset, uint count, float u, out float pdf, out float remainder)
+{
+	pdf = 0.0;
+	remainder = 0.0;
+	if (count == 0)
+		return 0;
+
+	// the integer part picks the entry, the fraction decides between its element and the alias,
+	// an unbound table reads zeros so nothing is picked
+	float scaled = u * count;
+	uint index = min(uint(scaled), count - 1);
+	LightTableEntry entry = table[offset + index];
+	float fraction = scaled - index;
+
+	if (fraction < entry.threshold)
+	{
+		remainder = fraction / entry.threshold;
+		pdf = entry.pdf;
+		return index;
+	}
+
+	remainder = min((fraction - entry.threshold) / (1.0 - entry.threshold), 0.99999994);
+	pdf = table[offset + entry.alias].pdf;
+	return entry.alias;
+}
+
+uint sampleAliasTable(StructuredBuffer<LightTableEntry> table, uint count, float u, out float pdf)
+{
+	float remainder;
+	return sampleAliasTable(table, 0, count, u, pdf, remainder);
+}
+
+// light sample strategies with something to sample - the spheres, the emissive triangles and the environment map,
+// a light sample goes to each of them with the same probability
+float lightStrategies()
+{
+	return (cam.lightCount > 0 ? 1.0 : 0.0) + (cam.emissiveCount > 0 ? 1.0 : 0.0) + (cam.environmentCells.x > 0 ? 1.0 : 0.0);
+}
+
+// light picked by its power and the probability it's picked with, zero without lights
+uint sampleLightTable(float u, out float pdf)
+{
+	return sampleAliasTable(lightTable, cam.lightCount, u, pdf);
+}
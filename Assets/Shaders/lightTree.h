@@ -0,0 +1,131 @@
+// Bounding sphere hierarchy over the lights built by LightBVH, parents before their children, the root is the first node.
+// Shadow rays pick a light by a descent weighted by the importance of the children at the shading point,
+// extension rays find the emitters they hit by traversing it.
+
+StructuredBuffer<LightNode> lightTree : register(t86);
+
+// importance of the node for the point - the falloff of lightFalloff by the distance of its center with the window
+// at the nearest point of the bounding sphere and the cosine of the smallest angle between the normal and the sphere,
+// zero only if no light of the node can reach the point, so the selection stays unbiased
+float lightImportance(LightNode node, float3 position, float3 normal)
+{
+	float3 offset = node.center - position;
+	float distance = length(offset);
+	float nearest = max(distance - node.radius, 0.0);
+
+	if (nearest >= node.range)
+		return 0.0;
+
+	float cosine = 1.0;
+	if (distance > node.radius)
+	{
+		float cosTheta = dot(offset, normal) / distance;
+		float sinTheta = sqrt(max(1.0 - cosTheta * cosTheta, 0.0));
+		float sinAlpha = node.radius / distance;
+		float cosAlpha = sqrt(1.0 - sinAlpha * sinAlpha);
+
+		// cosine of the angle to the center shrunk by the half angle of the sphere
+		cosine = cosTheta >= cosAlpha ? 1.0 : cosTheta * cosAlpha + sinTheta * sinAlpha;
+		if (cosine <= 0.0)
+			return 0.0;
+	}
+
+	float ratio = nearest * nearest / (node.range * node.range);
+	float window = 1.0 - ratio * ratio;
+	return node.power * cosine * window * window / (distance * distance + 1.0);
+}
+
+// light for the shading point and the probability it's picked with, zero if no light reaches the point
+uint sampleLightTree(float3 position, float3 normal, float u, out float pdf)
+{
+	pdf = 0.0;
+	if (cam.lightCount == 0)
+		return 0;
+
+	LightNode node = lightTree[0];
+	if (lightImportance(node, position, normal) <= 0.0)
+		return 0;
+
+	// the random number is rescaled after every choice, so a single one is enough for the whole descent
+	float probability = 1.0;
+
+	while (node.rightIndex >= 0)
+	{
+		LightNode left = lightTree[node.leftIndex];
+		LightNode right = lightTree[node.rightIndex];
+		float leftImportance = lightImportance(left, position, normal);
+		float rightImportance = lightImportance(right, position, normal);
+
+		if (leftImportance + rightImportance <= 0.0)
+			return 0;
+
+		float p = leftImportance / (leftImportance + rightImportance);
+		if (u < p)
+		{
+			u /= p;
+			probability *= p;
+			node = left;
+		}
+		else
+		{
+			u = (u - p) / (1.0 - p);
+			probability *= 1.0 - p;
+			node = right;
+		}
+
+		u = min(u, 0.99999994);
+	}
+
+	pdf = probability;
+	return node.leftIndex;
+}
+
+// closest light sphere in front of the ray origin nearer than the distance, the index is one based and kept without a hit
+void intersectLightTree(Ray ray, inout uint lightIndex, inout float distance)
+{
+	if (cam.lightCount == 0)
+		return;
+
+	int stack[STACKSIZE];
+	uint ptr = 0;
+	stack[ptr++] = 0;
+
+	while (ptr > 0)
+	{
+		LightNode node = lightTree[stack[--ptr]];
+		float3 position = node.center - ray.origin;
+
+		float tca = dot(position, ray.direction);
+
+		// distance of the center from the ray by the difference, not by |position|^2 - tca^2 which cancels for grazing rays,
+		// inner nodes get a margin for the rounding that grows along the ray, so they keep every hit of their lights
+		float3 offset = position - ray.direction * tca;
+		float d2 = dot(offset, offset);
+		float radius = node.rightIndex < 0 ? node.radius : node.radius + 1e-5 * abs(tca);
+		float radius2 = radius * radius;
+
+		if (d2 > radius2)
+			continue;
+
+		float thc = sqrt(radius2 - d2);
+		float t0 = tca - thc;
+		float t1 = tca + thc;
+
+		if (node.rightIndex < 0)
+		{
+			if (t0 < 0)
+				t0 = t1; // if t0 is negative, let's use t1 instead
+
+			if (t0 > 0.0f && t0 < distance)
+			{
+				distance = t0;
+				lightIndex = node.leftIndex + 1;
+			}
+		}
+		else if (t1 > 0.0 && t0 < distance)
+		{
+			stack[ptr++] = node.leftIndex;
+			stack[ptr++] = node.rightIndex;
+		}
+	}
+}
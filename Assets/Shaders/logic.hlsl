@@ -1,11 +1,13 @@
 #include "structs.h"
 #include "random.h"
+#include "bsdf.h"
+#include "adaptive.h"
 
 ////////////////////////////////////////////
 
 cbuffer Material : register(b1)
 {
-	MaterialProperty materialProp[MAX_LIGHTS]; // hopefully there won't be more than 128 materials (dx12 has unbound descriptors)
+	MaterialProperty materialProp[MAX_MATERIALS]; // hopefully there won't be more than 128 materials (dx12 has unbound descriptors)
 };
 
 ////////////////////////////////////////////
@@ -14,18 +16,21 @@ RWTexture2DArray<float4> output : register(u0); // TODO probably globally cohere
 RWByteAddressBuffer pathState : register(u1);
 RWByteAddressBuffer queue : register(u2);
 RWByteAddressBuffer queueCounters : register(u3);
+RWByteAddressBuffer pixelSamples : register(u7); // u5 is the NVAPI extension slot of structs.h
 
-StructuredBuffer<BVHNode> tree : register(t0);
-StructuredBuffer<Triangle> indices : register(t1);
-Buffer<float3> vertices : register(t2);
 StructuredBuffer<Light> lights : register(t3);
-StructuredBuffer<TriangleParameters> triParams : register(t4);
+StructuredBuffer<Instance> instances : register(t8);
+
+#include "geometry.h"
+#include "lightTree.h"
+#include "lightTable.h"
+#include "emissive.h"
+#include "environment.h"
 
-Texture2DArray diffuse : register(t5);
-Texture2DArray metallicRoughness : register(t6);
-Texture2DArray normals : register(t7);
 SamplerState samplerState : register(s0);
 
+#include "virtualTexture.h"
+
 ////////////////////////////////////////////
 
 static bool pathEliminated;
@@ -46,6 +51,10 @@ void endPath(in float3 radiance, in uint index)
 	// only threads in warp with path being eliminated
 	if (pathEliminated)
 	{
+		// the renderer reads the histogram back while the GUI shows it
+		if (cam.pathStatistics)
+			queueCounters.InterlockedAdd(OFFSET_QC_PATH_LENGTHS + 4 * min(_pstate_pathLength, PATH_LENGTH_BINS - 1), 1);
+
 		radiance = saturate(radiance);
 		
 		// gamma correction
@@ -56,6 +65,7 @@ void endPath(in float3 radiance, in uint index)
 
 		float3 pixel = output[uint3(coord, 0)].rgb;
 		uint sampleCount = asuint(output[uint3(coord, 0)].a);
+		float moment = output[uint3(coord, 1)].x;
 
 		
 		// Kahan summation ain't worth - there is ~1-2MP/s performance loss with only tiny faster convergence
@@ -70,45 +80,117 @@ void endPath(in float3 radiance, in uint index)
 		//output[uint3(coord, 0)] = float4(t / sampleCount, asfloat(sampleCount)); // probably race condition
 		//output[uint3(coord, 1)] = float4((t - sum) - y, 0);
 		
+		// second moment of the displayed luminance for the error of adaptive sampling
+		float value = luminance(radiance);
+		output[uint3(coord, 1)] = float4(((moment * sampleCount) + value * value) / (sampleCount + 1), 0, 0, 0);
 		output[uint3(coord, 0)] = float4(((pixel * sampleCount++) + radiance) / sampleCount, asfloat(sampleCount)); // probably race condition
 		
 		_set_queue_newPath(offset + qindex, index);
 	}
 }
 
+// emission of the material at the point of the triangle, the texture modulates the factor
+float3 emittedRadiance(MaterialProperty material, uint3 vertices, float3 p0, float3 p1, float3 p2, float3 baryCoord, float distance, uint pathLength)
+{
+	float3 emission = material.emission;
+
+	if (material.emissionIndex >= 0)
+	{
+		float2 t0 = loadTriangleParameters(vertices.x).texCoord;
+		float2 t1 = loadTriangleParameters(vertices.y).texCoord;
+		float2 t2 = loadTriangleParameters(vertices.z).texCoord;
+		float2 texCoord = t0 * baryCoord.x + t1 * baryCoord.y + t2 * baryCoord.z;
+
+		emission *= sampleVirtual(material.emissionIndex, texCoord, textureFootprint(p0, p1, p2, t0, t1, t2, distance, pathLength), samplerState).rgb;
+	}
+
+	return emission;
+}
+
+// emission of the triangle hit by the extension ray, weighted by the power heuristic against the light sample
+// of the previous bounce, the bounces which can't take light samples (camera rays, glass) store zero pdf and take all of it
+float3 hitEmission(in uint index)
+{
+	uint4 tri = _pstate_triangle;
+	MaterialProperty material = materialProp[tri.w];
+
+	if (cam.emissiveCount == 0 || all(material.emission <= 0.0))
+		return float3(0, 0, 0);
+
+	Instance instance = instances[_pstate_instance];
+	float3 p0 = transformPoint(instance.objectToWorld, loadVertex(tri.x, instance.mesh));
+	float3 p1 = transformPoint(instance.objectToWorld, loadVertex(tri.y, instance.mesh));
+	float3 p2 = transformPoint(instance.objectToWorld, loadVertex(tri.z, instance.mesh));
+
+	float distance = _pstate_hitDistance;
+	float3 emission = emittedRadiance(material, tri.xyz, p0, p1, p2, _pstate_baryCoord, distance, _pstate_pathLength);
+	float bsdfPdf = _pstate_bsdfPdf;
+
+	if (bsdfPdf <= 0.0)
+		return emission;
+
+	float cosine = abs(dot(normalize(cross(p1 - p0, p2 - p0)), _pstate_rayDirection));
+	return powerHeuristic(bsdfPdf, emissivePdf(material.emission, distance, cosine)) * emission;
+}
+
+// environment in the direction of the extension ray which left the scene, weighted by the power heuristic against
+// the light sample of the previous bounce the same as the emissive triangles
+float3 environmentHit(in uint index)
+{
+	float3 direction = _pstate_rayDirection;
+	float3 radiance = environmentRadiance(direction);
+	float bsdfPdf = _pstate_bsdfPdf;
+
+	if (bsdfPdf <= 0.0)
+		return radiance;
+
+	return powerHeuristic(bsdfPdf, environmentPdf(direction)) * radiance;
+}
+
 uint setMaterialHitProperties(in uint index)
 {
 	uint4 tri = _pstate_triangle;
-	float3 indices = tri.xyz;
 	float3 baryCoord = _pstate_baryCoord;
+	Instance instance = instances[_pstate_instance];
 
-    float2 t0 = triParams[indices.x].texCoord;
-    float2 t1 = triParams[indices.y].texCoord;
-    float2 t2 = triParams[indices.z].texCoord;
+	// vertex indices stay integers, floats lose them past 2^24
+	TriangleParameters v0 = loadTriangleParameters(tri.x);
+	TriangleParameters v1 = loadTriangleParameters(tri.y);
+	TriangleParameters v2 = loadTriangleParameters(tri.z);
 
-    float3 n0 = triParams[indices.x].normal;
-    float3 n1 = triParams[indices.y].normal;
-    float3 n2 = triParams[indices.z].normal;
+    float2 t0 = v0.texCoord;
+    float2 t1 = v1.texCoord;
+    float2 t2 = v2.texCoord;
+
+    float3 n0 = v0.normal;
+    float3 n1 = v1.normal;
+    float3 n2 = v2.normal;
 
 	float2 texCoord = t0 * baryCoord.x + t1 * baryCoord.y + t2 * baryCoord.z;
-    float3 normal = n0 * baryCoord.x + n1 * baryCoord.y + n2 * baryCoord.z;
+    float3 normal = normalize(transformNormal(instance.worldToObject, n0 * baryCoord.x + n1 * baryCoord.y + n2 * baryCoord.z));
+
+	// texture footprint of the hit
+	float3 p0 = transformPoint(instance.objectToWorld, loadVertex(tri.x, instance.mesh));
+	float3 p1 = transformPoint(instance.objectToWorld, loadVertex(tri.y, instance.mesh));
+	float3 p2 = transformPoint(instance.objectToWorld, loadVertex(tri.z, instance.mesh));
+	float footprint = textureFootprint(p0, p1, p2, t0, t1, t2, _pstate_hitDistance, _pstate_pathLength);
 	
     MaterialProperty material = materialProp[tri.w];
     //state.material.roughness = saturate(state.material.roughness + cam.sampleCounter * 0.0001);
 	
     if (material.diffuseIndex >= 0)
-        material.baseColor = diffuse.SampleLevel(samplerState, float3(texCoord, material.diffuseIndex), 0);
+        material.baseColor = sampleVirtual(material.diffuseIndex, texCoord, footprint, samplerState);
 
     if (material.metallicRoughnesIndex >= 0)
     {
-        float2 data = metallicRoughness.SampleLevel(samplerState, float3(texCoord, material.metallicRoughnesIndex), 0);
+        float2 data = sampleVirtual(material.metallicRoughnesIndex, texCoord, footprint, samplerState).xy;
         material.metallic = data.x;
         material.roughness = data.y;
     }
 
     if (material.normalIndex >= 0)
     {
-        float3 data = normals.SampleLevel(samplerState, float3(texCoord, material.normalIndex), 0);
+        float3 data = sampleVirtual(material.normalIndex, texCoord, footprint, samplerState).xyz;
         data = data * 2.0 - 1.0; // TODO maybe normalize
 
 		// flip the normal, if the ray is coming from behind
@@ -132,22 +214,110 @@ uint setMaterialHitProperties(in uint index)
     return material.materialType;
 }
 
+// shadow ray to a uniform point of an emissive triangle, the emission over the probability of the point per solid angle
+// is kept in the direct light for the material kernel, the light pdf takes the one of emissivePdf for the weights
+void createEmissiveShadowRay(in uint index, float3 surfacePos, float u)
+{
+	float selectionPdf;
+	uint emissiveIndex = sampleEmissiveTable(u, selectionPdf);
+
+	EmissiveTriangle light = emissives[emissiveIndex];
+	Instance instance = instances[light.instance];
+	Triangle tri = loadTriangle(light.triangle, instance.mesh);
+
+	float3 p0 = transformPoint(instance.objectToWorld, loadVertex(tri.vtix.x, instance.mesh));
+	float3 p1 = transformPoint(instance.objectToWorld, loadVertex(tri.vtix.y, instance.mesh));
+	float3 p2 = transformPoint(instance.objectToWorld, loadVertex(tri.vtix.z, instance.mesh));
+
+	// uniform point of the triangle
+	float2 r = rand2(SAMPLER_LIGHT_POINT);
+	float s = sqrt(r.x);
+	float3 baryCoord = float3(1.0 - s, s * (1.0 - r.y), s * r.y);
+	float3 lightPosition = p0 * baryCoord.x + p1 * baryCoord.y + p2 * baryCoord.z;
+
+	float3 lightDir = lightPosition - surfacePos;
+	float distance = length(lightDir);
+	lightDir /= distance;
+
+	// both sides of the triangle emit, the same as they do for the extension rays
+	float3 lightNormal = cross(p1 - p0, p2 - p0);
+	float area = 0.5 * length(lightNormal);
+	float cosine = area > 0.0 ? abs(dot(lightNormal, lightDir)) / (2.0 * area) : 0.0;
+
+	MaterialProperty material = materialProp[tri.materialID];
+	float3 emission = emittedRadiance(material, tri.vtix, p0, p1, p2, baryCoord, distance, _pstate_pathLength);
+	float pdf = emissiveSelection() * selectionPdf / area * distance * distance / cosine;
+	bool valid = selectionPdf > 0.0 && cosine > 0.0;
+
+	Ray shadowRay = Ray::create(surfacePos, lightDir);
+
+	_set_pstate_lightIndex(EMISSIVE_LIGHT | emissiveIndex);
+	_set_pstate_lightPdf(valid ? emissivePdf(material.emission, distance, cosine) : 0.0);
+	_set_pstate_directlight(valid ? emission / pdf : float3(0, 0, 0));
+	_set_pstate_shadowrayOrigin(shadowRay.origin);
+	_set_pstate_shadowrayDirection(shadowRay.direction);
+	_set_pstate_lightDistance(distance - EPSILON_OFFSET);
+}
+
+// shadow ray in a direction of the environment map, unbounded, the map over the probability is kept in the direct light
+void createEnvironmentShadowRay(in uint index, float3 surfacePos, float u)
+{
+	float pdf;
+	float3 lightDir = sampleEnvironment(u, rand2(SAMPLER_LIGHT_POINT), pdf);
+
+	Ray shadowRay = Ray::create(surfacePos, lightDir);
+
+	_set_pstate_lightIndex(ENVIRONMENT_LIGHT);
+	_set_pstate_lightPdf(pdf);
+	_set_pstate_directlight(pdf > 0.0 ? environmentRadiance(lightDir) / pdf : float3(0, 0, 0));
+	_set_pstate_shadowrayOrigin(shadowRay.origin);
+	_set_pstate_shadowrayDirection(shadowRay.direction);
+	_set_pstate_lightDistance(FLT_MAX);
+}
+
 void createShadowRay(in uint index)
 {
-	uint lightIndex = uint(rand() * cam.lightCount);
+	// the emissive triangles and the environment take the sample with their probabilities, the random number is rescaled for the pick
+	float u = rand(SAMPLER_LIGHT_SELECTION);
+	float emissiveProbability = emissiveSelection();
+	float environmentProbability = environmentSelection();
+	float3 surfacePos = _pstate_surfacePoint + _pstate_normal * EPSILON_OFFSET;
+
+	if (u < emissiveProbability)
+	{
+		createEmissiveShadowRay(index, surfacePos, min(u / emissiveProbability, 0.99999994));
+		return;
+	}
+
+	if (u < emissiveProbability + environmentProbability)
+	{
+		createEnvironmentShadowRay(index, surfacePos, min((u - emissiveProbability) / environmentProbability, 0.99999994));
+		return;
+	}
+
+	float sphereProbability = 1.0 - emissiveProbability - environmentProbability;
+	u = min((u - emissiveProbability - environmentProbability) / sphereProbability, 0.99999994);
+
+	float lightPdf;
+#if LIGHT_TREE_SELECTION
+	// lights which can't reach the point are never picked, the others by their importance
+	uint lightIndex = sampleLightTree(_pstate_surfacePoint, _pstate_normal, u, lightPdf);
+#else
+	uint lightIndex = sampleLightTable(u, lightPdf);
+#endif
+	lightPdf *= sphereProbability;
 	
 	// sample point on light
-	float z = 1.0 - 2.0 * rand();
+	float2 s = rand2(SAMPLER_LIGHT_POINT);
+	float z = 1.0 - 2.0 * s.x;
 	float r = sqrt(max(0.f, 1.0 - z * z));
-	float phi = 2.0 * PI * rand();
+	float phi = 2.0 * PI * s.y;
 	float x = r * cos(phi);
 	float y = r * sin(phi);
 	
 	float3 lightPosition = lights[lightIndex].position + float3(x, y, z) * lights[lightIndex].radius;
 	
 	// set shadow ray
-	float3 normal = _pstate_normal;
-	float3 surfacePos = _pstate_surfacePoint + normal * EPSILON_OFFSET;
     float3 lightDir = lightPosition - surfacePos;
     float distance = length(lightDir);
 
@@ -157,6 +327,7 @@ void createShadowRay(in uint index)
 
 	// write state
 	_set_pstate_lightIndex(lightIndex);
+	_set_pstate_lightPdf(lightPdf);
 	_set_pstate_shadowrayOrigin(shadowRay.origin);
 	_set_pstate_shadowrayDirection(shadowRay.direction);
 	_set_pstate_lightDistance(distance - EPSILON_OFFSET);
@@ -175,11 +346,12 @@ void clearTexture(in uint tid, in uint gid, in uint stride)
 		if (index < width * height)
 		{
 			if (index == 0)
-				queueCounters.Store(OFFSET_QC_NEWPATH, PATHCOUNT); // TODO make getters too?
+				queueCounters.Store2(OFFSET_QC_NEWPATH, uint2(PATHCOUNT, 0)); // TODO make getters too?
 				
 			float3 color = output[uint3(coord, 0)];
 			output[uint3(coord, 0)] = float4(color, asfloat(0));
-			//output[uint3(coord, 1)] = float4(0, 0, 0, 0);
+			output[uint3(coord, 1)] = float4(0, 0, 0, 0);
+			pixelSamples.Store(index * 4, 0); // the samples of the pixels start again
 		}
 		else if (index >= PATHCOUNT) // texture is cleared, terminate loop
 			break;
@@ -211,9 +383,12 @@ void main(uint3 gid : SV_GroupID, uint tid : SV_GroupIndex)
 	{
 		for (uint i = 0; i < ITERATIONS; i++)
 		{
-			uint index = tid + NUM_THREADS * gid.x + i * stride;
+			// every path is in the extension ray queue, new paths in the order of their pixels and the others in the order
+			// the material kernels got them, so taking them in its order keeps neighbouring threads on nearby paths
+			uint queueIndex = tid + NUM_THREADS * gid.x + i * stride;
+			uint index = cam.coherentQueues ? _queue_extRay : queueIndex;
 
-			seed = float2(frac(index * INVPI), frac(index * PI));
+			initSampler(_pstate_screenCoord, _pstate_sampleIndex, _pstate_pathLength);
 			pathEliminated = false;
 
 			float3 throughput = _pstate_throughput;
@@ -227,8 +402,10 @@ void main(uint3 gid : SV_GroupID, uint tid : SV_GroupIndex)
 			else
 			{
 				// accunmulate from previous path
-				if (!_pstate_inShadow)
-					radiance += _pstate_directlight * throughput;
+				// the transmissive surfaces on the way attenuate the light sample
+				float3 visibility = _pstate_visibility;
+				if (any(visibility > 0.0))
+					radiance += _pstate_directlight * visibility * throughput;
 		
 				// update throughput
 				throughput *= _pstate_lightThroughput;
@@ -240,19 +417,28 @@ void main(uint3 gid : SV_GroupID, uint tid : SV_GroupIndex)
 				// eliminate path out of scene
 				if (_pstate_hitDistance == FLT_MAX)
 				{
-					radiance += throughput * cam.envColor;
+					radiance += throughput * environmentHit(index);
 					pathEliminated = true;
 				}
+				else
+					radiance += throughput * hitEmission(index);
 			
-				// russian roulette
-				if (_pstate_pathLength > 200) // todo tweak
+				// russian roulette, the paths survive with their throughput and the survivors take its inverse
+				uint pathLength = _pstate_pathLength;
+				if (!pathEliminated && cam.rouletteMode != ROULETTE_OFF && pathLength >= cam.rouletteDepth)
 				{
-					float p = max(throughput.x, max(throughput.y, throughput.z));
-					if (rand() > p * 0.004)
+					float survival = cam.rouletteMode == ROULETTE_LUMINANCE ? luminance(throughput) : max(throughput.x, max(throughput.y, throughput.z));
+					survival = clamp(survival, cam.rouletteMinSurvival, 1.0);
+
+					if (rand(SAMPLER_RUSSIAN_ROULETTE) >= survival)
 						pathEliminated = true;
 
-					throughput *= 1 / p;
+					throughput /= survival;
 				}
+
+				// the longest paths end with the emission they hit and the light sample of the bounce before
+				if (pathLength >= (cam.maxDepth > 0 ? min(cam.maxDepth, PATH_LENGTH_LIMIT) : PATH_LENGTH_LIMIT))
+					pathEliminated = true;
 			}
 
 			// find paths for elimination
@@ -295,7 +481,7 @@ void main(uint3 gid : SV_GroupID, uint tid : SV_GroupIndex)
 				_set_pstate_radiance(radiance);
 				_set_pstate_throughput(throughput);
 				_set_pstate_pathLength(pathLength);
-				_set_pstate_inShadow(true);
+				_set_pstate_visibility(float3(0, 0, 0));
 			}
 		}
 	}
@@ -39,7 +39,7 @@ float3 glassSample(in State state)
     float3 transDirection = normalize(refract(state.ray.direction, normal, refractFactor));
     float cos2t = 1.0 - refractFactor * refractFactor * (1.0 - theta * theta);
 
-    if (cos2t < 0.0 || rand() < probability)
+    if (cos2t < 0.0 || rand(SAMPLER_GLASS) < probability)
         return normalize(reflect(state.ray.direction, normal));
         
     return transDirection;
@@ -58,8 +58,8 @@ void main(uint3 gid : SV_GroupID, uint tid : SV_GroupIndex)
         if (queueIndex >= queueElementCount)
             break;
 		
-		seed = float2(frac(queueIndex * INVPI), frac(queueIndex * PI));
 		uint index = _queue_matGlass;
+		initSampler(_pstate_screenCoord, _pstate_sampleIndex, _pstate_pathLength);
 
         State state;
         Sample sample;
@@ -73,6 +73,7 @@ void main(uint3 gid : SV_GroupID, uint tid : SV_GroupIndex)
         sample.bsdfDir = glassSample(state);
         
 		_set_pstate_lightThroughput(state.baseColor);
+		_set_pstate_bsdfPdf(0.0); // specular, emissive triangles it hits aren't weighted against light samples
 
 		// create extended ray
 		float3 surfacePoint = _pstate_surfacePoint;
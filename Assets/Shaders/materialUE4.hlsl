@@ -26,7 +26,7 @@ float3 ue4Sample(in State state)
     float3 N = state.normal;
     float3 V = -state.ray.direction;
 
-    float2 r = float2(rand(), rand());
+    float2 r = rand2(SAMPLER_BSDF);
 	
     float diffuseRatio =/* 0.5 **/ (1.0 - state.material.metallic);
     float3 direction;
@@ -37,7 +37,7 @@ float3 ue4Sample(in State state)
     float3 bitangent = cross(N, tangent);
 
 	// importance sample diffuse vs specular direction
-    if (rand().x < diffuseRatio) // TODO this is quite divergent
+    if (rand(SAMPLER_LOBE) < diffuseRatio) // TODO this is quite divergent
     {
         float x = sqrt(r.x);
         float phi = 2.0 * PI * r.y;
@@ -128,8 +128,8 @@ void main(uint3 gid : SV_GroupID, uint tid : SV_GroupIndex)
         if (queueIndex >= queueElementCount)
             break;
 		
-		seed = float2(frac(queueIndex * INVPI), frac(queueIndex * PI));
 		uint index = _queue_matUE4;
+		initSampler(_pstate_screenCoord, _pstate_sampleIndex, _pstate_pathLength);
 
         State state;
         Sample sample;
@@ -152,6 +152,7 @@ void main(uint3 gid : SV_GroupID, uint tid : SV_GroupIndex)
             throughput = ue4Evaluate(state, sample.bsdfDir) * abs(dot(state.normal, sample.bsdfDir)) / sample.pdf;
 		
 		_set_pstate_lightThroughput(throughput);
+		_set_pstate_bsdfPdf(sample.pdf); // for the weight of an emissive triangle the extension ray hits
 		
 		// create extended ray
 		float3 surfacePoint = _pstate_surfacePoint;
@@ -164,7 +165,8 @@ void main(uint3 gid : SV_GroupID, uint tid : SV_GroupIndex)
 		// set directLight
 		float3 lightDir = _pstate_shadowrayDirection;
 
-        bool legitLight = dot(lightDir, state.normal) > 0.0;
+        float selectionPdf = _pstate_lightPdf;
+        bool legitLight = dot(lightDir, state.normal) > 0.0 && selectionPdf > 0.0; // no light reaches the point otherwise
 		uint shadowBallot = NvBallot(legitLight);
         uint shadowRayCount = countbits(shadowBallot);
         uint shadowRayOffset = 0;
@@ -179,12 +181,22 @@ void main(uint3 gid : SV_GroupID, uint tid : SV_GroupIndex)
 		{
 			uint lightIndex = _pstate_lightIndex;
 			float distance = _pstate_lightDistance;
-			Light light = lights[lightIndex];
-			
-			float lightPdf = distance * distance / (4 * PI * light.radius * light.radius);
 			float bsdfPdf = ue4Pdf(state, lightDir);
-			
-			float3 directLight = powerHeuristic(lightPdf, bsdfPdf) * ue4Evaluate(state, lightDir) * light.emission * cam.lightCount * lightFalloff(distance, light.falloff);
+			float3 directLight;
+
+			if (lightIndex & (EMISSIVE_LIGHT | ENVIRONMENT_LIGHT))
+			{
+				// logic keeps the emission over the probability of the sample in the direct light, the light pdf is per solid angle
+				directLight = powerHeuristic(selectionPdf, bsdfPdf) * ue4Evaluate(state, lightDir) * dot(lightDir, state.normal) * _pstate_directlight;
+			}
+			else
+			{
+				Light light = lights[lightIndex];
+
+				float lightPdf = selectionPdf * distance * distance / (4 * PI * light.radius * light.radius); // of the light strategy, the pick included
+				directLight = powerHeuristic(lightPdf, bsdfPdf) * ue4Evaluate(state, lightDir) * light.emission / selectionPdf * lightFalloff(distance, light.falloff);
+			}
+
 			_set_pstate_directlight(directLight);
 			_set_queue_shadowRay(shadowRayOffset + shadowIndex, index);
 		}
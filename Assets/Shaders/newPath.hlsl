@@ -1,15 +1,37 @@
 #include "structs.h"
 #include "bsdf.h"
 #include "random.h"
+#include "adaptive.h"
 
 ////////////////////////////////////////////
 
 RWByteAddressBuffer pathState : register(u1);
 RWByteAddressBuffer queue : register(u2);
 RWByteAddressBuffer queueCounters : register(u3);
+RWByteAddressBuffer pixelSamples : register(u7); // paths started at every pixel since the image was cleared
+
+StructuredBuffer<uint2> schedule : register(t88); // passes over the tiles of adaptive sampling, the tile and the position of its first pixel
 
 ////////////////////////////////////////////
 
+// the last pass starting at or before the position, the same as AdaptiveSampling::schedulePixel
+uint schedulePass(uint position)
+{
+	uint first = 0;
+	uint last = cam.scheduleLength;
+
+	while (last - first > 1)
+	{
+		uint middle = (first + last) / 2;
+		if (schedule[middle].y <= position)
+			first = middle;
+		else
+			last = middle;
+	}
+
+	return first;
+}
+
 
 [numthreads(NUM_THREADS, 1, 1)]
 void main(uint3 gid : SV_GroupID, uint tid : SV_GroupIndex)
@@ -24,16 +46,21 @@ void main(uint3 gid : SV_GroupID, uint tid : SV_GroupIndex)
 		if (queueIndex >= queueElementCount)
             break;
 		
-		seed = float2(frac(queueIndex * INVPI), frac(queueIndex * PI));
-		
 		uint index = _queue_newPath;
 		uint width = (1.0 / cam.pixelSize.x);
 		uint height = (1.0 / cam.pixelSize.y);
 
-		uint newIndex = (lastPath + queueIndex) % (width * height);
-		uint2 coord = uint2(newIndex % width, newIndex / width);
+		// pixels are taken in turns by the passes over the tiles of the schedule, a pixel counts its own samples,
+		// as the tiles get different numbers of passes
+		uint position = (lastPath + queueIndex) % cam.schedulePaths;
+		uint2 pass = schedule[schedulePass(position)];
+		uint2 coord = tilePixel(pass.x, position - pass.y, uint2(width, height), cam.mortonOrder);
+		
+		uint sampleIndex;
+		pixelSamples.InterlockedAdd((coord.y * width + coord.x) * 4, 1, sampleIndex);
 		
-		float2 jitter = float2(rand(), rand()) * 2 - 1;
+		initSampler(coord, sampleIndex, 0);
+		float2 jitter = rand2(SAMPLER_CAMERA) * 2 - 1;
 		float2 uv = (coord + jitter) * cam.pixelSize;
 
 		Ray extRay = Ray::create(cam.pos, normalize(cam.ulc + uv.x * cam.horizontal - uv.y * cam.vertical));
@@ -41,11 +68,13 @@ void main(uint3 gid : SV_GroupID, uint tid : SV_GroupIndex)
 		_set_pstate_rayOrigin(extRay.origin);
 		_set_pstate_rayDirection(extRay.direction);
 		_set_pstate_screenCoord(coord);
+		_set_pstate_sampleIndex(sampleIndex);
 		_set_pstate_radiance(float3(0, 0, 0));
 		_set_pstate_throughput(float3(1, 1, 1));
 		_set_pstate_lightThroughput(float3(1, 1, 1));
+		_set_pstate_bsdfPdf(0.0); // camera rays take the whole emission of the triangles they hit
 		_set_pstate_pathLength(0);
-		_set_pstate_inShadow(true);
+		_set_pstate_visibility(float3(0, 0, 0));
 
 		// expecting that new path is running always as first
 		_set_queue_extRay(queueIndex, index);
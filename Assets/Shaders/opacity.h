@@ -0,0 +1,34 @@
+// Opacity of the flagged triangles for the ray kernels. The flags come in the top bits of the material index of the triangle,
+// a hit reads only the few values of MaterialOpacity for them, the material properties stay in the material kernels.
+// Needs geometry.h, virtualTexture.h and the sampler.
+
+StructuredBuffer<MaterialOpacity> opacities : register(t93);
+
+// the masked triangle is cut out where its alpha is under the cutoff, the diffuse texture is sampled at the barycentric
+// coordinates u, v of the hit with the footprint the materials take, the positions are in the object space of the instance
+bool alphaCutout(uint material, uint i, uint mesh, TrianglePositions positions, float2 uv, float distance, uint pathLength)
+{
+	MaterialOpacity opacity = opacities[material & ~TRIANGLE_FLAGS];
+	float alpha = opacity.alpha;
+
+	[branch] if (opacity.alphaIndex >= 0)
+	{
+		Triangle tri = loadTriangle(i, mesh);
+		float2 t0 = loadTriangleParameters(tri.vtix.x).texCoord;
+		float2 t1 = loadTriangleParameters(tri.vtix.y).texCoord;
+		float2 t2 = loadTriangleParameters(tri.vtix.z).texCoord;
+		float2 texCoord = t0 * (1.0 - uv.x - uv.y) + t1 * uv.x + t2 * uv.y;
+
+		float3 p0 = positions.v0;
+		float footprint = textureFootprint(p0, p0 + positions.e1, p0 + positions.e2, t0, t1, t2, distance, pathLength);
+		alpha *= sampleVirtual(opacity.alphaIndex, texCoord, footprint, samplerState).a;
+	}
+
+	return alpha < opacity.alphaCutoff;
+}
+
+// color a shadow ray keeps passing through a surface of the transmissive triangle
+float3 surfaceTransmittance(uint material)
+{
+	return opacities[material & ~TRIANGLE_FLAGS].transmittance;
+}
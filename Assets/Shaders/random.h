@@ -1,13 +1,132 @@
+#ifndef SOBOL_SAMPLER // just to make IDE shut up
+#define SOBOL_SAMPLER 0
+#endif
+
 cbuffer Cam : register(b0)
 {
     Camera cam;
 };
 
-static float2 seed;
+// Random numbers of a path given by its pixel, the sample of the pixel, the bounce and the dimension, the same
+// as Sampler on the CPU. The dimensions of a bounce are points of a 10D Sobol sequence shuffled and Owen scrambled
+// by hashes, every kernel sets the sampler of its path by initSampler before it draws.
+
+// first dimension of the draws of a bounce, rand2 takes the next one too
+#define SAMPLER_CAMERA				0
+#define SAMPLER_LIGHT_SELECTION		2
+#define SAMPLER_LIGHT_POINT			3
+#define SAMPLER_RUSSIAN_ROULETTE	5
+#define SAMPLER_LOBE				6
+#define SAMPLER_BSDF				7
+#define SAMPLER_GLASS				9
+#define SAMPLER_DIMENSIONS			10
+
+// generator matrices of the Sobol dimensions as columns, the top bit first (Joe-Kuo direction numbers)
+static const uint SOBOL_MATRICES[SAMPLER_DIMENSIONS][32] = {
+	{ 0x80000000u, 0x40000000u, 0x20000000u, 0x10000000u, 0x08000000u, 0x04000000u, 0x02000000u, 0x01000000u,
+	  0x00800000u, 0x00400000u, 0x00200000u, 0x00100000u, 0x00080000u, 0x00040000u, 0x00020000u, 0x00010000u,
+	  0x00008000u, 0x00004000u, 0x00002000u, 0x00001000u, 0x00000800u, 0x00000400u, 0x00000200u, 0x00000100u,
+	  0x00000080u, 0x00000040u, 0x00000020u, 0x00000010u, 0x00000008u, 0x00000004u, 0x00000002u, 0x00000001u },
+	{ 0x80000000u, 0xc0000000u, 0xa0000000u, 0xf0000000u, 0x88000000u, 0xcc000000u, 0xaa000000u, 0xff000000u,
+	  0x80800000u, 0xc0c00000u, 0xa0a00000u, 0xf0f00000u, 0x88880000u, 0xcccc0000u, 0xaaaa0000u, 0xffff0000u,
+	  0x80008000u, 0xc000c000u, 0xa000a000u, 0xf000f000u, 0x88008800u, 0xcc00cc00u, 0xaa00aa00u, 0xff00ff00u,
+	  0x80808080u, 0xc0c0c0c0u, 0xa0a0a0a0u, 0xf0f0f0f0u, 0x88888888u, 0xccccccccu, 0xaaaaaaaau, 0xffffffffu },
+	{ 0x80000000u, 0xc0000000u, 0x60000000u, 0x90000000u, 0xe8000000u, 0x5c000000u, 0x8e000000u, 0xc5000000u,
+	  0x68800000u, 0x9cc00000u, 0xee600000u, 0x55900000u, 0x80680000u, 0xc09c0000u, 0x60ee0000u, 0x90550000u,
+	  0xe8808000u, 0x5cc0c000u, 0x8e606000u, 0xc5909000u, 0x6868e800u, 0x9c9c5c00u, 0xeeee8e00u, 0x5555c500u,
+	  0x8000e880u, 0xc0005cc0u, 0x60008e60u, 0x9000c590u, 0xe8006868u, 0x5c009c9cu, 0x8e00eeeeu, 0xc5005555u },
+	{ 0x80000000u, 0xc0000000u, 0x20000000u, 0x50000000u, 0xf8000000u, 0x74000000u, 0xa2000000u, 0x93000000u,
+	  0xd8800000u, 0x25400000u, 0x59e00000u, 0xe6d00000u, 0x78080000u, 0xb40c0000u, 0x82020000u, 0xc3050000u,
+	  0x208f8000u, 0x51474000u, 0xfbea2000u, 0x75d93000u, 0xa0858800u, 0x914e5400u, 0xdbe79e00u, 0x25db6d00u,
+	  0x58800080u, 0xe54000c0u, 0x79e00020u, 0xb6d00050u, 0x800800f8u, 0xc00c0074u, 0x200200a2u, 0x50050093u },
+	{ 0x80000000u, 0x40000000u, 0x20000000u, 0xb0000000u, 0xf8000000u, 0xdc000000u, 0x7a000000u, 0x9d000000u,
+	  0x5a800000u, 0x2fc00000u, 0xa1600000u, 0xf0b00000u, 0xda880000u, 0x6fc40000u, 0x81620000u, 0x40bb0000u,
+	  0x22878000u, 0xb3c9c000u, 0xfb65a000u, 0xddb2d000u, 0x78022800u, 0x9c0b3c00u, 0x5a0fb600u, 0x2d0ddb00u,
+	  0xa2878080u, 0xf3c9c040u, 0xdb65a020u, 0x6db2d0b0u, 0x800228f8u, 0x400b3cdcu, 0x200fb67au, 0xb00ddb9du },
+	{ 0x80000000u, 0x40000000u, 0x60000000u, 0x30000000u, 0xc8000000u, 0x24000000u, 0x56000000u, 0xfb000000u,
+	  0xe0800000u, 0x70400000u, 0xa8600000u, 0x14300000u, 0x9ec80000u, 0xdf240000u, 0xb6d60000u, 0x8bbb0000u,
+	  0x48008000u, 0x64004000u, 0x36006000u, 0xcb003000u, 0x2880c800u, 0x54402400u, 0xfe605600u, 0xef30fb00u,
+	  0x7e48e080u, 0xaf647040u, 0x1eb6a860u, 0x9f8b1430u, 0xd6c81ec8u, 0xbb249f24u, 0x80d6d6d6u, 0x40bbbbbbu },
+	{ 0x80000000u, 0xc0000000u, 0xa0000000u, 0xd0000000u, 0x58000000u, 0x94000000u, 0x3e000000u, 0xe3000000u,
+	  0xbe800000u, 0x23c00000u, 0x1e200000u, 0xf3100000u, 0x46780000u, 0x67840000u, 0x78460000u, 0x84670000u,
+	  0xc6788000u, 0xa784c000u, 0xd846a000u, 0x5467d000u, 0x9e78d800u, 0x33845400u, 0xe6469e00u, 0xb7673300u,
+	  0x20f86680u, 0x104477c0u, 0xf8668020u, 0x4477c010u, 0x668020f8u, 0x77c01044u, 0x8020f866u, 0xc0104477u },
+	{ 0x80000000u, 0x40000000u, 0xa0000000u, 0x50000000u, 0x88000000u, 0x24000000u, 0x12000000u, 0x2d000000u,
+	  0x76800000u, 0x9e400000u, 0x08200000u, 0x64100000u, 0xb2280000u, 0x7d140000u, 0xfea20000u, 0xba490000u,
+	  0x1a248000u, 0x491b4000u, 0xc4b5a000u, 0xe3739000u, 0xf6800800u, 0xde400400u, 0xa8200a00u, 0x34100500u,
+	  0x3a280880u, 0x59140240u, 0xeca20120u, 0x974902d0u, 0x6ca48768u, 0xd75b49e4u, 0xcc95a082u, 0x87639641u },
+	{ 0x80000000u, 0x40000000u, 0xa0000000u, 0x50000000u, 0x28000000u, 0xd4000000u, 0x6a000000u, 0x71000000u,
+	  0x38800000u, 0x58400000u, 0xea200000u, 0x31100000u, 0x98a80000u, 0x08540000u, 0xc22a0000u, 0xe5250000u,
+	  0xf2b28000u, 0x79484000u, 0xfaa42000u, 0xbd731000u, 0x18a80800u, 0x48540400u, 0x622a0a00u, 0xb5250500u,
+	  0xdab28280u, 0xad484d40u, 0x90a426a0u, 0xcc731710u, 0x20280b88u, 0x10140184u, 0x880a04a2u, 0x84350611u },
+	{ 0x80000000u, 0x40000000u, 0xe0000000u, 0xb0000000u, 0x98000000u, 0x94000000u, 0x8a000000u, 0x5b000000u,
+	  0x33800000u, 0xd9c00000u, 0x72200000u, 0x3f100000u, 0xc1b80000u, 0xa6ec0000u, 0x53860000u, 0x29f50000u,
+	  0x0a3a8000u, 0x1b2ac000u, 0xd392e000u, 0x69ff7000u, 0xea380800u, 0xab2c0400u, 0x4ba60e00u, 0xfde50b00u,
+	  0x60028980u, 0xf006c940u, 0x7834e8a0u, 0x241a75b0u, 0x123a8b38u, 0xcf2ac99cu, 0xb992e922u, 0x82ff78f1u },
+};
+
+static uint samplerSeed;
+static uint samplerIndex;
+static uint samplerSampleIndex;
+
+// PCG hash
+uint hash(uint value)
+{
+	uint state = value * 747796405u + 2891336453u;
+	uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+uint hashCombine(uint seed, uint value)
+{
+	return seed ^ (value + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+}
+
+// nested uniform scramble of the bits from the top one, Laine-Karras permutation of the reversed bits
+uint scramble(uint value, uint seed)
+{
+	value = reversebits(value);
+	value += seed;
+	value ^= value * 0x6c50b47cu;
+	value ^= value * 0xb82f1e52u;
+	value ^= value * 0xc7afe638u;
+	value ^= value * 0x8d22f6e6u;
+	return reversebits(value);
+}
+
+uint sobol(uint index, uint dimension)
+{
+	uint result = 0;
+	for (uint bit = 0; index != 0; index >>= 1, ++bit)
+		if (index & 1)
+			result ^= SOBOL_MATRICES[dimension][bit];
+
+	return result;
+}
+
+float toFloat(uint value)
+{
+	return (value >> 8) * (1.0 / 16777216.0);
+}
+
+// every bounce takes the samples of the pixel in its own order, so the bounces are stratified but uncorrelated
+void initSampler(uint2 coord, uint sampleIndex, uint bounce)
+{
+	samplerSeed = hashCombine(hash(coord.y * uint(1.0 / cam.pixelSize.x) + coord.x), bounce);
+	samplerIndex = scramble(sampleIndex, samplerSeed);
+	samplerSampleIndex = sampleIndex;
+}
+
+float rand(uint dimension)
+{
+#if SOBOL_SAMPLER
+	return toFloat(scramble(sobol(samplerIndex, dimension), hashCombine(samplerSeed, dimension + 1)));
+#else
+	return toFloat(hash(hashCombine(hashCombine(samplerSeed, dimension), samplerSampleIndex)));
+#endif
+}
 
-inline float rand()
+float2 rand2(uint dimension)
 {
-    //seed -= float2(sin(cam.randomSeed), cos(cam.randomSeed));
-    seed -= cam.randomSeed;
-    return frac(sin(dot(seed, float2(12.9898, 78.233))) * 43758.5453);
-}
\ No newline at end of file
+	return float2(rand(dimension), rand(dimension + 1));
+}
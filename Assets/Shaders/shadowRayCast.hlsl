@@ -1,4 +1,12 @@
 #include "structs.h"
+#include "adaptive.h"
+
+////////////////////////////////////////////
+
+cbuffer Cam : register(b0)
+{
+	Camera cam;
+};
 
 ////////////////////////////////////////////
 
@@ -6,18 +14,23 @@ RWByteAddressBuffer pathState : register(u1);
 RWByteAddressBuffer queue : register(u2);
 RWByteAddressBuffer queueCounters : register(u3);
 
-StructuredBuffer<BVHNode> tree : register(t0);
-StructuredBuffer<Triangle> indices : register(t1);
-Buffer<float3> vertices : register(t2);
+StructuredBuffer<Instance> instances : register(t8);
+
+#include "geometry.h"
+
+SamplerState samplerState : register(s0);
+
+#include "virtualTexture.h"
+#include "opacity.h"
 
 ////////////////////////////////////////////
 
 
-bool rayTriangleIntersection(in Ray ray, float3 v0, float3 v1, float3 v2, out float distance)
+// hit of the triangle in the open interval (EPSILON, tmax), its distance and barycentric coordinates u, v for the flagged triangles
+bool rayTriangleOcclusion(in Ray ray, float3 v0, float3 e1, float3 e2, float tmax, out float3 hit)
 {
-    float3 e1 = v1 - v0;
-    float3 e2 = v2 - v0;
-	
+    hit = float3(0, 0, 0);
+
     float3 pvec = cross(ray.direction, e2);
     float det = dot(e1, pvec);
 
@@ -38,101 +51,142 @@ bool rayTriangleIntersection(in Ray ray, float3 v0, float3 v1, float3 v2, out fl
         return false;
 
     float t = dot(e2, qvec) * invDet;
-    if (t > EPSILON && t < 1 / EPSILON)
-    {
-        distance = length(ray.direction * t);
-        return true;
-    }
-    return false;
+    hit = float3(t, u, v);
+    return t > EPSILON && t < tmax;
 }
 
-float rayAABBIntersection(float3 minbox, float3 maxbox, in Ray r)
+// slab test of the box against the interval (0, tmax) of the ray, the origin is premultiplied by the inverse direction,
+// the entry distance clipped to the interval or -1 if the box is missed
+float rayAABBEntry(float3 minbox, float3 maxbox, float3 scaledOrigin, float3 invdir, float tmax)
 {
-    float3 invdir = 1.0 / r.direction;
-
-    float3 f = (maxbox - r.origin) * invdir;
-    float3 n = (minbox - r.origin) * invdir;
+    float3 f = maxbox * invdir - scaledOrigin;
+    float3 n = minbox * invdir - scaledOrigin;
 
-    float3 tmax = max(f, n);
-    float3 tmin = min(f, n);
+    float3 exits = max(f, n);
+    float3 entries = min(f, n);
 
-    float t1 = min(tmax.x, min(tmax.y, tmax.z));
-    float t0 = max(tmin.x, max(tmin.y, tmin.z));
+    float t1 = min(tmax, min(exits.x, min(exits.y, exits.z)));
+    float t0 = max(0.0, max(entries.x, max(entries.y, entries.z)));
 	
-    return (t1 >= t0) ? (t0 > 0.f ? t0 : t1) : -1.0;
+    return t0 <= t1 ? t0 : -1.0;
 }
 
-bool rayBVHIntersection(in Ray ray, float lightDistance)
+// spatial splits reference a triangle from more leaves, a hit of a transmissive one counts only in the leaf whose box holds it,
+// the box is widened by the rounding of the hit point, flat boxes of axis aligned triangles included
+bool hitInLeaf(BVHNode leaf, float3 position, float3 offset)
 {
+    float3 margin = 1e-5 * (abs(position) + abs(offset));
+    return all(position >= leaf.min - margin && position <= leaf.max + margin);
+}
+
+// occlusion traversal - the box tests are clipped to the light and the first opaque hit ends it, the nearer child still goes first,
+// it's already known from the clipped test and finds the blockers sooner (see the occlusion benchmark),
+// the distance along the shadow ray is the same in the object space of the instances.
+// The masked triangles let the ray through where they are cut out, the transmissive ones attenuate it, the flags are read only
+// for the hits in the scenes which have them, the visibility of the light is returned, zero if it's blocked.
+float3 rayBVHVisibility(in Ray worldRay, float lightDistance, uint pathLength)
+{
+    float3 visibility = float3(1, 1, 1);
+
     int stack[STACKSIZE];
     uint ptr = 0;
     stack[ptr++] = -1;
 
+    float3 worldInvdir = 1.0 / worldRay.direction;
+    float3 worldScaledOrigin = worldRay.origin * worldInvdir;
+
+    Ray ray = worldRay;
+    float3 invdir = worldInvdir;
+    float3 scaledOrigin = worldScaledOrigin;
+    int instance = -1; // instance being traversed, -1 in the top level BVH
+    uint instanceDepth = 0; // stack depth the instance was entered at
+
 	// early test
-    BVHNode node = tree[0];
-    if (rayAABBIntersection(node.min, node.max, ray) > 0.0)
+    BVHNode node = loadNode(0);
+    if (rayAABBEntry(node.min, node.max, scaledOrigin, invdir, lightDistance) < 0.0)
+        return visibility;
+
+    for (int idx = 0; idx > -1;)
     {
-        for (int idx = 0; idx > -1;)
-        {
-            node = tree[idx];
+        node = loadNode(idx);
 
-            if (node.isLeaf)
+        if (node.isLeaf)
+        {
+            if (instance < 0)
             {
-                for (int i = node.leftIndex; i < node.rightIndex; i++)
-                {
-                    uint3 ii = indices[i].vtix;
-                    float3 v0 = vertices[ii.x];
-                    float3 v1 = vertices[ii.y];
-                    float3 v2 = vertices[ii.z];
-
-                    float distance = FLT_MAX;
-                    if (rayTriangleIntersection(ray, v0, v1, v2, distance) && distance < lightDistance)
-                        //if (materialProp[indices[i].materialID].materialType == 0)
-                        return true;
-                }
+                // top level leaf - continue in the mesh BVH with the ray in object space of the instance
+                instance = node.leftIndex;
+                instanceDepth = ptr;
+                ray = transformRay(instances[instance], worldRay);
+                invdir = 1.0 / ray.direction;
+                scaledOrigin = ray.origin * invdir;
+                idx = instances[instance].root;
+                continue;
             }
-            else
-            {
-                BVHNode left = tree[node.leftIndex];
-                BVHNode right = tree[node.rightIndex];
 
-                float leftHit = rayAABBIntersection(left.min, left.max, ray);
-                float rightHit = rayAABBIntersection(right.min, right.max, ray);
+            uint mesh = instances[instance].mesh;
 
-                if (leftHit > 0.0 && rightHit > 0.0)
-                {
-                    int deferred;
-
-                    if (leftHit > rightHit)
-                    {
-                        idx = node.rightIndex;
-                        deferred = node.leftIndex;
-                    }
-                    else
-                    {
-                        idx = node.leftIndex;
-                        deferred = node.rightIndex;
-                    }
-
-                    stack[ptr++] = deferred;
+            for (int i = node.leftIndex; i < node.rightIndex; i++)
+            {
+                TrianglePositions tri = loadTrianglePositions(i, mesh);
+                float3 hit;
+
+                if (!rayTriangleOcclusion(ray, tri.v0, tri.e1, tri.e2, lightDistance, hit))
                     continue;
-                }
-                else if (leftHit > 0.0)
+
+                uint material = cam.opacityFlags != 0 ? loadTriangleMaterial(i, mesh) : 0;
+
+                [branch] if (material & MASKED_TRIANGLE)
                 {
-                    idx = node.leftIndex;
-                    continue;
+                    if (alphaCutout(material, i, mesh, tri, hit.yz, hit.x, pathLength))
+                        continue;
                 }
-                else if (rightHit > 0.0)
+                else if ((material & TRANSMISSIVE_TRIANGLE) && cam.transmissiveShadows)
                 {
-                    idx = node.rightIndex;
-                    continue;
+                    float3 offset = ray.direction * hit.x;
+                    if (hitInLeaf(node, ray.origin + offset, offset))
+                        visibility *= surfaceTransmittance(material);
+
+                    if (any(visibility > 0.0))
+                        continue;
                 }
+
+                return float3(0, 0, 0);
             }
-            idx = stack[--ptr];
         }
+        else
+        {
+            BVHNode left = loadNode(node.leftIndex);
+            BVHNode right = loadNode(node.rightIndex);
+
+            float leftHit = rayAABBEntry(left.min, left.max, scaledOrigin, invdir, lightDistance);
+            float rightHit = rayAABBEntry(right.min, right.max, scaledOrigin, invdir, lightDistance);
+
+            if (leftHit >= 0.0 || rightHit >= 0.0)
+            {
+                bool leftFirst = leftHit >= 0.0 && (rightHit < 0.0 || leftHit <= rightHit);
+                idx = leftFirst ? node.leftIndex : node.rightIndex;
+                // never full for the depths checked at the load, the far child is dropped rather than written past it
+                if (leftHit >= 0.0 && rightHit >= 0.0 && ptr < STACKSIZE)
+                    stack[ptr++] = leftFirst ? node.rightIndex : node.leftIndex;
+
+                continue;
+            }
+        }
+
+        // mesh BVH finished, back to the world ray
+        if (instance >= 0 && ptr == instanceDepth)
+        {
+            instance = -1;
+            ray = worldRay;
+            invdir = worldInvdir;
+            scaledOrigin = worldScaledOrigin;
+        }
+
+        idx = stack[--ptr];
     }
 
-    return false;
+    return visibility;
 }
 
 
@@ -140,11 +194,11 @@ bool rayBVHIntersection(in Ray ray, float lightDistance)
 void main(uint3 gid : SV_GroupID, uint tid : SV_GroupIndex)
 {
 	// reset queues from previous stages (newpath, ue4, glass)
-	// + increase path counter for newPath stage
+	// + move the next path of newPath stage in the schedule of adaptive sampling
 	if (tid + gid.x == 0)
 	{
 		uint2 last_newPathCount = queueCounters.Load2(OFFSET_QC_NEWPATH);
-		queueCounters.Store4(OFFSET_QC_NEWPATH, uint4(0, last_newPathCount.x + last_newPathCount.y, 0, 0));
+		queueCounters.Store4(OFFSET_QC_NEWPATH, uint4(0, (last_newPathCount.x + last_newPathCount.y) % cam.schedulePaths, 0, 0));
 	}
 	
 	uint stride = NUM_THREADS * NUM_GROUPS;
@@ -163,7 +217,7 @@ void main(uint3 gid : SV_GroupID, uint tid : SV_GroupIndex)
 		ray.direction = _pstate_shadowrayDirection;
 		float lightDistance = _pstate_lightDistance;
 		
-		bool inShadow = rayBVHIntersection(ray, lightDistance);
-		_set_pstate_inShadow(inShadow);
+		float3 visibility = rayBVHVisibility(ray, lightDistance, _pstate_pathLength);
+		_set_pstate_visibility(visibility);
 	}
 }
\ No newline at end of file
@@ -3,15 +3,25 @@
 #define NUM_GROUPS 1
 #define ITERATIONS 1
 #define PATHCOUNT 1
-#define MAX_LIGHT 1
+#define MAX_MATERIALS 1
+#define PATH_LENGTH_BINS 1
+#define STACKSIZE 64
 #endif
 
 #define FLT_MAX 3.402823466e+38
 #define EPSILON 1e-8
 #define EPSILON_OFFSET 1e-3
-#define STACKSIZE 16 // stack with depth of 16 is enough even for scene with 1.5M triangles TODO mb change in future / use of shared memory and subgroups
 #define PI 3.1415926535897932384626433832795
 #define INVPI 0.31830988618379067153776752674503
+#define EMISSIVE_LIGHT 0x80000000 // flag of the light index of an emissive triangle of emissive.h, the rest is its index
+#define ENVIRONMENT_LIGHT 0x40000000 // light index of a direction of the environment map of environment.h
+#define ROULETTE_OFF 0 // survival of the paths by RouletteMode of Constants.hpp
+#define ROULETTE_THROUGHPUT 1
+#define ROULETTE_LUMINANCE 2
+#define PATH_LENGTH_LIMIT 1024 // paths end there even without the roulette and the largest depth
+#define MASKED_TRIANGLE 0x40000000 // opacity flags of BVHWrapper::TriangleFlags in the top bits of the material index
+#define TRANSMISSIVE_TRIANGLE 0x80000000
+#define TRIANGLE_FLAGS 0xC0000000
 
 ///////////////////////////////////////////////////
 // define offsets for types
@@ -37,9 +47,9 @@
 #define OFFSET_P_SHADOWRAY_DIRECTION	OFFSET_P_SHADOWRAY_ORIGIN + F4SO
 #define OFFSET_P_LIGHT_INDEX			OFFSET_P_SHADOWRAY_DIRECTION + F4SO
 #define OFFSET_P_LIGHT_DISTANCE			OFFSET_P_LIGHT_INDEX + F1SO
-#define OFFSET_P_INSHADOW				OFFSET_P_LIGHT_DISTANCE + F1SO
+#define OFFSET_P_VISIBILITY				OFFSET_P_LIGHT_DISTANCE + F1SO
 
-#define OFFSET_P_RADIANCE				OFFSET_P_INSHADOW + F1SO
+#define OFFSET_P_RADIANCE				OFFSET_P_VISIBILITY + F1SO
 #define OFFSET_P_THROUGHPUT				OFFSET_P_RADIANCE + F4SO
 #define OFFSET_P_LIGHT_THROUGHPUT		OFFSET_P_THROUGHPUT + F4SO
 #define OFFSET_P_DIRECT_LIGHT			OFFSET_P_LIGHT_THROUGHPUT + F4SO
@@ -60,12 +70,13 @@
 // queue counters offsets
 ///////////////////////////////////////////////////
 #define OFFSET_QC_NEWPATH				0
-#define OFFSET_QC_LASTPATHCNT			4
+#define OFFSET_QC_LASTPATHCNT			4 // position of the next new path in the schedule of adaptive.h
 #define OFFSET_QC_MATUE4				8
 #define OFFSET_QC_MATGLASS				12
 #define OFFSET_QC_EXTRAY_UE4_OFFSET		16
 #define OFFSET_QC_EXTRAY_GLASS_OFFSET	20
 #define OFFSET_QC_SHADOWRAY				24
+#define OFFSET_QC_PATH_LENGTHS			32 // PATH_LENGTH_BINS counters of the lengths of the ended paths, cleared by the renderer every frame
 
 ///////////////////////////////////////////////////
 // define getters
@@ -74,6 +85,7 @@
 
 // LOADS ALWAYS LOAD FROM POSITION GIVEN BY "index" VARIABLE
 #define _pstate_rayOrigin				asfloat(pathState.Load3(GET(P_RAY_ORIGIN, index, 4)))
+#define _pstate_sampleIndex				pathState.Load(GET(P_RAY_ORIGIN, index, 4) + 12) // unused 4th component of the ray origin
 #define _pstate_rayDirection			asfloat(pathState.Load3(GET(P_RAY_DIRECTION, index, 4)))
 #define _pstate_matColor				asfloat(pathState.Load3(GET(P_MAT_COLOR, index, 4)))
 #define _pstate_matMetallicRoughness	asfloat(pathState.Load2(GET(P_MAT_METALICROUGHNESS, index, 2)))
@@ -82,14 +94,17 @@
 #define _pstate_baryCoord				asfloat(pathState.Load3(GET(P_BARYCOORD, index, 4)))
 #define _pstate_hitDistance				asfloat(pathState.Load(GET(P_HITDISTANCE, index, 1)))
 #define _pstate_triangle				pathState.Load4(GET(P_TRIANGLE, index, 4))
+#define _pstate_instance				pathState.Load(GET(P_BARYCOORD, index, 4) + 12) // unused 4th component of barycentric coordinates
 #define _pstate_shadowrayOrigin			asfloat(pathState.Load3(GET(P_SHADOWRAY_ORIGIN, index, 4)))
 #define _pstate_shadowrayDirection		asfloat(pathState.Load3(GET(P_SHADOWRAY_DIRECTION, index, 4)))
+#define _pstate_lightPdf				asfloat(pathState.Load(GET(P_SHADOWRAY_DIRECTION, index, 4) + 12)) // unused 4th component of the shadow ray direction
 #define _pstate_lightIndex				pathState.Load(GET(P_LIGHT_INDEX, index, 1))
 #define _pstate_lightDistance			asfloat(pathState.Load(GET(P_LIGHT_DISTANCE, index, 1)))
-#define _pstate_inShadow				pathState.Load(GET(P_INSHADOW, index, 1))
+#define _pstate_visibility				unpackVisibility(pathState.Load(GET(P_VISIBILITY, index, 1))) // of the light sample, zero if it's blocked
 #define _pstate_radiance				asfloat(pathState.Load3(GET(P_RADIANCE, index, 4)))
 #define _pstate_throughput				asfloat(pathState.Load3(GET(P_THROUGHPUT, index, 4)))
 #define _pstate_lightThroughput			asfloat(pathState.Load3(GET(P_LIGHT_THROUGHPUT, index, 4)))
+#define _pstate_bsdfPdf					asfloat(pathState.Load(GET(P_LIGHT_THROUGHPUT, index, 4) + 12)) // unused 4th component of the light throughput
 #define _pstate_directlight				asfloat(pathState.Load3(GET(P_DIRECT_LIGHT, index, 4)))
 #define _pstate_pathLength				pathState.Load(GET(P_PATH_LENGTH, index, 1))
 #define _pstate_screenCoord				pathState.Load2(GET(P_SCREEN_COORD, index, 2))
@@ -107,6 +122,7 @@
 ///////////////////////////////////////////////////
 // STORES ALWAYS STORE TO LOCATION POINTED BY "index" VARIABLE
 #define _set_pstate_rayOrigin(val)				(pathState.Store3(GET(P_RAY_ORIGIN, index, 4), asuint(val)))
+#define _set_pstate_sampleIndex(val)			(pathState.Store(GET(P_RAY_ORIGIN, index, 4) + 12, val))
 #define _set_pstate_rayDirection(val)			(pathState.Store3(GET(P_RAY_DIRECTION, index, 4), asuint(val)))
 #define _set_pstate_matColor(val)				(pathState.Store3(GET(P_MAT_COLOR, index, 4), asuint(val)))
 #define _set_pstate_matMetallicRoughness(val)	(pathState.Store2(GET(P_MAT_METALICROUGHNESS, index, 2), asuint(val)))
@@ -115,14 +131,17 @@
 #define _set_pstate_baryCoord(val)				(pathState.Store3(GET(P_BARYCOORD, index, 4), asuint(val)))
 #define _set_pstate_hitDistance(val)			(pathState.Store(GET(P_HITDISTANCE, index, 1), asuint(val)))
 #define _set_pstate_triangle(val)				(pathState.Store4(GET(P_TRIANGLE, index, 4), val))
+#define _set_pstate_instance(val)				(pathState.Store(GET(P_BARYCOORD, index, 4) + 12, val))
 #define _set_pstate_shadowrayOrigin(val)		(pathState.Store3(GET(P_SHADOWRAY_ORIGIN, index, 4), asuint(val)))
 #define _set_pstate_shadowrayDirection(val)		(pathState.Store3(GET(P_SHADOWRAY_DIRECTION, index, 4), asuint(val)))
+#define _set_pstate_lightPdf(val)				(pathState.Store(GET(P_SHADOWRAY_DIRECTION, index, 4) + 12, asuint(val)))
 #define _set_pstate_lightIndex(val)				(pathState.Store(GET(P_LIGHT_INDEX, index, 1), val))
 #define _set_pstate_lightDistance(val)			(pathState.Store(GET(P_LIGHT_DISTANCE, index, 1), asuint(val)))
-#define _set_pstate_inShadow(val)				(pathState.Store(GET(P_INSHADOW, index, 1), val))
+#define _set_pstate_visibility(val)				(pathState.Store(GET(P_VISIBILITY, index, 1), packVisibility(val)))
 #define _set_pstate_radiance(val)				(pathState.Store3(GET(P_RADIANCE, index, 4), asuint(val)))
 #define _set_pstate_throughput(val)				(pathState.Store3(GET(P_THROUGHPUT, index, 4), asuint(val)))
 #define _set_pstate_lightThroughput(val)		(pathState.Store3(GET(P_LIGHT_THROUGHPUT, index, 4), asuint(val)))
+#define _set_pstate_bsdfPdf(val)				(pathState.Store(GET(P_LIGHT_THROUGHPUT, index, 4) + 12, asuint(val)))
 #define _set_pstate_directlight(val)			(pathState.Store3(GET(P_DIRECT_LIGHT, index, 4), asuint(val)))
 #define _set_pstate_pathLength(val)				(pathState.Store(GET(P_PATH_LENGTH, index, 1), val))
 #define _set_pstate_screenCoord(val)			(pathState.Store2(GET(P_SCREEN_COORD, index, 2), val))
@@ -160,6 +179,32 @@ struct Light
     float radius;
 };
 
+// node of the light BVH, see LightBVH
+struct LightNode
+{
+	float3 center;
+	float radius;
+	float power;
+	float range;
+	int leftIndex; // index of the light in leaves
+	int rightIndex; // -1 in leaves
+};
+
+// triangle of an instance with an emissive material, see BVHWrapper::InstanceTriangle
+struct EmissiveTriangle
+{
+	uint instance;
+	uint triangle;
+};
+
+// entry of the alias table over the lights, see AliasTable
+struct LightTableEntry
+{
+	float threshold; // probability of the light of the entry, the alias is picked otherwise
+	uint alias;
+	float pdf; // of the light of the entry
+};
+
 struct Camera
 {
     float3 pos;
@@ -171,12 +216,27 @@ struct Camera
 	float3 vertical;
 	float pad3;
 	float2 pixelSize;
-    float2 randomSeed;
+    uint scheduleLength; // passes over the tiles in the schedule of adaptive.h
+    uint mortonOrder; // of the pixels in the tiles
 	float3 envColor;
 	float pad4;
     uint sampleCounter;
 	uint lightCount;
 	uint sampleLights;
+	uint coherentQueues; // logic takes the paths in the order of the extension ray queue
+	uint emissiveCount; // triangles of emissive.h
+	float emissivePower;
+	uint2 environmentCells; // of the sampling tables of environment.h, zero without an environment map
+	float environmentIntensity;
+	float environmentRotation; // around the up axis in turns
+	uint rouletteMode; // ROULETTE_OFF, ROULETTE_THROUGHPUT or ROULETTE_LUMINANCE
+	uint rouletteDepth; // first bounce of the Russian roulette
+	uint maxDepth; // bounces of the longest paths, zero for no limit
+	float rouletteMinSurvival;
+	uint pathStatistics; // lengths of the ended paths are counted into the queue counters
+	uint opacityFlags; // of all the triangles, the tests of the flags the scene doesn't have are skipped
+	uint transmissiveShadows; // shadow rays pass through the transmissive triangles attenuated
+	uint schedulePaths; // pixels of all the passes of the schedule
 };
 
 struct BVHNode
@@ -199,6 +259,42 @@ struct Triangle
 	uint materialID;
 };
 
+// triangle for the intersection in the order of the indices, edges are precomputed
+struct TrianglePositions
+{
+	float3 v0;
+	float3 e1;
+	float3 e2;
+};
+
+// placement of a mesh in the scene, rows of affine 3x4 transforms
+struct Instance
+{
+	float4 worldToObject[3];
+	float4 objectToWorld[3];
+	uint root; // root node of the mesh BVH
+	uint mesh;
+	uint2 pad0;
+};
+
+// decoding of the compressed geometry of a mesh
+struct MeshGeometry
+{
+	float3 origin;
+	uint vertexOffset;
+	float3 scale;
+	uint material;
+};
+
+// of the material of a flagged triangle, BVHWrapper::MaterialOpacity
+struct MaterialOpacity
+{
+	float3 transmittance; // of a surface of the transmissive material
+	float alpha; // of the masked material, the alpha of the diffuse texture multiplies it
+	float alphaCutoff;
+	int alphaIndex; // virtual texture index of the diffuse texture, -1 without it
+};
+
 struct TriangleParameters
 {
 	float3 normal;
@@ -230,6 +326,9 @@ struct MaterialProperty
     int normalIndex;
 
     uint materialType;
+
+	float3 emission;
+	int emissionIndex;
 };
 
 struct Sample
@@ -238,6 +337,40 @@ struct Sample
     float pdf;
 };
 
+// visibility of the light sample in 10 bits per channel, the transmissive surfaces attenuate it
+uint packVisibility(float3 visibility)
+{
+	uint3 v = uint3(saturate(visibility) * 1023.0 + 0.5);
+	return v.x | v.y << 10 | v.z << 20;
+}
+
+float3 unpackVisibility(uint packed)
+{
+	return float3(packed & 0x3FF, (packed >> 10) & 0x3FF, (packed >> 20) & 0x3FF) / 1023.0;
+}
+
+float3 transformPoint(float4 m[3], float3 p)
+{
+	return float3(dot(m[0], float4(p, 1)), dot(m[1], float4(p, 1)), dot(m[2], float4(p, 1)));
+}
+
+float3 transformVector(float4 m[3], float3 v)
+{
+	return float3(dot(m[0].xyz, v), dot(m[1].xyz, v), dot(m[2].xyz, v));
+}
+
+// normal transformed by inverse transpose, worldToObject is already the inverse
+float3 transformNormal(float4 worldToObject[3], float3 n)
+{
+	return worldToObject[0].xyz * n.x + worldToObject[1].xyz * n.y + worldToObject[2].xyz * n.z;
+}
+
+// ray in object space of the instance, direction isn't normalized, so the distance along the ray stays the same
+Ray transformRay(Instance instance, Ray ray)
+{
+	return Ray::create(transformPoint(instance.worldToObject, ray.origin), transformVector(instance.worldToObject, ray.direction));
+}
+
 inline void broadcast(inout uint val)
 {
     val |= NvShflXor(val, 16);
@@ -0,0 +1,61 @@
+#ifndef VT_TILE_SIZE // just to make IDE shut up
+#define VT_TILE_SIZE 128
+#define VT_TILE_BORDER 1
+#define VT_POOL_TILES 32
+#endif
+
+#define VT_TILE_STRIDE (VT_TILE_SIZE + 2 * VT_TILE_BORDER)
+
+struct VTDescriptor
+{
+	uint pageOffset;
+	uint tiles; // tiles per side in mip 0
+	uint mipCount;
+	uint size;
+};
+
+Texture2D vtPool : register(t5);
+StructuredBuffer<uint> vtPageTable : register(t6);
+StructuredBuffer<VTDescriptor> vtDescriptors : register(t7);
+RWByteAddressBuffer vtFeedback : register(u4);
+
+uint vtMipOffset(VTDescriptor desc, uint mip)
+{
+	uint mipTiles = desc.tiles >> mip;
+	return (desc.tiles * desc.tiles - mipTiles * mipTiles) * 4 / 3;
+}
+
+// texture footprint of a point of the triangle seen from the distance - pixel spread widened with every bounce,
+// scaled by uv density of the triangle
+float textureFootprint(float3 p0, float3 p1, float3 p2, float2 t0, float2 t1, float2 t2, float distance, uint pathLength)
+{
+	float worldArea = length(cross(p1 - p0, p2 - p0));
+	float uvArea = abs((t1.x - t0.x) * (t2.y - t0.y) - (t2.x - t0.x) * (t1.y - t0.y));
+	float spread = length(cam.vertical) * cam.pixelSize.y * (pathLength + 1);
+	return distance * spread * sqrt(uvArea / max(worldArea, EPSILON));
+}
+
+// footprint is the width of the sampled area in uv space
+float4 sampleVirtual(uint textureIndex, float2 uv, float footprint, SamplerState samplerState)
+{
+	VTDescriptor desc = vtDescriptors[textureIndex];
+
+	uv = frac(uv);
+	float lod = log2(max(footprint * desc.size, 1.0));
+	uint mip = min(uint(lod), desc.mipCount - 1);
+	uint tiles = desc.tiles >> mip;
+	uint2 tile = min(uint2(uv * tiles), tiles - 1);
+	uint page = desc.pageOffset + vtMipOffset(desc, mip) + tile.y * tiles + tile.x;
+
+	// request the page, streaming decides what gets loaded
+	vtFeedback.Store(page * 4, 1);
+
+	// entry points to the finest resident tile covering the page
+	uint entry = vtPageTable[page];
+	uint residentTiles = desc.tiles >> ((entry >> 16) & 0xff);
+	float2 slot = float2(entry & 0xff, (entry >> 8) & 0xff);
+	float2 inTile = frac(uv * residentTiles);
+
+	float2 poolUV = (slot * VT_TILE_STRIDE + VT_TILE_BORDER + inTile * VT_TILE_SIZE) / (VT_POOL_TILES * VT_TILE_STRIDE);
+	return vtPool.SampleLevel(samplerState, poolUV, 0);
+}
@@ -0,0 +1,205 @@
+﻿#include "Benchmarks.hpp"
+#include "AdaptiveSampling.hpp"
+#include "Sampler.hpp"
+#include <cmath>
+#include <random>
+#include <stdexcept>
+
+namespace
+{
+	// displayed value of one sample of a pixel, a flat background with a little noise, soft shadows
+	// with a binary visibility and a caustic of rare bright samples, all with an exact mean
+	struct Pixel
+	{
+		float base;
+		float amplitude; // uniform noise around the base
+		float probability; // of the bright sample
+		float bright;
+
+		float sample(float u, float v) const
+		{
+			return v < probability ? bright : base + amplitude * (2.f * u - 1.f);
+		}
+
+		double mean() const
+		{
+			return probability * bright + (1.0 - probability) * base;
+		}
+	};
+
+	std::vector<Pixel> createImage(uint32_t size, std::mt19937& generator)
+	{
+		std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+		std::vector<Pixel> pixels(size_t(size) * size);
+		for (uint32_t y = 0; y < size; ++y)
+		{
+			for (uint32_t x = 0; x < size; ++x)
+			{
+				const auto dx = (x + 0.5f) / size - 0.7f;
+				const auto dy = (y + 0.5f) / size - 0.6f;
+				auto& p = pixels[size_t(y) * size + x];
+
+				p = { 0.2f + 0.3f * unit(generator), 0.05f, 0.f, 1.f };
+
+				// caustic under the glass in a small disc, shadow in the lower half
+				if (dx * dx + dy * dy < 0.01f)
+					p.probability = 0.02f;
+				else if (y > size / 2)
+					p.probability = 0.1f * (y - size / 2) / (size / 2), p.bright = p.base + 0.4f;
+			}
+		}
+
+		return pixels;
+	}
+
+	// a pass over the schedule of a cleared image takes every pixel once, the tiles over the edges too
+	void checkSchedule(uint32_t width, uint32_t height, bool morton)
+	{
+		AdaptiveSampling adaptive;
+		adaptive.reset(width, height, morton);
+
+		std::vector<uint32_t> taken(size_t(width) * height);
+		for (uint32_t position = 0; position < adaptive.schedulePaths(); ++position)
+		{
+			const auto [x, y] = adaptive.schedulePixel(position);
+			if (x >= width || y >= height)
+				throw std::runtime_error("Schedule takes a pixel outside of the image");
+
+			++taken[size_t(y) * width + x];
+		}
+
+		if (std::any_of(taken.begin(), taken.end(), [](uint32_t n) { return n != 1; }))
+			throw std::runtime_error("Schedule doesn't take every pixel of the image once");
+	}
+
+	struct Result
+	{
+		size_t frames;
+		double paths;
+		double rmse; // against the exact means
+		double maxError;
+	};
+
+	// the frames of the renderer - new paths go over the schedule, the errors of the tiles are computed at the end
+	// of every interval and replace the schedule an interval later, as they come back through the staging buffers
+	Result render(const std::vector<Pixel>& pixels, uint32_t size, size_t pathsPerFrame, uint32_t maxWeight, bool reweight, size_t maxFrames)
+	{
+		AdaptiveSampling adaptive;
+		adaptive.reset(size, size);
+
+		std::vector<double> means(pixels.size());
+		std::vector<double> moments(pixels.size());
+		std::vector<uint32_t> samples(pixels.size());
+		std::vector<AdaptiveSampling::TileError> errors(adaptive.tileCount());
+		std::vector<AdaptiveSampling::TileError> pending;
+
+		size_t next = 0;
+		size_t frame = 0;
+
+		for (; frame < maxFrames; ++frame)
+		{
+			if (frame > 0 && frame % ADAPTIVE_INTERVAL == 0 && !pending.empty())
+			{
+				auto stop = true;
+				for (const auto& tile : pending)
+					stop &= tile.samples >= ADAPTIVE_MIN_SAMPLES && tile.error <= ADAPTIVE_TARGET_ERROR;
+
+				// the uniform schedule stops by the same test, but never drops a tile
+				if (reweight)
+					adaptive.update(pending.data(), pending.size(), ADAPTIVE_TARGET_ERROR, ADAPTIVE_MIN_SAMPLES, maxWeight);
+
+				if (stop)
+					break;
+			}
+
+			const auto schedulePaths = adaptive.schedulePaths();
+
+			for (size_t i = 0; i < pathsPerFrame; ++i, ++next)
+			{
+				const auto [x, y] = adaptive.schedulePixel(static_cast<uint32_t>(next % schedulePaths));
+				const auto pixel = size_t(y) * size + x;
+
+				const Sampler sampler(static_cast<uint32_t>(pixel), samples[pixel]);
+				const auto u = sampler.get2D(Sampler::CAMERA);
+				const double value = pixels[pixel].sample(u.x, u.y);
+
+				const auto n = ++samples[pixel];
+				means[pixel] += (value - means[pixel]) / n;
+				moments[pixel] += (value * value - moments[pixel]) / n;
+			}
+
+			next %= schedulePaths;
+
+			// adaptive.hlsl
+			if ((frame + 1) % ADAPTIVE_INTERVAL == 0)
+			{
+				for (uint32_t tile = 0; tile < errors.size(); ++tile)
+				{
+					errors[tile] = { 0.f, UINT32_MAX };
+					for (uint32_t i = 0; i < adaptive.tilePixels(tile); ++i)
+					{
+						const auto [x, y] = adaptive.tilePixel(tile, i);
+						const auto pixel = size_t(y) * size + x;
+
+						const auto error = AdaptiveSampling::pixelError(static_cast<float>(means[pixel]), static_cast<float>(moments[pixel]), samples[pixel]);
+						errors[tile].error = std::max(errors[tile].error, error);
+						errors[tile].samples = std::min(errors[tile].samples, samples[pixel]);
+					}
+				}
+
+				// read back an interval later
+				std::swap(pending, errors);
+				errors.resize(adaptive.tileCount());
+			}
+		}
+
+		Result result = { frame, double(frame) * pathsPerFrame, 0.0, 0.0 };
+		for (size_t i = 0; i < pixels.size(); ++i)
+		{
+			const auto error = std::abs(means[i] - pixels[i].mean());
+			result.rmse += error * error;
+			result.maxError = std::max(result.maxError, error);
+		}
+
+		result.rmse = std::sqrt(result.rmse / pixels.size());
+
+		return result;
+	}
+}
+
+int benchAdaptive(const Arguments& args)
+{
+	const auto size = static_cast<uint32_t>(argument(args, 0, 128));
+	const auto pathsPerPixel = argument(args, 1, 2);
+	const auto maxFrames = argument(args, 2, 20000);
+
+	std::printf("adaptive: %u x %u pixels, %zu paths per pixel in a frame, target error %.4f, tiles of %u pixels\n",
+		size, size, pathsPerPixel, ADAPTIVE_TARGET_ERROR, ADAPTIVE_TILE_SIZE);
+
+	for (const auto morton : { false, true })
+		checkSchedule(size + 5, size / 2 + 3, morton);
+
+	std::printf("  a pass over the schedule of %u x %u pixels takes every pixel once\n", size + 5, size / 2 + 3);
+
+	std::mt19937 generator(42);
+	const auto pixels = createImage(size, generator);
+	const auto pathsPerFrame = pixels.size() * pathsPerPixel;
+
+	// every run stops once all the tiles are under the target by the estimate, so they end at equal quality
+	Result uniform;
+	const auto uniformTime = measure(1, [&] { uniform = render(pixels, size, pathsPerFrame, 1, false, maxFrames); });
+
+	std::printf("  %-28s %7zu frames %9.1f Mpaths  RMSE %.5f  max error %.4f  %10.1f ms\n", "uniform", uniform.frames, uniform.paths / 1e6, uniform.rmse, uniform.maxError, uniformTime.best);
+
+	for (const auto& [name, maxWeight] : { std::pair<const char*, uint32_t>{ "converged tiles dropped", 1u }, { "adaptive", ADAPTIVE_MAX_WEIGHT } })
+	{
+		Result result;
+		const auto time = measure(1, [&] { result = render(pixels, size, pathsPerFrame, maxWeight, true, maxFrames); });
+
+		std::printf("  %-28s %7zu frames %9.1f Mpaths  RMSE %.5f  max error %.4f  %10.1f ms  %5.2fx fewer paths\n",
+			name, result.frames, result.paths / 1e6, result.rmse, result.maxError, time.best, uniform.paths / result.paths);
+	}
+
+	return 0;
+}
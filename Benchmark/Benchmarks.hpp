@@ -0,0 +1,63 @@
+﻿#pragma once
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+
+using Arguments = std::vector<std::string>;
+
+// registered in main.cpp
+int benchParams(const Arguments& args);
+int benchInstancing(const Arguments& args);
+int benchRefit(const Arguments& args);
+int benchBuilders(const Arguments& args);
+int benchStress(const Arguments& args);
+int benchTriangles(const Arguments& args);
+int benchTune(const Arguments& args);
+int benchGeometry(const Arguments& args);
+int benchLights(const Arguments& args);
+int benchSampler(const Arguments& args);
+int benchAdaptive(const Arguments& args);
+int benchCoherence(const Arguments& args);
+int benchEmissive(const Arguments& args);
+int benchEnvironment(const Arguments& args);
+int benchRoulette(const Arguments& args);
+int benchOcclusion(const Arguments& args);
+int benchTransparency(const Arguments& args);
+int benchResidency(const Arguments& args);
+
+inline size_t argument(const Arguments& args, size_t index, size_t fallback)
+{
+	return index < args.size() ? std::stoull(args[index]) : fallback;
+}
+
+struct Measurement
+{
+	double best = 1e300; // ms
+	double mean = 0.0; // ms
+};
+
+// runs the work given times and returns best and mean time of one run
+template<typename F>
+Measurement measure(size_t iterations, F&& work)
+{
+	Measurement result;
+
+	for (size_t i = 0; i < iterations; ++i)
+	{
+		const auto start = std::chrono::high_resolution_clock::now();
+		work();
+		const auto time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		result.best = std::min(result.best, time);
+		result.mean += time / iterations;
+	}
+
+	return result;
+}
+
+inline void report(const char* name, const Measurement& m)
+{
+	std::printf("  %-32s best %10.3f ms   mean %10.3f ms\n", name, m.best, m.mean);
+}
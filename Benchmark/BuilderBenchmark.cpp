@@ -0,0 +1,205 @@
+﻿#include "Benchmarks.hpp"
+#include "SyntheticScene.hpp"
+#include "BVHWrapper.hpp"
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <atomic>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <random>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+	struct Builder
+	{
+		const char* name;
+		BVH::Builder builder;
+		int treeletPasses;
+		size_t memoryBudget;
+		float duplicationBudget;
+	};
+
+	// every builder without and with the treelet optimization, SAH of the pair shows the gain,
+	// the out-of-core builds of larger meshes are bounded by a budget smaller than what the in-core ones take,
+	// SBVH with the spatial splits limited and turned off shows what the duplicates buy
+	const Builder BUILDERS[] = {
+		{ "SBVH", BVH::SBVH, 0, 0, 1.f },
+		{ "SBVH+TRBVH", BVH::SBVH, BVH_TREELET_PASSES, 0, 1.f },
+		{ "SBVH 16MB", BVH::SBVH, 0, 16 << 20, 1.f },
+		{ "SBVH 5% dup", BVH::SBVH, 0, 0, 0.05f },
+		{ "SBVH 0% dup", BVH::SBVH, 0, 0, 0.f },
+		{ "LBVH", BVH::LBVH, 0, 0, 1.f },
+		{ "LBVH+TRBVH", BVH::LBVH, BVH_TREELET_PASSES, 0, 1.f },
+		{ "HLBVH", BVH::HLBVH, 0, 0, 1.f },
+		{ "HLBVH+TRBVH", BVH::HLBVH, BVH_TREELET_PASSES, 0, 1.f },
+		{ "HLBVH 16MB", BVH::HLBVH, 0, 16 << 20, 1.f },
+	};
+
+	void benchScene(const std::string& name, const aiScene* scene, size_t rayCount)
+	{
+		std::printf("%s\n", name.c_str());
+
+		std::mt19937 generator(42);
+		std::vector<CPUTraversal::Ray> rays;
+		std::vector<CPUTraversal::Hit> reference;
+
+		for (const auto& [builderName, builder, treeletPasses, memoryBudget, duplicationBudget] : BUILDERS)
+		{
+			BVH::BuildParams params;
+			params.builder = builder;
+			params.treeletPasses = treeletPasses;
+			params.memoryBudget = memoryBudget;
+			params.duplicationBudget = duplicationBudget;
+			params.enablePrints = false;
+
+			std::unique_ptr<BVHWrapper> bvh;
+			const auto build = measure(builder == BVH::SBVH ? 1 : 3, [&] { bvh = std::make_unique<BVHWrapper>(scene, params); });
+
+			const auto stats = bvh->getStats();
+			if (rays.empty())
+				rays = randomRays(rayCount, Vec3f(stats.min.x, stats.min.y, stats.min.z), Vec3f(stats.max.x, stats.max.y, stats.max.z), generator);
+
+			std::vector<CPUTraversal::Hit> hits;
+			const auto traversal = measure(3, [&] { hits = closestHits(*bvh, rays); });
+
+			// every builder has to find the same closest hits as the SBVH
+			if (reference.empty())
+				reference = hits;
+
+			const auto differing = differingHits(reference, hits);
+
+			std::printf("  %-12s build %10.2f ms %8.2f MB peak  %8zu nodes %5.1f%% dup  SAH %8.2f  %2zu stack  %7.2f Mrays/s  %zu rays differ\n",
+				builderName, build.best, stats.buildBytes / 1e6, stats.nodes, 100.0 * stats.duplicates / (stats.triangles - stats.duplicates),
+				stats.meshCost, stats.stackDepth, rayCount / traversal.best / 1e3, differing);
+
+			if (differing > rayCount / 1000)
+				throw std::runtime_error(std::string(builderName) + " finds different hits than SBVH");
+
+			if (stats.stackDepth > BVH_STACK_SIZE)
+				throw std::runtime_error(std::string(builderName) + " builds deeper than the traversal stack");
+		}
+	}
+
+	// every builder reports its progress and stops soon after the load is cancelled in the middle of it
+	void checkCancel(const aiScene* scene)
+	{
+		for (const auto& [builderName, builder, treeletPasses, memoryBudget, duplicationBudget] : BUILDERS)
+		{
+			std::atomic<bool> cancelled = false;
+			float cancelledAt = 0.f, last = 0.f;
+
+			BVH::BuildParams params;
+			params.builder = builder;
+			params.treeletPasses = treeletPasses;
+			params.memoryBudget = memoryBudget;
+			params.duplicationBudget = duplicationBudget;
+			params.enablePrints = false;
+			params.cancelled = &cancelled;
+			params.progress = [&](F32 done)
+			{
+				if (done < last)
+					throw std::runtime_error(std::string(builderName) + " reports the progress going back");
+
+				last = done;
+				if (done >= 0.3f && !cancelled)
+				{
+					cancelledAt = done;
+					cancelled = true;
+				}
+			};
+
+			try
+			{
+				BVHWrapper bvh(scene, params);
+			}
+			catch (const BVH::Cancelled&)
+			{
+				if (last > 0.9f)
+					throw std::runtime_error(std::string(builderName) + " reached the end of the build after the cancel");
+
+				std::printf("  %-12s cancelled at %3.0f%%, stopped at %3.0f%%\n", builderName, 100.f * cancelledAt, 100.f * last);
+				continue;
+			}
+
+			throw std::runtime_error(std::string(builderName) + " build didn't stop after the cancel");
+		}
+	}
+}
+
+int benchBuilders(const Arguments& args)
+{
+	const auto rayCount = argument(args, 0, 100000);
+
+	// scenes given on the command line or all the bundled ones
+	std::vector<std::string> paths(args.size() > 1 ? args.begin() + 1 : args.end(), args.end());
+	if (paths.empty() && fs::exists("Assets/Models"))
+	{
+		for (const auto& f : fs::recursive_directory_iterator("Assets/Models"))
+			if (f.is_regular_file() && f.path().extension() == ".gltf")
+				paths.emplace_back(f.path().string());
+	}
+
+	std::printf("builders: %zu rays per scene\n", rayCount);
+
+	for (const auto& path : paths)
+	{
+		// the same import as the renderer does
+		Assimp::Importer importer;
+		const auto scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_SortByPType | aiProcess_GenSmoothNormals);
+
+		if (!scene)
+		{
+			std::printf("%s\n  skipped, %s\n", path.c_str(), importer.GetErrorString());
+			continue;
+		}
+
+		benchScene(path, scene, rayCount);
+	}
+
+	// generated meshes of growing size, always available
+	for (unsigned subdivisions = 5; subdivisions <= 7; ++subdivisions)
+	{
+		const auto mesh = generateMesh(subdivisions);
+		const auto scene = createScene(createMesh(mesh, { aiMatrix4x4() }), { aiMatrix4x4() });
+
+		benchScene("sphere " + std::to_string(mesh.faces.size()) + " triangles", scene.get(), rayCount);
+	}
+
+	{
+		const auto mesh = generateMesh(7);
+		const auto scene = createScene(createMesh(mesh, { aiMatrix4x4() }), { aiMatrix4x4() });
+
+		std::printf("cancelled builds of %zu triangles\n", mesh.faces.size());
+		checkCancel(scene.get());
+	}
+
+	// the scenes build their BVH on a thread of the load, a failed write of the out-of-core files has to reach its caller
+	const auto missing = fs::temp_directory_path() / "bvh-missing-directory";
+	fs::remove_all(missing);
+
+	const auto mesh = generateMesh(5);
+	const auto scene = createScene(createMesh(mesh, { aiMatrix4x4() }), { aiMatrix4x4() });
+	const auto directory = missing.string();
+
+	BVH::BuildParams params;
+	params.memoryBudget = 1 << 16;
+	params.tempDirectory = directory.c_str();
+	params.enablePrints = false;
+
+	auto build = std::async(std::launch::async, [&] { BVHWrapper bvh(scene.get(), params); });
+	try
+	{
+		build.get();
+	}
+	catch (const std::runtime_error& e)
+	{
+		std::printf("out-of-core build into %s\n  failed as expected, %s\n", directory.c_str(), e.what());
+		return 0;
+	}
+
+	throw std::runtime_error("Out-of-core build into a missing directory didn't report the failed write");
+}
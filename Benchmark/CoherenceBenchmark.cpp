@@ -0,0 +1,296 @@
+﻿#include "Benchmarks.hpp"
+#include "SyntheticScene.hpp"
+#include "BVHWrapper.hpp"
+#include "ParamsParser.hpp"
+#include "AdaptiveSampling.hpp"
+#include "Sampler.hpp"
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <cmath>
+#include <filesystem>
+#include <numeric>
+#include <random>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+	constexpr auto WARP = 32u;
+	constexpr auto RESIDENT_WARPS = 8u; // warps sharing the L1 of a multiprocessor, they take turns in every step
+
+	// set associative cache with LRU replacement, a load counts by the line of its first byte
+	class Cache
+	{
+	public:
+		Cache(size_t bytes, size_t lineBytes, size_t ways)
+			: mLineBits(static_cast<unsigned>(std::log2(lineBytes)))
+			, mWays(ways)
+			, mSets(bytes / lineBytes / ways)
+			, mLines(mSets * ways, UINTPTR_MAX)
+		{}
+
+		bool access(const void* address)
+		{
+			const auto line = reinterpret_cast<uintptr_t>(address) >> mLineBits;
+			const auto set = mLines.begin() + (line % mSets) * mWays;
+			const auto found = std::find(set, set + mWays, line);
+			const auto hit = found != set + mWays;
+
+			// the set is kept from the most recently used line, a miss replaces the last one
+			const auto used = hit ? found : set + mWays - 1;
+			std::rotate(set, used, used + 1);
+			*set = line;
+
+			mHits += hit;
+			++mLoads;
+			return hit;
+		}
+
+		unsigned lineBits() const { return mLineBits; }
+		double hitRate() const { return mLoads ? 100.0 * mHits / mLoads : 0.0; }
+
+	private:
+		unsigned mLineBits;
+		size_t mWays;
+		size_t mSets;
+		std::vector<uintptr_t> mLines;
+		size_t mHits = 0;
+		size_t mLoads = 0;
+	};
+
+	// the second level only sees the misses of the first one
+	struct Hierarchy
+	{
+		Cache l1;
+		Cache l2;
+
+		void access(const void* address)
+		{
+			if (!l1.access(address))
+				l2.access(address);
+		}
+	};
+
+	struct Result
+	{
+		double raysPerSecond; // of the traversal alone
+		double cpuL1; // hit rates in percent
+		double cpuL2;
+		double gpuL1;
+		double gpuL2;
+		double lanesPerLine; // active lanes of a warp step over the distinct cache lines they read, 32 when they all read the same line
+	};
+
+	// the loads of the traversal replayed through the caches of a CPU core tracing the rays one after another
+	// and through the caches of a multiprocessor running warps of consecutive rays in lockstep
+	Result simulate(const CPUTraversal& traversal, const std::vector<CPUTraversal::Ray>& rays)
+	{
+		Hierarchy cpu{ Cache(32 << 10, 64, 8), Cache(1 << 20, 64, 16) };
+		Hierarchy gpu{ Cache(64 << 10, 128, 4), Cache(2 << 20, 128, 16) };
+
+		std::vector<std::vector<const void*>> loads(WARP * RESIDENT_WARPS);
+		std::vector<uintptr_t> lines;
+		size_t laneLoads = 0;
+		size_t warpLines = 0;
+
+		for (size_t first = 0; first < rays.size(); first += loads.size())
+		{
+			const auto count = std::min(loads.size(), rays.size() - first);
+			size_t steps = 0;
+
+			for (size_t i = 0; i < count; ++i)
+			{
+				loads[i].clear();
+				traversal.intersect(rays[first + i], &loads[i]);
+				steps = std::max(steps, loads[i].size());
+
+				for (const auto address : loads[i])
+					cpu.access(address);
+			}
+
+			// lanes of a warp which finished or took another path through the tree read other lines in the same step
+			for (size_t step = 0; step < steps; ++step)
+			{
+				for (size_t warp = 0; warp < count; warp += WARP)
+				{
+					lines.clear();
+					for (auto lane = warp; lane < std::min(warp + WARP, count); ++lane)
+					{
+						if (step < loads[lane].size())
+						{
+							gpu.access(loads[lane][step]);
+							lines.emplace_back(reinterpret_cast<uintptr_t>(loads[lane][step]) >> gpu.l1.lineBits());
+						}
+					}
+
+					std::sort(lines.begin(), lines.end());
+					laneLoads += lines.size();
+					warpLines += std::unique(lines.begin(), lines.end()) - lines.begin();
+				}
+			}
+		}
+
+		const auto time = measure(3, [&]
+		{
+			for (const auto& ray : rays)
+				traversal.intersect(ray);
+		});
+
+		return { rays.size() / time.best * 1e3, cpu.l1.hitRate(), cpu.l2.hitRate(), gpu.l1.hitRate(), gpu.l2.hitRate(), double(laneLoads) / warpLines };
+	}
+
+	// pixels in the order newPath takes them from the first pass over the schedule
+	std::vector<uint32_t> tileOrder(uint32_t size, bool morton)
+	{
+		AdaptiveSampling adaptive;
+		adaptive.reset(size, size, morton);
+
+		std::vector<uint32_t> pixels;
+		for (uint32_t position = 0; position < adaptive.schedulePaths(); ++position)
+		{
+			const auto [x, y] = adaptive.schedulePixel(position);
+			pixels.emplace_back(y * size + x);
+		}
+
+		return pixels;
+	}
+
+	// square image of the saved view or of a view of the whole scene from the front, the same frustum as Camera
+	std::vector<CPUTraversal::Ray> cameraRays(const std::vector<uint32_t>& pixels, uint32_t size, const SceneCatalog::CameraParam& camera)
+	{
+		const auto pitch = camera.pitch * 3.14159265f / 180.f;
+		const auto yaw = camera.yaw * 3.14159265f / 180.f;
+
+		auto front = Vec3f(std::cos(yaw) * std::cos(pitch), std::sin(pitch), std::sin(yaw) * std::cos(pitch)).normalize();
+		auto left = cross(Vec3f(0.f, 1.f, 0.f), front).normalize();
+		const auto up = cross(front, left);
+		const auto halfSize = std::tan(FOV * 3.14159265f / 180.f / 2.f);
+
+		std::vector<CPUTraversal::Ray> rays;
+		for (const auto pixel : pixels)
+		{
+			const auto u = Sampler(pixel, 0).get2D(Sampler::CAMERA);
+			const auto x = ((pixel % size + u.x) / size * 2.f - 1.f) * halfSize;
+			const auto y = (1.f - (pixel / size + u.y) / size * 2.f) * halfSize;
+
+			rays.push_back({ Vec3f(camera.position.x, camera.position.y, camera.position.z), (front - left * x + up * y).normalize() });
+		}
+
+		return rays;
+	}
+
+	// the first bounce of every path which hit something, in the order of its primary ray, in a direction of the sampler
+	std::vector<CPUTraversal::Ray> bounceRays(const std::vector<uint32_t>& pixels, const std::vector<CPUTraversal::Ray>& primary, const CPUTraversal& traversal, float offset)
+	{
+		std::vector<CPUTraversal::Ray> rays;
+		for (size_t i = 0; i < primary.size(); ++i)
+		{
+			const auto hit = traversal.intersect(primary[i]);
+			if (hit.triangle < 0)
+				continue;
+
+			Sampler sampler(pixels[i], 0);
+			sampler.setBounce(1);
+
+			const auto u = sampler.get2D(Sampler::BSDF);
+			const auto z = 1.f - 2.f * u.x;
+			const auto r = std::sqrt(std::max(0.f, 1.f - z * z));
+			const auto phi = 6.2831853f * u.y;
+
+			rays.push_back({ primary[i].origin + primary[i].direction * (hit.distance - offset), Vec3f(r * std::cos(phi), r * std::sin(phi), z) });
+		}
+
+		return rays;
+	}
+
+	void benchScene(const std::string& name, const aiScene* scene, const std::string& paramsPath, uint32_t size)
+	{
+		std::printf("%s\n", name.c_str());
+
+		BVH::BuildParams params;
+		params.enablePrints = false;
+
+		const BVHWrapper bvh(scene, params);
+		const CPUTraversal traversal(bvh);
+
+		const auto stats = bvh.getStats();
+		const auto min = Vec3f(stats.min.x, stats.min.y, stats.min.z);
+		const auto max = Vec3f(stats.max.x, stats.max.y, stats.max.z);
+		const auto center = (min + max) * 0.5f;
+
+		auto camera = SceneCatalog::CameraParam{ { center.x, center.y, center.z - (max - min).length() }, 0.f, 90.f };
+		if (fs::exists(paramsPath))
+			camera = ParamsParser::parseFile(paramsPath).camera;
+
+		// the paths end at different bounces, the slots of the path state they are taken from without the coherent
+		// queues get shuffled after a few frames, the shuffled pixels stand in for them
+		std::vector<uint32_t> slots(size * size);
+		std::iota(slots.begin(), slots.end(), 0);
+		std::shuffle(slots.begin(), slots.end(), std::mt19937(42));
+
+		std::vector<uint32_t> scanline(size * size);
+		std::iota(scanline.begin(), scanline.end(), 0);
+
+		const std::pair<const char*, std::vector<uint32_t>> orders[] = {
+			{ "slots", slots },
+			{ "scanline", scanline },
+			{ "tiles", tileOrder(size, false) },
+			{ "Morton", tileOrder(size, true) },
+		};
+
+		for (const auto& [orderName, pixels] : orders)
+		{
+			const auto primary = cameraRays(pixels, size, camera);
+			const auto bounce = bounceRays(pixels, primary, traversal, (max - min).length() * 1e-4f);
+
+			for (const auto& [raysName, rays] : { std::make_pair("primary", &primary), std::make_pair("bounce", &bounce) })
+			{
+				const auto result = simulate(traversal, *rays);
+
+				std::printf("  %-8s %-7s %7.2f Mrays/s   CPU L1 %5.1f%% L2 %5.1f%%   GPU L1 %5.1f%% L2 %5.1f%%  %5.2f lanes per line\n",
+					orderName, raysName, result.raysPerSecond / 1e6, result.cpuL1, result.cpuL2, result.gpuL1, result.gpuL2, result.lanesPerLine);
+			}
+		}
+	}
+}
+
+int benchCoherence(const Arguments& args)
+{
+	const auto size = static_cast<uint32_t>(argument(args, 0, 256));
+
+	// scenes given on the command line or all the bundled ones
+	std::vector<std::string> paths(args.size() > 1 ? args.begin() + 1 : args.end(), args.end());
+	if (paths.empty() && fs::exists("Assets/Models"))
+	{
+		for (const auto& f : fs::recursive_directory_iterator("Assets/Models"))
+			if (f.is_regular_file() && f.path().extension() == ".gltf")
+				paths.emplace_back(f.path().string());
+	}
+
+	std::printf("coherence: %u x %u pixels, tiles of %u pixels, warps of %u rays, %u resident warps\n", size, size, ADAPTIVE_TILE_SIZE, WARP, RESIDENT_WARPS);
+
+	for (const auto& path : paths)
+	{
+		// the same import as the renderer does
+		Assimp::Importer importer;
+		const auto scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_SortByPType | aiProcess_GenSmoothNormals);
+
+		if (!scene)
+		{
+			std::printf("%s\n  skipped, %s\n", path.c_str(), importer.GetErrorString());
+			continue;
+		}
+
+		benchScene(path, scene, fs::path(path).replace_extension(".params").string(), size);
+	}
+
+	// scattered instances of a generated mesh, always available
+	std::mt19937 generator(42);
+	const auto mesh = generateMesh(5);
+	const auto transforms = scatterTransforms(500, 20.f * mesh.size(), generator);
+	const auto scene = createScene(createMesh(mesh, { aiMatrix4x4() }), transforms);
+
+	benchScene(std::to_string(transforms.size()) + " instances of a sphere of " + std::to_string(mesh.faces.size()) + " triangles", scene.get(), "", size);
+
+	return 0;
+}
@@ -0,0 +1,253 @@
+﻿#include "Benchmarks.hpp"
+#include "SyntheticScene.hpp"
+#include "BVHWrapper.hpp"
+#include "AliasTable.hpp"
+#include "Sampler.hpp"
+#include <cmath>
+#include <random>
+#include <stdexcept>
+
+namespace
+{
+	constexpr auto FLOOR_SIZE = 10.f;
+	constexpr auto LIGHT_HEIGHT = 2.f;
+	constexpr auto EMISSION = 10.f;
+	constexpr auto OFFSET = 1e-3f; // EPSILON_OFFSET of the kernels
+
+	struct Emitter
+	{
+		float x;
+		float z;
+		float size;
+	};
+
+	// a large panel, a few small ones and a tiny one, the table has to spread the samples by the area
+	const Emitter EMITTERS[] = { { 0.f, 0.f, 2.f }, { -3.f, 3.f, 0.5f }, { 3.f, -3.f, 0.5f }, { 3.f, 3.f, 0.25f }, { -3.f, -3.f, 0.05f } };
+
+	// unit square in the xz plane around the origin, two triangles
+	Mesh quad()
+	{
+		Mesh mesh;
+		mesh.vertices = { { -0.5f, 0.f, -0.5f }, { 0.5f, 0.f, -0.5f }, { 0.5f, 0.f, 0.5f }, { -0.5f, 0.f, 0.5f } };
+		mesh.normals.assign(4, { 0.f, 1.f, 0.f });
+		mesh.faces = { { 0, 1, 2 }, { 0, 2, 3 } };
+		return mesh;
+	}
+
+	aiMatrix4x4 placement(float x, float y, float z, float size)
+	{
+		aiMatrix4x4 scaling, translation;
+		aiMatrix4x4::Scaling(aiVector3D(size, 1.f, size), scaling);
+		aiMatrix4x4::Translation(aiVector3D(x, y, z), translation);
+		return translation * scaling;
+	}
+
+	// floor of material 0 under the first node, the panels of the emissive material 1 under the others,
+	// so the instances of the emitters are the ones after the first
+	std::unique_ptr<aiScene> createEmissiveScene()
+	{
+		auto floor = createMesh(quad(), { aiMatrix4x4() });
+		auto panel = createMesh(quad(), { aiMatrix4x4() });
+		floor->mMaterialIndex = 0;
+		panel->mMaterialIndex = 1;
+
+		auto scene = createScene(floor, { placement(0.f, 0.f, 0.f, FLOOR_SIZE) });
+		delete[] scene->mMeshes;
+		scene->mNumMeshes = 2;
+		scene->mMeshes = new aiMesh*[2]{ floor, panel };
+
+		auto root = scene->mRootNode;
+		auto children = new aiNode*[1 + std::size(EMITTERS)];
+		children[0] = root->mChildren[0];
+
+		for (size_t i = 0; i < std::size(EMITTERS); ++i)
+		{
+			auto node = new aiNode;
+			node->mParent = root;
+			node->mTransformation = placement(EMITTERS[i].x, LIGHT_HEIGHT, EMITTERS[i].z, EMITTERS[i].size);
+			node->mNumMeshes = 1;
+			node->mMeshes = new unsigned[1]{ 1 };
+			children[i + 1] = node;
+		}
+
+		delete[] root->mChildren;
+		root->mChildren = children;
+		root->mNumChildren = static_cast<unsigned>(1 + std::size(EMITTERS));
+
+		return scene;
+	}
+
+	inline float powerHeuristic(float rayPdf, float lightPdf)
+	{
+		return rayPdf * rayPdf / (rayPdf * rayPdf + lightPdf * lightPdf);
+	}
+
+	// emissive triangles with the alias table over their power, what Scene::createEmissives uploads for emissive.h
+	struct Emissives
+	{
+		std::vector<BVHWrapper::InstanceTriangle> triangles;
+		AliasTable table;
+		float power = 0.f;
+
+		// probability per solid angle of the point of the light sample, emissivePdf of the kernels
+		float pdf(float distance, float cosine) const
+		{
+			return EMISSION / power * distance * distance / std::max(cosine, 1e-8f);
+		}
+	};
+
+	enum Strategy
+	{
+		BSDF, // cosine sampled directions which hit the emitters
+		LIGHT, // uniform points of the emissive triangles picked by the table
+		MIS, // both weighted by the power heuristic, the way the kernels combine them
+	};
+
+	// outgoing radiance of the white Lambertian floor at the point lit by the emitters
+	float estimate(const CPUTraversal& traversal, const BVHWrapper& bvh, const Emissives& emissives, const Vec3f& point, uint32_t pixel, uint32_t samples, Strategy strategy)
+	{
+		const auto normal = Vec3f(0.f, 1.f, 0.f);
+		const auto origin = point + normal * OFFSET;
+		auto sum = 0.f;
+
+		for (uint32_t s = 0; s < samples; ++s)
+		{
+			Sampler sampler(pixel, s);
+			sampler.setBounce(1);
+
+			if (strategy != BSDF)
+			{
+				float selectionPdf;
+				const auto light = emissives.table.sample(sampler.get1D(Sampler::LIGHT_SELECTION), selectionPdf);
+				const auto [v0, v1, v2] = bvh.getPositions(emissives.triangles[light]);
+
+				const auto u = sampler.get2D(Sampler::LIGHT_POINT);
+				const auto root = std::sqrt(u.x);
+				const auto position = v0 * (1.f - root) + v1 * (root * (1.f - u.y)) + v2 * (root * u.y);
+
+				auto direction = position - origin;
+				const auto distance = direction.length();
+				direction = direction * (1.f / distance);
+
+				auto lightNormal = cross(v1 - v0, v2 - v0);
+				const auto area = 0.5f * lightNormal.length();
+				const auto lightCosine = std::abs(dot(lightNormal, direction)) / (2.f * area);
+				const auto cosine = dot(normal, direction);
+
+				if (selectionPdf > 0.f && lightCosine > 0.f && cosine > 0.f && !traversal.occluded({ origin, direction }, distance - OFFSET))
+				{
+					const auto pdf = selectionPdf / area * distance * distance / lightCosine;
+					const auto weight = strategy == MIS ? powerHeuristic(emissives.pdf(distance, lightCosine), cosine / 3.14159265f) : 1.f;
+
+					sum += weight * EMISSION / 3.14159265f * cosine / pdf;
+				}
+			}
+
+			if (strategy != LIGHT)
+			{
+				// cosine sampling cancels the cosine and the Lambertian BRDF
+				const auto u = sampler.get2D(Sampler::BSDF);
+				const auto radius = std::sqrt(u.x);
+				const auto phi = 2.f * 3.14159265f * u.y;
+				const auto direction = Vec3f(radius * std::cos(phi), std::sqrt(std::max(0.f, 1.f - u.x)), radius * std::sin(phi));
+
+				const auto hit = traversal.intersect({ origin, direction });
+				if (hit.instance < 1)
+					continue;
+
+				auto weight = 1.f;
+				if (strategy == MIS)
+				{
+					const auto [v0, v1, v2] = bvh.getPositions({ static_cast<uint32_t>(hit.instance), static_cast<uint32_t>(hit.triangle) });
+					const auto lightCosine = std::abs(dot(cross(v1 - v0, v2 - v0).normalize(), direction));
+					weight = powerHeuristic(direction.y / 3.14159265f, emissives.pdf(hit.distance, lightCosine));
+				}
+
+				sum += weight * EMISSION;
+			}
+		}
+
+		return sum / samples;
+	}
+}
+
+int benchEmissive(const Arguments& args)
+{
+	const auto pointCount = argument(args, 0, 1000);
+	const auto samples = static_cast<uint32_t>(argument(args, 1, 16));
+	const auto referenceSamples = static_cast<uint32_t>(argument(args, 2, 4096));
+
+	const auto scene = createEmissiveScene();
+	BVH::BuildParams params;
+	params.enablePrints = false;
+
+	const BVHWrapper bvh(scene.get(), params);
+	const CPUTraversal traversal(bvh);
+
+	// triangles of the emissive material, duplicates of the spatial splits left out
+	Emissives emissives;
+	emissives.triangles = bvh.getTriangles({ false, true });
+
+	if (emissives.triangles.size() != 2 * std::size(EMITTERS))
+		throw std::runtime_error("Emissive triangles found " + std::to_string(emissives.triangles.size()) + " times instead of once");
+
+	std::vector<float> powers;
+	for (const auto& triangle : emissives.triangles)
+	{
+		powers.emplace_back(bvh.getArea(triangle) * EMISSION);
+		emissives.power += powers.back();
+	}
+
+	emissives.table = AliasTable(powers);
+
+	std::printf("emissive: %zu emissive triangles of %zu panels over a floor, %zu points, %u samples, reference of %u light samples\n",
+		emissives.triangles.size(), std::size(EMITTERS), pointCount, samples, referenceSamples);
+
+	// the light samples alone are unbiased and converge the fastest on a diffuse floor, so they give the reference
+	std::mt19937 generator(42);
+	std::uniform_real_distribution<float> unit(-0.5f * FLOOR_SIZE, 0.5f * FLOOR_SIZE);
+
+	std::vector<Vec3f> points(pointCount);
+	std::vector<float> reference(pointCount);
+
+	for (size_t i = 0; i < pointCount; ++i)
+	{
+		points[i] = Vec3f(unit(generator), 0.f, unit(generator));
+		reference[i] = estimate(traversal, bvh, emissives, points[i], static_cast<uint32_t>(i + pointCount), referenceSamples, LIGHT);
+	}
+
+	const std::pair<const char*, Strategy> strategies[] = { { "BSDF hits", BSDF }, { "light samples", LIGHT }, { "MIS", MIS } };
+	auto bsdfError = 0.0;
+
+	for (const auto& [name, strategy] : strategies)
+	{
+		std::vector<float> values(pointCount);
+		const auto time = measure(3, [&]
+		{
+			for (size_t i = 0; i < pointCount; ++i)
+				values[i] = estimate(traversal, bvh, emissives, points[i], static_cast<uint32_t>(i), samples, strategy);
+		});
+
+		auto squaredError = 0.0;
+		auto sum = 0.0;
+		auto referenceSum = 0.0;
+
+		for (size_t i = 0; i < pointCount; ++i)
+		{
+			squaredError += (values[i] - reference[i]) * (values[i] - reference[i]);
+			sum += values[i];
+			referenceSum += reference[i];
+		}
+
+		// error per time is the variance times the cost, lower is better, relative to the BSDF hits
+		const auto rmse = std::sqrt(squaredError / pointCount);
+		const auto efficiency = squaredError * time.best;
+		if (strategy == BSDF)
+			bsdfError = efficiency;
+
+		std::printf("  %-16s RMSE %8.4f  mean %6.3f of the reference  %8.2f ms  %6.1fx the convergence per second of the BSDF hits\n",
+			name, rmse, sum / referenceSum, time.best, bsdfError / efficiency);
+	}
+
+	return 0;
+}
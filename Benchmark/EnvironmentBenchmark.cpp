@@ -0,0 +1,278 @@
+﻿#include "Benchmarks.hpp"
+#include "EnvironmentMap.hpp"
+#include "Sampler.hpp"
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+	constexpr auto PI = 3.14159265f;
+	const auto SUN = Vec3f(0.4f, 0.6f, -0.3f).normalize();
+	constexpr auto SUN_COSINE = 0.99996f; // about half a degree
+	constexpr auto SUN_RADIANCE = 20000.f;
+
+	// the same mapping as environment.h
+	Vec3f texelDirection(uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+	{
+		const auto phi = 2.f * PI * ((x + 0.5f) / width - 0.5f);
+		const auto theta = PI * (y + 0.5f) / height;
+		return { std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi) };
+	}
+
+	// blue sky brightening to the horizon, dark ground and a small sun which takes most of the power
+	DirectX::XMFLOAT3 sky(const Vec3f& direction)
+	{
+		if (dot(direction, SUN) > SUN_COSINE)
+			return { SUN_RADIANCE, SUN_RADIANCE * 0.9f, SUN_RADIANCE * 0.8f };
+
+		if (direction.y < 0.f)
+			return { 0.1f, 0.08f, 0.05f };
+
+		const auto t = 1.f - direction.y;
+		return { 0.3f + 0.5f * t, 0.5f + 0.4f * t, 1.f };
+	}
+
+	void writeRGBE(const DirectX::XMFLOAT3& color, uint8_t* rgbe)
+	{
+		const auto largest = std::max(color.x, std::max(color.y, color.z));
+		if (largest < 1e-32f)
+		{
+			rgbe[0] = rgbe[1] = rgbe[2] = rgbe[3] = 0;
+			return;
+		}
+
+		int exponent;
+		const auto scale = std::frexp(largest, &exponent) * 256.f / largest;
+		rgbe[0] = static_cast<uint8_t>(color.x * scale);
+		rgbe[1] = static_cast<uint8_t>(color.y * scale);
+		rgbe[2] = static_cast<uint8_t>(color.z * scale);
+		rgbe[3] = static_cast<uint8_t>(exponent + 128);
+	}
+
+	// Radiance file with the new run length encoding, runs of at least three bytes, literals otherwise
+	void writeRadiance(const std::string& path, uint32_t width, uint32_t height)
+	{
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		file << "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " << height << " +X " << width << "\n";
+
+		std::vector<uint8_t> rgbe(width * 4);
+		std::vector<uint8_t> encoded;
+
+		for (uint32_t y = 0; y < height; ++y)
+		{
+			for (uint32_t x = 0; x < width; ++x)
+				writeRGBE(sky(texelDirection(x, y, width, height)), &rgbe[x * 4]);
+
+			encoded = { 2, 2, static_cast<uint8_t>(width >> 8), static_cast<uint8_t>(width & 0xFF) };
+			for (uint32_t c = 0; c < 4; ++c)
+			{
+				for (uint32_t x = 0; x < width;)
+				{
+					auto run = 1u;
+					while (x + run < width && run < 127 && rgbe[(x + run) * 4 + c] == rgbe[x * 4 + c])
+						++run;
+
+					if (run >= 3)
+					{
+						encoded.insert(encoded.end(), { static_cast<uint8_t>(128 + run), rgbe[x * 4 + c] });
+						x += run;
+						continue;
+					}
+
+					// literals up to the next run
+					auto count = 0u;
+					while (x + count < width && count < 128
+						&& !(x + count + 2 < width && rgbe[(x + count) * 4 + c] == rgbe[(x + count + 1) * 4 + c] && rgbe[(x + count) * 4 + c] == rgbe[(x + count + 2) * 4 + c]))
+						++count;
+
+					count = std::max(count, 1u);
+					encoded.emplace_back(static_cast<uint8_t>(count));
+					for (uint32_t i = 0; i < count; ++i)
+						encoded.emplace_back(rgbe[(x + i) * 4 + c]);
+
+					x += count;
+				}
+			}
+
+			file.write(reinterpret_cast<const char*>(encoded.data()), encoded.size());
+		}
+	}
+
+	inline float powerHeuristic(float a, float b)
+	{
+		return a * a / (a * a + b * b);
+	}
+
+	Vec3f cosineDirection(const Vec3f& normal, const DirectX::XMFLOAT2& u)
+	{
+		const auto tangent = cross(std::abs(normal.z) < 0.999f ? Vec3f(0.f, 0.f, 1.f) : Vec3f(1.f, 0.f, 0.f), normal).normalize();
+		const auto bitangent = cross(normal, tangent);
+		const auto radius = std::sqrt(u.x);
+		const auto phi = 2.f * PI * u.y;
+
+		return tangent * (radius * std::cos(phi)) + bitangent * (radius * std::sin(phi)) + normal * std::sqrt(std::max(0.f, 1.f - u.x));
+	}
+
+	enum Strategy
+	{
+		BSDF, // cosine sampled directions
+		LIGHT, // directions of the map picked by the tables
+		MIS, // both weighted by the power heuristic, the way the kernels combine them
+	};
+
+	// outgoing luminance of a white Lambertian point with the normal lit by the whole map
+	float estimate(const EnvironmentMap& map, const Vec3f& normal, uint32_t pixel, uint32_t samples, Strategy strategy)
+	{
+		const auto luminance = [](const Vec3f& c) { return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z; };
+		auto sum = 0.f;
+
+		for (uint32_t s = 0; s < samples; ++s)
+		{
+			Sampler sampler(pixel, s);
+			sampler.setBounce(1);
+
+			if (strategy != BSDF)
+			{
+				const auto u = sampler.get2D(Sampler::LIGHT_POINT);
+				float pdf;
+				const auto direction = map.sample(sampler.get1D(Sampler::LIGHT_SELECTION), u.x, u.y, pdf);
+				const auto cosine = dot(direction, normal);
+
+				if (pdf > 0.f && cosine > 0.f)
+				{
+					const auto weight = strategy == MIS ? powerHeuristic(pdf, cosine / PI) : 1.f;
+					sum += weight * luminance(map.radiance(direction)) * cosine / PI / pdf;
+				}
+			}
+
+			if (strategy != LIGHT)
+			{
+				const auto direction = cosineDirection(normal, sampler.get2D(Sampler::BSDF));
+				const auto weight = strategy == MIS ? powerHeuristic(dot(direction, normal) / PI, map.pdf(direction)) : 1.f;
+				sum += weight * luminance(map.radiance(direction));
+			}
+		}
+
+		return sum / samples;
+	}
+}
+
+int benchEnvironment(const Arguments& args)
+{
+	const auto width = static_cast<uint32_t>(argument(args, 0, 4096));
+	const auto pointCount = argument(args, 1, 1000);
+	const auto samples = static_cast<uint32_t>(argument(args, 2, 16));
+	const auto height = width / 2;
+
+	const auto directory = fs::temp_directory_path() / "environment-benchmark";
+	const auto path = (directory / "sky.hdr").string();
+	fs::create_directories(directory);
+	writeRadiance(path, width, height);
+
+	std::printf("environment: %u x %u sky with a sun, %.1f MB file, tables of %u cells per row, %zu points, %u samples\n",
+		width, height, fs::file_size(path) / 1e6, ENVIRONMENT_TABLE_WIDTH, pointCount, samples);
+
+	// the first load decodes the file and builds the tables, the next ones read the cache
+	EnvironmentMap map;
+	report("decode, tables and cache", measure(1, [&] { map = EnvironmentMap(path); }));
+	report("load from the cache", measure(3, [&] { map = EnvironmentMap(path); }));
+
+	if (!map.fromCache())
+		throw std::runtime_error("Environment map wasn't read from the cache");
+
+	// the texels are decoded from the run length encoding within the precision of the RGBE and the shared exponent
+	auto texelError = 0.f;
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			const auto expected = sky(texelDirection(x, y, width, height));
+			const auto texel = EnvironmentMap::unpackSharedExponent(map.getTexels()[size_t(y) * width + x]);
+			const auto largest = std::max(expected.x, std::max(expected.y, expected.z));
+
+			texelError = std::max(texelError, std::max(std::abs(texel.x - expected.x), std::max(std::abs(texel.y - expected.y), std::abs(texel.z - expected.z))) / largest);
+		}
+	}
+
+	std::printf("  texels off by %.2f%% of their largest component at most\n", 100.f * texelError);
+	if (texelError > 1.f / 64)
+		throw std::runtime_error("Environment map texels differ from the ones written");
+
+	// the pdf of the sample has to be the one the extension rays get for its direction, up to the rounding of the directions
+	// on the borders of the cells, and integrate to one over the sphere
+	std::mt19937 generator(42);
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+	constexpr auto CHECKS = 100000;
+	auto differing = 0;
+	auto integral = 0.0;
+
+	for (size_t i = 0; i < CHECKS; ++i)
+	{
+		float pdf;
+		const auto direction = map.sample(unit(generator), unit(generator), unit(generator), pdf);
+		differing += std::abs(pdf - map.pdf(direction)) > 1e-3f * pdf;
+
+		const auto z = 1.f - 2.f * unit(generator);
+		const auto r = std::sqrt(std::max(0.f, 1.f - z * z));
+		const auto phi = 2.f * PI * unit(generator);
+		integral += map.pdf(Vec3f(r * std::cos(phi), z, r * std::sin(phi))) * 4.f * PI / CHECKS;
+	}
+
+	std::printf("  %d of %d samples with a different pdf of their direction, integral of the pdf over the sphere %.4f\n", differing, CHECKS, integral);
+	if (differing > CHECKS / 1000)
+		throw std::runtime_error("Environment samples have a different pdf than their directions");
+
+	// random normals, the map sampling alone gives the reference
+	std::vector<Vec3f> normals(pointCount);
+	std::vector<float> reference(pointCount);
+
+	for (size_t i = 0; i < pointCount; ++i)
+	{
+		const auto z = 1.f - 2.f * unit(generator);
+		const auto r = std::sqrt(std::max(0.f, 1.f - z * z));
+		const auto phi = 2.f * PI * unit(generator);
+
+		normals[i] = Vec3f(r * std::cos(phi), z, r * std::sin(phi));
+		reference[i] = estimate(map, normals[i], static_cast<uint32_t>(i + pointCount), 4096, LIGHT);
+	}
+
+	const std::pair<const char*, Strategy> strategies[] = { { "BSDF hits", BSDF }, { "map samples", LIGHT }, { "MIS", MIS } };
+	auto bsdfError = 0.0;
+
+	for (const auto& [name, strategy] : strategies)
+	{
+		std::vector<float> values(pointCount);
+		const auto time = measure(3, [&]
+		{
+			for (size_t i = 0; i < pointCount; ++i)
+				values[i] = estimate(map, normals[i], static_cast<uint32_t>(i), samples, strategy);
+		});
+
+		auto squaredError = 0.0;
+		auto sum = 0.0;
+		auto referenceSum = 0.0;
+
+		for (size_t i = 0; i < pointCount; ++i)
+		{
+			squaredError += (values[i] - reference[i]) * (values[i] - reference[i]);
+			sum += values[i];
+			referenceSum += reference[i];
+		}
+
+		// error per time is the variance times the cost, lower is better, relative to the BSDF hits
+		const auto efficiency = squaredError * time.best;
+		if (strategy == BSDF)
+			bsdfError = efficiency;
+
+		std::printf("  %-16s RMSE %10.4f  mean %6.3f of the reference  %8.2f ms  %8.1fx the convergence per second of the BSDF hits\n",
+			name, std::sqrt(squaredError / pointCount), sum / referenceSum, time.best, bsdfError / efficiency);
+	}
+
+	fs::remove_all(directory);
+	return 0;
+}
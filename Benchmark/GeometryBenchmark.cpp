@@ -0,0 +1,116 @@
+﻿#include "Benchmarks.hpp"
+#include "SyntheticScene.hpp"
+#include "BVHWrapper.hpp"
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <filesystem>
+#include <future>
+#include <random>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+	void benchScene(const std::string& name, const aiScene* scene, size_t rayCount)
+	{
+		std::printf("%s\n", name.c_str());
+
+		BVH::BuildParams params;
+		params.enablePrints = false;
+
+		std::mt19937 generator(42);
+		std::vector<CPUTraversal::Ray> rays;
+		std::vector<CPUTraversal::Hit> reference;
+		size_t referenceBytes = 0;
+
+		// full precision geometry first, the compressed one is checked against it
+		for (const auto compress : { false, true })
+		{
+			const BVHWrapper bvh(scene, params, false, compress);
+
+			const auto stats = bvh.getStats();
+			if (rays.empty())
+				rays = randomRays(rayCount, Vec3f(stats.min.x, stats.min.y, stats.min.z), Vec3f(stats.max.x, stats.max.y, stats.max.z), generator);
+
+			std::vector<CPUTraversal::Hit> hits;
+			const auto closest = measure(3, [&] { hits = closestHits(bvh, rays); });
+
+			if (reference.empty())
+			{
+				reference = hits;
+				referenceBytes = stats.bytes;
+			}
+
+			// quantized vertices move by half a step at most, only grazing rays may change their hit
+			const auto differing = differingHits(reference, hits);
+
+			std::printf("  %-12s %8.2f MB GPU  %8.2f B/triangle  %5.1f%% saved  closest %7.2f Mrays/s  %zu rays differ\n",
+				compress ? "compressed" : "full", stats.bytes / 1e6, double(stats.bytes) / stats.triangles,
+				100.0 * (1.0 - double(stats.bytes) / referenceBytes), rayCount / closest.best / 1e3, differing);
+
+			if (differing > rayCount / 1000)
+				throw std::runtime_error("compressed geometry finds different hits than the full precision one");
+		}
+	}
+}
+
+int benchGeometry(const Arguments& args)
+{
+	const auto rayCount = argument(args, 0, 100000);
+
+	// scenes given on the command line or all the bundled ones
+	std::vector<std::string> paths(args.size() > 1 ? args.begin() + 1 : args.end(), args.end());
+	if (paths.empty() && fs::exists("Assets/Models"))
+	{
+		for (const auto& f : fs::recursive_directory_iterator("Assets/Models"))
+			if (f.is_regular_file() && f.path().extension() == ".gltf")
+				paths.emplace_back(f.path().string());
+	}
+
+	std::printf("geometry: %zu rays per scene\n", rayCount);
+
+	for (const auto& path : paths)
+	{
+		// the same import as the renderer does
+		Assimp::Importer importer;
+		const auto scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_SortByPType | aiProcess_GenSmoothNormals);
+
+		if (!scene)
+		{
+			std::printf("%s\n  skipped, %s\n", path.c_str(), importer.GetErrorString());
+			continue;
+		}
+
+		benchScene(path, scene, rayCount);
+	}
+
+	// generated meshes of growing size, always available
+	for (unsigned subdivisions = 5; subdivisions <= 7; ++subdivisions)
+	{
+		const auto mesh = generateMesh(subdivisions);
+		const auto scene = createScene(createMesh(mesh, { aiMatrix4x4() }), { aiMatrix4x4() });
+
+		benchScene("sphere " + std::to_string(mesh.faces.size()) + " triangles", scene.get(), rayCount);
+	}
+
+	// a mesh over the 21 bit vertex indices is refused on the thread the scenes build their BVH on, the error has to reach the load
+	const auto terrain = generateTerrain(1449);
+	const auto oversized = createScene(createMesh(terrain, { aiMatrix4x4() }), { aiMatrix4x4() });
+
+	BVH::BuildParams params;
+	params.enablePrints = false;
+
+	auto build = std::async(std::launch::async, [&] { BVHWrapper bvh(oversized.get(), params, false, true); });
+	try
+	{
+		build.get();
+	}
+	catch (const std::runtime_error& e)
+	{
+		std::printf("terrain of %zu vertices\n  refused as expected, %s\n", terrain.vertices.size(), e.what());
+		return 0;
+	}
+
+	throw std::runtime_error("Compressed geometry of a mesh over 2^21 vertices wasn't refused");
+}
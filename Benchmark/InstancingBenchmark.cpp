@@ -0,0 +1,57 @@
+﻿#include "Benchmarks.hpp"
+#include "SyntheticScene.hpp"
+#include "BVHWrapper.hpp"
+#include <memory>
+#include <algorithm>
+#include <random>
+#include <cmath>
+#include <stdexcept>
+
+int benchInstancing(const Arguments& args)
+{
+	const auto instanceCount = argument(args, 0, 2000);
+	const auto rayCount = argument(args, 1, 100000);
+	const auto mesh = args.size() > 2 ? loadMesh(args[2]) : generateMesh(3);
+
+	// copies roughly 3 mesh sizes apart
+	std::mt19937 generator(42);
+	const auto sceneSize = 3.f * mesh.size() * std::cbrt(static_cast<float>(instanceCount));
+	const auto transforms = scatterTransforms(instanceCount, sceneSize, generator);
+
+	const auto triangleCount = mesh.faces.size() * instanceCount;
+	std::printf("instancing: %zu instances of %zu triangles, %.2fM triangles flattened, %zu rays\n", instanceCount, mesh.faces.size(), triangleCount / 1e6, rayCount);
+
+	const auto flatScene = createScene(createMesh(mesh, transforms), { aiMatrix4x4() });
+	const auto instancedScene = createScene(createMesh(mesh, { aiMatrix4x4() }), transforms);
+
+	std::unique_ptr<BVHWrapper> flat, instanced;
+	const auto flatBuild = measure(1, [&] { flat = std::make_unique<BVHWrapper>(flatScene.get()); });
+	const auto instancedBuild = measure(1, [&] { instanced = std::make_unique<BVHWrapper>(instancedScene.get()); });
+
+	const auto rays = randomRays(rayCount, sceneSize, generator);
+
+	std::vector<CPUTraversal::Hit> flatHits, instancedHits;
+	const auto flatTraversal = measure(1, [&] { flatHits = closestHits(*flat, rays); });
+	const auto instancedTraversal = measure(1, [&] { instancedHits = closestHits(*instanced, rays); });
+
+	const auto hits = std::count_if(flatHits.begin(), flatHits.end(), [](const CPUTraversal::Hit& hit) { return hit.triangle >= 0; });
+	const auto differing = differingHits(flatHits, instancedHits);
+
+	const auto flatStats = flat->getStats();
+	const auto instancedStats = instanced->getStats();
+
+	report("flattened SBVH build", flatBuild);
+	report("mesh BVH + top level build", instancedBuild);
+	report("flattened closest hit", flatTraversal);
+	report("two-level closest hit", instancedTraversal);
+	std::printf("  flattened  %8zu nodes %9zu triangles %8.2f MB\n", flatStats.nodes, flatStats.triangles, flatStats.bytes / 1e6);
+	std::printf("  two-level  %8zu nodes %9zu triangles %8.2f MB\n", instancedStats.nodes, instancedStats.triangles, instancedStats.bytes / 1e6);
+	std::printf("  memory %.1fx smaller, build %.1fx faster, traversal %.2fx of flattened, %.1f%% rays hit, %zu differ\n",
+		static_cast<double>(flatStats.bytes) / instancedStats.bytes, flatBuild.best / instancedBuild.best, flatTraversal.best / instancedTraversal.best, 100.0 * hits / rayCount, differing);
+
+	// precision of transformed rays differs a bit on grazing hits, anything more is a bug
+	if (differing > rayCount / 1000)
+		throw std::runtime_error("Flattened and two-level traversal disagree");
+
+	return 0;
+}
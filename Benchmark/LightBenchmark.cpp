@@ -0,0 +1,289 @@
+﻿#include "Benchmarks.hpp"
+#include "LightBVH.hpp"
+#include "AliasTable.hpp"
+#include <cfloat>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+
+namespace
+{
+	constexpr auto SCENE_SIZE = 100.f;
+
+	struct ShadingPoint
+	{
+		Vec3f position;
+		Vec3f normal;
+	};
+
+	Vec3f toVec3f(const DirectX::XMFLOAT3& v)
+	{
+		return { v.x, v.y, v.z };
+	}
+
+	float lightFalloff(float distance, float radius)
+	{
+		const auto n = std::clamp(1.f - std::pow(distance / radius, 4.f), 0.f, 1.f);
+		return (n * n) / (distance * distance + 1.f);
+	}
+
+	// direct light of the center of the light without visibility, the terms of the kernels which depend on the picked light
+	float contribution(const Light& light, const ShadingPoint& point)
+	{
+		auto direction = toVec3f(light.position) - point.position;
+		const auto distance = direction.length();
+		const auto cosine = dot(direction.normalize(), point.normal);
+
+		if (cosine <= 0.f)
+			return 0.f;
+
+		return lightPower(light) * cosine * lightFalloff(distance, light.falloff);
+	}
+
+	// small lights of a limited range scattered over the scene, like the lamps of a city
+	std::vector<Light> randomLights(size_t count, std::mt19937& generator)
+	{
+		std::uniform_real_distribution<float> position(0.f, SCENE_SIZE);
+		std::uniform_real_distribution<float> emission(0.1f, 10.f);
+		std::uniform_real_distribution<float> radius(0.05f, 0.2f);
+		std::uniform_real_distribution<float> falloff(5.f, 30.f);
+
+		std::vector<Light> lights(count);
+		for (auto& light : lights)
+			light = { { position(generator), position(generator), position(generator) }, falloff(generator), { emission(generator), emission(generator), emission(generator) }, radius(generator) };
+
+		return lights;
+	}
+
+	std::vector<ShadingPoint> randomPoints(size_t count, std::mt19937& generator)
+	{
+		std::uniform_real_distribution<float> position(0.f, SCENE_SIZE);
+		std::normal_distribution<float> normal;
+
+		std::vector<ShadingPoint> points(count);
+		for (auto& point : points)
+			point = { { position(generator), position(generator), position(generator) }, Vec3f(normal(generator), normal(generator), normal(generator)).normalize() };
+
+		return points;
+	}
+
+	// expected squared error of the estimates of the given samples relative to the sum of the squared references.
+	// The variance of a single sample is the sum of contribution^2 / pdf over the lights minus the reference^2, exactly,
+	// the squared errors of random estimates are dominated by the rare picks of the near lights and vary by orders of magnitude.
+	template<typename Pdf>
+	double relativeError(const std::vector<ShadingPoint>& points, const std::vector<Light>& lights, size_t samples, Pdf&& pdf)
+	{
+		double error = 0.0;
+		double norm = 0.0;
+
+		for (const auto& point : points)
+		{
+			double reference = 0.0;
+			double moment = 0.0;
+
+			for (size_t i = 0; i < lights.size(); ++i)
+			{
+				const double f = contribution(lights[i], point);
+				if (f <= 0.0)
+					continue;
+
+				const double p = pdf(point, i);
+				if (p <= 0.0)
+					throw std::runtime_error("light selection misses a light which reaches the point");
+
+				reference += f;
+				moment += f * f / p;
+			}
+
+			error += (moment - reference * reference) / samples;
+			norm += reference * reference;
+		}
+
+		return error / norm;
+	}
+
+	// time of the picks only, the sum keeps them from being optimized out
+	template<typename Sampler>
+	float sampleAll(const std::vector<ShadingPoint>& points, size_t samples, Sampler&& sample)
+	{
+		float sum = 0.f;
+		for (const auto& point : points)
+			for (size_t s = 0; s < samples; ++s)
+				sum += sample(point);
+
+		return sum;
+	}
+
+	// closest light sphere by testing all of them, the loop the kernel had before the tree with the same test as the leaves
+	int intersectAll(const std::vector<Light>& lights, const Vec3f& origin, const Vec3f& direction, float& distance)
+	{
+		int hit = -1;
+		for (size_t i = 0; i < lights.size(); ++i)
+		{
+			const auto position = toVec3f(lights[i].position) - origin;
+			const auto radius2 = lights[i].radius * lights[i].radius;
+
+			const auto tca = dot(position, direction);
+			const auto offset = position - direction * tca;
+			const auto d2 = dot(offset, offset);
+
+			if (d2 > radius2)
+				continue;
+
+			const auto thc = std::sqrt(radius2 - d2);
+			auto t0 = tca - thc;
+
+			if (t0 < 0.f)
+				t0 = tca + thc;
+
+			if (t0 > 0.f && t0 < distance)
+			{
+				distance = t0;
+				hit = static_cast<int>(i);
+			}
+		}
+
+		return hit;
+	}
+}
+
+int benchLights(const Arguments& args)
+{
+	const auto lightCount = argument(args, 0, 10000);
+	const auto pointCount = argument(args, 1, 2000);
+	const auto samples = argument(args, 2, 16);
+	const auto rayCount = argument(args, 3, 10000);
+
+	std::printf("lights: %zu lights, %zu shading points, %zu samples per point, %zu rays\n", lightCount, pointCount, samples, rayCount);
+
+	std::mt19937 generator(42);
+	auto lights = randomLights(lightCount, generator);
+	const auto points = randomPoints(pointCount, generator);
+
+	std::vector<float> powers(lights.size());
+	for (size_t i = 0; i < lights.size(); ++i)
+		powers[i] = lightPower(lights[i]);
+
+	LightBVH tree;
+	AliasTable table;
+	const auto build = measure(5, [&] { tree = LightBVH(lights); });
+	const auto tableBuild = measure(5, [&] { table = AliasTable(powers); });
+	report("build", build);
+	report("alias table build", tableBuild);
+
+	const auto uniformError = relativeError(points, lights, samples, [&](const ShadingPoint&, size_t) { return 1.0 / lights.size(); });
+	const auto aliasError = relativeError(points, lights, samples, [&](const ShadingPoint&, size_t light) { return static_cast<double>(table.getEntries()[light].pdf); });
+	const auto treeError = relativeError(points, lights, samples, [&](const ShadingPoint& point, size_t light) { return static_cast<double>(tree.pdf(point.position, point.normal, light)); });
+
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+	const auto uniform = measure(3, [&]
+	{
+		sampleAll(points, samples, [&](const ShadingPoint& point)
+		{
+			const auto light = std::min(static_cast<size_t>(unit(generator) * lights.size()), lights.size() - 1);
+			return contribution(lights[light], point) * lights.size();
+		});
+	});
+
+	const auto alias = measure(3, [&]
+	{
+		sampleAll(points, samples, [&](const ShadingPoint& point)
+		{
+			float pdf;
+			const auto light = table.sample(unit(generator), pdf);
+			return pdf > 0.f ? contribution(lights[light], point) / pdf : 0.f;
+		});
+	});
+
+	const auto importance = measure(3, [&]
+	{
+		sampleAll(points, samples, [&](const ShadingPoint& point)
+		{
+			float pdf;
+			const auto light = tree.sample(point.position, point.normal, unit(generator), pdf);
+			return pdf > 0.f ? contribution(lights[light], point) / pdf : 0.f;
+		});
+	});
+
+	// convergence per second is the inverse of the error times the time it took
+	const auto uniformEfficiency = 1.0 / (uniformError * uniform.best);
+	const auto aliasEfficiency = 1.0 / (aliasError * alias.best);
+	const auto treeEfficiency = 1.0 / (treeError * importance.best);
+
+	std::printf("  %-12s %10.3f ms  relative MSE %10.3e\n", "uniform", uniform.best, uniformError);
+	std::printf("  %-12s %10.3f ms  relative MSE %10.3e  convergence per second %.2fx of the uniform selection\n", "alias table", alias.best, aliasError, aliasEfficiency / uniformEfficiency);
+	std::printf("  %-12s %10.3f ms  relative MSE %10.3e  convergence per second %.2fx of the uniform selection\n", "light BVH", importance.best, treeError, treeEfficiency / uniformEfficiency);
+
+	// edits of single lights like the live updating of the light editor, the refit tree is checked by the emitter hits below
+	std::uniform_real_distribution<float> shift(-1.f, 1.f);
+	std::vector<int> changed;
+	std::vector<size_t> edited;
+	const auto editCount = std::max<size_t>(lights.size() / 100, 1);
+
+	const auto refits = measure(1, [&]
+	{
+		for (size_t i = 0; i < editCount; ++i)
+		{
+			const auto index = std::min(static_cast<size_t>(unit(generator) * lights.size()), lights.size() - 1);
+			auto& light = lights[index];
+			light.position = { light.position.x + shift(generator), light.position.y + shift(generator), light.position.z + shift(generator) };
+			light.emission = { light.emission.x * 1.1f, light.emission.y * 1.1f, light.emission.z * 1.1f };
+
+			tree.refit(lights, index, changed);
+			edited.emplace_back(index);
+		}
+	});
+
+	// every entry of the alias table depends on the total power, a changed light takes the whole rebuild
+	const auto rebuilds = measure(1, [&]
+	{
+		for (const auto index : edited)
+			table.setWeight(index, lightPower(lights[index]));
+	});
+
+	std::printf("  single light edit: light BVH refit %.4f ms over %.1f nodes vs %.3f ms of its build, alias table rebuild %.3f ms vs %.3f ms of its build\n",
+		refits.best / editCount, static_cast<double>(changed.size()) / editCount, build.best, rebuilds.best / editCount, tableBuild.best);
+
+	// emitter hits of the tree have to be the ones of the linear loop
+	std::uniform_real_distribution<float> position(0.f, SCENE_SIZE);
+	std::normal_distribution<float> normal;
+	std::vector<std::pair<Vec3f, Vec3f>> rays(rayCount);
+
+	// rays aimed at lights, random ones would rarely hit any
+	for (auto& [origin, direction] : rays)
+	{
+		const auto& target = lights[std::min(static_cast<size_t>(unit(generator) * lights.size()), lights.size() - 1)];
+		origin = Vec3f(position(generator), position(generator), position(generator));
+		direction = (toVec3f(target.position) + Vec3f(normal(generator), normal(generator), normal(generator)) * target.radius * 0.5f - origin).normalize();
+	}
+
+	std::vector<int> linearHits(rays.size());
+	std::vector<int> treeHits(rays.size());
+	std::vector<float> linearDistances(rays.size(), FLT_MAX);
+	std::vector<float> treeDistances(rays.size(), FLT_MAX);
+
+	const auto linear = measure(1, [&]
+	{
+		for (size_t i = 0; i < rays.size(); ++i)
+			linearHits[i] = intersectAll(lights, rays[i].first, rays[i].second, linearDistances[i] = FLT_MAX);
+	});
+
+	const auto traversal = measure(3, [&]
+	{
+		for (size_t i = 0; i < rays.size(); ++i)
+			treeHits[i] = tree.intersect(rays[i].first, rays[i].second, treeDistances[i] = FLT_MAX);
+	});
+
+	size_t differing = 0;
+	for (size_t i = 0; i < rays.size(); ++i)
+		differing += linearHits[i] != treeHits[i] || linearDistances[i] != treeDistances[i];
+
+	std::printf("  emitter hits: linear %.2f Mrays/s, light BVH %.2f Mrays/s, %zu rays differ\n",
+		rays.size() / linear.best / 1e3, rays.size() / traversal.best / 1e3, differing);
+
+	if (differing > 0)
+		throw std::runtime_error("light BVH finds different emitters than the linear loop");
+
+	return 0;
+}
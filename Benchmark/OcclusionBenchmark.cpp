@@ -0,0 +1,176 @@
+﻿#include "Benchmarks.hpp"
+#include "SyntheticScene.hpp"
+#include "BVHWrapper.hpp"
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <filesystem>
+#include <random>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+	constexpr auto LIGHTS = 16;
+	constexpr auto ENVIRONMENT_RAYS = 4; // every fourth shadow ray goes to the environment, unbounded
+
+	struct ShadowRay
+	{
+		CPUTraversal::Ray ray;
+		float distance;
+	};
+
+	// shadow rays from the hits of random rays to lights spread over the bounds, the way logic.hlsl makes them
+	std::vector<ShadowRay> shadowRays(const BVHWrapper& bvh, size_t count, std::mt19937& generator)
+	{
+		const auto stats = bvh.getStats();
+		const auto min = Vec3f(stats.min.x, stats.min.y, stats.min.z);
+		auto size = Vec3f(stats.max.x, stats.max.y, stats.max.z) - min;
+		const auto offset = 1e-4f * size.length();
+
+		std::uniform_real_distribution<float> unit(0.f, 1.f);
+		std::vector<Vec3f> lights(LIGHTS);
+		for (auto& light : lights)
+			light = min + Vec3f(unit(generator), unit(generator), unit(generator)) * size;
+
+		const CPUTraversal traversal(bvh);
+		std::vector<ShadowRay> rays;
+
+		while (rays.size() < count)
+		{
+			for (const auto& primary : randomRays(count, min, min + size, generator))
+			{
+				const auto hit = traversal.intersect(primary);
+				if (hit.triangle < 0 || rays.size() == count)
+					continue;
+
+				// back off the surface along the ray, the kernels use the normal
+				const auto point = primary.origin + primary.direction * (hit.distance - offset);
+
+				if (rays.size() % ENVIRONMENT_RAYS == 0)
+				{
+					const auto direction = Vec3f(unit(generator) - 0.5f, unit(generator) - 0.5f, unit(generator) - 0.5f).normalize();
+					rays.push_back({ { point, direction }, FLT_MAX });
+					continue;
+				}
+
+				auto toLight = lights[rays.size() % LIGHTS] - point;
+				const auto distance = toLight.length();
+				rays.push_back({ { point, toLight / distance }, distance - offset });
+			}
+		}
+
+		return rays;
+	}
+
+	void benchScene(const std::string& name, const aiScene* scene, size_t rayCount)
+	{
+		BVH::BuildParams params;
+		params.enablePrints = false;
+
+		// precomputed triangles as the kernels have them by default
+		const BVHWrapper bvh(scene, params, PRECOMPUTED_TRIANGLES);
+		const CPUTraversal traversal(bvh);
+
+		std::mt19937 generator(42);
+		const auto rays = shadowRays(bvh, rayCount, generator);
+		const auto stats = bvh.getStats();
+
+		std::printf("%s\n  %zu triangles, %zu nodes, %zu shadow rays, every %d-th to the environment\n", name.c_str(), stats.triangles, stats.nodes, rays.size(), ENVIRONMENT_RAYS);
+
+		std::vector<char> ordered(rays.size()), occlusion(rays.size()), closest(rays.size());
+		const auto orderedTime = measure(5, [&]
+		{
+			for (size_t i = 0; i < rays.size(); ++i)
+				ordered[i] = traversal.occludedOrdered(rays[i].ray, rays[i].distance);
+		});
+		const auto occlusionTime = measure(5, [&]
+		{
+			for (size_t i = 0; i < rays.size(); ++i)
+				occlusion[i] = traversal.occluded(rays[i].ray, rays[i].distance);
+		});
+		const auto closestTime = measure(5, [&]
+		{
+			for (size_t i = 0; i < rays.size(); ++i)
+				closest[i] = traversal.intersect(rays[i].ray).distance < rays[i].distance;
+		});
+
+		// reads of nodes, instances and triangles per ray, a subset is enough
+		const auto sampled = std::min<size_t>(rays.size(), 10000);
+		std::vector<const void*> loads;
+		size_t orderedLoads = 0, occlusionLoads = 0;
+
+		for (size_t i = 0; i < sampled; ++i)
+		{
+			loads.clear();
+			traversal.occludedOrdered(rays[i].ray, rays[i].distance, &loads);
+			orderedLoads += loads.size();
+
+			loads.clear();
+			traversal.occluded(rays[i].ray, rays[i].distance, &loads);
+			occlusionLoads += loads.size();
+		}
+
+		size_t occluded = 0, differing = 0;
+		for (size_t i = 0; i < rays.size(); ++i)
+		{
+			occluded += occlusion[i];
+			differing += occlusion[i] != ordered[i] || occlusion[i] != closest[i];
+		}
+
+		const auto rate = [&](const Measurement& m) { return rays.size() / m.best / 1e3; };
+		std::printf("  %-28s %7.2f Mrays/s\n", "closest hit", rate(closestTime));
+		std::printf("  %-28s %7.2f Mrays/s  %7.1f loads/ray\n", "ordered any hit (former)", rate(orderedTime), double(orderedLoads) / sampled);
+		std::printf("  %-28s %7.2f Mrays/s  %7.1f loads/ray\n", "occlusion", rate(occlusionTime), double(occlusionLoads) / sampled);
+		std::printf("  %.1f%% occluded, occlusion %.2fx the former shadow rays, %zu rays differ\n",
+			100.0 * occluded / rays.size(), orderedTime.best / occlusionTime.best, differing);
+
+		// the clipped box tests only skip what's past the light, rounding at its distance may change a few grazing rays
+		if (differing > rays.size() / 1000)
+			throw std::runtime_error("Occlusion traversal disagrees with the closest hits");
+	}
+}
+
+int benchOcclusion(const Arguments& args)
+{
+	const auto rayCount = argument(args, 0, 100000);
+
+	// scenes given on the command line or all the bundled ones
+	std::vector<std::string> paths(args.size() > 1 ? args.begin() + 1 : args.end(), args.end());
+	if (paths.empty() && fs::exists("Assets/Models"))
+	{
+		for (const auto& f : fs::recursive_directory_iterator("Assets/Models"))
+			if (f.is_regular_file() && f.path().extension() == ".gltf")
+				paths.emplace_back(f.path().string());
+	}
+
+	std::printf("occlusion: %zu shadow rays per scene to %d lights and the environment\n", rayCount, LIGHTS);
+
+	for (const auto& path : paths)
+	{
+		// the same import as the renderer does
+		Assimp::Importer importer;
+		const auto scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_SortByPType | aiProcess_GenSmoothNormals);
+
+		if (!scene)
+		{
+			std::printf("%s\n  skipped, %s\n", path.c_str(), importer.GetErrorString());
+			continue;
+		}
+
+		benchScene(path, scene, rayCount);
+	}
+
+	// a generated mesh and scattered instances of a smaller one, always available
+	const auto mesh = generateMesh(7);
+	benchScene("sphere " + std::to_string(mesh.faces.size()) + " triangles",
+		createScene(createMesh(mesh, { aiMatrix4x4() }), { aiMatrix4x4() }).get(), rayCount);
+
+	std::mt19937 generator(7);
+	const auto instanced = generateMesh(3);
+	const auto transforms = scatterTransforms(1000, 30.f * instanced.size(), generator);
+	benchScene("1000 instances of " + std::to_string(instanced.faces.size()) + " triangles",
+		createScene(createMesh(instanced, { aiMatrix4x4() }), transforms).get(), rayCount);
+
+	return 0;
+}
@@ -0,0 +1,96 @@
+﻿#include "Benchmarks.hpp"
+#include "ParamsParser.hpp"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+	// the former CSVIterator based loading - string per line, stringstream and string per token
+	SceneCatalog::SceneParams parseBaseline(const std::string& path)
+	{
+		SceneCatalog::SceneParams params;
+		std::ifstream file(path);
+		std::string line;
+
+		auto readRow = [&](std::vector<std::string>& row)
+		{
+			row.clear();
+			std::stringstream lineStream(line);
+			std::string token;
+
+			while (std::getline(lineStream, token, ','))
+				row.emplace_back(token);
+		};
+
+		std::vector<std::string> row;
+		std::getline(file, line);
+		readRow(row);
+
+		for (size_t i = 0; i < sizeof(SceneCatalog::CameraParam) / 4; i++)
+			reinterpret_cast<float*>(&params.camera)[i] = std::stof(row[i]);
+
+		while (std::getline(file, line))
+		{
+			readRow(row);
+
+			Light light;
+			for (size_t i = 0; i < sizeof(Light) / 4; i++)
+				reinterpret_cast<float*>(&light)[i] = std::stof(row[i]);
+
+			params.lights.emplace_back(light);
+		}
+
+		return params;
+	}
+}
+
+int benchParams(const Arguments& args)
+{
+	const auto lightCount = argument(args, 0, 10000);
+	const auto iterations = argument(args, 1, 20);
+	const auto path = (fs::temp_directory_path() / "synthetic.params").string();
+
+	{
+		std::mt19937 generator(42);
+		std::uniform_real_distribution<float> position(-50.f, 50.f);
+		std::uniform_real_distribution<float> emission(0.f, 100.f);
+
+		std::ofstream file(path);
+		file << "-2.8, 5.4, 4.2, -36, 302\n";
+		for (size_t i = 0; i < lightCount; ++i)
+		{
+			file << position(generator) << ", " << position(generator) << ", " << position(generator) << ", 100, "
+				<< emission(generator) << ", " << emission(generator) << ", " << emission(generator) << ", 0.5\n";
+		}
+	}
+
+	const auto size = fs::file_size(path);
+	std::printf("params: %zu lights, %.2f MB, %zu iterations\n", lightCount, size / 1e6, iterations);
+
+	std::string contents;
+	{
+		std::ifstream file(path, std::ios::binary);
+		contents.assign(std::istreambuf_iterator<char>(file), {});
+	}
+
+	size_t check = 0;
+	const auto baseline = measure(iterations, [&] { check += parseBaseline(path).lights.size(); });
+	const auto mapped = measure(iterations, [&] { check += ParamsParser::parseFile(path).lights.size(); });
+	const auto memory = measure(iterations, [&] { check += ParamsParser(contents).parse().lights.size(); });
+
+	report("getline + stringstream + stof", baseline);
+	report("ParamsParser mapped file", mapped);
+	report("ParamsParser in memory", memory);
+	std::printf("  speedup %.1fx, %.1f MB/s\n", baseline.best / mapped.best, size / 1e3 / mapped.best);
+
+	if (check != 3 * iterations * lightCount)
+		throw std::runtime_error("Parsers disagree on the light count");
+
+	fs::remove(path);
+	return 0;
+}
@@ -0,0 +1,123 @@
+﻿#include "Benchmarks.hpp"
+#include "SyntheticScene.hpp"
+#include "BVHWrapper.hpp"
+#include <memory>
+#include <random>
+#include <cmath>
+#include <cfloat>
+#include <stdexcept>
+
+int benchRefit(const Arguments& args)
+{
+	const auto instanceCount = argument(args, 0, 2000);
+	const auto frameCount = argument(args, 1, 60);
+	const auto rayCount = argument(args, 2, 100000);
+	const auto mesh = generateMesh(3);
+
+	std::mt19937 generator(42);
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+	const auto sceneSize = 3.f * mesh.size() * std::cbrt(static_cast<float>(instanceCount));
+	const auto transforms = scatterTransforms(instanceCount, sceneSize, generator);
+
+	// every instance flies its own way and spins, after all the frames it's a third of the scene away from the start
+	std::vector<aiVector3D> velocities(instanceCount);
+	for (auto& velocity : velocities)
+		velocity = aiVector3D(unit(generator) - 0.5f, unit(generator) - 0.5f, unit(generator) - 0.5f).Normalize() * (sceneSize / 3.f / frameCount);
+
+	auto animate = [&](size_t instance, size_t frame)
+	{
+		aiMatrix4x4 translation, rotation;
+		aiMatrix4x4::Translation(velocities[instance] * static_cast<float>(frame), translation);
+		aiMatrix4x4::RotationY(0.05f * frame, rotation);
+
+		return translation * transforms[instance] * rotation;
+	};
+
+	std::printf("refit: %zu instances of %zu triangles, %zu frames, %zu rays\n", instanceCount, mesh.faces.size(), frameCount, rayCount);
+
+	// instances are children of the root node, node indices start at 1
+	const auto scene = createScene(createMesh(mesh, { aiMatrix4x4() }), transforms);
+	BVHWrapper refitted(scene.get()), incremental(scene.get());
+	const auto initialCost = refitted.getStats().topLevelCost;
+
+	size_t frame = 0;
+	const auto refitTime = measure(frameCount, [&]
+	{
+		++frame;
+		for (size_t i = 0; i < instanceCount; ++i)
+			refitted.setNodeTransform(static_cast<uint32_t>(i + 1), animate(i, frame));
+
+		refitted.refit(FLT_MAX);
+	});
+
+	frame = 0;
+	const auto incrementalTime = measure(frameCount, [&]
+	{
+		++frame;
+		for (size_t i = 0; i < instanceCount; ++i)
+			incremental.setNodeTransform(static_cast<uint32_t>(i + 1), animate(i, frame));
+
+		incremental.refit();
+	});
+
+	for (size_t i = 0; i < instanceCount; ++i)
+		scene->mRootNode->mChildren[i]->mTransformation = animate(i, frameCount);
+
+	std::unique_ptr<BVHWrapper> rebuilt;
+	const auto rebuildTime = measure(3, [&] { rebuilt = std::make_unique<BVHWrapper>(scene.get()); });
+
+	const auto rays = randomRays(rayCount, sceneSize, generator);
+	const auto expected = closestHits(*rebuilt, rays);
+	const auto refittedDiffering = differingHits(expected, closestHits(refitted, rays));
+	const auto incrementalDiffering = differingHits(expected, closestHits(incremental, rays));
+
+	report("refit per frame", refitTime);
+	report("refit + subtree rebuilds per frame", incrementalTime);
+	report("full rebuild", rebuildTime);
+	std::printf("  top level SAH cost: initial %.2f, refit only %.2f, with rebuilds %.2f, rebuilt %.2f\n",
+		initialCost, refitted.getStats().topLevelCost, incremental.getStats().topLevelCost, rebuilt->getStats().topLevelCost);
+
+	// deforming mesh, its BVH can only be refitted
+	const auto sphere = generateMesh(6);
+	const auto sphereSize = sphere.size();
+
+	aiMatrix4x4 center;
+	aiMatrix4x4::Translation(aiVector3D(sphereSize / 2.f, sphereSize / 2.f, sphereSize / 2.f), center);
+	const auto sphereScene = createScene(createMesh(sphere, { aiMatrix4x4() }), { center });
+
+	std::vector<aiVector3D> vertices(sphere.vertices.size());
+	auto deform = [&](size_t frame)
+	{
+		for (size_t v = 0; v < vertices.size(); ++v)
+			vertices[v] = sphere.vertices[v] * (1.f + 0.1f * std::sin(0.2f * frame + 3.f * sphere.vertices[v].y));
+	};
+
+	std::printf("deformation: %zu triangles\n", sphere.faces.size());
+
+	BVHWrapper deformed(sphereScene.get());
+	frame = 0;
+	const auto deformTime = measure(frameCount, [&]
+	{
+		deform(++frame);
+		deformed.setVertices(0, vertices.data());
+		deformed.refit();
+	});
+
+	std::copy(vertices.begin(), vertices.end(), sphereScene->mMeshes[0]->mVertices);
+	const auto deformRebuildTime = measure(3, [&] { rebuilt = std::make_unique<BVHWrapper>(sphereScene.get()); });
+
+	const auto sphereRays = randomRays(rayCount, sphereSize, generator);
+	const auto deformedDiffering = differingHits(closestHits(*rebuilt, sphereRays), closestHits(deformed, sphereRays));
+
+	report("mesh refit per frame", deformTime);
+	report("mesh rebuild", deformRebuildTime);
+	std::printf("  refit %.1fx faster than rebuild, %zu / %zu / %zu rays differ from the rebuilt BVHs\n",
+		rebuildTime.best / incrementalTime.mean, refittedDiffering, incrementalDiffering, deformedDiffering);
+
+	// refitted bounds are conservative, hits have to be the same
+	if (refittedDiffering + incrementalDiffering + deformedDiffering > rayCount / 1000)
+		throw std::runtime_error("Refitted and rebuilt BVH disagree");
+
+	return 0;
+}
@@ -0,0 +1,186 @@
+﻿#include "Benchmarks.hpp"
+#include "TileResidency.hpp"
+#include "Constants.hpp"
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+	void check(bool condition, const char* what)
+	{
+		if (!condition)
+			throw std::runtime_error(std::string("Tile residency: ") + what);
+	}
+
+	// a texture of 4 x 4 tiles in a pool of 4 slots, feedback of single pages, the way VirtualTexture drives it
+	void checkResidency()
+	{
+		const uint32_t sizes[] = { 4 * VT_TILE_SIZE };
+		const auto frameFeedback = [](TileResidency& residency, std::initializer_list<uint32_t> pages)
+		{
+			std::vector<uint32_t> feedback(residency.pageCount());
+			for (const auto page : pages)
+				feedback[page] = 1;
+
+			return residency.process(feedback.data(), feedback.size());
+		};
+
+		TileResidency residency;
+		residency.init(1, sizes, 4);
+
+		const auto page = [&](uint32_t mip, uint32_t x, uint32_t y) { return residency.encode({ 0, mip, x, y }); };
+		const auto entry = [&](uint32_t mip, uint32_t x, uint32_t y) { return residency.pageTable()[page(mip, x, y)]; };
+
+		// the pinned coarsest mip covers every page
+		const auto root = residency.addPinned(page(2, 0, 0));
+		residency.commit(page(2, 0, 0), root);
+		for (const auto e : residency.pageTable())
+			check(e == TileResidency::makeEntry(root, 2), "pages don't fall back to the pinned coarsest mip");
+
+		// missing pages come coarsest first, a finer tile covers only its own page
+		const auto missing = frameFeedback(residency, { page(0, 1, 1), page(1, 0, 0), page(0, 0, 0) });
+		check(missing.size() == 3 && missing[0] == page(1, 0, 0), "missing pages aren't ordered coarsest first");
+
+		const auto load = [&](uint32_t p)
+		{
+			const auto slot = static_cast<uint32_t>(residency.allocate(p));
+			residency.commit(p, slot);
+			return slot;
+		};
+		const auto coarse = load(page(1, 0, 0)), fine = load(page(0, 1, 1)), unused = load(page(0, 0, 0));
+
+		check(entry(1, 0, 0) == TileResidency::makeEntry(coarse, 1), "resident page doesn't point to its tile");
+		check(entry(0, 1, 0) == TileResidency::makeEntry(coarse, 1), "page doesn't fall back to the resident coarser mip");
+		check(entry(0, 1, 1) == TileResidency::makeEntry(fine, 0), "resident finer page takes the coarser entry");
+		check(entry(0, 2, 2) == TileResidency::makeEntry(root, 2), "page outside of the resident tiles isn't on the coarsest mip");
+
+		// the tile not requested for the longest time is evicted once the pool is full, its page falls back again
+		residency.nextFrame();
+		frameFeedback(residency, { page(0, 1, 1), page(1, 0, 0) });
+		residency.nextFrame();
+
+		const auto evicted = residency.allocate(page(0, 2, 2));
+		check(evicted == unused, "eviction doesn't take the least recently used tile");
+		check(entry(0, 0, 0) == TileResidency::makeEntry(coarse, 1), "evicted page doesn't fall back to the coarser mip");
+		residency.commit(page(0, 2, 2), static_cast<uint32_t>(evicted));
+
+		// tiles requested in this frame and the pinned one stay, a full pool refuses more
+		frameFeedback(residency, { page(0, 1, 1), page(1, 0, 0) });
+		check(residency.allocate(page(0, 3, 3)) < 0, "pool full of requested tiles evicts one of them");
+		check(residency.residentCount() == 4, "resident tiles aren't counted");
+	}
+
+	// page table entries are valid and point to a slot of a tile covering the page
+	size_t invalidEntries(const TileResidency& residency, const std::vector<int64_t>& slotPages)
+	{
+		size_t invalid = 0;
+		for (uint32_t i = 0; i < residency.pageCount(); ++i)
+		{
+			const auto e = residency.pageTable()[i];
+			const auto page = residency.decode(i);
+			const auto slot = (e & 0xff) + ((e >> 8) & 0xff) * VT_POOL_TILES;
+			const auto mip = (e >> 16) & 0xff;
+
+			if (!(e & TileResidency::ENTRY_VALID) || slotPages[slot] < 0 || mip < page.mip)
+			{
+				++invalid;
+				continue;
+			}
+
+			const auto tile = residency.decode(static_cast<uint32_t>(slotPages[slot]));
+			const auto shift = mip - page.mip;
+			invalid += tile.texture != page.texture || tile.mip != mip || tile.x != page.x >> shift || tile.y != page.y >> shift;
+		}
+
+		return invalid;
+	}
+}
+
+int benchResidency(const Arguments& args)
+{
+	const auto frames = argument(args, 0, 2000);
+	const auto textureCount = static_cast<uint32_t>(argument(args, 1, 16));
+
+	checkResidency();
+	std::printf("residency: LRU eviction, fallback to the coarser mips and the full pool checked\n");
+
+	// 4k textures in the pool of the renderer, views panning over a few of them at a time
+	const auto slotCount = VT_POOL_TILES * VT_POOL_TILES;
+	const std::vector<uint32_t> sizes(textureCount, 4096);
+
+	TileResidency residency;
+	residency.init(textureCount, sizes.data(), slotCount);
+
+	std::vector<int64_t> slotPages(slotCount, -1);
+	for (uint32_t t = 0; t < textureCount; ++t)
+	{
+		const auto page = residency.encode({ t, residency.layout(t).mipCount - 1, 0, 0 });
+		const auto slot = residency.addPinned(page);
+		residency.commit(page, slot);
+		slotPages[slot] = page;
+	}
+
+	std::printf("  %u textures of %u tiles, %zu pages, %u slots, %zu frames\n", textureCount, residency.layout(0).tiles, residency.pageCount(), slotCount, frames);
+
+	// tiles loaded in a frame are committed the next one, the same as the streamer does it
+	std::vector<std::pair<uint32_t, uint32_t>> loading;
+	std::vector<uint32_t> feedback(residency.pageCount());
+	size_t requests = 0, misses = 0, refused = 0, invalid = 0;
+
+	const auto time = measure(1, [&]
+	{
+		for (size_t frame = 0; frame < frames; ++frame)
+		{
+			for (const auto& [page, slot] : loading)
+			{
+				residency.commit(page, slot);
+				slotPages[slot] = page;
+			}
+			loading.clear();
+
+			std::fill(feedback.begin(), feedback.end(), 0);
+			for (uint32_t k = 0; k < 4; ++k)
+			{
+				const auto t = static_cast<uint32_t>((frame / 200 + k) % textureCount);
+				const auto cu = 0.5f + 0.4f * std::sin(0.01f * frame + t), cv = 0.5f + 0.4f * std::cos(0.013f * frame + 2.f * t);
+				const auto lod = static_cast<float>(k % 3);
+
+				for (uint32_t y = 0; y < 32; ++y)
+					for (uint32_t x = 0; x < 32; ++x)
+						feedback[TileResidency::requestPage(residency.layout(t), cu + 0.3f * (x / 31.f - 0.5f), cv + 0.3f * (y / 31.f - 0.5f), lod)] = 1;
+			}
+
+			const auto missing = residency.process(feedback.data(), feedback.size());
+			for (const auto f : feedback)
+				requests += f;
+
+			misses += missing.size();
+			for (size_t i = 0; i < std::min<size_t>(missing.size(), VT_MAX_UPLOADS * VT_FEEDBACK_INTERVAL); ++i)
+			{
+				const auto slot = residency.allocate(missing[i]);
+				if (slot < 0)
+				{
+					++refused;
+					break;
+				}
+
+				// the evicted tile's page is replaced, the entries pointing to it fell back already
+				slotPages[slot] = -1;
+				loading.emplace_back(missing[i], static_cast<uint32_t>(slot));
+			}
+
+			residency.nextFrame();
+		}
+	});
+
+	invalid = invalidEntries(residency, slotPages);
+
+	std::printf("  %8.3f ms/frame  %5.1f%% of the requested pages missing  %zu frames with a full pool  %zu resident tiles  %zu invalid page table entries\n",
+		time.best / frames, 100.0 * misses / requests, refused, residency.residentCount(), invalid);
+
+	if (invalid > 0)
+		throw std::runtime_error("Page table entries point to tiles which don't cover their pages");
+
+	return 0;
+}
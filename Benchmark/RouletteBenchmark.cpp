@@ -0,0 +1,175 @@
+﻿#include "Benchmarks.hpp"
+#include "Sampler.hpp"
+#include "Constants.hpp"
+#include <array>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+	// paths through mostly closed rooms of diffuse walls with a texture, every bounce takes a light sample seen
+	// from some of the points and a few rays escape to a white sky, so the paths are long and their means are known
+	using Albedo = std::array<float, 3>;
+	constexpr std::pair<const char*, Albedo> ROOMS[] = { { "grey", { 0.6f, 0.5f, 0.4f } }, { "red", { 0.9f, 0.7f, 0.4f } } };
+	constexpr auto TEXTURE_CONTRAST = 0.5f; // the albedo is scaled by a uniform factor of 1 +- it
+	constexpr auto ESCAPE = 0.05f;
+	constexpr auto DIRECT_LIGHT = 0.2f;
+	constexpr auto VISIBILITY = 0.25f; // of the light sample, the shadow ray of the others is blocked
+	constexpr auto SKY = 1.f;
+	constexpr auto LIMIT = 1024u; // PATH_LENGTH_LIMIT of structs.h
+
+	struct Roulette
+	{
+		const char* name;
+		RouletteMode mode;
+		uint32_t depth;
+		uint32_t maxDepth;
+		float minSurvival;
+	};
+
+	float luminance(const std::array<float, 3>& c)
+	{
+		return 0.2126f * c[0] + 0.7152f * c[1] + 0.0722f * c[2];
+	}
+
+	// the expected radiance of a channel, the bounce k is reached with (1 - ESCAPE)^k and the throughput of the albedo^k
+	float reference(const Albedo& albedo, size_t channel)
+	{
+		const auto reflected = (1.f - ESCAPE) * albedo[channel];
+		return (DIRECT_LIGHT + ESCAPE * SKY * albedo[channel]) / (1.f - reflected);
+	}
+
+	// a path of the sample the way logic.hlsl ends it, the roulette at the hit takes the light sample of the bounce with it
+	std::array<float, 3> trace(const Albedo& albedo, const Roulette& roulette, uint32_t pixel, uint32_t sampleIndex, uint32_t& length)
+	{
+		Sampler sampler(pixel, sampleIndex);
+		std::array<float, 3> throughput = { 1.f, 1.f, 1.f };
+		std::array<float, 3> radiance = {};
+
+		for (length = 0; ; ++length)
+		{
+			sampler.setBounce(length);
+
+			if (roulette.mode != RouletteMode::OFF && length >= roulette.depth)
+			{
+				const auto largest = std::max(throughput[0], std::max(throughput[1], throughput[2]));
+				const auto survival = std::clamp(roulette.mode == RouletteMode::LUMINANCE ? luminance(throughput) : largest, roulette.minSurvival, 1.f);
+
+				if (sampler.get1D(Sampler::RUSSIAN_ROULETTE) >= survival)
+					break;
+
+				for (auto& t : throughput)
+					t /= survival;
+			}
+
+			if (length >= (roulette.maxDepth > 0 ? std::min(roulette.maxDepth, LIMIT) : LIMIT))
+				break;
+
+			if (sampler.get1D(Sampler::LIGHT_SELECTION) < VISIBILITY)
+				for (size_t c = 0; c < 3; ++c)
+					radiance[c] += throughput[c] * DIRECT_LIGHT / VISIBILITY;
+
+			const auto u = sampler.get2D(Sampler::BSDF);
+			const auto texture = 1.f + TEXTURE_CONTRAST * (2.f * u.y - 1.f);
+			for (size_t c = 0; c < 3; ++c)
+				throughput[c] *= albedo[c] * texture;
+
+			if (u.x < ESCAPE)
+			{
+				for (size_t c = 0; c < 3; ++c)
+					radiance[c] += throughput[c] * SKY;
+
+				break;
+			}
+		}
+
+		return radiance;
+	}
+}
+
+int benchRoulette(const Arguments& args)
+{
+	const auto pixels = static_cast<uint32_t>(argument(args, 0, 2000));
+	const auto samples = static_cast<uint32_t>(argument(args, 1, 64));
+
+	const Roulette roulettes[] = {
+		{ "none", RouletteMode::OFF, 0, 0, 1.f },
+		{ "max depth 8", RouletteMode::OFF, 0, 8, 1.f },
+		{ "throughput from 1", RouletteMode::THROUGHPUT, 1, 0, 0.05f },
+		{ "throughput from 3", RouletteMode::THROUGHPUT, 3, 0, 0.05f },
+		{ "defaults", ROULETTE_MODE, ROULETTE_DEPTH, ROULETTE_MAX_DEPTH, ROULETTE_MIN_SURVIVAL },
+		{ "luminance from 5", RouletteMode::LUMINANCE, 5, 0, 0.25f },
+	};
+
+	for (const auto& [room, albedo] : ROOMS)
+	{
+		std::printf("roulette: %s room, %u pixels, %u samples, albedo %.1f %.1f %.1f, %.0f%% of the bounces escape, mean %.3f %.3f %.3f\n",
+			room, pixels, samples, albedo[0], albedo[1], albedo[2], 100.f * ESCAPE, reference(albedo, 0), reference(albedo, 1), reference(albedo, 2));
+
+		auto baseline = 0.0;
+		for (const auto& roulette : roulettes)
+		{
+			std::array<uint64_t, PATH_LENGTH_BINS> lengths = {};
+			std::vector<std::array<float, 3>> values(pixels);
+
+			const auto time = measure(3, [&]
+			{
+				lengths = {};
+				for (uint32_t pixel = 0; pixel < pixels; ++pixel)
+				{
+					std::array<float, 3> sum = {};
+					for (uint32_t s = 0; s < samples; ++s)
+					{
+						uint32_t length;
+						const auto radiance = trace(albedo, roulette, pixel, s, length);
+						for (size_t c = 0; c < 3; ++c)
+							sum[c] += radiance[c];
+
+						++lengths[std::min<size_t>(length, PATH_LENGTH_BINS - 1)];
+					}
+
+					for (size_t c = 0; c < 3; ++c)
+						values[pixel][c] = sum[c] / samples;
+				}
+			});
+
+			auto squaredError = 0.0;
+			auto mean = 0.0;
+			for (const auto& value : values)
+			{
+				for (size_t c = 0; c < 3; ++c)
+				{
+					squaredError += (value[c] - reference(albedo, c)) * (value[c] - reference(albedo, c)) / 3;
+					mean += value[c] / (reference(albedo, c) * 3 * pixels);
+				}
+			}
+
+			uint64_t bounces = 0;
+			for (size_t i = 0; i < lengths.size(); ++i)
+				bounces += lengths[i] * i;
+
+			// error per time is the variance times the cost, lower is better, relative to the paths without the roulette
+			const auto efficiency = squaredError * time.best;
+			if (roulette.mode == RouletteMode::OFF && roulette.maxDepth == 0)
+				baseline = efficiency;
+
+			const auto paths = static_cast<double>(pixels) * samples;
+			std::printf("  %-20s RMSE %7.4f  mean %6.3f of the reference  %6.2f bounces  %6.2f M samples/s  %6.2fx the convergence per second\n",
+				roulette.name, std::sqrt(squaredError / pixels), mean, bounces / paths, paths / time.best / 1e3, baseline / efficiency);
+
+			// percentages of the paths by their length, the last bin has the longer ones too
+			std::printf("    lengths");
+			for (size_t i = 0; i < 16; ++i)
+				std::printf(" %4.1f", 100.0 * lengths[i] / paths);
+			std::printf("  %4.1f longer\n", 100.0 * std::accumulate(lengths.begin() + 16, lengths.end(), uint64_t(0)) / paths);
+
+			// the roulette keeps the means, only the largest depth cuts them off
+			if (roulette.maxDepth == 0 && std::abs(mean - 1.0) > 0.01)
+				throw std::runtime_error("Russian roulette changed the mean of the paths");
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,204 @@
+﻿#include "Benchmarks.hpp"
+#include "Sampler.hpp"
+#include <array>
+#include <cmath>
+#include <random>
+
+namespace
+{
+	constexpr auto BOUNCES = 2;
+	constexpr auto PI = 3.14159265f;
+
+	float fract(float x)
+	{
+		return x - std::floor(x);
+	}
+
+	// the generator the kernels had before, a sine hash of a seed set by the queue index, moved by a seed of the frame
+	class SineHash
+	{
+	public:
+		SineHash(uint32_t pixel, float frameSeedX, float frameSeedY)
+			: mSeedX(fract(pixel * 0.31830988f)), mSeedY(fract(pixel * PI)), mFrameSeedX(frameSeedX), mFrameSeedY(frameSeedY)
+		{
+		}
+
+		float get()
+		{
+			mSeedX -= mFrameSeedX;
+			mSeedY -= mFrameSeedY;
+			return fract(std::sin(mSeedX * 12.9898f + mSeedY * 78.233f) * 43758.5453f);
+		}
+
+	private:
+		float mSeedX;
+		float mSeedY;
+		float mFrameSeedX;
+		float mFrameSeedY;
+	};
+
+	// terms of a path with the features the kernels have, a discontinuity in 2D is an edge in the pixel or a shadow boundary
+	// on the light, the 1D ones are picks of lights and lobes, all the terms have an exact mean
+	struct Pixel
+	{
+		float edgeOffset, edgeAmplitude, edgePhase; // camera, the edge in the pixel
+		float lightWeight, lightProbability; // light selection
+		float shadowOffset, shadowAmplitude; // light point, the shadow boundary on the light
+		float lobeProbability; // lobe
+		float bsdfAmplitude, bsdfFrequency; // bsdf, the rest of the importance sampled lobe
+		double mean;
+	};
+
+	double edgeArea(float offset, float amplitude, float phase)
+	{
+		// area under the clamped curve, the integrand is smooth enough for the midpoint rule
+		constexpr auto STEPS = 1 << 16;
+		double area = 0.0;
+		for (auto i = 0; i < STEPS; ++i)
+		{
+			const auto x = (i + 0.5) / STEPS;
+			area += std::clamp(offset + amplitude * std::sin(2.0 * PI * (x + phase)), 0.0, 1.0);
+		}
+
+		return area / STEPS;
+	}
+
+	std::vector<Pixel> randomPixels(size_t count, std::mt19937& generator)
+	{
+		std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+		std::vector<Pixel> pixels(count);
+		for (auto& p : pixels)
+		{
+			p = { 0.3f + 0.4f * unit(generator), 0.3f * unit(generator), unit(generator), 0.5f + 1.5f * unit(generator), unit(generator),
+				0.2f + 0.6f * unit(generator), 0.2f * unit(generator), unit(generator), 0.5f * unit(generator), 4.f * unit(generator), 1.0 };
+
+			const auto light = p.lightProbability * p.lightWeight + (1.f - p.lightProbability);
+			const auto lobe = p.lobeProbability * 2.f + (1.f - p.lobeProbability) * 0.5f;
+
+			p.mean = edgeArea(p.edgeOffset, p.edgeAmplitude, p.edgePhase);
+			for (auto b = 0; b < BOUNCES; ++b)
+				p.mean *= light * edgeArea(p.shadowOffset, p.shadowAmplitude, 0.f) * lobe; // the bsdf term has the mean one
+		}
+
+		return pixels;
+	}
+
+	// one path, the numbers are drawn in the order and dimensions of the kernels
+	template<typename Draw1D, typename Draw2D>
+	double path(const Pixel& p, Draw1D&& get1D, Draw2D&& get2D)
+	{
+		const auto camera = get2D(0, Sampler::CAMERA);
+		double value = camera[1] < p.edgeOffset + p.edgeAmplitude * std::sin(2.f * PI * (camera[0] + p.edgePhase)) ? 1.0 : 0.0;
+
+		for (uint32_t bounce = 0; bounce < BOUNCES; ++bounce)
+		{
+			value *= get1D(bounce, Sampler::LIGHT_SELECTION) < p.lightProbability ? p.lightWeight : 1.f;
+
+			const auto point = get2D(bounce, Sampler::LIGHT_POINT);
+			value *= point[1] < p.shadowOffset + p.shadowAmplitude * std::sin(2.f * PI * point[0]) ? 1.0 : 0.0;
+
+			value *= get1D(bounce + 1, Sampler::LOBE) < p.lobeProbability ? 2.f : 0.5f;
+
+			const auto direction = get2D(bounce + 1, Sampler::BSDF);
+			value *= 1.f + p.bsdfAmplitude * std::sin(2.f * PI * (direction[0] + p.bsdfFrequency * direction[1]));
+		}
+
+		return value;
+	}
+
+	struct Result
+	{
+		double error; // relative RMSE over the pixels
+		Measurement time;
+	};
+
+	template<typename Estimate>
+	Result run(const std::vector<Pixel>& pixels, size_t samples, Estimate&& estimate)
+	{
+		std::vector<double> estimates(pixels.size());
+		const auto time = measure(3, [&]
+		{
+			for (size_t i = 0; i < pixels.size(); ++i)
+				estimates[i] = estimate(static_cast<uint32_t>(i), pixels[i]) / samples;
+		});
+
+		double error = 0.0;
+		double norm = 0.0;
+		for (size_t i = 0; i < pixels.size(); ++i)
+		{
+			error += (estimates[i] - pixels[i].mean) * (estimates[i] - pixels[i].mean);
+			norm += pixels[i].mean * pixels[i].mean;
+		}
+
+		return { std::sqrt(error / norm), time };
+	}
+}
+
+int benchSampler(const Arguments& args)
+{
+	const auto pixelCount = argument(args, 0, 2000);
+	const auto maxSamples = argument(args, 1, 1024);
+
+	std::printf("sampler: %zu pixels, paths of %d bounces, up to %zu samples per pixel\n", pixelCount, BOUNCES, maxSamples);
+
+	std::mt19937 generator(42);
+	const auto pixels = randomPixels(pixelCount, generator);
+
+	// seeds of the frames as the camera made them
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+	std::vector<std::array<float, 2>> frameSeeds(maxSamples);
+	for (auto& seed : frameSeeds)
+		seed = { unit(generator), unit(generator) };
+
+	for (auto samples = size_t(16); samples <= maxSamples; samples *= 4)
+	{
+		const auto sine = run(pixels, samples, [&](uint32_t pixel, const Pixel& p)
+		{
+			double sum = 0.0;
+			for (size_t s = 0; s < samples; ++s)
+			{
+				// every kernel started from the same seed, so all the bounces were drawn by one sequence
+				SineHash hash(pixel, frameSeeds[s][0], frameSeeds[s][1]);
+				sum += path(p, [&](uint32_t, Sampler::Dimension) { return hash.get(); }, [&](uint32_t, Sampler::Dimension) { return std::array<float, 2>{ hash.get(), hash.get() }; });
+			}
+
+			return sum;
+		});
+
+		const auto estimate = [&](bool sobol)
+		{
+			return run(pixels, samples, [&](uint32_t pixel, const Pixel& p)
+			{
+				double sum = 0.0;
+				for (size_t s = 0; s < samples; ++s)
+				{
+					// a kernel sets the bounce of its path once
+					Sampler sampler(pixel, static_cast<uint32_t>(s), sobol);
+					uint32_t current = 0;
+					const auto setBounce = [&](uint32_t bounce) { if (bounce != current) sampler.setBounce(current = bounce); };
+					const auto get1D = [&](uint32_t bounce, Sampler::Dimension dimension) { setBounce(bounce); return sampler.get1D(dimension); };
+					const auto get2D = [&](uint32_t bounce, Sampler::Dimension dimension) { setBounce(bounce); const auto u = sampler.get2D(dimension); return std::array<float, 2>{ u.x, u.y }; };
+					sum += path(p, get1D, get2D);
+				}
+
+				return sum;
+			});
+		};
+
+		const auto pcg = estimate(false);
+		const auto sobol = estimate(true);
+
+		// the paths here cost next to nothing, so the time is mostly the sampler, on the GPU the rays take it and the same samples
+		// take about the same time, then the squared error at equal samples is what a frame gains,
+		// convergence per second is the inverse of the squared error times the time it took
+		const auto efficiency = [&](const Result& r) { return 1.0 / (r.error * r.error * r.time.best); };
+
+		std::printf("  %5zu samples\n", samples);
+		for (const auto& [name, result] : { std::pair<const char*, Result>{ "sine hash", sine }, { "PCG", pcg }, { "Sobol", sobol } })
+			std::printf("    %-10s %10.3f ms  relative RMSE %10.3e  squared error %5.2fx lower, convergence per second %5.2fx of the sine hash\n",
+				name, result.time.best, result.error, (sine.error * sine.error) / (result.error * result.error), efficiency(result) / efficiency(sine));
+	}
+
+	return 0;
+}
@@ -0,0 +1,112 @@
+﻿#include "Benchmarks.hpp"
+#include "SyntheticScene.hpp"
+#include "BVHWrapper.hpp"
+#include "CPUTraversal.hpp"
+#include <memory>
+#include <random>
+#include <cmath>
+#include <stdexcept>
+
+namespace
+{
+	// chunks of the GPU buffer with elements of the given size
+	size_t chunkCount(size_t elements, size_t stride)
+	{
+		const auto bits = geometryChunkBits(stride);
+		return (elements + (size_t(1) << bits) - 1) >> bits;
+	}
+}
+
+int benchStress(const Arguments& args)
+{
+	const auto triangleCount = argument(args, 0, 100000000);
+	const auto rayCount = argument(args, 1, 100000);
+	const auto memoryBudget = argument(args, 2, 0) << 20; // MB, 0 builds in core
+	const auto cells = static_cast<unsigned>(std::ceil(std::sqrt(triangleCount / 2.0)));
+
+	std::printf("stress: terrain of %zu triangles, %zu rays\n", 2 * size_t(cells) * cells, rayCount);
+
+	std::unique_ptr<aiScene> scene;
+	const auto generation = measure(1, [&]
+	{
+		const auto terrain = generateTerrain(cells);
+		scene = createScene(createMesh(terrain, { aiMatrix4x4() }), { aiMatrix4x4() });
+	});
+	report("generation", generation);
+
+	// SBVH of a single mesh this large takes minutes, HLBVH is what such scenes would be built with
+	BVH::BuildParams params;
+	params.builder = BVH::HLBVH;
+	params.enablePrints = false;
+	params.memoryBudget = memoryBudget;
+
+	std::unique_ptr<BVHWrapper> bvh;
+	const auto build = measure(1, [&] { bvh = std::make_unique<BVHWrapper>(scene.get(), params); });
+	report("HLBVH build", build);
+
+	const auto stats = bvh->getStats();
+	std::printf("  %zu nodes, %zu triangles, %zu vertices, %.2f GB of GPU buffers, %.2f GB peak build memory\n",
+		stats.nodes, stats.triangles, stats.vertices, stats.bytes / 1e9, stats.buildBytes / 1e9);
+
+	const size_t chunks[] = {
+		chunkCount(stats.nodes, sizeof(BVHWrapper::BVHNode)),
+		chunkCount(stats.triangles, sizeof(BVHWrapper::Triangle)),
+		chunkCount(stats.vertices, sizeof(Vec3f)),
+		chunkCount(stats.vertices, sizeof(BVHWrapper::TriangleProperties)),
+	};
+	std::printf("  GPU chunks: nodes %zu, triangles %zu, vertices %zu, vertex properties %zu of %u\n", chunks[0], chunks[1], chunks[2], chunks[3], GEOMETRY_CHUNKS);
+
+	if (*std::max_element(std::begin(chunks), std::end(chunks)) > GEOMETRY_CHUNKS)
+		std::printf("  the scene doesn't fit into the GPU chunks\n");
+
+	// rays straight down on the terrain, the triangle under a ray is known from the grid so the hits are checked exactly
+	std::mt19937 generator(42);
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+	const auto& mesh = *scene->mMeshes[0];
+	const auto side = size_t(cells) + 1;
+
+	std::vector<CPUTraversal::Ray> rays(rayCount);
+	std::vector<float> expected(rayCount);
+	for (size_t i = 0; i < rayCount; ++i)
+	{
+		const auto x = unit(generator), y = unit(generator);
+		rays[i] = { Vec3f(x, y, 1.f), Vec3f(0.f, 0.f, -1.f) };
+
+		const auto cx = std::min<size_t>(static_cast<size_t>(x * cells), cells - 1), cy = std::min<size_t>(static_cast<size_t>(y * cells), cells - 1);
+		const auto u = x * cells - cx, v = y * cells - cy;
+		const auto z = [&](size_t dx, size_t dy) { return mesh.mVertices[(cy + dy) * side + cx + dx].z; };
+
+		// the quad is split along its diagonal, see generateTerrain
+		const auto height = u >= v
+			? z(0, 0) + u * (z(1, 0) - z(0, 0)) + v * (z(1, 1) - z(1, 0))
+			: z(0, 0) + v * (z(0, 1) - z(0, 0)) + u * (z(1, 1) - z(0, 1));
+
+		expected[i] = 1.f - height;
+	}
+
+	// GPU sized chunks and 1 MB ones, which split even small scenes, have to address the same triangles
+	for (const auto chunkBytes : { GEOMETRY_CHUNK_BYTES, size_t(1) << 20 })
+	{
+		const CPUTraversal traversal(*bvh, chunkBytes);
+		std::vector<CPUTraversal::Hit> hits(rayCount);
+
+		const auto traversalTime = measure(3, [&]
+		{
+			for (size_t i = 0; i < rayCount; ++i)
+				hits[i] = traversal.intersect(rays[i]);
+		});
+
+		size_t wrong = 0;
+		for (size_t i = 0; i < rayCount; ++i)
+			if (hits[i].triangle < 0 || std::abs(hits[i].distance - expected[i]) > 1e-4f)
+				++wrong;
+
+		std::printf("  %6.0f MB chunks  %7.2f Mrays/s  %zu rays hit a wrong place\n", chunkBytes / 1e6, rayCount / traversalTime.best / 1e3, wrong);
+
+		if (wrong > 0)
+			throw std::runtime_error("Chunked traversal misses the terrain");
+	}
+
+	return 0;
+}
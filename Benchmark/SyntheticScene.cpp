@@ -0,0 +1,254 @@
+﻿#include "SyntheticScene.hpp"
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <map>
+#include <cmath>
+#include <cfloat>
+#include <stdexcept>
+
+float Mesh::size() const
+{
+	aiVector3D min(FLT_MAX, FLT_MAX, FLT_MAX), max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (const auto& v : vertices)
+	{
+		min = aiVector3D(std::min(min.x, v.x), std::min(min.y, v.y), std::min(min.z, v.z));
+		max = aiVector3D(std::max(max.x, v.x), std::max(max.y, v.y), std::max(max.z, v.z));
+	}
+
+	return (max - min).Length();
+}
+
+Mesh generateMesh(unsigned subdivisions)
+{
+	const auto t = (1.f + std::sqrt(5.f)) / 2.f;
+
+	Mesh mesh;
+	mesh.vertices = {
+		{ -1, t, 0 }, { 1, t, 0 }, { -1, -t, 0 }, { 1, -t, 0 },
+		{ 0, -1, t }, { 0, 1, t }, { 0, -1, -t }, { 0, 1, -t },
+		{ t, 0, -1 }, { t, 0, 1 }, { -t, 0, -1 }, { -t, 0, 1 },
+	};
+	mesh.faces = {
+		{ 0, 11, 5 }, { 0, 5, 1 }, { 0, 1, 7 }, { 0, 7, 10 }, { 0, 10, 11 },
+		{ 1, 5, 9 }, { 5, 11, 4 }, { 11, 10, 2 }, { 10, 7, 6 }, { 7, 1, 8 },
+		{ 3, 9, 4 }, { 3, 4, 2 }, { 3, 2, 6 }, { 3, 6, 8 }, { 3, 8, 9 },
+		{ 4, 9, 5 }, { 2, 4, 11 }, { 6, 2, 10 }, { 8, 6, 7 }, { 9, 8, 1 },
+	};
+
+	for (unsigned s = 0; s < subdivisions; ++s)
+	{
+		std::map<std::pair<unsigned, unsigned>, unsigned> midpoints;
+		auto midpoint = [&](unsigned a, unsigned b)
+		{
+			auto [it, inserted] = midpoints.try_emplace({ std::min(a, b), std::max(a, b) }, static_cast<unsigned>(mesh.vertices.size()));
+			if (inserted)
+				mesh.vertices.emplace_back((mesh.vertices[a] + mesh.vertices[b]) * 0.5f);
+
+			return it->second;
+		};
+
+		std::vector<std::array<unsigned, 3>> faces;
+		for (const auto& [a, b, c] : mesh.faces)
+		{
+			const auto ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+			faces.insert(faces.end(), { { a, ab, ca }, { b, bc, ab }, { c, ca, bc }, { ab, bc, ca } });
+		}
+
+		mesh.faces = std::move(faces);
+	}
+
+	for (auto& v : mesh.vertices)
+	{
+		v.Normalize();
+		mesh.normals.emplace_back(v);
+		v *= 1.f + 0.1f * std::sin(5.f * v.x) * std::sin(5.f * v.y) * std::sin(5.f * v.z);
+	}
+
+	return mesh;
+}
+
+Mesh generateTerrain(unsigned cells)
+{
+	const auto side = size_t(cells) + 1;
+
+	Mesh mesh;
+	mesh.vertices.resize(side * side);
+	mesh.normals.resize(side * side);
+	mesh.faces.resize(2 * size_t(cells) * cells);
+
+	for (size_t y = 0; y < side; ++y)
+	{
+		for (size_t x = 0; x < side; ++x)
+		{
+			const auto u = static_cast<float>(x) / cells, v = static_cast<float>(y) / cells;
+			mesh.vertices[y * side + x] = { u, v, 0.05f * std::sin(20.f * u) * std::cos(20.f * v) };
+			mesh.normals[y * side + x] = aiVector3D(-std::cos(20.f * u) * std::cos(20.f * v), std::sin(20.f * u) * std::sin(20.f * v), 1.f).Normalize();
+		}
+	}
+
+	for (size_t y = 0; y < cells; ++y)
+	{
+		for (size_t x = 0; x < cells; ++x)
+		{
+			const auto v00 = static_cast<unsigned>(y * side + x), v10 = v00 + 1, v01 = static_cast<unsigned>(v00 + side), v11 = v01 + 1;
+			mesh.faces[2 * (y * cells + x)] = { v00, v10, v11 };
+			mesh.faces[2 * (y * cells + x) + 1] = { v00, v11, v01 };
+		}
+	}
+
+	return mesh;
+}
+
+Mesh loadMesh(const std::string& path)
+{
+	Assimp::Importer importer;
+	const auto scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_SortByPType | aiProcess_GenSmoothNormals | aiProcess_PreTransformVertices);
+
+	if (!scene)
+		throw std::runtime_error(importer.GetErrorString());
+
+	for (size_t i = 0; i < scene->mNumMeshes; ++i)
+	{
+		const auto& source = *scene->mMeshes[i];
+		if (~source.mPrimitiveTypes & aiPrimitiveType_TRIANGLE)
+			continue;
+
+		Mesh mesh;
+		mesh.vertices.assign(source.mVertices, source.mVertices + source.mNumVertices);
+		mesh.normals.assign(source.mNormals, source.mNormals + source.mNumVertices);
+		for (size_t f = 0; f < source.mNumFaces; ++f)
+			mesh.faces.push_back({ source.mFaces[f].mIndices[0], source.mFaces[f].mIndices[1], source.mFaces[f].mIndices[2] });
+
+		return mesh;
+	}
+
+	throw std::runtime_error("No triangle mesh in " + path);
+}
+
+aiMesh* createMesh(const Mesh& mesh, const std::vector<aiMatrix4x4>& transforms)
+{
+	const auto vertexCount = mesh.vertices.size();
+	const auto faceCount = mesh.faces.size();
+
+	auto result = new aiMesh;
+	result->mPrimitiveTypes = aiPrimitiveType_TRIANGLE;
+	result->mNumVertices = static_cast<unsigned>(vertexCount * transforms.size());
+	result->mNumFaces = static_cast<unsigned>(faceCount * transforms.size());
+	result->mVertices = new aiVector3D[result->mNumVertices];
+	result->mNormals = new aiVector3D[result->mNumVertices];
+	result->mFaces = new aiFace[result->mNumFaces];
+
+	for (size_t t = 0; t < transforms.size(); ++t)
+	{
+		const auto normalTransform = aiMatrix3x3(transforms[t]).Inverse().Transpose();
+
+		for (size_t v = 0; v < vertexCount; ++v)
+		{
+			result->mVertices[t * vertexCount + v] = transforms[t] * mesh.vertices[v];
+			result->mNormals[t * vertexCount + v] = (normalTransform * mesh.normals[v]).Normalize();
+		}
+
+		for (size_t f = 0; f < faceCount; ++f)
+		{
+			auto& face = result->mFaces[t * faceCount + f];
+			face.mNumIndices = 3;
+			face.mIndices = new unsigned[3];
+
+			for (size_t i = 0; i < 3; ++i)
+				face.mIndices[i] = static_cast<unsigned>(mesh.faces[f][i] + t * vertexCount);
+		}
+	}
+
+	return result;
+}
+
+std::unique_ptr<aiScene> createScene(aiMesh* mesh, const std::vector<aiMatrix4x4>& transforms)
+{
+	auto scene = std::make_unique<aiScene>();
+	scene->mNumMeshes = 1;
+	scene->mMeshes = new aiMesh*[1]{ mesh };
+
+	scene->mRootNode = new aiNode;
+	scene->mRootNode->mNumChildren = static_cast<unsigned>(transforms.size());
+	scene->mRootNode->mChildren = new aiNode*[transforms.size()];
+
+	for (size_t i = 0; i < transforms.size(); ++i)
+	{
+		auto node = new aiNode;
+		node->mParent = scene->mRootNode;
+		node->mTransformation = transforms[i];
+		node->mNumMeshes = 1;
+		node->mMeshes = new unsigned[1]{ 0 };
+
+		scene->mRootNode->mChildren[i] = node;
+	}
+
+	return scene;
+}
+
+std::vector<aiMatrix4x4> scatterTransforms(size_t count, float sceneSize, std::mt19937& generator)
+{
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+	std::vector<aiMatrix4x4> transforms(count);
+	for (auto& transform : transforms)
+	{
+		const auto axis = aiVector3D(unit(generator) - 0.5f, unit(generator) - 0.5f, unit(generator) - 0.5f).Normalize();
+		const auto position = aiVector3D(unit(generator), unit(generator), unit(generator)) * sceneSize;
+		const auto scale = 0.5f + unit(generator);
+
+		aiMatrix4x4 rotation, scaling, translation;
+		aiMatrix4x4::Rotation(unit(generator) * 6.2831853f, axis, rotation);
+		aiMatrix4x4::Scaling(aiVector3D(scale, scale, scale), scaling);
+		aiMatrix4x4::Translation(position, translation);
+
+		transform = translation * rotation * scaling;
+	}
+
+	return transforms;
+}
+
+std::vector<CPUTraversal::Ray> randomRays(size_t count, const Vec3f& min, const Vec3f& max, std::mt19937& generator)
+{
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+	auto size = max - min;
+
+	std::vector<CPUTraversal::Ray> rays(count);
+	for (auto& ray : rays)
+	{
+		const auto target = min + Vec3f(unit(generator), unit(generator), unit(generator)) * size;
+		auto direction = Vec3f(unit(generator) - 0.5f, unit(generator) - 0.5f, unit(generator) - 0.5f).normalize();
+
+		ray = { target - direction * size.length() * 2.f, direction };
+	}
+
+	return rays;
+}
+
+std::vector<CPUTraversal::Ray> randomRays(size_t count, float sceneSize, std::mt19937& generator)
+{
+	return randomRays(count, Vec3f(0.f, 0.f, 0.f), Vec3f(sceneSize, sceneSize, sceneSize), generator);
+}
+
+std::vector<CPUTraversal::Hit> closestHits(const BVHWrapper& bvh, const std::vector<CPUTraversal::Ray>& rays)
+{
+	CPUTraversal traversal(bvh);
+
+	std::vector<CPUTraversal::Hit> hits(rays.size());
+	for (size_t i = 0; i < rays.size(); ++i)
+		hits[i] = traversal.intersect(rays[i]);
+
+	return hits;
+}
+
+size_t differingHits(const std::vector<CPUTraversal::Hit>& a, const std::vector<CPUTraversal::Hit>& b)
+{
+	size_t differing = 0;
+	for (size_t i = 0; i < a.size(); ++i)
+	{
+		if ((a[i].triangle >= 0) != (b[i].triangle >= 0) || std::abs(a[i].distance - b[i].distance) > 1e-3f * std::max(1.f, a[i].distance))
+			++differing;
+	}
+
+	return differing;
+}
@@ -0,0 +1,39 @@
+﻿#pragma once
+#include "CPUTraversal.hpp"
+#include <assimp/scene.h>
+#include <array>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+struct Mesh
+{
+	std::vector<aiVector3D> vertices;
+	std::vector<aiVector3D> normals;
+	std::vector<std::array<unsigned, 3>> faces;
+
+	float size() const; // diagonal of the bounds
+};
+
+// bumpy subdivided icosahedron, stands in for a scanned mesh when none is given
+Mesh generateMesh(unsigned subdivisions);
+// height field over the unit square with cells^2 quads of two triangles, vertex (x, y) has index y * (cells + 1) + x
+Mesh generateTerrain(unsigned cells);
+// first triangle mesh of the file
+Mesh loadMesh(const std::string& path);
+
+// all the transforms are baked into a single mesh, the same as aiProcess_PreTransformVertices did
+aiMesh* createMesh(const Mesh& mesh, const std::vector<aiMatrix4x4>& transforms);
+// scene with the single mesh placed under a node per transform
+std::unique_ptr<aiScene> createScene(aiMesh* mesh, const std::vector<aiMatrix4x4>& transforms);
+
+// randomly rotated and scaled copies in a cube of the given size
+std::vector<aiMatrix4x4> scatterTransforms(size_t count, float sceneSize, std::mt19937& generator);
+// rays from the outside of the box towards random points in it
+std::vector<CPUTraversal::Ray> randomRays(size_t count, const Vec3f& min, const Vec3f& max, std::mt19937& generator);
+std::vector<CPUTraversal::Ray> randomRays(size_t count, float sceneSize, std::mt19937& generator);
+
+std::vector<CPUTraversal::Hit> closestHits(const BVHWrapper& bvh, const std::vector<CPUTraversal::Ray>& rays);
+// rays which hit something else or in a different distance
+size_t differingHits(const std::vector<CPUTraversal::Hit>& a, const std::vector<CPUTraversal::Hit>& b);
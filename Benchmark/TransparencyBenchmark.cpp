@@ -0,0 +1,145 @@
+﻿#include "Benchmarks.hpp"
+#include "SyntheticScene.hpp"
+#include "BVHWrapper.hpp"
+#include <assimp/material.h>
+#include <assimp/pbrmaterial.h>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+
+namespace
+{
+	constexpr auto SHELL_RADIUS = 3.f;
+	constexpr auto RAY_RADIUS = 12.f; // of the sphere the shadow rays start on, outside of everything
+	const aiColor4D GLASS(0.9f, 0.8f, 0.7f, 0.5f);
+
+	aiMaterial* createMaterial(const char* alphaMode, const aiColor4D& color)
+	{
+		auto material = new aiMaterial;
+		const aiString mode(alphaMode);
+		material->AddProperty(&mode, AI_MATKEY_GLTF_ALPHAMODE);
+		material->AddProperty(&color, 1, AI_MATKEY_COLOR_DIFFUSE);
+		return material;
+	}
+
+	// a light in the middle of a glass shell of few large triangles, masked blobs around it
+	// of which half are cut out, the opaque scene has the same geometry without the alpha modes
+	std::unique_ptr<aiScene> createScene(bool flagged, std::mt19937& generator)
+	{
+		std::uniform_real_distribution<float> unit(0.f, 1.f);
+		const auto blob = generateMesh(3);
+
+		std::vector<aiMatrix4x4> cutOut, kept;
+		for (size_t i = 0; i < 200; ++i)
+		{
+			// between the shell and the start of the rays
+			const auto direction = aiVector3D(unit(generator) - 0.5f, unit(generator) - 0.5f, unit(generator) - 0.5f).Normalize();
+			const auto position = direction * (SHELL_RADIUS + 2.f + 5.f * unit(generator));
+
+			aiMatrix4x4 scale, translation;
+			aiMatrix4x4::Scaling(aiVector3D(0.3f + 0.4f * unit(generator)), scale);
+			aiMatrix4x4::Translation(position, translation);
+			(i % 2 ? kept : cutOut).push_back(translation * scale);
+		}
+
+		aiMatrix4x4 shell;
+		aiMatrix4x4::Scaling(aiVector3D(SHELL_RADIUS), shell);
+
+		auto scene = std::make_unique<aiScene>();
+		scene->mNumMeshes = 3;
+		scene->mMeshes = new aiMesh*[3]{ ::createMesh(generateMesh(1), { shell }), ::createMesh(blob, cutOut), ::createMesh(blob, kept) };
+
+		for (unsigned m = 0; m < scene->mNumMeshes; ++m)
+			scene->mMeshes[m]->mMaterialIndex = m;
+
+		scene->mNumMaterials = 3;
+		scene->mMaterials = new aiMaterial*[3]{
+			createMaterial(flagged ? "BLEND" : "OPAQUE", GLASS),
+			createMaterial(flagged ? "MASK" : "OPAQUE", aiColor4D(1.f, 1.f, 1.f, 0.2f)),
+			createMaterial(flagged ? "MASK" : "OPAQUE", aiColor4D(1.f, 1.f, 1.f, 0.8f)),
+		};
+
+		scene->mRootNode = new aiNode;
+		scene->mRootNode->mNumMeshes = 3;
+		scene->mRootNode->mMeshes = new unsigned[3]{ 0, 1, 2 };
+
+		return scene;
+	}
+
+	// from random points on a sphere around the scene to the light in the middle
+	std::vector<CPUTraversal::Ray> shadowRays(size_t count, std::mt19937& generator)
+	{
+		std::uniform_real_distribution<float> unit(0.f, 1.f);
+		std::vector<CPUTraversal::Ray> rays(count);
+
+		for (auto& ray : rays)
+		{
+			const auto z = 1.f - 2.f * unit(generator);
+			const auto r = std::sqrt(std::max(0.f, 1.f - z * z));
+			const auto phi = 6.2831853f * unit(generator);
+			const auto direction = Vec3f(r * std::cos(phi), z, r * std::sin(phi));
+
+			ray = { direction * RAY_RADIUS, direction * -1.f };
+		}
+
+		return rays;
+	}
+}
+
+int benchTransparency(const Arguments& args)
+{
+	const auto rayCount = argument(args, 0, 100000);
+
+	std::mt19937 generator(42);
+	const auto rays = shadowRays(rayCount, generator);
+
+	BVH::BuildParams params;
+	params.enablePrints = false;
+
+	std::printf("transparency: %zu shadow rays to a light inside a glass shell behind masked blobs, half of them cut out\n", rays.size());
+
+	for (const auto flagged : { false, true })
+	{
+		std::mt19937 sceneGenerator(7);
+		const auto scene = createScene(flagged, sceneGenerator);
+		const BVHWrapper bvh(scene.get(), params, PRECOMPUTED_TRIANGLES);
+		const CPUTraversal traversal(bvh);
+		const auto stats = bvh.getStats();
+
+		std::vector<Vec3f> visibility(rays.size());
+		const auto time = measure(5, [&]
+		{
+			for (size_t i = 0; i < rays.size(); ++i)
+				visibility[i] = traversal.visibility(rays[i], RAY_RADIUS);
+		});
+
+		// reads of nodes, instances, triangles and materials per ray, a subset is enough
+		const auto sampled = std::min<size_t>(rays.size(), 10000);
+		std::vector<const void*> loads;
+		for (size_t i = 0; i < sampled; ++i)
+			traversal.visibility(rays[i], RAY_RADIUS, &loads);
+
+		// the first surface the closest hit keeps is either the shell, the light is behind a single surface of it,
+		// or a blob which blocks it, the blobs are farther from the light than the bumps of the shell
+		size_t lit = 0, differing = 0;
+		for (size_t i = 0; i < rays.size(); ++i)
+		{
+			const auto shell = traversal.intersect(rays[i]).distance > RAY_RADIUS - 1.2f * SHELL_RADIUS;
+			const auto expected = flagged && shell ? Vec3f(GLASS.r, GLASS.g, GLASS.b) : Vec3f();
+
+			const auto& v = visibility[i];
+			lit += v.x > 0.f || v.y > 0.f || v.z > 0.f;
+			differing += std::abs(v.x - expected.x) > 1e-4f || std::abs(v.y - expected.y) > 1e-4f || std::abs(v.z - expected.z) > 1e-4f;
+		}
+
+		std::printf("%s\n  %zu triangles, %zu references added by the spatial splits\n", flagged ? "glass and masks" : "all opaque", stats.triangles, stats.duplicates);
+		std::printf("  %7.2f Mrays/s  %7.1f loads/ray  %5.1f%% of the rays reach the light  %zu rays with a different visibility than expected\n",
+			rays.size() / time.best / 1e3, double(loads.size()) / sampled, 100.0 * lit / rays.size(), differing);
+
+		// the shell is passed once, only the rounding at the borders of its triangles can differ
+		if (differing > rays.size() / 1000)
+			throw std::runtime_error("Visibility through the glass and the masks differs from the closest hits");
+	}
+
+	return 0;
+}
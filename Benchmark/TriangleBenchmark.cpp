@@ -0,0 +1,112 @@
+﻿#include "Benchmarks.hpp"
+#include "SyntheticScene.hpp"
+#include "BVHWrapper.hpp"
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+	size_t occludedRays(const BVHWrapper& bvh, const std::vector<CPUTraversal::Ray>& rays)
+	{
+		const CPUTraversal traversal(bvh);
+
+		size_t occluded = 0;
+		for (const auto& ray : rays)
+			occluded += traversal.occluded(ray, FLT_MAX);
+
+		return occluded;
+	}
+
+	void benchScene(const std::string& name, const aiScene* scene, size_t rayCount)
+	{
+		std::printf("%s\n", name.c_str());
+
+		BVH::BuildParams params;
+		params.enablePrints = false;
+
+		std::mt19937 generator(42);
+		std::vector<CPUTraversal::Ray> rays;
+		std::vector<CPUTraversal::Hit> reference;
+		size_t referenceOccluded = 0;
+
+		// the same tree with triangles loaded through the vertex indices and precomputed
+		for (const auto precompute : { false, true })
+		{
+			const BVHWrapper bvh(scene, params, precompute);
+
+			const auto stats = bvh.getStats();
+			if (rays.empty())
+				rays = randomRays(rayCount, Vec3f(stats.min.x, stats.min.y, stats.min.z), Vec3f(stats.max.x, stats.max.y, stats.max.z), generator);
+
+			std::vector<CPUTraversal::Hit> hits;
+			const auto closest = measure(3, [&] { hits = closestHits(bvh, rays); });
+
+			size_t occluded = 0;
+			const auto occlusion = measure(3, [&] { occluded = occludedRays(bvh, rays); });
+
+			if (reference.empty())
+			{
+				reference = hits;
+				referenceOccluded = occluded;
+			}
+
+			// edges are computed the same way in both, the hits have to match exactly
+			const auto differing = differingHits(reference, hits);
+
+			std::printf("  %-12s %8.2f MB GPU  %8.2f B/triangle  closest %7.2f Mrays/s  occlusion %7.2f Mrays/s  %zu rays differ\n",
+				precompute ? "precomputed" : "indexed", stats.bytes / 1e6, double(stats.bytes) / stats.triangles,
+				rayCount / closest.best / 1e3, rayCount / occlusion.best / 1e3, differing);
+
+			if (differing > 0 || occluded != referenceOccluded)
+				throw std::runtime_error("precomputed triangles find different hits than the indexed ones");
+		}
+	}
+}
+
+int benchTriangles(const Arguments& args)
+{
+	const auto rayCount = argument(args, 0, 100000);
+
+	// scenes given on the command line or all the bundled ones
+	std::vector<std::string> paths(args.size() > 1 ? args.begin() + 1 : args.end(), args.end());
+	if (paths.empty() && fs::exists("Assets/Models"))
+	{
+		for (const auto& f : fs::recursive_directory_iterator("Assets/Models"))
+			if (f.is_regular_file() && f.path().extension() == ".gltf")
+				paths.emplace_back(f.path().string());
+	}
+
+	std::printf("triangles: %zu rays per scene\n", rayCount);
+
+	for (const auto& path : paths)
+	{
+		// the same import as the renderer does
+		Assimp::Importer importer;
+		const auto scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_SortByPType | aiProcess_GenSmoothNormals);
+
+		if (!scene)
+		{
+			std::printf("%s\n  skipped, %s\n", path.c_str(), importer.GetErrorString());
+			continue;
+		}
+
+		benchScene(path, scene, rayCount);
+	}
+
+	// generated meshes of growing size, always available
+	for (unsigned subdivisions = 5; subdivisions <= 7; ++subdivisions)
+	{
+		const auto mesh = generateMesh(subdivisions);
+		const auto scene = createScene(createMesh(mesh, { aiMatrix4x4() }), { aiMatrix4x4() });
+
+		benchScene("sphere " + std::to_string(mesh.faces.size()) + " triangles", scene.get(), rayCount);
+	}
+
+	return 0;
+}
@@ -0,0 +1,211 @@
+﻿#include "Benchmarks.hpp"
+#include "SyntheticScene.hpp"
+#include "BVHWrapper.hpp"
+#include "ParamsParser.hpp"
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <filesystem>
+#include <functional>
+#include <random>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+	// only the ratio of the costs matters to the SAH, the node cost stays 1
+	constexpr float TRIANGLE_COSTS[] = { 0.25f, 0.5f, 1.f, 2.f, 4.f };
+	constexpr int MIN_LEAF_SIZES[] = { 1, 2, 4 };
+	constexpr int MAX_LEAF_SIZES[] = { 2, 4, 8, 16, 0 }; // 0 is unbounded
+	constexpr float SPLIT_ALPHAS[] = { 1e-5f, 1e-4f, 1e-3f, 1e-2f };
+
+	constexpr auto ROUNDS = 2; // passes over all the settings, each one is swept with the others fixed
+	constexpr auto MIN_GAIN = 1.05; // a candidate has to be faster by this much to replace the best, the timing is noisy
+
+	struct Settings
+	{
+		float triangleCost = 1.f;
+		int minLeafSize = 1;
+		int maxLeafSize = 0;
+		float splitAlpha = BVH::BuildParams().splitAlpha;
+	};
+
+	BVH::BuildParams buildParams(const Settings& settings)
+	{
+		BVH::BuildParams params;
+		params.enablePrints = false;
+		params.platform = Platform("Tuned", 1.f, settings.triangleCost);
+		params.platform.setLeafPreferences(settings.minLeafSize, settings.maxLeafSize > 0 ? settings.maxLeafSize : Platform().getMaxLeafSize());
+		params.splitAlpha = settings.splitAlpha;
+
+		return params;
+	}
+
+	// primary rays of the saved view, the same frustum as Camera
+	std::vector<CPUTraversal::Ray> cameraRays(size_t count, const SceneCatalog::CameraParam& camera, std::mt19937& generator)
+	{
+		const auto pitch = camera.pitch * 3.14159265f / 180.f;
+		const auto yaw = camera.yaw * 3.14159265f / 180.f;
+
+		auto front = Vec3f(std::cos(yaw) * std::cos(pitch), std::sin(pitch), std::sin(yaw) * std::cos(pitch)).normalize();
+		auto left = cross(Vec3f(0.f, 1.f, 0.f), front).normalize();
+		const auto up = cross(front, left);
+
+		const auto halfHeight = std::tan(FOV * 3.14159265f / 180.f / 2.f);
+		const auto halfWidth = WIDTHF / HEIGHTF * halfHeight;
+
+		std::uniform_real_distribution<float> unit(-1.f, 1.f);
+		std::vector<CPUTraversal::Ray> rays(count);
+		for (auto& ray : rays)
+		{
+			auto direction = front + left * (unit(generator) * halfWidth) + up * (unit(generator) * halfHeight);
+			ray = { Vec3f(camera.position.x, camera.position.y, camera.position.z), direction.normalize() };
+		}
+
+		return rays;
+	}
+
+	// primary rays and a bounce in a random direction from each of their hits, shaped like the rays of a frame
+	std::vector<CPUTraversal::Ray> representativeRays(const std::string& path, const BVHWrapper& bvh, size_t count, std::mt19937& generator)
+	{
+		const auto stats = bvh.getStats();
+		const auto min = Vec3f(stats.min.x, stats.min.y, stats.min.z);
+		const auto max = Vec3f(stats.max.x, stats.max.y, stats.max.z);
+
+		// without saved params the view is random too
+		const auto paramsPath = fs::path(path).replace_extension(".params").string();
+		auto rays = fs::exists(paramsPath)
+			? cameraRays(count / 2, ParamsParser::parseFile(paramsPath).camera, generator)
+			: randomRays(count / 2, min, max, generator);
+
+		const auto hits = closestHits(bvh, rays);
+		const auto offset = (max - min).length() * 1e-4f;
+
+		std::uniform_real_distribution<float> unit(-1.f, 1.f);
+		for (size_t i = 0; i < hits.size() && rays.size() < count; ++i)
+		{
+			if (hits[i].triangle < 0)
+				continue;
+
+			Vec3f direction;
+			do
+				direction = Vec3f(unit(generator), unit(generator), unit(generator));
+			while (direction.lengthsq() > 1.f || direction.lengthsq() < 1e-4f);
+
+			const auto& primary = rays[i];
+			rays.push_back({ primary.origin + primary.direction * (hits[i].distance - offset), direction.normalize() });
+		}
+
+		return rays;
+	}
+
+	void tuneScene(const std::string& path, const aiScene* scene, size_t rayCount)
+	{
+		std::printf("%s\n", path.c_str());
+
+		std::mt19937 generator(42);
+		Settings best;
+
+		std::vector<CPUTraversal::Ray> rays;
+		std::vector<CPUTraversal::Hit> reference;
+		double bestTime = 0.0;
+		double defaultTime = 0.0;
+
+		// best of a few traversals of the rays, the build time isn't part of it
+		const auto evaluate = [&](const Settings& settings)
+		{
+			const BVHWrapper bvh(scene, buildParams(settings));
+
+			if (rays.empty())
+				rays = representativeRays(path, bvh, rayCount, generator);
+
+			std::vector<CPUTraversal::Hit> hits;
+			const auto traversal = measure(5, [&] { hits = closestHits(bvh, rays); });
+
+			if (reference.empty())
+				reference = hits;
+
+			// every setting has to find the same closest hits
+			const auto differing = differingHits(reference, hits);
+			if (differing > rays.size() / 1000)
+				throw std::runtime_error(path + " finds " + std::to_string(differing) + " different hits with the tuned settings");
+
+			std::printf("  triangle cost %5.2f  leaf size %2d-%-2d  split alpha %7.0e  %8.2f Mrays/s  SAH %8.2f\n",
+				settings.triangleCost, settings.minLeafSize, settings.maxLeafSize, settings.splitAlpha,
+				rays.size() / traversal.best / 1e3, bvh.getStats().meshCost);
+
+			return traversal.best;
+		};
+
+		defaultTime = bestTime = evaluate(best);
+
+		// sweeps one setting with the others fixed at their best values
+		const auto sweep = [&](const auto& values, auto Settings::* member)
+		{
+			for (const auto value : values)
+			{
+				auto candidate = best;
+				candidate.*member = value;
+
+				const auto bounded = candidate.maxLeafSize == 0 || candidate.minLeafSize <= candidate.maxLeafSize;
+				if (candidate.*member == best.*member || !bounded)
+					continue;
+
+				const auto time = evaluate(candidate);
+				if (time * MIN_GAIN < bestTime)
+				{
+					best = candidate;
+					bestTime = time;
+				}
+			}
+		};
+
+		for (int round = 0; round < ROUNDS; ++round)
+		{
+			sweep(TRIANGLE_COSTS, &Settings::triangleCost);
+			sweep(MIN_LEAF_SIZES, &Settings::minLeafSize);
+			sweep(MAX_LEAF_SIZES, &Settings::maxLeafSize);
+			sweep(SPLIT_ALPHAS, &Settings::splitAlpha);
+		}
+
+		// saved next to the scene params, the renderer picks it up on the next load
+		const auto bvhParamsPath = fs::path(path).replace_extension(".bvhparams").string();
+		ParamsParser::writeBVHFile(bvhParamsPath, buildParams(best));
+
+		std::printf("  best: triangle cost %.2f, leaf size %d-%d, split alpha %.0e, %.2fx the defaults, written to %s\n",
+			best.triangleCost, best.minLeafSize, best.maxLeafSize, best.splitAlpha, defaultTime / bestTime, bvhParamsPath.c_str());
+	}
+}
+
+int benchTune(const Arguments& args)
+{
+	const auto rayCount = argument(args, 0, 20000);
+
+	// scenes given on the command line or all the bundled ones
+	std::vector<std::string> paths(args.size() > 1 ? args.begin() + 1 : args.end(), args.end());
+	if (paths.empty() && fs::exists("Assets/Models"))
+	{
+		for (const auto& f : fs::recursive_directory_iterator("Assets/Models"))
+			if (f.is_regular_file() && f.path().extension() == ".gltf")
+				paths.emplace_back(f.path().string());
+	}
+
+	std::printf("tune: %zu rays per scene\n", rayCount);
+
+	for (const auto& path : paths)
+	{
+		// the same import as the renderer does
+		Assimp::Importer importer;
+		const auto scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_SortByPType | aiProcess_GenSmoothNormals);
+
+		if (!scene)
+		{
+			std::printf("%s\n  skipped, %s\n", path.c_str(), importer.GetErrorString());
+			continue;
+		}
+
+		tuneScene(path, scene, rayCount);
+	}
+
+	return 0;
+}
@@ -0,0 +1,70 @@
+﻿#include "Benchmarks.hpp"
+#include <cstdio>
+#include <cstring>
+#include <exception>
+
+namespace
+{
+	struct Command
+	{
+		const char* name;
+		const char* usage;
+		int (*run)(const Arguments&);
+	};
+
+	const Command COMMANDS[] = {
+		{ "params", "params [lights=10000] [iterations=20]   parse a synthetic .params file", benchParams },
+		{ "instancing", "instancing [instances=2000] [rays=100000] [mesh]   flattened vs two-level BVH of a repeated mesh", benchInstancing },
+		{ "refit", "refit [instances=2000] [frames=60] [rays=100000]   refit of animated instances and a deforming mesh vs rebuild", benchRefit },
+		{ "builders", "builders [rays=100000] [scene...]   build time and ray throughput of SBVH, LBVH and HLBVH on the bundled scenes, a failed write of the out-of-core build checked to reach the caller", benchBuilders },
+		{ "stress", "stress [triangles=100000000] [rays=100000] [budget MB=0]   procedural terrain over the size limits of a single GPU buffer, chunked addressing checked against the grid, out-of-core build within a nonzero budget", benchStress },
+		{ "triangles", "triangles [rays=100000] [scene...]   memory and ray throughput of indexed vs precomputed triangles", benchTriangles },
+		{ "tune", "tune [rays=20000] [scene...]   sweep SAH costs, leaf sizes and split alpha by the traversal time of the saved view, writes .bvhparams next to the scene", benchTune },
+		{ "geometry", "geometry [rays=100000] [scene...]   memory of the quantized and packed geometry vs full precision, hits checked against it, an oversized mesh checked to be refused", benchGeometry },
+		{ "lights", "lights [lights=10000] [points=2000] [samples=16] [rays=10000]   convergence per second of the light BVH and the alias table vs uniform light selection, refit and rebuild after single light edits, emitter hits checked against the linear loop", benchLights },
+		{ "sampler", "sampler [pixels=2000] [samples=1024]   error and convergence per second of the Sobol and PCG samplers vs the former sine hash on paths with known means", benchSampler },
+		{ "adaptive", "adaptive [size=128] [paths per pixel=2] [frames=20000]   paths to render an image with a caustic to the target error by adaptive sampling vs the uniform one, error against the exact means", benchAdaptive },
+		{ "coherence", "coherence [size=256] [scene...]   cache hit rates and ray throughput of primary rays and their bounces taken by rows, tiles, the Morton order and shuffled like the path slots", benchCoherence },
+		{ "emissive", "emissive [points=1000] [samples=16] [reference samples=4096]   error and convergence per second of the emitter hits, the light samples of the emissive triangles and their MIS on a floor under panels of different sizes", benchEmissive },
+		{ "environment", "environment [width=4096] [points=1000] [samples=16]   decode and cache load times of an HDR sky, pdf of the map samples checked, error and convergence per second of the BSDF hits, the map samples and their MIS", benchEnvironment },
+		{ "roulette", "roulette [pixels=2000] [samples=64]   mean, error, path lengths and convergence per second of the Russian roulette settings on long paths with known means", benchRoulette },
+		{ "occlusion", "occlusion [rays=100000] [scene...]   shadow rays to lights and the environment by the occlusion traversal vs the former ordered any hit and the closest hit, rays per second and reads per ray", benchOcclusion },
+		{ "transparency", "transparency [rays=100000]   shadow rays through a glass shell and masked blobs vs the same scene all opaque, visibility checked against the closest hits, rays per second and reads per ray", benchTransparency },
+		{ "residency", "residency [frames=2000] [textures=16]   virtual texture tiles streamed for views panning over 4k textures, LRU eviction, mip fallback and the full pool checked on synthetic feedback", benchResidency },
+	};
+
+	void printUsage()
+	{
+		std::printf("Usage: Benchmark <command> [arguments]\n\n");
+		for (const auto& c : COMMANDS)
+			std::printf("  %s\n", c.usage);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		printUsage();
+		return 1;
+	}
+
+	for (const auto& c : COMMANDS)
+	{
+		if (std::strcmp(argv[1], c.name) == 0)
+		{
+			try
+			{
+				return c.run(Arguments(argv + 2, argv + argc));
+			}
+			catch (const std::exception& e)
+			{
+				std::fprintf(stderr, "%s\n", e.what());
+				return -1;
+			}
+		}
+	}
+
+	printUsage();
+	return 1;
+}
@@ -0,0 +1,70 @@
+﻿#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "Constants.hpp"
+
+// Path budget of the image tiles by their error. It doesn't touch D3D - it consumes the errors of the tiles
+// computed from the accumulation by adaptive.hlsl and makes the schedule of tiles newPath takes the pixels from,
+// so it can be driven by anything producing the errors.
+class AdaptiveSampling
+{
+public:
+	struct TileError // GPU side in adaptive.hlsl
+	{
+		float error; // largest standard error of the displayed luminance of a pixel in the tile
+		uint32_t samples; // fewest samples of a pixel in the tile
+	};
+
+	struct Pass // GPU side in newPath.hlsl
+	{
+		uint32_t tile;
+		uint32_t start; // position of its first pixel in a pass over the schedule
+	};
+
+	// standard error of the mean of a pixel from the mean and the second moment of its samples
+	static float pixelError(float mean, float moment, uint32_t samples);
+
+	// every tile once, the schedule of a cleared image, the tiles go along the Morton curve or by rows in every round
+	void reset(uint32_t width, uint32_t height, bool morton = MORTON_PIXEL_ORDER);
+
+	// tiles under the target error with at least the minimal samples are left out, the others are repeated
+	// by the samples they still need, up to maxWeight times per pass over the schedule
+	void update(const TileError* errors, size_t count, float targetError = ADAPTIVE_TARGET_ERROR,
+		uint32_t minSamples = ADAPTIVE_MIN_SAMPLES, uint32_t maxWeight = ADAPTIVE_MAX_WEIGHT);
+
+	// passes over the tiles in the order newPath takes them, a tile is tilesX() * y + x
+	const std::vector<Pass>& getSchedule() const { return mSchedule; }
+	uint32_t schedulePaths() const { return mSchedulePaths; } // pixels of all the passes
+	bool converged() const { return mSchedule.empty(); }
+
+	// pixels of the tile inside of the image, the tiles over its edge have fewer
+	uint32_t tilePixels(uint32_t tile) const;
+	// pixel at the position in the pass over the tile, the same as tilePixel of adaptive.h
+	std::pair<uint32_t, uint32_t> tilePixel(uint32_t tile, uint32_t position) const;
+	// pixel at the position in the pass over the schedule, the same as newPath
+	std::pair<uint32_t, uint32_t> schedulePixel(uint32_t position) const;
+
+	uint32_t tilesX() const { return mTilesX; }
+	uint32_t tilesY() const { return mTilesY; }
+	size_t tileCount() const { return size_t(mTilesX) * mTilesY; }
+	size_t activeTiles() const { return mActiveTiles; }
+	float maxError() const { return mMaxError; }
+
+private:
+	void addPass(uint32_t tile);
+
+private:
+	std::vector<Pass> mSchedule;
+	uint32_t mSchedulePaths = 0;
+	std::vector<uint32_t> mWeights; // passes of the tiles in one pass over the schedule
+	std::vector<uint32_t> mOrder; // tiles in the order of a round
+	uint32_t mWidth = 0;
+	uint32_t mHeight = 0;
+	bool mMorton = MORTON_PIXEL_ORDER;
+	uint32_t mTilesX = 0;
+	uint32_t mTilesY = 0;
+	size_t mActiveTiles = 0;
+	float mMaxError = 0.f;
+};
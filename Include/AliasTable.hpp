@@ -0,0 +1,42 @@
+﻿#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Walker's alias table, picks an element with the probability proportional to its (nonnegative) weight
+// by a single random number in constant time. Every entry holds the threshold of its own element and the element which takes the rest.
+class AliasTable
+{
+public:
+	struct Entry
+	{
+		float threshold; // probability of the element of the entry, the alias is picked otherwise
+		uint32_t alias;
+		float pdf; // probability of the element of the entry in the whole table
+	};
+
+public:
+	AliasTable() = default;
+	explicit AliasTable(const std::vector<float>& weights);
+
+	// changes the weight of one element, the whole table is rebuilt in place only if it differs,
+	// returns whether it was rebuilt - every entry depends on the total weight, so it's O(n) the same as the construction
+	bool setWeight(size_t index, float weight);
+
+	// element picked by a uniform random number and the probability it's picked with, zero if all the weights are zero
+	size_t sample(float u, float& pdf) const;
+	// the same pick from entries of a table kept elsewhere, the part of u left over by the pick is uniform again
+	// and given in the remainder, so it can place the sample inside the picked element
+	static size_t sample(const Entry* entries, size_t count, float u, float& pdf, float& remainder);
+
+	const std::vector<Entry>& getEntries() const { return mEntries; }
+
+private:
+	void build();
+
+private:
+	std::vector<float> mWeights;
+	std::vector<Entry> mEntries;
+	std::vector<uint32_t> mSmall; // work lists of the build, kept so a rebuild doesn't allocate
+	std::vector<uint32_t> mLarge;
+};
@@ -1,9 +1,17 @@
 ﻿#pragma once
 #include <vector>
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <DirectXMath.h>
-#include "Nvidia-SBVH/Array.h"
+#include "Nvidia-SBVH/BVH.h"
+#include "Constants.hpp"
+#include <assimp/matrix4x4.h>
+#include <assimp/vector3.h>
 
+struct aiMaterial;
 struct aiMesh;
+struct aiNode;
 struct aiScene;
 
 
@@ -23,29 +31,199 @@ public:
 	struct alignas(16) Triangle
 	{
 		DirectX::XMINT3 indices;
-		uint32_t index; // triangle index (for material)
+		uint32_t index; // material index, the opacity flags of the material take the top bits
+	};
+
+	// opacity of the triangles of a material, shadow rays pass through the transmissive ones attenuated and the masked ones
+	// are cut out where their alpha is under the cutoff, the same bits as in structs.h
+	enum TriangleFlags : uint32_t
+	{
+		OPAQUE_TRIANGLE = 0,
+		MASKED_TRIANGLE = 1u << 30,
+		TRANSMISSIVE_TRIANGLE = 1u << 31,
+		TRIANGLE_FLAGS = MASKED_TRIANGLE | TRANSMISSIVE_TRIANGLE,
+	};
+
+	// what the ray kernels read of the material of a flagged triangle, the rest of the properties stays in the material kernels
+	struct MaterialOpacity
+	{
+		DirectX::XMFLOAT3 transmittance; // of a surface of the transmissive material, the glass kernel multiplies by the same color
+		float alpha; // of the masked material, the alpha of its diffuse texture multiplies it
+		float alphaCutoff;
+		int32_t alphaIndex = -1; // virtual texture index of the diffuse texture, set by the scene
 	};
 	
+	// triangle for the intersection in the order of mIndices, the edges are precomputed so it takes a single load
+	struct TrianglePositions
+	{
+		DirectX::XMFLOAT3 v0;
+		DirectX::XMFLOAT3 e1; // v1 - v0
+		DirectX::XMFLOAT3 e2; // v2 - v0
+	};
+
 	struct alignas(16) TriangleProperties
 	{
 		DirectX::XMFLOAT3A normal;
 		DirectX::XMFLOAT2 texCoord;
 		uint32_t materialID;
 	};
+
+	// three 21 bit unsigned integers in 64 bits, x takes the lowest bits of lo, y the rest of lo and the lowest of hi, z the rest
+	struct Packed3x21
+	{
+		uint32_t lo;
+		uint32_t hi;
+	};
+
+	// compressed geometry - positions quantized to the bounds of their mesh, triangles as vertex indices local to their mesh
+	using PackedVertex = Packed3x21;
+	using PackedTriangle = Packed3x21;
+
+	// octahedral normal as two 16 bit snorms, texture coordinates as two halfs
+	struct PackedProperties
+	{
+		uint32_t normal;
+		uint32_t texCoord;
+	};
+
+	// decoding of the compressed geometry of a mesh, the material is the same for all its triangles
+	struct alignas(16) MeshGeometry
+	{
+		DirectX::XMFLOAT3 origin; // min of the mesh bounds
+		uint32_t vertexOffset;
+		DirectX::XMFLOAT3 scale; // of a quantization step
+		uint32_t material; // with the opacity flags, the packed triangles have no room for them
+	};
+
+	// placement of a mesh in the scene, rows of affine 3x4 transforms
+	struct alignas(16) Instance
+	{
+		DirectX::XMFLOAT4 worldToObject[3];
+		DirectX::XMFLOAT4 objectToWorld[3];
+		uint32_t root; // root node of the mesh BVH
+		uint32_t mesh;
+	};
+
+	// triangle of an instance, the emissive ones are sampled as lights
+	struct InstanceTriangle
+	{
+		uint32_t instance;
+		uint32_t triangle; // index of the triangle in the leaf order of its mesh BVH
+	};
+
+	struct Stats
+	{
+		size_t meshes;
+		size_t instances;
+		size_t nodes;
+		size_t triangles;
+		size_t vertices;
+		size_t duplicates; // triangle references added by spatial splits of the mesh BVHs
+		size_t bytes; // size of all GPU buffers
+		size_t buildBytes; // peak working memory of the largest mesh BVH build
+		float topLevelCost; // SAH cost of the top level relative to the area of its root
+		float meshCost; // SAH cost of the mesh BVHs relative to the areas of their roots, summed over the meshes
+		size_t stackDepth; // traversal stack entries taken by the deepest top level leaf and mesh BVH, at most BVH_STACK_SIZE
+		DirectX::XMFLOAT3 min; // bounds of the scene
+		DirectX::XMFLOAT3 max;
+	};
+
+	// elements of a buffer changed since the last upload
+	struct Range
+	{
+		size_t begin = SIZE_MAX;
+		size_t end = 0;
+
+		void add(size_t first, size_t last) { begin = std::min(begin, first); end = std::max(end, last); }
+		bool empty() const { return begin >= end; }
+	};
 	
 public:
 	BVHWrapper() = default;
-	BVHWrapper(const aiScene* scene);
+	// precomputed triangles take more memory than the vertex indices, the indices are kept for shading anyway,
+	// compressed geometry snaps the vertices to the quantization grid, the full precision buffers are kept for the CPU
+	BVHWrapper(const aiScene* scene, const BVH::BuildParams& params = BVH::BuildParams(), bool precomputeTriangles = false, bool compressGeometry = false);
+
+	// new world transform of an instance or of all instances of a scene node (depth first index), degenerate one is ignored
+	void setTransform(size_t instance, const aiMatrix4x4& transform);
+	void setNodeTransform(uint32_t node, const aiMatrix4x4& transform);
+	// new positions (and normals) of all vertices of the mesh, triangles stay the same
+	void setVertices(size_t mesh, const aiVector3D* vertices, const aiVector3D* normals = nullptr);
+
+	// bounds of the changed meshes and of the top level are recomputed bottom-up,
+	// top level subtrees whose SAH cost grew over threshold times the cost after their build are rebuilt in place
+	void refit(float rebuildThreshold = BVH_REBUILD_THRESHOLD);
+
+	Stats getStats() const;
+
+	// every triangle of the instances of the meshes with the selected materials (by material index) once,
+	// the references added by the spatial splits are left out
+	std::vector<InstanceTriangle> getTriangles(const std::vector<bool>& materials) const;
+	// vertices and area in world space by the current transform of the instance
+	std::array<Vec3f, 3> getPositions(const InstanceTriangle& triangle) const;
+	float getArea(const InstanceTriangle& triangle) const;
+
+	// flags by the glTF alpha mode of the material, BLEND is taken for glass
+	static uint32_t opacityFlags(const aiMaterial& material);
+	static MaterialOpacity opacity(const aiMaterial& material);
+
+	static DirectX::XMUINT3 unpack(const Packed3x21& packed);
+	static Vec3f decodeVertex(const MeshGeometry& mesh, const PackedVertex& vertex);
+	static TriangleProperties decodeProperties(const PackedProperties& properties);
 
 private:
-	void buildSBVH();
+	struct MeshBVH
+	{
+		int root = -1; // -1 for meshes without triangles
+		size_t nodeEnd = 0;
+		size_t vertexOffset = 0;
+		size_t vertexCount = 0;
+		size_t triangleBegin = 0;
+		size_t triangleEnd = 0;
+		std::vector<std::vector<int>> levels; // nodes by depth, refit goes from the deepest one
+		bool dirty = false;
+	};
+
+	void buildMeshBVH(size_t meshIndex, std::vector<BVHNode>& nodes);
+	void collectInstances(const aiNode* node, const aiMatrix4x4& parentTransform, uint32_t& nodeIndex);
+	void buildTopLevelBVH(const std::vector<BVHNode>& meshNodes);
+	void refitMesh(MeshBVH& mesh);
+	void compressMesh(size_t meshIndex);
+	void refitTopLevel(float rebuildThreshold);
 
 private:
 	const aiScene* mScene;
-	std::vector<BVHNode> mGPUTree;
+	BVH::BuildParams mBuildParams; // of the mesh BVHs
+	std::vector<BVHNode> mGPUTree; // top level BVH over instances first, BVHs of the meshes after it
 	std::vector<Triangle> mIndices;
+	std::vector<TrianglePositions> mTrianglePositions; // empty unless the triangles are precomputed
 	std::vector<TriangleProperties> mTriangleProperties;
-    Array<Vec3f> mVertices;
+	std::vector<PackedTriangle> mPackedTriangles; // the compressed buffers are empty unless the geometry is compressed
+	std::vector<PackedVertex> mPackedVertices;
+	std::vector<PackedProperties> mPackedProperties;
+	std::vector<MeshGeometry> mMeshGeometry;
+	std::vector<Instance> mInstances;
+	std::vector<MaterialOpacity> mOpacities; // of the materials, the scene uploads its own with the texture indices
+	uint32_t mOpacityFlags = OPAQUE_TRIANGLE; // of all the triangles
+	std::vector<uint32_t> mInstanceNodes; // scene node (depth first index) of every instance, nondecreasing
+	std::vector<MeshBVH> mMeshes;
+	std::vector<float> mTopLevelCost; // relative SAH cost of the top level subtrees after their build
+	size_t mTopLevelDepth = 0; // levels of the top level BVH the traversal stack has left after the deepest mesh BVH
+	bool mInstancesDirty = false;
+	bool mPrecomputeTriangles = false;
+	bool mCompressGeometry = false;
+	size_t mBuildBytes = 0; // peak of the mesh BVH builds, they run one after another
+	size_t mDuplicates = 0;
+    Array<Vec3f> mVertices; // in object space of the mesh
+
+	// uploaded and reset by the scene
+	Range mDirtyNodes;
+	Range mDirtyInstances;
+	Range mDirtyVertices;
+	Range mDirtyProperties;
+	Range mDirtyPositions;
+	Range mDirtyMeshes;
 
 	friend class Scene; // todo lazy to make getters/setters :'(
+	friend class CPUTraversal;
 };
\ No newline at end of file
@@ -0,0 +1,75 @@
+﻿#pragma once
+#include "BVHWrapper.hpp"
+#include "Nvidia-SBVH/linear_math.h"
+#include "Constants.hpp"
+#include <cfloat>
+#include <vector>
+
+// Traversal of the flattened BVHWrapper buffers on the CPU. It follows the extension and shadow ray kernels,
+// so it's used to check the GPU data layout and to measure the structure without a device.
+// Geometry is addressed by chunks like in geometry.h, smaller chunks than on the GPU check the addressing on small scenes.
+class CPUTraversal
+{
+public:
+	struct Ray
+	{
+		Vec3f origin;
+		Vec3f direction;
+	};
+
+	struct Hit
+	{
+		float distance = FLT_MAX; // in units of the ray direction
+		int triangle = -1; // index of BVHWrapper triangle
+		int instance = -1;
+		Vec3f baryCoord;
+	};
+
+public:
+	explicit CPUTraversal(const BVHWrapper& bvh, size_t chunkBytes = GEOMETRY_CHUNK_BYTES);
+
+	// addresses of the nodes, instances and geometry the traversal reads are appended to loads in the order of the reads,
+	// they drive the cache simulation of the coherence benchmark
+	Hit intersect(const Ray& ray, std::vector<const void*>* loads = nullptr) const;
+	// occlusion traversal of the shadow rays, the box tests are clipped to the distance and take the inverse direction
+	// computed once, the first opaque hit ends it, the transmissive triangles attenuate the visibility on the way,
+	// the same as shadowRayCast.hlsl, zero if the ray is blocked
+	Vec3f visibility(const Ray& ray, float distance, std::vector<const void*>* loads = nullptr) const;
+	bool occluded(const Ray& ray, float distance, std::vector<const void*>* loads = nullptr) const;
+	// closest child first traversal the shadow rays had before, compared by the occlusion benchmark
+	bool occludedOrdered(const Ray& ray, float distance, std::vector<const void*>* loads = nullptr) const;
+
+private:
+	// array split into chunks of 2^bits elements, the same split as of the scene buffers
+	template<typename T>
+	class Chunks
+	{
+	public:
+		Chunks(const T* data, size_t size, size_t chunkBytes);
+
+		const T& operator[](size_t index) const { return mChunks[index >> mBits][index & mMask]; }
+
+	private:
+		std::vector<const T*> mChunks;
+		unsigned mBits;
+		size_t mMask;
+	};
+
+	template<bool AnyHit>
+	void traverse(const Ray& ray, Hit& hit, std::vector<const void*>* loads) const;
+	// vertex and edges of the triangle in the mesh of the instance
+	void loadTriangle(int index, int instance, std::vector<const void*>* loads, Vec3f& v0, Vec3f& e1, Vec3f& e2) const;
+	// material index with the opacity flags, of the mesh with the compressed geometry
+	uint32_t loadMaterial(int index, int instance, std::vector<const void*>* loads) const;
+	// the masked triangles are cut out by the alpha factor of their material, the CPU has no textures
+	bool alphaCutout(uint32_t material) const;
+
+private:
+	const BVHWrapper& mBVH;
+	Chunks<BVHWrapper::BVHNode> mNodes;
+	Chunks<BVHWrapper::Triangle> mTriangles;
+	Chunks<Vec3f> mVertices;
+	Chunks<BVHWrapper::TrianglePositions> mPositions; // empty unless the BVH precomputes the triangles
+	Chunks<BVHWrapper::PackedTriangle> mPackedTriangles; // empty unless the BVH compresses the geometry
+	Chunks<BVHWrapper::PackedVertex> mPackedVertices;
+};
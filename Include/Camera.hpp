@@ -1,5 +1,6 @@
 ﻿#pragma once
 #include <DirectXMath.h>
+#include "Constants.hpp"
 
 
 class Camera // todo change
@@ -14,11 +15,26 @@ public:
 		DirectX::XMVECTOR vertical;
 		DirectX::XMFLOAT2 pixelSize;
 		
-		DirectX::XMFLOAT2 randomSeed; // TODO these shouldn't be in camera buffer
+		uint32_t scheduleLength = 0; // passes over the tiles of adaptive sampling, set by the renderer
+		uint32_t mortonOrder = MORTON_PIXEL_ORDER;
 		DirectX::XMFLOAT3A envColor = { 0.0f, 0.0001f, 0.0001f };
 		int32_t iterationCounter = -1;	
 		uint32_t lightCount = 2;
 		uint32_t sampleLights = false;
+		uint32_t coherentQueues = COHERENT_QUEUES;
+		uint32_t emissiveCount = 0; // triangles of the emissive materials, set by the scene
+		float emissivePower = 0.f; // sum of their areas times the largest emission components
+		DirectX::XMUINT2 environmentCells = {}; // of the sampling tables of the environment map, zero without it, set by the scene
+		float environmentIntensity = 1.f;
+		float environmentRotation = 0.f; // around the up axis in turns
+		RouletteMode rouletteMode = ROULETTE_MODE;
+		uint32_t rouletteDepth = ROULETTE_DEPTH; // first bounce of the Russian roulette
+		uint32_t maxDepth = ROULETTE_MAX_DEPTH; // bounces of the longest paths, zero for no limit
+		float rouletteMinSurvival = ROULETTE_MIN_SURVIVAL;
+		uint32_t pathStatistics = false; // the kernels count the lengths of the ended paths into the queue counters
+		uint32_t opacityFlags = 0; // of all the triangles, the ray kernels test only the flags the scene has, set by the scene
+		uint32_t transmissiveShadows = TRANSMISSIVE_SHADOWS;
+		uint32_t schedulePaths = 0; // pixels of all the passes of adaptive sampling, set by the renderer
 	};
 public:
 
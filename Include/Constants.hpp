@@ -1,4 +1,6 @@
 ﻿#pragma once
+#include <cstddef>
+#include <cstdint>
 
 // This is just starting resolution, and it may change during execution
 constexpr auto WIDTH = 1280u; 
@@ -12,10 +14,80 @@ constexpr auto FOV = 60.f;
 constexpr auto NUM_SM = 34;
 constexpr auto PATHCOUNT = 1 << 21; // 2M paths
 constexpr auto NUM_GROUPS = NUM_SM * 8;
-constexpr auto MAX_LIGHTS = 128;
+constexpr auto MAX_MATERIALS = 128; // size of the material constant buffer
 constexpr auto NUM_THREADS = 256;
 constexpr auto ITERATIONS = PATHCOUNT / (NUM_GROUPS * NUM_THREADS);
 
+// virtual texturing
+constexpr auto VT_TILE_SIZE = 128u; // texels of one tile, textures are stored in the cache as pow2 squares of at least this size
+constexpr auto VT_TILE_BORDER = 1u; // border of the tile for bilinear filtering
+constexpr auto VT_POOL_TILES = 32u; // physical pool has VT_POOL_TILES^2 tiles
+constexpr auto VT_FEEDBACK_INTERVAL = 4u; // frames between feedback readbacks
+constexpr auto VT_MAX_UPLOADS = 32u; // tile uploads per frame
+constexpr auto VT_CACHE_DIR_NAME = ".vtcache";
+
+// top level BVH subtree is rebuilt once its SAH cost grows by this factor
+constexpr auto BVH_REBUILD_THRESHOLD = 1.5f;
+constexpr auto BVH_TREELET_PASSES = 3; // restructuring passes when the treelet optimization is on
+constexpr auto BVH_MEMORY_BUDGET = size_t(2) << 30; // working memory of a mesh BVH build, larger meshes are built out of core
+constexpr auto BVH_STACK_SIZE = 64; // traversal stack of the shaders and the CPU, scenes deeper than it fail to load
+
+// triangles with precomputed edges in the order of the BVH leaves for the intersection
+constexpr auto PRECOMPUTED_TRIANGLES = true;
+
+// quantized vertices and normals, turns the precomputed triangles off
+constexpr auto COMPRESSED_GEOMETRY = false;
+
+// new paths go to the tiles by their error, the accumulation stops once all are under ADAPTIVE_TARGET_ERROR
+constexpr auto ADAPTIVE_SAMPLING = true;
+constexpr auto ADAPTIVE_TILE_SIZE = 16u; // pixels per side of a tile, a power of two
+static_assert((ADAPTIVE_TILE_SIZE & (ADAPTIVE_TILE_SIZE - 1)) == 0, "the Morton order goes over square tiles of a power of two");
+constexpr auto ADAPTIVE_INTERVAL = 8u; // frames between error readbacks
+constexpr auto ADAPTIVE_MIN_SAMPLES = 32u; // samples of every pixel of a tile before its error is trusted
+constexpr auto ADAPTIVE_TARGET_ERROR = 1.f / 255; // standard error of the displayed luminance of a pixel, a step of the 8 bit output
+constexpr auto ADAPTIVE_MAX_WEIGHT = 8u; // passes of the neediest tile per pass over the schedule
+
+// pixels of the new paths along the Morton curve, otherwise by rows
+constexpr auto MORTON_PIXEL_ORDER = true;
+
+// logic takes the paths in the order of the extension ray queue instead of their slots
+constexpr auto COHERENT_QUEUES = true;
+
+// Owen scrambled Sobol sequences of the pixels instead of PCG hashes
+constexpr auto SOBOL_SAMPLER = false;
+
+// lights of the shadow rays picked by the light BVH, otherwise by the alias table over their power
+constexpr auto LIGHT_TREE_SELECTION = true;
+
+// Russian roulette from the bounce ROULETTE_DEPTH on, paths end at ROULETTE_MAX_DEPTH unless it's zero
+enum class RouletteMode : uint32_t { OFF, THROUGHPUT, LUMINANCE }; // the same as structs.h
+constexpr auto ROULETTE_MODE = RouletteMode::THROUGHPUT;
+constexpr auto ROULETTE_DEPTH = 5u;
+constexpr auto ROULETTE_MAX_DEPTH = 0u;
+constexpr auto ROULETTE_MIN_SURVIVAL = 0.25f; // lower bound of the survival probability
+constexpr auto PATH_LENGTH_BINS = 32u; // histogram of the lengths of the ended paths
+
+// shadow rays pass through the glass attenuated by its color instead of being blocked
+constexpr auto TRANSMISSIVE_SHADOWS = true;
+
+// HDR environment map next to the scene (scene.hdr or scene.pfm)
+constexpr auto ENVIRONMENT_MAX_WIDTH = 16384u; // D3D11 texture limit, wider maps are box filtered down
+constexpr auto ENVIRONMENT_TABLE_WIDTH = 1024u; // cells of the sampling tables per row, half as many rows
+
+// scene buffers are split into chunks bound as separate views
+constexpr auto GEOMETRY_CHUNK_BYTES = size_t(1) << 29;
+constexpr auto GEOMETRY_CHUNKS = 16u; // of every buffer, their registers are listed in geometry.h
+
+// chunk of a buffer has 2^bits elements, the shaders address it by a shift and a mask
+constexpr unsigned geometryChunkBits(size_t stride, size_t chunkBytes = GEOMETRY_CHUNK_BYTES)
+{
+	unsigned bits = 0;
+	while ((size_t(2) << bits) * stride <= chunkBytes)
+		++bits;
+
+	return bits;
+}
+
 constexpr auto CAPTURE_DIR_NAME = R"(Captures)";
 constexpr auto CAPTURE_NAME = "potato";
 
@@ -0,0 +1,58 @@
+﻿#pragma once
+#include <DirectXMath.h>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "Nvidia-SBVH/linear_math.h"
+#include "AliasTable.hpp"
+#include "Constants.hpp"
+
+// Equirectangular HDR environment map with the tables of its importance sampling, the same as environment.h samples it.
+// The map is split into cells, an alias table over the rows of cells picks a row and the table of the row picks a cell,
+// both weighted by the luminance times the sine of the polar angle, a direction is a uniform point of the cell.
+// Texels are kept as R9G9B9E5 shared exponent floats, the format of the texture of the kernels. Maps of Radiance RGBE (.hdr)
+// and float (.pfm) files are cached with their tables in the tile cache directory of the virtual textures
+// and read from there again until the source changes.
+class EnvironmentMap
+{
+public:
+	EnvironmentMap() = default;
+	explicit EnvironmentMap(const std::string& path);
+	// linear texels by rows from the top
+	EnvironmentMap(uint32_t width, uint32_t height, const std::vector<DirectX::XMFLOAT3>& texels);
+
+	bool empty() const { return mTexels.empty(); }
+	bool fromCache() const { return mFromCache; }
+	uint32_t getWidth() const { return mWidth; }
+	uint32_t getHeight() const { return mHeight; }
+	DirectX::XMUINT2 getCells() const { return { mCellsX, mCellsY }; }
+	const std::vector<uint32_t>& getTexels() const { return mTexels; }
+	// the rows first, the cells of every row after them
+	const std::vector<AliasTable::Entry>& getTable() const { return mTable; }
+
+	// rotation around the up axis is in turns, the same as in environment.h
+	Vec3f radiance(const Vec3f& direction, float rotation = 0.f) const;
+	// direction picked by the tables, u picks the row, u1 the cell of the row and the position in it with u2,
+	// the probability is per solid angle
+	Vec3f sample(float u, float u1, float u2, float& pdf, float rotation = 0.f) const;
+	float pdf(const Vec3f& direction, float rotation = 0.f) const;
+
+	static uint32_t packSharedExponent(const DirectX::XMFLOAT3& color);
+	static DirectX::XMFLOAT3 unpackSharedExponent(uint32_t packed);
+
+private:
+	class Builder;
+
+	void buildTables(const std::vector<double>& cellLuminance);
+	bool loadCache(const std::string& path, int64_t sourceTime);
+	void saveCache(const std::string& path, int64_t sourceTime) const;
+
+private:
+	uint32_t mWidth = 0;
+	uint32_t mHeight = 0;
+	uint32_t mCellsX = 0;
+	uint32_t mCellsY = 0;
+	std::vector<uint32_t> mTexels;
+	std::vector<AliasTable::Entry> mTable;
+	bool mFromCache = false;
+};
@@ -19,10 +19,16 @@ public:
 private:
 	Renderer& mRenderer;	
 	int mPickedResolution = 0;
-	int mPickedScene = 3;
+	int mPickedScene = 0;
+	int mPickedBuilder = 0;
+	bool mOptimizeTreelets = false;
 	int mEditingLight = 0;
 	bool mShowEditor = false;
 	bool mSampleLights = false;
+	bool mMortonOrder = MORTON_PIXEL_ORDER;
+	bool mCoherentQueues = COHERENT_QUEUES;
+	bool mPathStatistics = false;
+	bool mTransmissiveShadows = TRANSMISSIVE_SHADOWS;
 
 	bool mUpdating = false;
 	DirectX::XMFLOAT3 mLightPos;
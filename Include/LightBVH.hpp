@@ -0,0 +1,57 @@
+﻿#pragma once
+#include "SceneCatalog.hpp"
+#include "Nvidia-SBVH/linear_math.h"
+#include <DirectXMath.h>
+#include <algorithm>
+#include <vector>
+
+// largest emission component, the lights are picked by it
+inline float lightPower(const Light& light)
+{
+	return std::max(light.emission.x, std::max(light.emission.y, light.emission.z));
+}
+
+// Bounding sphere hierarchy over the spherical lights. A shadow ray picks its light by a single descent from the root,
+// every step chooses a child by its importance at the shading point, so the lights which can't reach it are never picked.
+// Extension rays find the emitters they hit by traversing it instead of testing every light.
+// The kernels do the same in lightTree.h, the CPU versions check them in the benchmark.
+class LightBVH
+{
+public:
+	struct alignas(16) Node
+	{
+		DirectX::XMFLOAT3 center; // bounding sphere of the light spheres
+		float radius;
+		float power; // sum of the largest emission components
+		float range; // largest falloff of the lights, nothing farther from the bounding sphere is lit
+		int leftIndex; // index of the light in leaves
+		int rightIndex; // -1 in leaves
+	};
+
+public:
+	LightBVH() = default;
+	explicit LightBVH(const std::vector<Light>& lights);
+
+	// light picked for the shading point by a uniform random number and the probability it's picked with,
+	// zero probability if no light reaches the point
+	size_t sample(const Vec3f& position, const Vec3f& normal, float u, float& pdf) const;
+	// probability of the light being picked for the shading point, the product of the choices on its path from the root
+	float pdf(const Vec3f& position, const Vec3f& normal, size_t light) const;
+
+	// closest light sphere in front of the ray origin nearer than the distance, -1 if there's none
+	int intersect(const Vec3f& origin, const Vec3f& direction, float& distance) const;
+
+	// bounds and power of the nodes above the light after it changed, the nodes are appended to the changed ones,
+	// the tree isn't rebuilt so it gets worse as the light moves away from its neighbours
+	void refit(const std::vector<Light>& lights, size_t light, std::vector<int>& changed);
+
+	const std::vector<Node>& getNodes() const { return mNodes; }
+
+private:
+	int build(const std::vector<Light>& lights, std::vector<uint32_t>& order, size_t begin, size_t end, int parent);
+
+private:
+	std::vector<Node> mNodes; // parents before their children, the root is the first one
+	std::vector<int> mParents; // of the nodes, -1 for the root
+	std::vector<int> mLeaves; // of the lights
+};
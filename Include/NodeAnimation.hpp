@@ -0,0 +1,56 @@
+﻿#pragma once
+#include <vector>
+#include <cstdint>
+#include <assimp/anim.h>
+#include <assimp/matrix4x4.h>
+
+struct aiScene;
+struct aiNode;
+
+// Rigid animation of scene nodes, plays the first animation of the scene in a loop.
+// Nodes are indexed depth first, the same way the BVH indexes the instances.
+class NodeAnimation
+{
+public:
+	NodeAnimation() = default;
+	explicit NodeAnimation(const aiScene* scene);
+
+	bool empty() const { return mChannels.empty(); }
+
+	// advances the animation, returns nodes whose world transform changed (in increasing order)
+	const std::vector<uint32_t>& update(float dt);
+	const aiMatrix4x4& getTransform(uint32_t node) const { return mNodes[node].world; }
+
+private:
+	struct Node
+	{
+		uint32_t parent;
+		int channel = -1;
+		aiMatrix4x4 local;
+		aiMatrix4x4 world;
+	};
+
+	struct Channel
+	{
+		std::vector<aiVectorKey> positions;
+		std::vector<aiQuatKey> rotations;
+		std::vector<aiVectorKey> scalings;
+
+		// used for key types the channel doesn't have
+		aiVector3D restPosition;
+		aiQuaternion restRotation;
+		aiVector3D restScaling;
+	};
+
+	void addNode(const aiNode* node, uint32_t parent);
+	aiMatrix4x4 evaluate(const Channel& channel) const;
+
+private:
+	std::vector<Node> mNodes;
+	std::vector<Channel> mChannels;
+	std::vector<uint32_t> mChanged;
+	std::vector<aiString> mNames; // of the nodes, only needed to bind the channels
+	double mTime = 0.0; // in ticks
+	double mDuration = 0.0;
+	double mTicksPerSecond = 25.0;
+};
@@ -29,6 +29,8 @@
 #include <cmath>
 #include "linear_math.h"
 #include <string.h>
+#include <climits>
+#include <algorithm>
 #include "Util.h"
 
 
@@ -63,7 +65,9 @@ public:
 	T*              getPtr(int idx = 0)                   { FW_ASSERT(idx >= 0 && idx <= m_size); return m_ptr + idx; }
 
 	int             getStride(void) const                    { return sizeof(T); }
-	int             getNumBytes(void) const                    { return getSize() * getStride(); }
+	size_t          getNumBytes(void) const                    { return (size_t)getSize() * getStride(); }
+	int             getCapacity(void) const                    { return m_alloc; }
+	size_t          getCapacityBytes(void) const               { return (size_t)m_alloc * sizeof(T); }
 
 	void            reset(int size = 0)                  { clear(); setCapacity(size); m_size = size; }
 	void            clear(void)                          { m_size = 0; }
@@ -134,10 +138,11 @@ template <class T> void Array<T>::resize(int size)
 
 	if (size > m_alloc)
 	{
-		int newAlloc = max1i((int)(MinBytes / sizeof(T)), 1);
+		// doubling in 64 bits, arrays over 2^30 elements would overflow it
+		S64 newAlloc = max1i((int)(MinBytes / sizeof(T)), 1);
 		while (size > newAlloc)
 			newAlloc <<= 1;
-		realloc(newAlloc);
+		realloc((int)std::min(newAlloc, (S64)INT_MAX));
 	}
 
 	m_size = size;
@@ -30,6 +30,10 @@
 #include "BVHNode.h"
 #include <cstdio>
 #include <string>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <stdexcept>
 
 typedef float F32;
 
@@ -52,16 +56,41 @@ class BVH
 public:
 	struct Stats   
 	{
+		enum
+		{
+			NumDepthBins = 65,      // the last bin takes the deeper leaves
+			NumLeafSizeBins = 17,   // leaves by their triangle count, the last bin takes the larger ones
+		};
+
 		Stats()             { clear(); }
 		void clear()        { memset(this, 0, sizeof(Stats)); }
-		void print() const  {} //printf("Tree stats: [bfactor=%d] %d nodes (%d+%d), %.2f SAHCost, %.1f children/inner, %.1f tris/leaf\n", branchingFactor, numLeafNodes + numInnerNodes, numLeafNodes, numInnerNodes, SAHCost, 1.f*numChildNodes / max1i(numInnerNodes, 1), 1.f*numTris / max1i(numLeafNodes, 1)); }
+		void print() const;
 
 		F32     SAHCost;           // Surface Area Heuristic cost
+		F32     builtSAHCost;      // before the treelet optimization
 		S32     branchingFactor;
 		S32     numInnerNodes;
 		S32     numLeafNodes;
 		S32     numChildNodes;
-		S32     numTris;
+		S32     numTris;           // references in the leaves, duplicates included
+		S64     numDuplicates;     // references added by spatial splits
+		S32     maxDepth;
+		S32     depthHistogram[NumDepthBins];       // leaves by depth
+		S32     leafSizeHistogram[NumLeafSizeBins]; // leaves by triangle count
+		size_t  peakBytes;
+	};
+
+	// thrown by the builders on the thread of the build once BuildParams::cancelled is set
+	struct Cancelled : std::runtime_error
+	{
+		Cancelled(void) : std::runtime_error("BVH build cancelled") {}
+	};
+
+	enum Builder
+	{
+		SBVH,   // spatial splits, best trees but slow
+		LBVH,   // Morton code order split on the highest differing bit, fast but worse trees
+		HLBVH,  // LBVH treelets joined by a SAH built top, nearly as fast as LBVH
 	};
 
 	struct BuildParams
@@ -69,36 +98,69 @@ public:
 		Stats*      stats;
 		bool        enablePrints;
 		F32         splitAlpha;     // spatial split area threshold, see Nvidia paper on SBVH by Martin Stich, usually 0.05
+		Builder     builder;
+		S32         maxLeafSize;    // triangles in a leaf of LBVH and HLBVH, SBVH decides by SAH
+		S32         treeletPasses;  // treelet restructuring passes over the built tree, 0 disables them
+		size_t      memoryBudget;   // bytes of working memory, larger builds go out of core by spatial clusters, 0 is unlimited
+		const char* tempDirectory;  // of the files of the out-of-core build, NULL is the temp directory of the system
+		const std::atomic<bool>* cancelled; // set by another thread to stop the build, NULL never stops it
+		std::function<void(F32)> progress;  // called with the share of the build done on its thread, empty doesn't report
+		F32         duplicationBudget; // SBVH references duplicated by spatial splits relative to the triangles, negative is unlimited
+		S64         maxDuplicates;  // absolute limit of the duplicates, negative is unlimited, the smaller of the two applies
+		Platform    platform;       // SAH costs of all builders, leaf size bounds of SBVH
 
 		BuildParams(void)
 		{
 			stats = NULL;
 			enablePrints = true;
 			splitAlpha = 1.0e-5f;
+			builder = SBVH;
+			maxLeafSize = 4;
+			treeletPasses = 0;
+			memoryBudget = 0;
+			tempDirectory = NULL;
+			cancelled = NULL;
+			duplicationBudget = 1.0f;
+			maxDuplicates = -1;
 		}
 
+		bool        isCancelled(void) const         { return cancelled && cancelled->load(std::memory_order_relaxed); }
+		void        checkCancelled(void) const      { if (isCancelled()) throw Cancelled(); }
+		void        reportProgress(F32 done) const  { if (progress) progress(done); }
 	};
 
 public:
 	BVH(GPUScene* scene, const Platform& platform, const BuildParams& params);
-	~BVH(void)                  { if (m_root) m_root->deleteSubtree(); } 
 
 	GPUScene*           getScene(void) const           { return m_scene; }
 	const Platform&     getPlatform(void) const        { return m_platform; }
-	BVHNode*            getRoot(void) const            { return m_root; } 
+
+	// nodes are stored with every parent before its children, the root is the first one
+	Array<BVHNode>&         getNodes(void)                 { return m_nodes; }
+	const Array<BVHNode>&   getNodes(void) const           { return m_nodes; }
+	const BVHNode&      getNode(S32 idx) const         { return m_nodes[idx]; }
+	int                 getNumNodes(void) const        { return m_nodes.getSize(); }
 
 	Array<S32>&         getTriIndices(void)                  { return m_triIndices; }
 	const Array<S32>&   getTriIndices(void) const            { return m_triIndices; }
-	const int			getNumNodes(void) const { return m_numNodes; }
 
-private:
+	size_t              getPeakBytes(void) const       { return m_peakBytes; }   // working memory of the build at its peak
+	void                updatePeakBytes(size_t bytes)  { m_peakBytes = std::max(m_peakBytes, bytes); }
 
-	GPUScene*              m_scene;
+	int                 getSubtreeSize(BVH_STAT stat = BVH_STAT_NODE_COUNT) const;
+	float               computeSAHCost(void) const;
+	void                computeStats(Stats& stats) const; // SAH costs are left to the caller
+
+	// renumbers the nodes in depth first order, builders and optimizations which don't keep parents before children call it
+	void                reorderDepthFirst(void);
+
+private:
+	GPUScene*           m_scene;
 	Platform            m_platform;
 
-	BVHNode*            m_root;
-	Array<S32>        m_triIndices;
-	int					m_numNodes;
+	Array<BVHNode>      m_nodes;
+	Array<S32>          m_triIndices;
+	size_t              m_peakBytes;
 };
 
 
@@ -63,62 +63,24 @@ private:
 	Vec3f           m_mx; // AABB max bound
 };
 
+// Node of the BVH arena, children are indices into the same arena
 class BVHNode
 {
 public:
-	BVHNode() : m_probability(1.f), m_parentProbability(1.f), m_treelet(-1), m_index(-1) {} 
-	virtual bool        isLeaf() const = 0;               
-	virtual S32         getNumChildNodes() const = 0;
-	virtual BVHNode*    getChildNode(S32 i) const = 0;
-	virtual S32         getNumTriangles() const { return 0; }
+	BVHNode() : m_lo(0), m_hi(0) { m_children[0] = -1; m_children[1] = -1; }
 
-	float       getArea() const     { return m_bounds.area(); }
-
-	AABB        m_bounds;
-
-	// These are somewhat experimental, for some specific test and may be invalid...
-	float       m_probability;          // probability of coming here (widebvh uses this)
-	float       m_parentProbability;    // probability of coming to parent (widebvh uses this)
-
-	int         m_treelet;              // for queuing tests (qmachine uses this)
-	int         m_index;                // in linearized tree (qmachine uses this)
-
-	// Subtree functions
-	int     getSubtreeSize(BVH_STAT stat = BVH_STAT_NODE_COUNT) const;
-	void    computeSubtreeProbabilities(const Platform& p, float parentProbability, float& sah);
-	float   computeSubtreeSAHCost(const Platform& p) const;     // NOTE: assumes valid probabilities
-	void    deleteSubtree();
+	static BVHNode      inner(const AABB& bounds, S32 child0, S32 child1) { BVHNode n; n.m_bounds = bounds; n.m_children[0] = child0; n.m_children[1] = child1; return n; }
+	static BVHNode      leaf(const AABB& bounds, S32 lo, S32 hi)          { BVHNode n; n.m_bounds = bounds; n.m_lo = lo; n.m_hi = hi; return n; }
 
-	void    assignIndicesDepthFirst(S32 index = 0, bool includeLeafNodes = true);
-	void    assignIndicesBreadthFirst(S32 index = 0, bool includeLeafNodes = true);
-};
-
-
-class InnerNode : public BVHNode
-{
-public:
-	InnerNode(const AABB& bounds, BVHNode* child0, BVHNode* child1)   { m_bounds = bounds; m_children[0] = child0; m_children[1] = child1; }
+	bool        isLeaf() const                  { return m_children[0] < 0; }
+	S32         getNumChildNodes() const        { return isLeaf() ? 0 : 2; }
+	S32         getChildNode(S32 i) const       { FW_ASSERT(i >= 0 && i < 2); return m_children[i]; }
+	S32         getNumTriangles() const         { return isLeaf() ? m_hi - m_lo : 0; }
 
-	bool        isLeaf() const                  { return false; }
-	S32         getNumChildNodes() const        { return 2; }
-	BVHNode*    getChildNode(S32 i) const       { FW_ASSERT(i >= 0 && i<2); return m_children[i]; }
-
-	BVHNode*    m_children[2];  
-};
-
-
-class LeafNode : public BVHNode
-{
-public:
-	LeafNode(const AABB& bounds, int lo, int hi)  { m_bounds = bounds; m_lo = lo; m_hi = hi; } 
-	LeafNode(const LeafNode& s)                 { *this = s; }
-
-	bool        isLeaf() const                  { return true; }
-	S32         getNumChildNodes() const        { return 0; }  // leafnode has 0 children
-	BVHNode*    getChildNode(S32) const         { return NULL; }
+	float       getArea() const     { return m_bounds.area(); }
 
-	S32         getNumTriangles() const         { return m_hi - m_lo; }
-	S32         m_lo;  // lower index in triangle list
-	S32         m_hi;  // higher index in triangle list
+	AABB        m_bounds;
+	S32         m_children[2];  // -1 in leaves
+	S32         m_lo;           // lower index in triangle list (leaves only)
+	S32         m_hi;           // higher index in triangle list (leaves only)
 };
-
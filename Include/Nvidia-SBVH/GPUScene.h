@@ -41,17 +41,18 @@ public:
 
 public:
 		
-	GPUScene(const S32 numTris, const S32 numVerts, const Array<Triangle>& tris, const Array<Vec3f>& verts) : 
+	// view of the geometry, it isn't copied and has to outlive the scene
+	GPUScene(const S32 numTris, const S32 numVerts, const Triangle* tris, const Vec3f* verts) : 
 		m_numTris(numTris), m_numVerts(numVerts), m_tris(tris), m_verts(verts) {}
 
 	~GPUScene(void) {};
 
 	int             getNumTriangles(void) const   { return m_numTris; }
-	const Triangle* getTrianglePtr(int idx = 0)   { FW_ASSERT(idx >= 0 && idx <= m_numTris); return (const Triangle*)m_tris.getPtr() + idx; }
+	const Triangle* getTrianglePtr(int idx = 0)   { FW_ASSERT(idx >= 0 && idx <= m_numTris); return m_tris + idx; }
 	const Triangle& getTriangle(int idx)          { FW_ASSERT(idx < m_numTris); return *getTrianglePtr(idx); }
 
 	int             getNumVertices(void) const    { return m_numVerts; }
-	const Vec3f*    getVertexPtr(int idx = 0)     { FW_ASSERT(idx >= 0 && idx <= m_numVerts); return (const Vec3f*)m_verts.getPtr() + idx; }
+	const Vec3f*    getVertexPtr(int idx = 0)     { FW_ASSERT(idx >= 0 && idx <= m_numVerts); return m_verts + idx; }
 	const Vec3f&    getVertex(int idx)            { FW_ASSERT(idx < m_numVerts); return *getVertexPtr(idx); }
 
 private:
@@ -61,7 +62,7 @@ private:
 private:
 	S32             m_numTris;
 	S32             m_numVerts;
-	Array<Triangle>      m_tris;     
-	Array<Vec3f>         m_verts; 
+	const Triangle* m_tris;
+	const Vec3f*    m_verts;
 };
 
@@ -0,0 +1,62 @@
+#pragma once
+#include "BVH.h"
+#include <vector>
+#include <cstdint>
+
+// Linear BVH builder, see "Fast BVH Construction on GPUs" by Lauterbach et al., 2009.
+// Triangles are sorted along the Morton curve of their centroids by a parallel radix sort,
+// every node splits its range where the highest differing bit of the codes flips.
+// Triangles sharing the top TreeletBits of the code form treelets which are built in parallel.
+// LBVH joins them by the same Morton splits, HLBVH (Pantaleoni and Luebke, 2010) by SAH splits.
+class LBVHBuilder
+{
+private:
+	enum
+	{
+		MortonBits = 10,   // per axis
+		CodeBits = 3 * MortonBits,
+		TreeletBits = 12,
+		RadixBits = 8,
+	};
+
+	struct Treelet
+	{
+		S32             lo;      // range of sorted triangles
+		S32             hi;
+		U32             code;    // shared top bits
+		S32             offset;  // of the treelet nodes in the BVH arena
+		Array<BVHNode>  nodes;   // built separately, children index this array
+	};
+
+public:
+	LBVHBuilder(BVH& bvh, const BVH::BuildParams& params);
+
+	void                    run(void);
+
+private:
+	void                    computeCodes(void);
+	void                    sortCodes(void);
+	void                    createTreelets(void);
+
+	S32                     buildTreelet(Array<BVHNode>& nodes, S32 lo, S32 hi, int bit);
+	S32                     buildMortonTop(S32 lo, S32 hi, int bit);
+	S32                     buildSAHTop(S32 lo, S32 hi);
+	BVHNode                 createLeaf(S32 lo, S32 hi);
+	void                    copyTreelet(const Treelet& treelet);
+
+	U32                     getCode(S32 index) const { return static_cast<U32>(m_keys[index] >> 32); }
+	const AABB&             getBounds(const Treelet& treelet) const { return treelet.nodes[0].m_bounds; }
+
+private:
+	LBVHBuilder(const LBVHBuilder&); // forbidden
+	LBVHBuilder&            operator=(const LBVHBuilder&); // forbidden
+
+private:
+	BVH&                    m_bvh;
+	const BVH::BuildParams& m_params;
+
+	std::vector<uint64_t>   m_keys;       // Morton code in the high half, triangle index in the low half
+	std::vector<AABB>       m_triBounds;
+	std::vector<Treelet>    m_treelets;
+	S32                     m_numTopNodes;  // top nodes come first in the arena, the treelets after them
+};
@@ -0,0 +1,86 @@
+#pragma once
+#include "BVH.h"
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Builder of meshes whose in-core build doesn't fit into BuildParams::memoryBudget.
+// Triangle indices are spilled into temporary files by octants of their centroid bounds, clusters over the budget
+// are streamed from their file and split again. Every cluster is then loaded and built alone by the in-core builder
+// chosen in the params, its nodes go back to the file. A SAH top joins the clusters, it comes first in the arena
+// and the cluster nodes are copied after it, the same layout LBVHBuilder produces for its treelets.
+class OutOfCoreBuilder
+{
+private:
+	enum
+	{
+		BlockSize = 16384,      // triangle indices read or written by a single file access
+		MinClusterSize = 4096,  // tiny budgets would end up with more files than triangles
+	};
+
+	// binary file in the given or the system temp directory, it's removed with the object
+	class TempFile
+	{
+	public:
+		explicit TempFile(const char* directory);
+		~TempFile(void);
+
+		void                write(const void* data, size_t bytes);  // appends, the file is opened by the first access
+		void                read(void* data, size_t bytes);         // reads on from the start of a closed file
+		void                close(void);
+		void                clear(void);
+
+	private:
+		TempFile(const TempFile&); // forbidden
+		TempFile&           operator=(const TempFile&); // forbidden
+
+	private:
+		std::fstream        m_stream;
+		std::string         m_path;
+	};
+
+	struct Cluster
+	{
+		std::unique_ptr<TempFile>   file;       // triangle indices, after the build the nodes and the sorted indices
+		S32                         numTris;
+		AABB                        bounds;     // of the triangles, of the built root later
+		AABB                        centroids;
+		S32                         numNodes;
+		S32                         offset;     // of the cluster nodes in the BVH arena
+		S32                         triOffset;  // of the cluster triangle indices
+
+		explicit Cluster(const char* directory) : file(new TempFile(directory)), numTris(0), numNodes(0), offset(0), triOffset(0) {}
+	};
+
+public:
+	OutOfCoreBuilder(BVH& bvh, const BVH::BuildParams& params);
+
+	void                    run(void);
+
+	// working memory of the in-core build of the given triangles, duplicates of SBVH included
+	static size_t           estimateBytes(const BVH::BuildParams& params, S32 numTris);
+
+private:
+	void                    partition(void);
+	void                    split(Cluster& cluster, std::vector<Cluster>& children);
+	void                    append(Cluster& cluster, Array<S32>& block, S32 tri);
+	void                    flush(Cluster& cluster, Array<S32>& block);
+	void                    buildCluster(Cluster& cluster);
+	S32                     buildTop(S32 lo, S32 hi);
+	void                    copyCluster(Cluster& cluster);
+
+	AABB                    getBounds(S32 tri) const;
+
+private:
+	OutOfCoreBuilder(const OutOfCoreBuilder&); // forbidden
+	OutOfCoreBuilder&       operator=(const OutOfCoreBuilder&); // forbidden
+
+private:
+	BVH&                    m_bvh;
+	const BVH::BuildParams& m_params;
+
+	S32                     m_clusterSize;  // triangles of a cluster built in core within the budget
+	std::vector<Cluster>    m_clusters;
+	S32                     m_numTopNodes;
+};
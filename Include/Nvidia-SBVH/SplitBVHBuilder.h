@@ -37,6 +37,7 @@ private:
 		MaxDepth = 64,
 		MaxSpatialDepth = 48,
 		NumSpatialBins = 32,
+		ProgressLevels = 10,    // nodes above it report the progress, a thousand calls at most
 	};
 
 	struct Reference   /// a AABB bounding box enclosing 1 triangle, a reference can be duplicated by a split to be contained in 2 AABB boxes
@@ -86,14 +87,14 @@ public:
 	SplitBVHBuilder(BVH& bvh, const BVH::BuildParams& params);
 	~SplitBVHBuilder(void);
 
-	BVHNode*                run(int &numNodes);
+	void                    run(void);
 
 private:
 	static int              sortCompare(void* data, int idxA, int idxB);
 	static void             sortSwap(void* data, int idxA, int idxB);
 
-	BVHNode*                buildNode(const NodeSpec& spec, int level, F32 progressStart, F32 progressEnd);
-	BVHNode*                createLeaf(const NodeSpec& spec);
+	S32                     buildNode(const NodeSpec& spec, int level, F32 progressStart, F32 progressEnd);
+	S32                     createLeaf(const NodeSpec& spec);
 
 	ObjectSplit             findObjectSplit(const NodeSpec& spec, F32 nodeSAH);
 	void                    performObjectSplit(NodeSpec& left, NodeSpec& right, const NodeSpec& spec, const ObjectSplit& split);
@@ -118,8 +119,8 @@ private:
 	SpatialBin              m_bins[3][NumSpatialBins];
 
 	FW::Timer               m_progressTimer;
-	S32                     m_numDuplicates;
-	int						m_numNodes;
+	S64                     m_numDuplicates;
+	S64                     m_maxDuplicates;    // budget of the spatial splits, object splits take over once it's used up
 };
 
 	
\ No newline at end of file
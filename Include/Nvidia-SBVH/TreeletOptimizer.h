@@ -0,0 +1,46 @@
+#pragma once
+#include "BVH.h"
+#include <vector>
+#include <atomic>
+
+// Restructures small treelets of a built BVH to lower its SAH cost,
+// see "Fast Parallel Construction of High-Quality Bounding Volume Hierarchies" by Karras and Aila, 2013.
+// Every inner node, children first, grows a treelet by expanding its largest leaf until there are TreeletLeaves of them
+// and the optimal topology over those leaves is found by dynamic programming over their subsets.
+// Only inner nodes of the treelet are reused, leaves and their triangle ranges stay as they are.
+// Nodes keep their arena slots and only their children are rewired, BVH::reorderDepthFirst() restores the order afterwards.
+class TreeletOptimizer
+{
+private:
+	enum
+	{
+		TreeletLeaves = 7,
+		NumSubsets = 1 << TreeletLeaves,
+		ParallelDepth = 6,  // subtrees under this depth are optimized in parallel, the top above them afterwards
+	};
+
+public:
+	TreeletOptimizer(BVH& bvh, const BVH::BuildParams& params);
+
+	void                    run(void);
+
+private:
+	void                    optimizeSubtree(S32 node);
+	void                    optimizeTop(S32 node, int depth);
+	void                    collectSubtrees(S32 node, int depth, std::vector<S32>& subtrees);
+
+	void                    updateCost(S32 node);
+	void                    optimizeTreelet(S32 root);
+
+private:
+	TreeletOptimizer(const TreeletOptimizer&); // forbidden
+	TreeletOptimizer&       operator=(const TreeletOptimizer&); // forbidden
+
+private:
+	Array<BVHNode>&         m_nodes;
+	const Platform&         m_platform;
+	const BVH::BuildParams& m_params;
+
+	std::vector<F32>        m_costs;  // SAH cost of the subtree by node index, not normalized by the root area
+	std::atomic<S32>        m_numRestructured;
+};
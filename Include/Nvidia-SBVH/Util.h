@@ -30,6 +30,7 @@
 #include "linear_math.h"
 #include <string>
 #include <ctime>
+#include <cstdint>
 
 
 #define FW_F32_MIN          (1.175494351e-38f)
@@ -40,11 +41,11 @@
 typedef unsigned char U8;
 typedef unsigned short U16;
 typedef unsigned int U32;
-typedef unsigned long U64;
+typedef uint64_t U64;   // long is 32 bits with MSVC
 typedef signed char S8;
 typedef signed short S16;
 typedef signed int S32;
-typedef signed long S64;
+typedef int64_t S64;
 typedef float F32;
 typedef double F64;
 
@@ -0,0 +1,38 @@
+﻿#pragma once
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Runs work(i) for all i < count on every core, chunks of grain indices are handed out to the threads.
+// Counts below two chunks aren't worth starting the threads and run on the caller.
+template<typename F>
+void parallelFor(size_t count, const F& work, size_t grain = 2048)
+{
+	const auto threads = std::min<size_t>(std::thread::hardware_concurrency(), count / grain);
+
+	if (threads < 2)
+	{
+		for (size_t i = 0; i < count; ++i)
+			work(i);
+
+		return;
+	}
+
+	std::atomic<size_t> next = 0;
+	auto worker = [&]()
+	{
+		for (auto begin = next.fetch_add(grain); begin < count; begin = next.fetch_add(grain))
+			for (auto i = begin; i < std::min(begin + grain, count); ++i)
+				work(i);
+	};
+
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < threads; ++i)
+		workers.emplace_back(worker);
+
+	worker();
+
+	for (auto& t : workers)
+		t.join();
+}
@@ -0,0 +1,72 @@
+﻿#pragma once
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include "SceneCatalog.hpp"
+#include "Nvidia-SBVH/BVH.h"
+
+// Read-only view of a whole file mapped into memory
+class MappedFile
+{
+public:
+	explicit MappedFile(const std::string& path);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	std::string_view data() const { return { mData, mSize }; }
+
+private:
+	void close();
+
+	void* mFile = nullptr;
+	void* mMapping = nullptr;
+	const char* mData = nullptr;
+	size_t mSize = 0;
+};
+
+struct ParseError : std::runtime_error
+{
+	ParseError(const std::string& source, size_t line, size_t column, const std::string& message);
+
+	size_t line;
+	size_t column;
+};
+
+// Parser of .params scene files. First row is the camera, every other row is a light:
+//   camera: x, y, z, pitch, yaw
+//   light:  x, y, z, falloff, emission r, g, b, radius
+// Empty lines and lines starting with # are skipped. The parser doesn't allocate except for the light list.
+// The .bvhparams files next to them have a single row of BVH build settings, written by the tune benchmark:
+//   bvh:    node cost, triangle cost, min leaf size, max leaf size (0 is unbounded), split alpha
+class ParamsParser
+{
+public:
+	ParamsParser(std::string_view data, std::string_view source = "params");
+
+	SceneCatalog::SceneParams parse();
+	// the settings of the row replace the ones in the params, the builder and the rest are kept
+	void parseBVH(BVH::BuildParams& params);
+
+	static SceneCatalog::SceneParams parseFile(const std::string& path);
+	static void parseBVHFile(const std::string& path, BVH::BuildParams& params);
+	static void writeBVHFile(const std::string& path, const BVH::BuildParams& params);
+
+private:
+	template<size_t N>
+	void parseRow(float (&values)[N], size_t (&columns)[N], const char* const (&names)[N], const char* row);
+
+	bool nextRow();
+	float parseFloat(const char* name, const char* row);
+	void skipSpaces();
+	[[noreturn]] void fail(const std::string& message) const;
+	[[noreturn]] void fail(const std::string& message, size_t column) const;
+
+private:
+	std::string_view mData;
+	std::string_view mSource;
+	size_t mPosition = 0;
+	size_t mLineStart = 0;
+	size_t mLine = 0;
+};
@@ -1,16 +1,23 @@
 ﻿#pragma once
 #include <d3d11.h>
 #include <utility>
+#include <future>
+#include <memory>
+#include <vector>
+#include <array>
+#include <chrono>
 
 #include "UniqueDX11.hpp"
 #include "Scene.hpp"
 #include "GUI.hpp"
+#include "AdaptiveSampling.hpp"
 
 class Renderer
 {
 	using Resolution = std::pair<unsigned, unsigned>;
 public:
 	Renderer(HWND hwnd, Resolution resolution);
+	~Renderer();
 
 	void update(float dt);
 	void draw();
@@ -19,8 +26,11 @@ private:
 	IDXGIAdapter* enumerateDevice();
 	void createDevice(HWND hwnd, Resolution resolution);
 	void initScene(const std::string& name);
+	void swapScene();
 	void createBuffers();
 	void createRenderTexture(Resolution res);
+	void updateAdaptiveSampling();
+	void updatePathStatistics();
 	void reloadComputeShaders(); // TODO rewrite
 	void captureScreen();
 	void resize(const Resolution& resolution);
@@ -35,6 +45,12 @@ private:
 	GUI mGUI;
 	Scene mScene;	
 
+	// scene loaded in the background, swapped in once it's ready
+	std::future<Scene> mSceneLoad;
+	std::shared_ptr<SceneLoadToken> mSceneLoadToken;
+	std::vector<std::future<Scene>> mCancelledLoads;
+	BVH::BuildParams mBVHParams; // of the scenes loaded next
+
 	uni::Swapchain mSwapChain;
 	uni::Device mDevice;
 	uni::DeviceContext mContext;
@@ -48,6 +64,7 @@ private:
 	uni::ComputeShader mShaderMaterialGlass;
 	uni::ComputeShader mShaderExtensionRay;
 	uni::ComputeShader mShaderShadowRay;
+	uni::ComputeShader mShaderAdaptive;
 	
 	uni::InputLayout mVertexLayout;
 
@@ -64,5 +81,25 @@ private:
 	uni::UnorderedAccessView mQueueUAV;
 	uni::UnorderedAccessView mQueueCountersUAV;
 
+	// adaptive sampling, the buffers are sized by the render texture
+	AdaptiveSampling mAdaptive;
+	Buffer mScheduleBuffer;
+	uni::Buffer mPixelSamplesBuffer;
+	uni::UnorderedAccessView mPixelSamplesUAV;
+	uni::Buffer mTileErrorBuffer;
+	uni::UnorderedAccessView mTileErrorUAV;
+	std::array<uni::Buffer, 2> mTileErrorStaging;
+	std::array<int64_t, 2> mTileErrorFrame = { -1, -1 }; // frame the staging copy was made at
+	int64_t mFrame = 0; // frames rendered since the image was cleared
+	bool mScheduleDirty = false;
+
+	// lengths of the paths ended since the image was cleared and the samples finished per second, the kernels count them
+	// into the queue counters while the GUI shows them, a copy of every frame is read back two frames later
+	std::array<uni::Buffer, 2> mPathLengthStaging;
+	std::array<int64_t, 2> mPathLengthFrame = { -1, -1 };
+	std::array<uint64_t, PATH_LENGTH_BINS> mPathLengths = {};
+	double mSamplesPerSecond = 0.0;
+	std::chrono::steady_clock::time_point mPathLengthTime;
+
 	friend class GUI;
 };
@@ -0,0 +1,47 @@
+﻿#pragma once
+#include <DirectXMath.h>
+#include <cstdint>
+#include "Constants.hpp"
+
+// Random numbers of a path, the same as random.h of the kernels. They are given by the pixel, the sample of the pixel,
+// the bounce and the dimension, so no generator state is carried along the path. The dimensions of a bounce are points
+// of a 10D Sobol sequence (Joe-Kuo direction numbers), shuffled and Owen scrambled by hashes (Burley 2020) seeded
+// by the pixel and the bounce, otherwise they are independent PCG hashes.
+class Sampler
+{
+public:
+	// first dimension of the draws of a bounce, 2D draws take the next one too
+	enum Dimension
+	{
+		CAMERA = 0,
+		LIGHT_SELECTION = 2,
+		LIGHT_POINT = 3,
+		RUSSIAN_ROULETTE = 5,
+		LOBE = 6,
+		BSDF = 7,
+		GLASS = 9,
+		DIMENSIONS = 10,
+	};
+
+public:
+	Sampler(uint32_t pixel, uint32_t sampleIndex, bool sobol = SOBOL_SAMPLER);
+
+	void setBounce(uint32_t bounce);
+
+	float get1D(Dimension dimension) const;
+	DirectX::XMFLOAT2 get2D(Dimension dimension) const;
+
+	static uint32_t hash(uint32_t value); // PCG hash
+	static uint32_t hashCombine(uint32_t seed, uint32_t value);
+	static uint32_t reverseBits(uint32_t value);
+	static uint32_t scramble(uint32_t value, uint32_t seed); // nested uniform scramble of the bits from the top one
+	static uint32_t sobol(uint32_t index, uint32_t dimension);
+	static float toFloat(uint32_t value); // [0, 1) by the top 24 bits
+
+private:
+	uint32_t mPixelSeed;
+	uint32_t mSampleIndex;
+	uint32_t mSeed; // of the pixel and the bounce
+	uint32_t mIndex; // shuffled sample index of the bounce
+	bool mSobol;
+};
@@ -1,6 +1,7 @@
 ﻿#pragma once
 #include "Camera.hpp"
 #include "BVHWrapper.hpp"
+#include "NodeAnimation.hpp"
 #include <assimp/Importer.hpp>
 #include <d3d11.h>
 #include "UniqueDX11.hpp"
@@ -9,36 +10,15 @@
 #include <mutex>
 #include "Constants.hpp"
 #include <array>
-
-struct Light
-{
-	DirectX::XMFLOAT3 position;
-	float falloff;
-	DirectX::XMFLOAT3 emission;
-	float radius;
-};
-
-struct SceneParams
-{
-	SceneParams() { instance.loadScenes(); }
-	
-	void loadScenes();
-	size_t getSceneIndex(const std::string& name);
-	
-	struct CameraParam
-	{
-		DirectX::XMFLOAT3 position;
-		float pitch;
-		float yaw;
-	};
-	
-	std::vector<std::string> pathNames;
-	std::vector<const char*> pathsReference;
-	std::vector<std::vector<Light>> lights;
-	std::vector<CameraParam> cameraParams;
-
-	static SceneParams instance;
-};
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <stdexcept>
+#include "VirtualTexture.hpp"
+#include "SceneCatalog.hpp"
+#include "LightBVH.hpp"
+#include "AliasTable.hpp"
+#include "EnvironmentMap.hpp"
 
 struct alignas(16) MaterialProperty // TODO CBUFFER
 {
@@ -63,17 +43,30 @@ struct alignas(16) MaterialProperty // TODO CBUFFER
 	float transmittance; // for now, only as pad
 	
 	// int32_t indexDiffuse = -1;
-	int32_t textureIndices[3] = { -1, -1, -1 };
+	int32_t textureIndices[3] = { -1, -1, -1 }; // virtual texture indices
 	uint32_t materialType = UE4;
+
+	DirectX::XMFLOAT3 emission = {}; // emissive factor, the triangles of the material are lights unless it's black
+	int32_t emissionIndex = -1; // virtual texture index of the emissive texture, it multiplies the factor
+};
+
+// Progress and cancellation of a scene loaded in the background
+struct SceneLoadToken
+{
+	std::atomic<float> progress = 0.f;
+	std::atomic<bool> cancelled = false;
+};
+
+struct SceneLoadCancelled : std::runtime_error
+{
+	using std::runtime_error::runtime_error;
 };
 
 class Scene
 {
-	using RawTextureData = std::vector<std::vector<unsigned char>>;
-	using LoadedTextures = std::pair<RawTextureData, unsigned>;
 public:
 	Scene() = default;
-	Scene(ID3D11Device* device, const std::string& path);
+	Scene(ID3D11Device* device, const std::string& path, SceneLoadToken* token = nullptr, const BVH::BuildParams& bvhParams = BVH::BuildParams());
 
 	Scene(Scene&) = delete;
 	Scene& operator=(const Scene&) = delete;
@@ -82,17 +75,23 @@ public:
 	Scene& operator=(Scene&& scene) = default;
 
 	void update(float dt);
+	// uploads parts of the scene buffers changed by the animation or by edits of the BVH
+	void updateBuffers(ID3D11DeviceContext* context);
 
 private:
-	void loadScene(const std::string& path);
-	void loadTextures();
+	void loadScene(const std::string& path, SceneLoadToken* token);
+	void loadTextures(SceneLoadToken* token, const std::function<void(float)>& progress);
 	void createBVH();
 	void createSampler();
 	void createPropertyBuffer(const std::vector<MaterialProperty>& data);
 
-	LoadedTextures loadSpecificTexture(aiTextureType type, std::vector<MaterialProperty>& properties, MaterialProperty::Indices index) const;
-	void createTextures(LoadedTextures rawTextures, Texture& resource);
-	void createLights();
+	void createLights(const std::vector<Light>& lights);
+	void updateLights(); // rebuilds the light BVH and the light buffers after the lights changed
+	void updateLight(size_t index); // refits the light BVH after one light changed, uploaded by updateBuffers
+	void createEmissives(); // triangles of the emissive materials sampled as lights, after the BVH is built
+	void updateEmissives(const BVHWrapper::Range& instances); // powers of the emissive triangles of the moved instances, after a refit
+	float emissivePower(const BVHWrapper::InstanceTriangle& triangle) const;
+	void createEnvironment(); // HDR environment map next to the scene file with its sampling tables
 	
 private:	
 	ID3D11Device* mDevice;
@@ -100,20 +99,46 @@ private:
 	aiScene* mScene;
 	std::string mSceneName;
 	std::string mPath;
+	BVH::BuildParams mBVHParams;
+
+	BVHWrapper mBVH; // kept for refits of the animated or edited geometry
+	NodeAnimation mAnimation;
 
-	Buffer mBVHBuffer;
-	Buffer mIndexBuffer;
-	Buffer mVertexBuffer;
-	Buffer mTriangleProperties;
+	ChunkedBuffer mBVHBuffer;
+	ChunkedBuffer mIndexBuffer;
+	ChunkedBuffer mVertexBuffer;
+	ChunkedBuffer mTriangleProperties;
+	ChunkedBuffer mTrianglePositions; // empty without PRECOMPUTED_TRIANGLES
+	Buffer mInstanceBuffer;
+	Buffer mMeshGeometryBuffer; // empty without COMPRESSED_GEOMETRY
 	Buffer mLightBuffer;
+	Buffer mLightTreeBuffer;
+	Buffer mLightTableBuffer; // empty with LIGHT_TREE_SELECTION
 
 	uni::SamplerState mSampler;
 	uni::Buffer mMaterialPropertyBuffer;	
-	Texture mDiffuse;
-	Texture mMetallicRoughness;
-	Texture mNormal;
+	Buffer mOpacityBuffer; // of the materials, for the flagged triangles the rays hit
+	std::unique_ptr<VirtualTexture> mVirtualTexture;
 	
-	std::array<Light, MAX_LIGHTS> mLights;
+	std::vector<Light> mLights;
+	LightBVH mLightBVH;
+	AliasTable mLightTable; // over the power of the lights
+
+	std::vector<DirectX::XMFLOAT3> mEmissions; // of the materials
+	std::vector<BVHWrapper::InstanceTriangle> mEmissives;
+	std::vector<float> mEmissivePowers; // area times the largest emission component of the emissive triangles
+	AliasTable mEmissiveTable; // over their powers
+	Buffer mEmissiveBuffer;
+	Buffer mEmissiveTableBuffer;
+
+	Texture mEnvironmentTexture; // empty without an environment map, the CPU copy isn't kept
+	Buffer mEnvironmentTableBuffer;
+
+	// uploaded and reset by updateBuffers
+	BVHWrapper::Range mDirtyLights;
+	std::vector<int> mDirtyLightNodes;
+	bool mLightTableDirty = false;
+	bool mEmissiveTableDirty = false;
 
 	friend class Renderer; // TODO change the laziness
 	friend class GUI;
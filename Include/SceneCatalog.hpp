@@ -0,0 +1,78 @@
+﻿#pragma once
+#include <DirectXMath.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+
+struct Light
+{
+	DirectX::XMFLOAT3 position;
+	float falloff;
+	DirectX::XMFLOAT3 emission;
+	float radius;
+};
+
+// Index of scenes under Assets\Models. It's cached in an index file and only directories
+// which changed since the last run are listed again. Scene params are parsed when the scene is opened.
+class SceneCatalog
+{
+public:
+	struct CameraParam
+	{
+		DirectX::XMFLOAT3 position;
+		float pitch;
+		float yaw;
+	};
+
+	struct SceneParams
+	{
+		CameraParam camera;
+		std::vector<Light> lights;
+	};
+
+	static SceneCatalog& getInstance();
+
+	SceneParams getParams(const std::string& name);
+	size_t getSceneIndex(const std::string& name) const;
+	const std::string& getName(size_t index) const { return mEntries[index].name; }
+	const std::vector<const char*>& getNames() const { return mNames; }
+
+	static std::string getParamsPath(const std::string& name);
+	static std::string getBVHParamsPath(const std::string& name); // tuned BVH build settings, the file is optional
+	static std::string getEnvironmentPath(const std::string& name); // HDR environment map (.hdr or .pfm), empty without one
+
+private:
+	struct Entry
+	{
+		std::string name; // relative to Assets\Models
+		int64_t paramsTime = -1; // params file mtime the cached params were parsed from, 0 when there is no file
+		bool parsed = false;
+		SceneParams params;
+	};
+
+	struct Directory
+	{
+		int64_t time;
+		std::vector<std::string> subdirectories;
+		std::vector<std::string> scenes;
+	};
+
+	SceneCatalog();
+
+	bool load(std::unordered_map<std::string, Directory>& directories, std::unordered_map<std::string, Entry>& entries) const;
+	void save() const;
+	void scanDirectory(const std::string& relative, std::unordered_map<std::string, Directory>& cached, std::unordered_map<std::string, Entry>& entries);
+
+	static SceneParams defaultParams();
+
+private:
+	std::vector<Entry> mEntries;
+	std::unordered_map<std::string, size_t> mIndices;
+	std::unordered_map<std::string, Directory> mDirectories;
+	std::vector<const char*> mNames;
+
+	mutable std::mutex mMutex; // params are requested from scene loading threads
+	bool mDirty = false;
+};
@@ -0,0 +1,72 @@
+﻿#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Residency bookkeeping of virtual textures. It doesn't touch D3D at all - it consumes feedback
+// (flags of requested pages) and decides which tiles to stream in and which to evict,
+// so it can be driven by anything producing the feedback.
+class TileResidency
+{
+public:
+	struct TextureLayout
+	{
+		uint32_t pageOffset; // first page of the texture in the page table
+		uint32_t tiles; // tiles per side in mip 0
+		uint32_t mipCount;
+		uint32_t size; // texels per side in mip 0
+	};
+
+	struct Page
+	{
+		uint32_t texture;
+		uint32_t mip;
+		uint32_t x;
+		uint32_t y;
+	};
+
+	// page table entry - slot of the finest resident tile covering the page
+	static constexpr uint32_t ENTRY_VALID = 1u << 31;
+	static uint32_t makeEntry(uint32_t slot, uint32_t mip);
+
+	// mirrors the page lookup in virtualTexture.h
+	static uint32_t mipOffset(const TextureLayout& layout, uint32_t mip);
+	static uint32_t requestPage(const TextureLayout& layout, float u, float v, float lod);
+
+	void init(uint32_t textureCount, const uint32_t* sizes, uint32_t slotCount);
+
+	uint32_t addPinned(uint32_t page); // resident forever, returns slot
+	std::vector<uint32_t> process(const uint32_t* feedback, size_t count); // returns missing pages, coarsest first
+	int64_t allocate(uint32_t page); // returns slot or -1 when everything is in use
+	void commit(uint32_t page, uint32_t slot);
+	void nextFrame() { ++mFrame; }
+
+	Page decode(uint32_t page) const;
+	uint32_t encode(const Page& page) const;
+	const TextureLayout& layout(uint32_t texture) const { return mLayouts[texture]; }
+	const std::vector<uint32_t>& pageTable() const { return mPageTable; }
+	size_t pageCount() const { return mPageTable.size(); }
+	size_t residentCount() const { return mResidentCount; }
+
+	bool dirty = false;
+
+private:
+	void refresh(const Page& page);
+	void evict(uint32_t slot);
+
+	struct Slot
+	{
+		int64_t page = -1;
+		uint64_t lastUsed = 0;
+		bool pinned = false;
+		bool loading = false;
+	};
+
+	std::vector<TextureLayout> mLayouts;
+	std::vector<uint32_t> mPageTable;
+	std::vector<int32_t> mPageSlot; // slot of the page's own tile, -1 when not resident
+	std::vector<Slot> mSlots;
+	std::vector<uint32_t> mFreeSlots;
+	size_t mResidentCount = 0;
+	uint64_t mFrame = 1;
+};
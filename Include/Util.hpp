@@ -1,6 +1,11 @@
 ﻿#pragma once
 #include <utility>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
 #include "UniqueDX11.hpp"
+#include "Constants.hpp"
+#include "spdlog/fmt/fmt.h"
 
 struct Buffer
 {
@@ -8,36 +13,112 @@ struct Buffer
 	uni::ShaderResourceView srv;
 };
 
+// Buffer split into chunks of 2^bits elements, see geometry.h
+struct ChunkedBuffer
+{
+	std::vector<Buffer> chunks;
+	unsigned bits = 0;
+
+	// view of the chunk or nothing when the buffer is shorter
+	ID3D11ShaderResourceView* srv(size_t chunk)
+	{
+		if (chunk >= chunks.size())
+			return nullptr;
+
+		return chunks[chunk].srv;
+	}
+};
+
 struct Texture
 {
 	uni::Texure2D texture;
 	uni::ShaderResourceView srv;
 }; 
 
-template <typename T>
-Buffer createBuffer(ID3D11Device* device, unsigned stride, const T& data, DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN, UINT flags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED)
+inline Buffer createBuffer(ID3D11Device* device, unsigned stride, const void* data, size_t count, DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN, UINT flags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED)
 {
 	Buffer buffer;
+	if (count == 0)
+		return buffer; // D3D11 has no empty buffers, unbound view reads zeros
+
+	// the byte width is 32 bits, larger data has to be split by createChunkedBuffer
+	const auto bytes = static_cast<size_t>(stride) * count;
+	if (bytes > size_t(D3D11_REQ_RESOURCE_SIZE_IN_MEGABYTES_EXPRESSION_C_TERM) << 20)
+		throw std::runtime_error(fmt::format("Buffer of {} elements of {} bytes is over the size limit", count, stride));
 	
 	D3D11_BUFFER_DESC bufferDescriptor = {};
 	bufferDescriptor.Usage = D3D11_USAGE_DEFAULT;
 	bufferDescriptor.StructureByteStride = stride;
-	bufferDescriptor.ByteWidth = stride * data.size();
+	bufferDescriptor.ByteWidth = static_cast<UINT>(bytes);
 	bufferDescriptor.BindFlags = D3D11_BIND_SHADER_RESOURCE; // D3D11_BIND_UNORDERED_ACCESS
 	bufferDescriptor.CPUAccessFlags = 0;
 	bufferDescriptor.MiscFlags = flags;
 
 	D3D11_SUBRESOURCE_DATA bufferData = {};
-	bufferData.pSysMem = data.data();
+	bufferData.pSysMem = data;
 	
 	D3D11_SHADER_RESOURCE_VIEW_DESC srvDescriptor = {};
 	srvDescriptor.Format = format;
 	srvDescriptor.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
 	srvDescriptor.Buffer.FirstElement = 0;
-	srvDescriptor.Buffer.NumElements = data.size();
+	srvDescriptor.Buffer.NumElements = static_cast<UINT>(count);
 	
-	device->CreateBuffer(&bufferDescriptor, &bufferData, &buffer.buffer);
+	if (device->CreateBuffer(&bufferDescriptor, &bufferData, &buffer.buffer) != S_OK)
+		throw std::runtime_error(fmt::format("Failed to create buffer of {} bytes", bytes));
+
 	device->CreateShaderResourceView(buffer.buffer, &srvDescriptor, &buffer.srv);
 
 	return buffer;
 }
+
+template <typename T>
+Buffer createBuffer(ID3D11Device* device, unsigned stride, const T& data, DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN, UINT flags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED)
+{
+	return createBuffer(device, stride, data.data(), data.size(), format, flags);
+}
+
+// splits the data into at most GEOMETRY_CHUNKS buffers of GEOMETRY_CHUNK_BYTES
+template <typename T>
+ChunkedBuffer createChunkedBuffer(ID3D11Device* device, unsigned stride, const T& data, DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN, UINT flags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED)
+{
+	ChunkedBuffer buffer;
+	buffer.bits = geometryChunkBits(stride);
+
+	const auto chunkSize = size_t(1) << buffer.bits;
+	if (data.size() > chunkSize * GEOMETRY_CHUNKS)
+		throw std::runtime_error(fmt::format("Scene buffer of {} elements of {} bytes doesn't fit into {} chunks", data.size(), stride, GEOMETRY_CHUNKS));
+
+	const auto bytes = reinterpret_cast<const char*>(data.data());
+	for (size_t first = 0; first < data.size(); first += chunkSize)
+		buffer.chunks.emplace_back(createBuffer(device, stride, bytes + first * stride, std::min(chunkSize, data.size() - first), format, flags));
+
+	return buffer;
+}
+
+// uploads elements [begin, end) of the data to the same elements of the buffer
+template <typename T>
+void updateBuffer(ID3D11DeviceContext* context, ID3D11Buffer* buffer, unsigned stride, const T& data, size_t begin, size_t end)
+{
+	if (begin >= end)
+		return;
+
+	const D3D11_BOX box = { static_cast<UINT>(begin * stride), 0, 0, static_cast<UINT>(end * stride), 1, 1 };
+	context->UpdateSubresource(buffer, 0, &box, reinterpret_cast<const char*>(data.data()) + begin * stride, 0, 0);
+}
+
+// uploads elements [begin, end) of the data to the chunks they fall into
+template <typename T>
+void updateBuffer(ID3D11DeviceContext* context, ChunkedBuffer& buffer, unsigned stride, const T& data, size_t begin, size_t end)
+{
+	const auto bytes = reinterpret_cast<const char*>(data.data());
+
+	for (auto chunk = begin >> buffer.bits; chunk < buffer.chunks.size() && (chunk << buffer.bits) < end; ++chunk)
+	{
+		const auto first = chunk << buffer.bits;
+		const auto lo = std::max(begin, first) - first;
+		const auto hi = std::min(end, first + (size_t(1) << buffer.bits)) - first;
+
+		const D3D11_BOX box = { static_cast<UINT>(lo * stride), 0, 0, static_cast<UINT>(hi * stride), 1, 1 };
+		context->UpdateSubresource(buffer.chunks[chunk].buffer, 0, &box, bytes + (first + lo) * stride, 0, 0);
+	}
+}
@@ -0,0 +1,93 @@
+﻿#pragma once
+#include <d3d11.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <array>
+#include <fstream>
+#include <functional>
+#include <unordered_map>
+#include <cstdint>
+#include "UniqueDX11.hpp"
+#include "Util.hpp"
+#include "TileResidency.hpp"
+
+// Tiled textures streamed from the on-disk tile cache into a shared physical pool.
+class VirtualTexture
+{
+public:
+	struct Descriptor // GPU side of TileResidency::TextureLayout
+	{
+		uint32_t pageOffset;
+		uint32_t tiles;
+		uint32_t mipCount;
+		uint32_t size;
+	};
+
+	VirtualTexture(ID3D11Device* device);
+	~VirtualTexture();
+
+	VirtualTexture(VirtualTexture&) = delete;
+	VirtualTexture& operator=(const VirtualTexture&) = delete;
+
+	int32_t addTexture(const std::string& path); // returns the virtual texture index
+	// builds tile caches, creates resources and starts streaming, progress is called from the caching threads
+	void finalize(const std::atomic<bool>* cancelled = nullptr, const std::function<void(float)>& progress = {});
+	void update(ID3D11DeviceContext* context);
+
+	ID3D11ShaderResourceView* poolSRV() { return mPool.srv; }
+	ID3D11ShaderResourceView* pageTableSRV() { return mPageTable.srv; }
+	ID3D11ShaderResourceView* descriptorSRV() { return mDescriptors.srv; }
+	ID3D11UnorderedAccessView* feedbackUAV() { return mFeedbackUAV; }
+
+	const TileResidency& residency() const { return mResidency; }
+
+private:
+	struct CachedTexture
+	{
+		std::string source;
+		std::string cache;
+		uint32_t size;
+		uint32_t mipCount;
+	};
+
+	struct LoadedTile
+	{
+		uint32_t page;
+		uint32_t slot;
+		std::vector<unsigned char> data;
+	};
+
+	void buildCache(CachedTexture& texture) const;
+	std::vector<unsigned char> readTile(const TileResidency::Page& page);
+	void streamTiles();
+	void readFeedback(ID3D11DeviceContext* context);
+	void uploadTile(ID3D11DeviceContext* context, const LoadedTile& tile);
+
+private:
+	ID3D11Device* mDevice;
+	TileResidency mResidency;
+	std::vector<CachedTexture> mTextures;
+	std::vector<std::ifstream> mFiles; // opened tile caches, read only by the streaming thread after finalize
+	std::unordered_map<std::string, int32_t> mTextureIndices;
+
+	Texture mPool;
+	Buffer mPageTable;
+	Buffer mDescriptors;
+	uni::Buffer mFeedback;
+	uni::UnorderedAccessView mFeedbackUAV;
+	std::array<uni::Buffer, 2> mFeedbackStaging;
+	std::array<int64_t, 2> mFeedbackFrame = { -1, -1 }; // frame the staging copy was made at
+	int64_t mFrame = 0;
+
+	std::thread mStreamer;
+	std::mutex mMutex;
+	std::condition_variable mCondition;
+	std::deque<LoadedTile> mRequests;
+	std::deque<LoadedTile> mLoaded;
+	std::atomic<bool> mRunning = false;
+};
@@ -0,0 +1,154 @@
+﻿#include "AdaptiveSampling.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	// bits of the value spread to the even positions, x of a Morton code
+	uint32_t spreadBits(uint32_t value)
+	{
+		value &= 0x0000ffff;
+		value = (value | (value << 8)) & 0x00ff00ff;
+		value = (value | (value << 4)) & 0x0f0f0f0f;
+		value = (value | (value << 2)) & 0x33333333;
+		value = (value | (value << 1)) & 0x55555555;
+		return value;
+	}
+
+	// every other bit from the lowest one, the inverse of spreadBits
+	uint32_t compactBits(uint32_t value)
+	{
+		value &= 0x55555555;
+		value = (value ^ (value >> 1)) & 0x33333333;
+		value = (value ^ (value >> 2)) & 0x0f0f0f0f;
+		value = (value ^ (value >> 4)) & 0x00ff00ff;
+		value = (value ^ (value >> 8)) & 0x0000ffff;
+		return value;
+	}
+}
+
+float AdaptiveSampling::pixelError(float mean, float moment, uint32_t samples)
+{
+	if (samples == 0)
+		return 0.f;
+
+	return std::sqrt(std::max(moment - mean * mean, 0.f) / samples);
+}
+
+void AdaptiveSampling::reset(uint32_t width, uint32_t height, bool morton)
+{
+	mWidth = width;
+	mHeight = height;
+	mMorton = morton;
+	mTilesX = (width + ADAPTIVE_TILE_SIZE - 1) / ADAPTIVE_TILE_SIZE;
+	mTilesY = (height + ADAPTIVE_TILE_SIZE - 1) / ADAPTIVE_TILE_SIZE;
+	mActiveTiles = tileCount();
+	mMaxError = 0.f;
+
+	// consecutive tiles of the Morton order are neighbours, so are the pixels the threads of a dispatch start at,
+	// the curve goes over the whole square around the image, the tiles outside of it are left out
+	mOrder.resize(tileCount());
+	for (uint32_t i = 0; i < mOrder.size(); ++i)
+		mOrder[i] = i;
+
+	if (morton)
+		std::sort(mOrder.begin(), mOrder.end(), [this](uint32_t a, uint32_t b)
+		{
+			return (spreadBits(a % mTilesX) | spreadBits(a / mTilesX) << 1) < (spreadBits(b % mTilesX) | spreadBits(b / mTilesX) << 1);
+		});
+
+	mSchedule.clear();
+	mSchedulePaths = 0;
+	for (const auto i : mOrder)
+		addPass(i);
+}
+
+uint32_t AdaptiveSampling::tilePixels(uint32_t tile) const
+{
+	return std::min(mWidth - tile % mTilesX * ADAPTIVE_TILE_SIZE, ADAPTIVE_TILE_SIZE) * std::min(mHeight - tile / mTilesX * ADAPTIVE_TILE_SIZE, ADAPTIVE_TILE_SIZE);
+}
+
+std::pair<uint32_t, uint32_t> AdaptiveSampling::tilePixel(uint32_t tile, uint32_t position) const
+{
+	const auto cornerX = tile % mTilesX * ADAPTIVE_TILE_SIZE;
+	const auto cornerY = tile / mTilesX * ADAPTIVE_TILE_SIZE;
+	const auto width = std::min(mWidth - cornerX, ADAPTIVE_TILE_SIZE);
+	const auto height = std::min(mHeight - cornerY, ADAPTIVE_TILE_SIZE);
+
+	// the tiles over the edge go by rows over their pixels inside of the image, the Morton curve would leave gaps
+	if (width < ADAPTIVE_TILE_SIZE || height < ADAPTIVE_TILE_SIZE)
+		return { cornerX + position % width, cornerY + position / width };
+
+	const auto x = mMorton ? compactBits(position) : position % ADAPTIVE_TILE_SIZE;
+	const auto y = mMorton ? compactBits(position >> 1) : position / ADAPTIVE_TILE_SIZE;
+
+	return { cornerX + x, cornerY + y };
+}
+
+std::pair<uint32_t, uint32_t> AdaptiveSampling::schedulePixel(uint32_t position) const
+{
+	// the last pass starting at or before the position
+	const auto pass = std::upper_bound(mSchedule.begin(), mSchedule.end(), position, [](uint32_t p, const Pass& pass) { return p < pass.start; }) - 1;
+	return tilePixel(pass->tile, position - pass->start);
+}
+
+void AdaptiveSampling::addPass(uint32_t tile)
+{
+	mSchedule.push_back({ tile, mSchedulePaths });
+	mSchedulePaths += tilePixels(tile);
+}
+
+void AdaptiveSampling::update(const TileError* errors, size_t count, float targetError, uint32_t minSamples, uint32_t maxWeight)
+{
+	// errors of another resolution are stale
+	if (count != tileCount())
+		return;
+
+	// samples the tile needs to get to the target, the error falls with the square root of the samples,
+	// tiles with too few samples for a reliable estimate are sampled evenly until they have them
+	std::vector<float> needs(count);
+	auto maxNeed = 0.f;
+	auto warmup = false;
+	mMaxError = 0.f;
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		const auto& tile = errors[i];
+		mMaxError = std::max(mMaxError, tile.error);
+
+		if (tile.samples < minSamples)
+		{
+			warmup = true;
+			needs[i] = -1.f;
+		}
+		else if (tile.error > targetError)
+		{
+			const auto ratio = tile.error / targetError;
+			needs[i] = tile.samples * (ratio * ratio - 1.f);
+			maxNeed = std::max(maxNeed, needs[i]);
+		}
+	}
+
+	// passes by the need relative to the neediest tile, so the tiles get to the target together,
+	// the warmup ones take a single pass like the neediest one until all of them have the minimal samples
+	mWeights.assign(count, 0);
+	mActiveTiles = 0;
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (needs[i] < 0.f)
+			mWeights[i] = 1;
+		else if (needs[i] > 0.f)
+			mWeights[i] = warmup ? 1 : std::clamp(static_cast<uint32_t>(std::ceil(maxWeight * needs[i] / maxNeed)), 1u, maxWeight);
+
+		mActiveTiles += mWeights[i] > 0;
+	}
+
+	// the passes of a tile are spread over the schedule, the tiles of one round keep the order of the reset
+	mSchedule.clear();
+	mSchedulePaths = 0;
+	for (uint32_t round = 0; round < maxWeight; ++round)
+		for (const auto i : mOrder)
+			if (mWeights[i] > round)
+				addPass(i);
+}
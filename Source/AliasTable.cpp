@@ -0,0 +1,98 @@
+﻿#include "AliasTable.hpp"
+#include <algorithm>
+#include <numeric>
+
+AliasTable::AliasTable(const std::vector<float>& weights)
+	: mWeights(weights)
+{
+	build();
+}
+
+bool AliasTable::setWeight(size_t index, float weight)
+{
+	if (mWeights[index] == weight)
+		return false;
+
+	mWeights[index] = weight;
+	build();
+
+	return true;
+}
+
+size_t AliasTable::sample(float u, float& pdf) const
+{
+	float remainder;
+	return sample(mEntries.data(), mEntries.size(), u, pdf, remainder);
+}
+
+size_t AliasTable::sample(const Entry* entries, size_t count, float u, float& pdf, float& remainder)
+{
+	pdf = 0.f;
+	remainder = 0.f;
+	if (count == 0)
+		return 0;
+
+	// the integer part picks the entry, the fraction decides between its element and the alias
+	const auto scaled = u * count;
+	const auto index = std::min(static_cast<size_t>(scaled), count - 1);
+	const auto& entry = entries[index];
+	const auto fraction = scaled - index;
+
+	if (fraction < entry.threshold)
+	{
+		remainder = fraction / entry.threshold;
+		pdf = entry.pdf;
+		return index;
+	}
+
+	remainder = std::min((fraction - entry.threshold) / (1.f - entry.threshold), 0.99999994f);
+	pdf = entries[entry.alias].pdf;
+	return entry.alias;
+}
+
+// Vose's construction - elements under the average weight are filled up by the ones over it,
+// all the weights zero give an empty table so nothing is ever picked
+void AliasTable::build()
+{
+	const auto count = mWeights.size();
+	const auto total = std::accumulate(mWeights.begin(), mWeights.end(), 0.0);
+
+	mEntries.clear();
+	if (count == 0 || total <= 0.0)
+		return;
+
+	mEntries.resize(count);
+	mSmall.clear();
+	mLarge.clear();
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		// weight relative to the average, kept in the threshold while the table is built
+		const auto weight = mWeights[i];
+		mEntries[i] = { static_cast<float>(weight * count / total), static_cast<uint32_t>(i), static_cast<float>(weight / total) };
+
+		(mEntries[i].threshold < 1.f ? mSmall : mLarge).push_back(static_cast<uint32_t>(i));
+	}
+
+	while (!mSmall.empty() && !mLarge.empty())
+	{
+		const auto small = mSmall.back();
+		const auto large = mLarge.back();
+		mSmall.pop_back();
+
+		mEntries[small].alias = large;
+		mEntries[large].threshold -= 1.f - mEntries[small].threshold;
+
+		if (mEntries[large].threshold < 1.f)
+		{
+			mLarge.pop_back();
+			mSmall.push_back(large);
+		}
+	}
+
+	// what is left is one up to rounding
+	for (const auto i : mLarge)
+		mEntries[i].threshold = 1.f;
+	for (const auto i : mSmall)
+		mEntries[i].threshold = 1.f;
+}
@@ -1,97 +1,827 @@
 ﻿#include "BVHWrapper.hpp"
+#include "Parallel.hpp"
 #include "Nvidia-SBVH/BVH.h"
 #include "assimp/scene.h"
-#include <stack>
+#include "assimp/pbrmaterial.h"
+#include <DirectXPackedVector.h>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <tuple>
 
+namespace
+{
+	constexpr uint32_t QUANTIZATION_STEPS = (1u << 21) - 1; // largest coordinate of a quantized vertex, also the largest local vertex index
+
+	DirectX::XMFLOAT4 row(const aiMatrix4x4& m, unsigned r)
+	{
+		return { m[r][0], m[r][1], m[r][2], m[r][3] };
+	}
+
+	Vec3f transformPoint(const DirectX::XMFLOAT4 (&m)[3], const Vec3f& p)
+	{
+		return {
+			m[0].x * p.x + m[0].y * p.y + m[0].z * p.z + m[0].w,
+			m[1].x * p.x + m[1].y * p.y + m[1].z * p.z + m[1].w,
+			m[2].x * p.x + m[2].y * p.y + m[2].z * p.z + m[2].w,
+		};
+	}
+
+	// world bounds of the instance from transformed corners of the mesh bounds
+	AABB instanceBounds(const BVHWrapper::BVHNode& root, const BVHWrapper::Instance& instance)
+	{
+		AABB bounds;
+		for (unsigned corner = 0; corner < 8; ++corner)
+		{
+			const Vec3f p(corner & 1 ? root.max.x : root.min.x, corner & 2 ? root.max.y : root.min.y, corner & 4 ? root.max.z : root.min.z);
+			bounds.grow(transformPoint(instance.objectToWorld, p));
+		}
+
+		return bounds;
+	}
+
+	void setBounds(BVHWrapper::BVHNode& node, const AABB& box)
+	{
+		node.min = { box.min().x, box.min().y, box.min().z };
+		node.max = { box.max().x, box.max().y, box.max().z };
+	}
+
+	// union of min and max works even for empty children
+	void mergeBounds(BVHWrapper::BVHNode& node, const BVHWrapper::BVHNode& left, const BVHWrapper::BVHNode& right)
+	{
+		node.min = { std::min(left.min.x, right.min.x), std::min(left.min.y, right.min.y), std::min(left.min.z, right.min.z) };
+		node.max = { std::max(left.max.x, right.max.x), std::max(left.max.y, right.max.y), std::max(left.max.z, right.max.z) };
+	}
+
+	// decoded vertices may differ from the snapped ones in the last bit when the shader fuses the multiply-add,
+	// bounds grown by a quantization step stay conservative
+	void growBounds(BVHWrapper::BVHNode& node, const DirectX::XMFLOAT3& margin)
+	{
+		node.min = { node.min.x - margin.x, node.min.y - margin.y, node.min.z - margin.z };
+		node.max = { node.max.x + margin.x, node.max.y + margin.y, node.max.z + margin.z };
+	}
+
+	BVHWrapper::Packed3x21 pack(uint32_t x, uint32_t y, uint32_t z)
+	{
+		return { x | (y << 21), (y >> 11) | (z << 10) };
+	}
+
+	uint32_t quantize(float value, float origin, float scale)
+	{
+		return scale > 0.f ? std::min(static_cast<uint32_t>(std::lround((value - origin) / scale)), QUANTIZATION_STEPS) : 0u;
+	}
+
+	uint32_t snorm16(float value)
+	{
+		return static_cast<uint16_t>(static_cast<int16_t>(std::lround(std::clamp(value, -1.f, 1.f) * 32767.f)));
+	}
+
+	float signNotZero(float value)
+	{
+		return value >= 0.f ? 1.f : -1.f;
+	}
+
+	// octahedral mapping of the unit sphere onto the [-1, 1] square, the lower hemisphere is folded over its diagonals
+	uint32_t encodeNormal(const DirectX::XMFLOAT3A& normal)
+	{
+		const auto l1 = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+		if (l1 == 0.f)
+			return 0;
+
+		auto u = normal.x / l1;
+		auto v = normal.y / l1;
+
+		if (normal.z < 0.f)
+		{
+			const auto folded = (1.f - std::abs(v)) * signNotZero(u);
+			v = (1.f - std::abs(u)) * signNotZero(v);
+			u = folded;
+		}
+
+		return snorm16(u) | snorm16(v) << 16;
+	}
+
+	// texture coordinates lose precision past a few repeats of the texture, the halfs keep 11 bits of mantissa
+	uint32_t encodeTexCoord(const DirectX::XMFLOAT2& texCoord)
+	{
+		using DirectX::PackedVector::XMConvertFloatToHalf;
+		return XMConvertFloatToHalf(texCoord.x) | uint32_t(XMConvertFloatToHalf(texCoord.y)) << 16;
+	}
+
+	BVHWrapper::TrianglePositions trianglePositions(const Vec3f& v0, const Vec3f& v1, const Vec3f& v2)
+	{
+		const auto e1 = v1 - v0;
+		const auto e2 = v2 - v0;
+
+		return { { v0.x, v0.y, v0.z }, { e1.x, e1.y, e1.z }, { e2.x, e2.y, e2.z } };
+	}
+
+	// flat boxes still get some area, costs are divided by it
+	float area(const BVHWrapper::BVHNode& node)
+	{
+		return std::max(AABB({ node.min.x, node.min.y, node.min.z }, { node.max.x, node.max.y, node.max.z }).area(), FLT_MIN);
+	}
+
+	// SAH cost of every top level subtree in the node range, children follow their parent so the reverse order visits them first
+	void subtreeCosts(const std::vector<BVHWrapper::BVHNode>& nodes, size_t first, size_t last, std::vector<float>& costs)
+	{
+		for (auto i = last; i-- > first; )
+		{
+			const auto& node = nodes[i];
+			costs[i] = area(node) + (node.isLeaf ? 0.f : costs[node.leftIndex] + costs[node.rightIndex]);
+		}
+	}
+
+	// SAH split of the instances sorted along the widest axis of their centroids, every leaf holds a single instance.
+	// Nodes are written in preorder from the next index, so every subtree occupies a contiguous range of 2n - 1 nodes.
+	// Leaves are at most depth levels below the node, the splits leave no more instances to either side than fit in the levels left.
+	int buildTopLevel(std::vector<BVHWrapper::BVHNode>& nodes, int& next, std::vector<uint32_t>& order, size_t begin, size_t end, const std::vector<AABB>& bounds, size_t depth)
+	{
+		const auto nodeIndex = next++;
+
+		AABB box, centroids;
+		for (auto i = begin; i < end; ++i)
+		{
+			box.grow(bounds[order[i]]);
+			centroids.grow(bounds[order[i]].midPoint());
+		}
+
+		BVHWrapper::BVHNode node = {};
+		setBounds(node, box);
+
+		if (end - begin == 1)
+		{
+			node.leftIndex = order[begin];
+			node.rightIndex = order[begin] + 1;
+			node.isLeaf = true;
+			nodes[nodeIndex] = node;
+
+			return nodeIndex;
+		}
+
+		const auto extent = centroids.max() - centroids.min();
+		const auto axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		std::sort(order.begin() + begin, order.begin() + end, [&](uint32_t a, uint32_t b) { return bounds[a].midPoint()._v[axis] < bounds[b].midPoint()._v[axis]; });
+
+		// areas of all right parts first, then the cheapest split sweeping from the left
+		std::vector<float> rightArea(end - begin);
+		AABB right;
+		for (auto i = end - 1; i > begin; --i)
+		{
+			right.grow(bounds[order[i]]);
+			rightArea[i - begin] = right.area();
+		}
+
+		const auto half = depth > 32 ? SIZE_MAX : size_t(1) << (depth - 1);
+
+		AABB left;
+		auto split = begin + (end - begin) / 2;
+		auto bestCost = FLT_MAX;
+		for (auto i = begin + 1; i < end; ++i)
+		{
+			left.grow(bounds[order[i - 1]]);
+			if (i - begin > half || end - i > half)
+				continue;
 
-BVHWrapper::BVHWrapper(const aiScene* scene)
+			const auto cost = left.area() * (i - begin) + rightArea[i - begin] * (end - i);
+
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				split = i;
+			}
+		}
+
+		node.leftIndex = buildTopLevel(nodes, next, order, begin, split, bounds, depth - 1);
+		node.rightIndex = buildTopLevel(nodes, next, order, split, end, bounds, depth - 1);
+		nodes[nodeIndex] = node;
+
+		return nodeIndex;
+	}
+}
+
+BVHWrapper::BVHWrapper(const aiScene* scene, const BVH::BuildParams& params, bool precomputeTriangles, bool compressGeometry)
 	: mScene(scene)
+	, mBuildParams(params)
+	, mPrecomputeTriangles(precomputeTriangles && !compressGeometry) // positions are decoded from the quantized vertices instead
+	, mCompressGeometry(compressGeometry)
 {
-	buildSBVH();
+	// every mesh gets its BVH built once, no matter how many times it's placed in the scene
+	std::vector<BVHNode> meshNodes;
+	mMeshes.resize(mScene->mNumMeshes);
+
+	if (mCompressGeometry)
+		mMeshGeometry.resize(mScene->mNumMeshes);
+
+	for (size_t i = 0; i < mScene->mNumMaterials; ++i)
+		mOpacities.emplace_back(opacity(*mScene->mMaterials[i]));
+
+	// progress of the mesh builds is their share of the triangles
+	size_t totalFaces = 0, doneFaces = 0;
+	for (size_t i = 0; i < mScene->mNumMeshes; ++i)
+		totalFaces += mScene->mMeshes[i]->mNumFaces;
+
+	for (size_t i = 0; i < mScene->mNumMeshes; ++i)
+	{
+		// processing only triangles (means points and lines are not rendered)
+		if (~mScene->mMeshes[i]->mPrimitiveTypes & aiPrimitiveType_TRIANGLE)
+			continue;
+
+		params.checkCancelled();
+
+		const auto faces = mScene->mMeshes[i]->mNumFaces;
+		if (params.progress)
+			mBuildParams.progress = [&params, doneFaces, faces, totalFaces](float done) { params.reportProgress((doneFaces + done * faces) / totalFaces); };
+
+		buildMeshBVH(i, meshNodes);
+		doneFaces += faces;
+	}
+
+	// the token and the callback belong to the caller, they don't outlive the construction
+	mBuildParams.cancelled = nullptr;
+	mBuildParams.progress = nullptr;
+
+	uint32_t nodeIndex = 0;
+	collectInstances(mScene->mRootNode, aiMatrix4x4(), nodeIndex);
+
+	if (mInstances.empty())
+		throw std::runtime_error("Scene doesn't contain any triangles");
+
+	// the stack holds the sentinel and a node per level of the top level and the mesh BVH a ray is in
+	size_t meshLevels = 0, topLevels = 0;
+	for (const auto& mesh : mMeshes)
+		meshLevels = std::max(meshLevels, mesh.levels.size());
+
+	while ((size_t(1) << topLevels) < mInstances.size())
+		++topLevels;
+
+	if (meshLevels + topLevels > BVH_STACK_SIZE)
+		throw std::runtime_error("Scene is too deep for the traversal stack, the mesh BVHs have " + std::to_string(meshLevels) + " levels and "
+			+ std::to_string(mInstances.size()) + " instances need " + std::to_string(topLevels) + " more, the stack has " + std::to_string(BVH_STACK_SIZE));
+
+	mTopLevelDepth = BVH_STACK_SIZE - meshLevels;
+	buildTopLevelBVH(meshNodes);
+	params.reportProgress(1.f);
 }
 
-void BVHWrapper::buildSBVH()
+void BVHWrapper::setTransform(size_t instance, const aiMatrix4x4& transform)
 {
-	Array<GPUScene::Triangle> triangles;
-	
-	for (size_t i = 0; i < mScene->mNumMeshes; ++i)
+	if (std::abs(transform.Determinant()) == 0.f)
+		return;
+
+	auto inverse = transform;
+	inverse.Inverse();
+
+	for (unsigned r = 0; r < 3; ++r)
 	{
-		auto& mesh = *mScene->mMeshes[i];
+		mInstances[instance].worldToObject[r] = row(inverse, r);
+		mInstances[instance].objectToWorld[r] = row(transform, r);
+	}
 
-		// processing only triangles (means points and lines are not rendered)
-		if (~mesh.mPrimitiveTypes & aiPrimitiveType_TRIANGLE) 
+	mDirtyInstances.add(instance, instance + 1);
+	mInstancesDirty = true;
+}
+
+void BVHWrapper::setNodeTransform(uint32_t node, const aiMatrix4x4& transform)
+{
+	const auto [first, last] = std::equal_range(mInstanceNodes.begin(), mInstanceNodes.end(), node);
+
+	for (auto it = first; it != last; ++it)
+		setTransform(it - mInstanceNodes.begin(), transform);
+}
+
+void BVHWrapper::setVertices(size_t mesh, const aiVector3D* vertices, const aiVector3D* normals)
+{
+	auto& m = mMeshes[mesh];
+	if (m.root < 0)
+		return;
+
+	for (size_t i = 0; i < m.vertexCount; ++i)
+	{
+		mVertices[m.vertexOffset + i] = { vertices[i].x, vertices[i].y, vertices[i].z };
+
+		if (normals)
+			mTriangleProperties[m.vertexOffset + i].normal = { normals[i].x, normals[i].y, normals[i].z };
+	}
+
+	// bounds of the mesh changed, all of it is quantized again
+	if (mCompressGeometry)
+		compressMesh(mesh);
+
+	mDirtyVertices.add(m.vertexOffset, m.vertexOffset + m.vertexCount);
+	if (normals)
+		mDirtyProperties.add(m.vertexOffset, m.vertexOffset + m.vertexCount);
+
+	m.dirty = true;
+}
+
+void BVHWrapper::refit(float rebuildThreshold)
+{
+	for (auto& mesh : mMeshes)
+	{
+		if (mesh.dirty)
+		{
+			refitMesh(mesh);
+			mInstancesDirty = true; // bounds of its instances changed too
+		}
+	}
+
+	if (mInstancesDirty)
+		refitTopLevel(rebuildThreshold);
+}
+
+BVHWrapper::Stats BVHWrapper::getStats() const
+{
+	Stats stats = {};
+	stats.meshes = std::count_if(mMeshes.begin(), mMeshes.end(), [](const MeshBVH& mesh) { return mesh.root >= 0; });
+	stats.instances = mInstances.size();
+	stats.nodes = mGPUTree.size();
+	stats.triangles = mIndices.size();
+	stats.vertices = mVertices.getSize();
+	stats.duplicates = mDuplicates;
+	stats.bytes = stats.nodes * sizeof(BVHNode) + stats.instances * sizeof(Instance);
+
+	if (mCompressGeometry)
+		stats.bytes += stats.triangles * sizeof(PackedTriangle)
+			+ stats.vertices * sizeof(PackedVertex)
+			+ mPackedProperties.size() * sizeof(PackedProperties)
+			+ mMeshGeometry.size() * sizeof(MeshGeometry);
+	else
+		stats.bytes += stats.triangles * sizeof(Triangle)
+			+ stats.vertices * sizeof(Vec3f)
+			+ mTriangleProperties.size() * sizeof(TriangleProperties)
+			+ mTrianglePositions.size() * sizeof(TrianglePositions);
+	stats.buildBytes = mBuildBytes;
+
+	std::vector<float> costs(2 * mInstances.size() - 1);
+	subtreeCosts(mGPUTree, 0, costs.size(), costs);
+	stats.topLevelCost = costs[0] / area(mGPUTree[0]);
+
+	// the top level nodes are in preorder, parents come before their children
+	std::vector<size_t> depths(costs.size(), 0);
+	size_t topDepth = 0, meshLevels = 0;
+	for (size_t i = 0; i < depths.size(); ++i)
+	{
+		if (mGPUTree[i].isLeaf)
+			topDepth = std::max(topDepth, depths[i]);
+		else
+			depths[mGPUTree[i].leftIndex] = depths[mGPUTree[i].rightIndex] = depths[i] + 1;
+	}
+
+	for (const auto& mesh : mMeshes)
+		meshLevels = std::max(meshLevels, mesh.levels.size());
+
+	stats.stackDepth = topDepth + meshLevels;
+
+	for (const auto& mesh : mMeshes)
+	{
+		if (mesh.root < 0)
+			continue;
+
+		float cost = 0.f;
+		for (auto i = static_cast<size_t>(mesh.root); i < mesh.nodeEnd; ++i)
+			cost += area(mGPUTree[i]) * (mGPUTree[i].isLeaf ? mGPUTree[i].rightIndex - mGPUTree[i].leftIndex : 1);
+
+		stats.meshCost += cost / area(mGPUTree[mesh.root]);
+	}
+
+	stats.min = mGPUTree[0].min;
+	stats.max = mGPUTree[0].max;
+
+	return stats;
+}
+
+std::vector<BVHWrapper::InstanceTriangle> BVHWrapper::getTriangles(const std::vector<bool>& materials) const
+{
+	// triangles of the selected meshes, a triangle split by the builder has the same vertex indices in all its references
+	std::vector<std::vector<uint32_t>> meshTriangles(mMeshes.size());
+	for (size_t m = 0; m < mMeshes.size(); ++m)
+	{
+		const auto& mesh = mMeshes[m];
+		if (mesh.root < 0)
+			continue;
+
+		const auto material = mIndices[mesh.triangleBegin].index & ~TRIANGLE_FLAGS;
+		if (material >= materials.size() || !materials[material])
 			continue;
-		
-		// insert vertices
-		const auto offset = mVertices.getSize();
-		mVertices.add(reinterpret_cast<Vec3f*>(mesh.mVertices), mesh.mNumVertices);
 
-		// triangle properties
-		for (size_t n = 0; n < mesh.mNumVertices; n++)
+		auto& triangles = meshTriangles[m];
+		triangles.resize(mesh.triangleEnd - mesh.triangleBegin);
+		std::iota(triangles.begin(), triangles.end(), static_cast<uint32_t>(mesh.triangleBegin));
+
+		const auto key = [this](uint32_t i) { const auto& v = mIndices[i].indices; return std::make_tuple(v.x, v.y, v.z); };
+		std::sort(triangles.begin(), triangles.end(), [&](uint32_t a, uint32_t b) { return key(a) < key(b) || (key(a) == key(b) && a < b); });
+		triangles.erase(std::unique(triangles.begin(), triangles.end(), [&](uint32_t a, uint32_t b) { return key(a) == key(b); }), triangles.end());
+	}
+
+	std::vector<InstanceTriangle> triangles;
+	for (uint32_t i = 0; i < mInstances.size(); ++i)
+		for (const auto triangle : meshTriangles[mInstances[i].mesh])
+			triangles.push_back({ i, triangle });
+
+	return triangles;
+}
+
+std::array<Vec3f, 3> BVHWrapper::getPositions(const InstanceTriangle& triangle) const
+{
+	const auto& transform = mInstances[triangle.instance].objectToWorld;
+	const auto& indices = mIndices[triangle.triangle].indices;
+
+	return { transformPoint(transform, mVertices[indices.x]), transformPoint(transform, mVertices[indices.y]), transformPoint(transform, mVertices[indices.z]) };
+}
+
+float BVHWrapper::getArea(const InstanceTriangle& triangle) const
+{
+	const auto [v0, v1, v2] = getPositions(triangle);
+	return 0.5f * cross(v1 - v0, v2 - v0).length();
+}
+
+uint32_t BVHWrapper::opacityFlags(const aiMaterial& material)
+{
+	aiString mode;
+	material.Get(AI_MATKEY_GLTF_ALPHAMODE, mode);
+
+	if (mode == aiString("BLEND"))
+		return TRANSMISSIVE_TRIANGLE;
+
+	return mode == aiString("MASK") ? MASKED_TRIANGLE : OPAQUE_TRIANGLE;
+}
+
+BVHWrapper::MaterialOpacity BVHWrapper::opacity(const aiMaterial& material)
+{
+	aiColor4D color(1.f, 1.f, 1.f, 1.f);
+	material.Get(AI_MATKEY_COLOR_DIFFUSE, color);
+
+	// glTF cuts out under a half without the cutoff
+	auto cutoff = 0.5f;
+	material.Get(AI_MATKEY_GLTF_ALPHACUTOFF, cutoff);
+
+	return { { color.r, color.g, color.b }, color.a, cutoff };
+}
+
+DirectX::XMUINT3 BVHWrapper::unpack(const Packed3x21& packed)
+{
+	return { packed.lo & QUANTIZATION_STEPS, (packed.lo >> 21 | packed.hi << 11) & QUANTIZATION_STEPS, (packed.hi >> 10) & QUANTIZATION_STEPS };
+}
+
+// the same arithmetic as in geometry.h
+Vec3f BVHWrapper::decodeVertex(const MeshGeometry& mesh, const PackedVertex& vertex)
+{
+	const auto q = unpack(vertex);
+	return {
+		mesh.origin.x + static_cast<float>(q.x) * mesh.scale.x,
+		mesh.origin.y + static_cast<float>(q.y) * mesh.scale.y,
+		mesh.origin.z + static_cast<float>(q.z) * mesh.scale.z,
+	};
+}
+
+BVHWrapper::TriangleProperties BVHWrapper::decodeProperties(const PackedProperties& properties)
+{
+	const auto u = std::max(static_cast<int16_t>(properties.normal & 0xFFFF) / 32767.f, -1.f);
+	const auto v = std::max(static_cast<int16_t>(properties.normal >> 16) / 32767.f, -1.f);
+
+	// unfolding of the lower hemisphere
+	auto normal = Vec3f(u, v, 1.f - std::abs(u) - std::abs(v));
+	const auto t = std::max(-normal.z, 0.f);
+	normal.x -= t * signNotZero(normal.x);
+	normal.y -= t * signNotZero(normal.y);
+	normal.normalize();
+
+	using DirectX::PackedVector::XMConvertHalfToFloat;
+	const auto s = XMConvertHalfToFloat(static_cast<DirectX::PackedVector::HALF>(properties.texCoord & 0xFFFF));
+	const auto r = XMConvertHalfToFloat(static_cast<DirectX::PackedVector::HALF>(properties.texCoord >> 16));
+
+	return { { normal.x, normal.y, normal.z }, { s, r }, 0 };
+}
+
+void BVHWrapper::buildMeshBVH(size_t meshIndex, std::vector<BVHNode>& nodes)
+{
+	const auto& mesh = *mScene->mMeshes[meshIndex];
+	auto& meshBVH = mMeshes[meshIndex];
+
+	// nodes, triangles and vertices are addressed by 32 bit signed indices, the scene buffers are split into chunks on the GPU
+	if (mVertices.size() + mesh.mNumVertices > INT_MAX || mIndices.size() + mesh.mNumFaces > INT_MAX || nodes.size() + 2 * size_t(mesh.mNumFaces) > INT_MAX)
+		throw std::runtime_error("Scene is too large, it has over 2^31 triangles, vertices or BVH nodes");
+
+	// local vertex indices of the compressed triangles have 21 bits
+	if (mCompressGeometry && mesh.mNumVertices > QUANTIZATION_STEPS + 1)
+		throw std::runtime_error("Mesh " + std::to_string(meshIndex) + " is too large for the compressed geometry, it has "
+			+ std::to_string(mesh.mNumVertices) + " vertices, over 2^21");
+
+	// insert vertices
+	const auto offset = mVertices.getSize();
+	mVertices.add(reinterpret_cast<Vec3f*>(mesh.mVertices), mesh.mNumVertices);
+
+	meshBVH.vertexOffset = offset;
+	meshBVH.vertexCount = mesh.mNumVertices;
+
+	// triangle properties
+	for (size_t n = 0; n < mesh.mNumVertices; n++)
+	{
+		mTriangleProperties.emplace_back(TriangleProperties{
+			{mesh.mNormals[n].x, mesh.mNormals[n].y, mesh.mNormals[n].z},
+			(mesh.HasTextureCoords(0) ? *reinterpret_cast<DirectX::XMFLOAT2*>(&mesh.mTextureCoords[0][n]) : DirectX::XMFLOAT2{ 0, 0 }),
+			mesh.mMaterialIndex
+		});
+	}
+
+	// the shadow rays take the opacity from the triangles they hit, without the material
+	const auto flags = mesh.mMaterialIndex < mScene->mNumMaterials ? opacityFlags(*mScene->mMaterials[mesh.mMaterialIndex]) : OPAQUE_TRIANGLE;
+	const auto material = mesh.mMaterialIndex | flags;
+	mOpacityFlags |= flags;
+
+	// vertices are snapped to what the shaders decode, so the BVH is built over the same triangles the GPU intersects
+	if (mCompressGeometry)
+	{
+		mPackedVertices.resize(mVertices.getSize());
+		mPackedProperties.resize(mTriangleProperties.size());
+		mMeshGeometry[meshIndex].vertexOffset = static_cast<uint32_t>(offset);
+		mMeshGeometry[meshIndex].material = material;
+		compressMesh(meshIndex);
+	}
+
+	// triangles (indices) local to the mesh, the builder reads the vertices of the mesh in place
+	Array<GPUScene::Triangle> triangles;
+	triangles.resize(mesh.mNumFaces);
+	for (size_t n = 0; n < mesh.mNumFaces; ++n)
+	{
+		auto& f = mesh.mFaces[n];
+		triangles[static_cast<int>(n)].vertices = Vec3i(f.mIndices[0], f.mIndices[1], f.mIndices[2]);
+	}
+
+	GPUScene scene(triangles.getSize(), mesh.mNumVertices, triangles.getPtr(), mVertices.getPtr(offset));
+
+	BVH bvh(&scene, mBuildParams.platform, mBuildParams);
+
+	const auto base = nodes.size();
+	nodes.resize(base + bvh.getNumNodes());
+
+	meshBVH.root = static_cast<int>(base);
+	meshBVH.nodeEnd = nodes.size();
+
+	// join vertex indices and material id, leaves keep their ranges of the triangle indices
+	const auto start = mIndices.size();
+	for (int i = 0; i < bvh.getTriIndices().getSize(); i++)
+	{
+		const auto& indices = bvh.getScene()->getTriangle(bvh.getTriIndices()[i]).vertices;
+		mIndices.emplace_back(Triangle{ {indices.x + offset, indices.y + offset, indices.z + offset}, material });
+
+		if (mPrecomputeTriangles)
+			mTrianglePositions.emplace_back(trianglePositions(mVertices[indices.x + offset], mVertices[indices.y + offset], mVertices[indices.z + offset]));
+
+		// the material is taken from the mesh
+		if (mCompressGeometry)
+			mPackedTriangles.emplace_back(pack(indices.x, indices.y, indices.z));
+	}
+
+	meshBVH.triangleBegin = start;
+	meshBVH.triangleEnd = mIndices.size();
+	mDuplicates += bvh.getTriIndices().getSize() - mesh.mNumFaces;
+
+	// parents precede their children in the arena, so their depth is known when the children are reached
+	std::vector<size_t> depths(bvh.getNumNodes(), 0);
+
+	for (int i = 0; i < bvh.getNumNodes(); i++)
+	{
+		const auto& source = bvh.getNode(i);
+		auto& node = nodes[base + i];
+		node.min = { source.m_bounds.min().x, source.m_bounds.min().y, source.m_bounds.min().z };
+		node.max = { source.m_bounds.max().x, source.m_bounds.max().y, source.m_bounds.max().z };
+		node.isLeaf = source.isLeaf();
+
+		if (mCompressGeometry)
+			growBounds(node, mMeshGeometry[meshIndex].scale);
+
+		if (meshBVH.levels.size() <= depths[i])
+			meshBVH.levels.resize(depths[i] + 1);
+		meshBVH.levels[depths[i]].emplace_back(static_cast<int>(base + i));
+
+		if (source.isLeaf())
 		{
-			mTriangleProperties.emplace_back(TriangleProperties{
-				{mesh.mNormals[n].x, mesh.mNormals[n].y, mesh.mNormals[n].z},
-				(mesh.HasTextureCoords(0) ? *reinterpret_cast<DirectX::XMFLOAT2*>(&mesh.mTextureCoords[0][n]) : DirectX::XMFLOAT2{ 0, 0 }),
-				mesh.mMaterialIndex
-			});
+			node.leftIndex = static_cast<int>(start + source.m_lo);
+			node.rightIndex = static_cast<int>(start + source.m_hi);
 		}
+		else
+		{
+			node.leftIndex = static_cast<int>(base + source.m_children[0]);
+			node.rightIndex = static_cast<int>(base + source.m_children[1]);
+			depths[source.m_children[0]] = depths[source.m_children[1]] = depths[i] + 1;
+		}
+	}
+
+	mBuildBytes = std::max(mBuildBytes, bvh.getPeakBytes());
+}
+
+void BVHWrapper::compressMesh(size_t meshIndex)
+{
+	const auto& mesh = mMeshes[meshIndex];
+	auto& geometry = mMeshGeometry[meshIndex];
+
+	AABB bounds;
+	for (size_t i = 0; i < mesh.vertexCount; ++i)
+		bounds.grow(mVertices[mesh.vertexOffset + i]);
+
+	const auto scale = (bounds.max() - bounds.min()) * (1.f / QUANTIZATION_STEPS);
+	geometry.origin = { bounds.min().x, bounds.min().y, bounds.min().z };
+	geometry.scale = { scale.x, scale.y, scale.z };
 
-		// triangles (indices)		
-		for (size_t n = 0; n < mesh.mNumFaces; ++n)
+	parallelFor(mesh.vertexCount, [&](size_t i)
+	{
+		auto& vertex = mVertices[mesh.vertexOffset + i];
+		auto& packed = mPackedVertices[mesh.vertexOffset + i];
+		const auto& properties = mTriangleProperties[mesh.vertexOffset + i];
+
+		packed = pack(quantize(vertex.x, geometry.origin.x, scale.x), quantize(vertex.y, geometry.origin.y, scale.y), quantize(vertex.z, geometry.origin.z, scale.z));
+		vertex = decodeVertex(geometry, packed);
+
+		mPackedProperties[mesh.vertexOffset + i] = { encodeNormal(properties.normal), encodeTexCoord(properties.texCoord) };
+	});
+
+	mDirtyMeshes.add(meshIndex, meshIndex + 1);
+}
+
+void BVHWrapper::collectInstances(const aiNode* node, const aiMatrix4x4& parentTransform, uint32_t& nodeIndex)
+{
+	const auto transform = parentTransform * node->mTransformation;
+	const auto index = nodeIndex++;
+
+	// degenerate transform can't be inverted, there wouldn't be anything to see anyway
+	if (std::abs(transform.Determinant()) > 0.f)
+	{
+		for (size_t i = 0; i < node->mNumMeshes; ++i)
 		{
-			auto& f = mesh.mFaces[n];
-			
-			Vec3i triangle(f.mIndices[0] + offset, f.mIndices[1] + offset, f.mIndices[2] + offset);
-			triangles.add(*reinterpret_cast<GPUScene::Triangle*>(&triangle));
+			const auto mesh = node->mMeshes[i];
+			if (mMeshes[mesh].root < 0)
+				continue;
+
+			mInstances.emplace_back();
+			mInstances.back().root = mMeshes[mesh].root;
+			mInstances.back().mesh = mesh;
+			mInstanceNodes.emplace_back(index);
+
+			setTransform(mInstances.size() - 1, transform);
 		}
 	}
 
-	
-    GPUScene scene = GPUScene(triangles.getSize(), mVertices.getSize(), triangles, mVertices);
-	
-   	const Platform defaultPlatform;
-	const BVH::BuildParams defaultParams;
-	BVH bvh(&scene, defaultPlatform, defaultParams);
+	for (size_t i = 0; i < node->mNumChildren; ++i)
+		collectInstances(node->mChildren[i], transform, nodeIndex);
+}
+
+void BVHWrapper::buildTopLevelBVH(const std::vector<BVHNode>& meshNodes)
+{
+	std::vector<AABB> bounds(mInstances.size());
+	for (size_t i = 0; i < mInstances.size(); ++i)
+		bounds[i] = instanceBounds(meshNodes[mInstances[i].root], mInstances[i]);
+
+	std::vector<uint32_t> order(mInstances.size());
+	std::iota(order.begin(), order.end(), 0);
+
+	const auto topLevelSize = 2 * mInstances.size() - 1;
+	mGPUTree.resize(topLevelSize);
+
+	int next = 0;
+	buildTopLevel(mGPUTree, next, order, 0, order.size(), bounds, mTopLevelDepth);
+
+	mTopLevelCost.resize(topLevelSize);
+	subtreeCosts(mGPUTree, 0, topLevelSize, mTopLevelCost);
+	for (size_t i = 0; i < topLevelSize; ++i)
+		mTopLevelCost[i] /= area(mGPUTree[i]);
 
-	std::stack<std::pair<::BVHNode*, size_t>> stack{ { {bvh.getRoot(), 0} } };
-	mGPUTree.resize(bvh.getNumNodes());
+	// mesh BVHs follow the top level one
+	const auto offset = static_cast<int>(topLevelSize);
 
-	for (size_t nodeIndex = 0; !stack.empty(); )
+	for (auto node : meshNodes)
 	{
-		auto [root, currentIndex] = stack.top(); stack.pop();
-		auto& aabb = root->m_bounds;
-		auto& node = mGPUTree[currentIndex];
-		node.min = { aabb.min().x, aabb.min().y, aabb.min().z };
-		node.max = { aabb.max().x, aabb.max().y, aabb.max().z };
-		node.isLeaf = false;
-				
-		if (root->isLeaf())
+		if (!node.isLeaf)
 		{
-			const auto leaf = reinterpret_cast<const LeafNode*>(root);
-			const auto start = mIndices.size();
+			node.leftIndex += offset;
+			node.rightIndex += offset;
+		}
 
-			node.leftIndex = start;
-			node.rightIndex = start + leaf->m_hi - leaf->m_lo;
-			node.isLeaf = true;
+		mGPUTree.emplace_back(node);
+	}
+
+	for (auto& instance : mInstances)
+		instance.root += offset;
+
+	for (auto& mesh : mMeshes)
+	{
+		if (mesh.root < 0)
+			continue;
+
+		mesh.root += offset;
+		mesh.nodeEnd += offset;
+		for (auto& level : mesh.levels)
+			for (auto& node : level)
+				node += offset;
+	}
+
+	// everything is uploaded with the buffers
+	mDirtyNodes = mDirtyInstances = mDirtyVertices = mDirtyProperties = mDirtyPositions = mDirtyMeshes = {};
+	mInstancesDirty = false;
+}
+
+void BVHWrapper::refitMesh(MeshBVH& mesh)
+{
+	// nodes of one level don't depend on each other
+	for (auto level = mesh.levels.rbegin(); level != mesh.levels.rend(); ++level)
+	{
+		parallelFor(level->size(), [&](size_t i)
+		{
+			auto& node = mGPUTree[(*level)[i]];
 
-			// join vertex indices and triangle id (used for material)
-			for (auto i = leaf->m_lo; i < leaf->m_hi; i++)
+			if (node.isLeaf)
 			{
-				const uint32_t index = bvh.getTriIndices()[i];
-				const auto& indices = bvh.getScene()->getTriangle(index).vertices;
-				mIndices.emplace_back(Triangle{{indices.x, indices.y, indices.z}, mTriangleProperties[indices.x].materialID }); // TODO is matID right?
+				AABB box;
+				for (auto t = node.leftIndex; t < node.rightIndex; ++t)
+				{
+					const auto& indices = mIndices[t].indices;
+					box.grow(mVertices[indices.x]);
+					box.grow(mVertices[indices.y]);
+					box.grow(mVertices[indices.z]);
+
+					if (mPrecomputeTriangles)
+						mTrianglePositions[t] = trianglePositions(mVertices[indices.x], mVertices[indices.y], mVertices[indices.z]);
+				}
+
+				setBounds(node, box);
+
+				if (mCompressGeometry)
+					growBounds(node, mMeshGeometry[&mesh - mMeshes.data()].scale);
 			}
-		}
+			else
+				mergeBounds(node, mGPUTree[node.leftIndex], mGPUTree[node.rightIndex]);
+		});
+	}
+
+	mDirtyNodes.add(mesh.root, mesh.nodeEnd);
+	if (mPrecomputeTriangles)
+		mDirtyPositions.add(mesh.triangleBegin, mesh.triangleEnd);
+
+	mesh.dirty = false;
+}
+
+void BVHWrapper::refitTopLevel(float rebuildThreshold)
+{
+	const auto topLevelSize = 2 * mInstances.size() - 1;
+
+	std::vector<AABB> bounds(mInstances.size());
+	for (size_t i = 0; i < mInstances.size(); ++i)
+		bounds[i] = instanceBounds(mGPUTree[mInstances[i].root], mInstances[i]);
+
+	// children follow their parent, reverse order is bottom-up
+	for (auto i = topLevelSize; i-- > 0; )
+	{
+		auto& node = mGPUTree[i];
+
+		if (node.isLeaf)
+			setBounds(node, bounds[node.leftIndex]);
 		else
+			mergeBounds(node, mGPUTree[node.leftIndex], mGPUTree[node.rightIndex]);
+	}
+
+	std::vector<float> costs(topLevelSize);
+	subtreeCosts(mGPUTree, 0, topLevelSize, costs);
+
+	// the topmost degraded subtrees are rebuilt over the same instances into the same nodes, no deeper than the stack allows
+	std::vector<std::pair<int, size_t>> stack{ { 0, 0 } };
+	while (!stack.empty())
+	{
+		const auto [index, depth] = stack.back(); stack.pop_back();
+		const auto& node = mGPUTree[index];
+
+		if (node.isLeaf)
+			continue;
+
+		if (costs[index] / area(node) <= rebuildThreshold * mTopLevelCost[index])
 		{
-			nodeIndex += 2;
-			stack.push({ root->getChildNode(1), nodeIndex });
-			node.rightIndex = stack.top().second;
-			stack.push({ root->getChildNode(0), nodeIndex - 1 });
-			node.leftIndex = stack.top().second;
+			stack.emplace_back(node.leftIndex, depth + 1);
+			stack.emplace_back(node.rightIndex, depth + 1);
+			continue;
 		}
 
-		mGPUTree.emplace_back(node);
+		std::vector<uint32_t> order;
+		for (std::vector<int> leaves{ index }; !leaves.empty(); )
+		{
+			const auto& n = mGPUTree[leaves.back()]; leaves.pop_back();
+
+			if (n.isLeaf)
+				order.emplace_back(n.leftIndex);
+			else
+				leaves.insert(leaves.end(), { n.leftIndex, n.rightIndex });
+		}
+
+		auto next = index;
+		buildTopLevel(mGPUTree, next, order, 0, order.size(), bounds, mTopLevelDepth - depth);
+
+		subtreeCosts(mGPUTree, index, next, mTopLevelCost);
+		for (auto i = index; i < next; ++i)
+			mTopLevelCost[i] /= area(mGPUTree[i]);
 	}
-}
 
+	mDirtyNodes.add(0, topLevelSize);
+	mInstancesDirty = false;
+}
@@ -0,0 +1,393 @@
+﻿#include "CPUTraversal.hpp"
+#include <algorithm>
+
+namespace
+{
+	constexpr auto EPSILON = 1e-8f;
+	constexpr auto STACKSIZE = BVH_STACK_SIZE; // the same as the shaders, the scene checks its depth against it
+
+	Vec3f transformPoint(const DirectX::XMFLOAT4 (&m)[3], const Vec3f& p)
+	{
+		return {
+			m[0].x * p.x + m[0].y * p.y + m[0].z * p.z + m[0].w,
+			m[1].x * p.x + m[1].y * p.y + m[1].z * p.z + m[1].w,
+			m[2].x * p.x + m[2].y * p.y + m[2].z * p.z + m[2].w,
+		};
+	}
+
+	Vec3f transformVector(const DirectX::XMFLOAT4 (&m)[3], const Vec3f& v)
+	{
+		return {
+			m[0].x * v.x + m[0].y * v.y + m[0].z * v.z,
+			m[1].x * v.x + m[1].y * v.y + m[1].z * v.z,
+			m[2].x * v.x + m[2].y * v.y + m[2].z * v.z,
+		};
+	}
+
+	float rayAABBIntersection(const BVHWrapper::BVHNode& node, const CPUTraversal::Ray& r)
+	{
+		const auto invdir = Vec3f(1.f / r.direction.x, 1.f / r.direction.y, 1.f / r.direction.z);
+
+		const auto f = (Vec3f(node.max.x, node.max.y, node.max.z) - r.origin) * invdir;
+		const auto n = (Vec3f(node.min.x, node.min.y, node.min.z) - r.origin) * invdir;
+
+		const auto tmax = max3f(f, n);
+		const auto tmin = min3f(f, n);
+
+		const auto t1 = std::min(tmax.x, std::min(tmax.y, tmax.z));
+		const auto t0 = std::max(tmin.x, std::max(tmin.y, tmin.z));
+
+		return (t1 >= t0) ? (t0 > 0.f ? t0 : t1) : -1.f;
+	}
+
+	// slab test of the box against the interval (0, tmax) of the ray, the origin is premultiplied by the inverse direction,
+	// the entry distance clipped to the interval or -1 if the box is missed
+	float rayAABBEntry(const BVHWrapper::BVHNode& node, const Vec3f& scaledOrigin, const Vec3f& invdir, float tmax)
+	{
+		const auto f = Vec3f(node.max.x, node.max.y, node.max.z) * invdir - scaledOrigin;
+		const auto n = Vec3f(node.min.x, node.min.y, node.min.z) * invdir - scaledOrigin;
+
+		const auto exits = max3f(f, n);
+		const auto entries = min3f(f, n);
+
+		const auto t1 = std::min(tmax, std::min(exits.x, std::min(exits.y, exits.z)));
+		const auto t0 = std::max(0.f, std::max(entries.x, std::max(entries.y, entries.z)));
+
+		return t0 <= t1 ? t0 : -1.f;
+	}
+
+	Vec3f toVec3f(const DirectX::XMFLOAT3& v)
+	{
+		return { v.x, v.y, v.z };
+	}
+
+	// spatial splits reference a triangle from more leaves, a hit of a transmissive one counts only in the leaf whose box holds it,
+	// the box is widened by the rounding of the hit point, the same as shadowRayCast.hlsl
+	bool hitInLeaf(const BVHWrapper::BVHNode& leaf, const Vec3f& position, const Vec3f& offset)
+	{
+		const auto margin = Vec3f(
+			std::abs(position.x) + std::abs(offset.x),
+			std::abs(position.y) + std::abs(offset.y),
+			std::abs(position.z) + std::abs(offset.z)) * 1e-5f;
+
+		return position.x >= leaf.min.x - margin.x && position.x <= leaf.max.x + margin.x
+			&& position.y >= leaf.min.y - margin.y && position.y <= leaf.max.y + margin.y
+			&& position.z >= leaf.min.z - margin.z && position.z <= leaf.max.z + margin.z;
+	}
+
+	bool rayTriangleIntersection(const CPUTraversal::Ray& ray, const Vec3f& v0, const Vec3f& e1, const Vec3f& e2, float& distance, Vec3f& baryCoord)
+	{
+		const auto pvec = cross(ray.direction, e2);
+		const auto det = dot(e1, pvec);
+
+		if (det > -EPSILON && det < EPSILON)
+			return false;
+
+		const auto invDet = 1.f / det;
+		const auto tvec = ray.origin - v0;
+		const auto u = dot(tvec, pvec) * invDet;
+
+		if (u < 0.f || u > 1.f)
+			return false;
+
+		const auto qvec = cross(tvec, e1);
+		const auto v = dot(ray.direction, qvec) * invDet;
+
+		if (v < 0.f || u + v > 1.f)
+			return false;
+
+		distance = dot(e2, qvec) * invDet;
+		baryCoord = { 1 - u - v, u, v };
+
+		return true;
+	}
+}
+
+template<typename T>
+CPUTraversal::Chunks<T>::Chunks(const T* data, size_t size, size_t chunkBytes)
+	: mBits(geometryChunkBits(sizeof(T), chunkBytes))
+	, mMask((size_t(1) << mBits) - 1)
+{
+	// the memory is contiguous, only the addressing follows the chunks of the GPU
+	for (size_t first = 0; first < size; first += mMask + 1)
+		mChunks.emplace_back(data + first);
+}
+
+CPUTraversal::CPUTraversal(const BVHWrapper& bvh, size_t chunkBytes)
+	: mBVH(bvh)
+	, mNodes(bvh.mGPUTree.data(), bvh.mGPUTree.size(), chunkBytes)
+	, mTriangles(bvh.mIndices.data(), bvh.mIndices.size(), chunkBytes)
+	, mVertices(bvh.mVertices.data(), bvh.mVertices.size(), chunkBytes)
+	, mPositions(bvh.mTrianglePositions.data(), bvh.mTrianglePositions.size(), chunkBytes)
+	, mPackedTriangles(bvh.mPackedTriangles.data(), bvh.mPackedTriangles.size(), chunkBytes)
+	, mPackedVertices(bvh.mPackedVertices.data(), bvh.mPackedVertices.size(), chunkBytes)
+{}
+
+CPUTraversal::Hit CPUTraversal::intersect(const Ray& ray, std::vector<const void*>* loads) const
+{
+	Hit hit;
+	traverse<false>(ray, hit, loads);
+
+	return hit;
+}
+
+bool CPUTraversal::occluded(const Ray& ray, float distance, std::vector<const void*>* loads) const
+{
+	const auto visible = visibility(ray, distance, loads);
+	return visible.x <= 0.f && visible.y <= 0.f && visible.z <= 0.f;
+}
+
+bool CPUTraversal::occludedOrdered(const Ray& ray, float distance, std::vector<const void*>* loads) const
+{
+	Hit hit;
+	hit.distance = distance;
+	traverse<true>(ray, hit, loads);
+
+	return hit.triangle >= 0;
+}
+
+template<bool AnyHit>
+void CPUTraversal::traverse(const Ray& worldRay, Hit& hit, std::vector<const void*>* loads) const
+{
+	const auto& tree = mNodes;
+	const auto load = [loads](const auto& data) -> const auto& { if (loads) loads->push_back(&data); return data; };
+	const auto minDistance = AnyHit ? EPSILON : 0.f; // shadow rays ignore hits at their origin
+
+	int stack[STACKSIZE];
+	size_t ptr = 0;
+	stack[ptr++] = -1;
+
+	auto ray = worldRay;
+	auto instance = -1; // instance being traversed, -1 in the top level BVH
+	size_t instanceDepth = 0; // stack depth the instance was entered at
+
+	// early test
+	if (rayAABBIntersection(load(tree[0]), ray) <= 0.f)
+		return;
+
+	for (int idx = 0; idx > -1;)
+	{
+		const auto& node = tree[idx];
+
+		if (node.isLeaf)
+		{
+			if (instance < 0)
+			{
+				// top level leaf - continue in the mesh BVH with the ray in object space of the instance
+				const auto& transform = load(mBVH.mInstances[node.leftIndex]);
+
+				instance = node.leftIndex;
+				instanceDepth = ptr;
+				ray = { transformPoint(transform.worldToObject, worldRay.origin), transformVector(transform.worldToObject, worldRay.direction) };
+				idx = transform.root;
+				continue;
+			}
+
+			for (auto i = node.leftIndex; i < node.rightIndex; i++)
+			{
+				Vec3f v0, e1, e2;
+				loadTriangle(i, instance, loads, v0, e1, e2);
+
+				float distance;
+				Vec3f baryCoord;
+
+				if (rayTriangleIntersection(ray, v0, e1, e2, distance, baryCoord)
+					&& distance >= minDistance && distance < hit.distance)
+				{
+					// the masked triangles are cut out the same as by extensionRayCast.hlsl
+					if (mBVH.mOpacityFlags & BVHWrapper::MASKED_TRIANGLE)
+					{
+						const auto material = loadMaterial(i, instance, loads);
+						if ((material & BVHWrapper::MASKED_TRIANGLE) && alphaCutout(material))
+							continue;
+					}
+
+					hit = { distance, i, instance, baryCoord };
+
+					if (AnyHit)
+						return;
+				}
+			}
+		}
+		else
+		{
+			const auto leftHit = rayAABBIntersection(load(tree[node.leftIndex]), ray);
+			const auto rightHit = rayAABBIntersection(load(tree[node.rightIndex]), ray);
+
+			if (leftHit > 0.f && rightHit > 0.f)
+			{
+				// never full for the depths checked at the load, the far child would be dropped rather than written past it
+				idx = leftHit > rightHit ? node.rightIndex : node.leftIndex;
+				if (ptr < STACKSIZE)
+					stack[ptr++] = leftHit > rightHit ? node.leftIndex : node.rightIndex;
+				continue;
+			}
+			else if (leftHit > 0.f)
+			{
+				idx = node.leftIndex;
+				continue;
+			}
+			else if (rightHit > 0.f)
+			{
+				idx = node.rightIndex;
+				continue;
+			}
+		}
+
+		// mesh BVH finished, back to the world ray
+		if (instance >= 0 && ptr == instanceDepth)
+		{
+			instance = -1;
+			ray = worldRay;
+		}
+
+		idx = stack[--ptr];
+	}
+}
+
+Vec3f CPUTraversal::visibility(const Ray& worldRay, float distance, std::vector<const void*>* loads) const
+{
+	const auto& tree = mNodes;
+	const auto load = [loads](const auto& data) -> const auto& { if (loads) loads->push_back(&data); return data; };
+
+	int stack[STACKSIZE];
+	size_t ptr = 0;
+	stack[ptr++] = -1;
+
+	// the distance along the ray is the same in the object space of the instances, only the inverse direction changes
+	const auto worldInvdir = Vec3f(1.f / worldRay.direction.x, 1.f / worldRay.direction.y, 1.f / worldRay.direction.z);
+	const auto worldScaledOrigin = worldRay.origin * worldInvdir;
+	auto ray = worldRay;
+	auto invdir = worldInvdir;
+	auto scaledOrigin = worldScaledOrigin;
+	auto instance = -1; // instance being traversed, -1 in the top level BVH
+	size_t instanceDepth = 0; // stack depth the instance was entered at
+	auto visible = Vec3f(1.f, 1.f, 1.f);
+
+	if (rayAABBEntry(load(tree[0]), scaledOrigin, invdir, distance) < 0.f)
+		return visible;
+
+	for (int idx = 0; idx > -1;)
+	{
+		const auto& node = tree[idx];
+
+		if (node.isLeaf)
+		{
+			if (instance < 0)
+			{
+				const auto& transform = load(mBVH.mInstances[node.leftIndex]);
+
+				instance = node.leftIndex;
+				instanceDepth = ptr;
+				ray = { transformPoint(transform.worldToObject, worldRay.origin), transformVector(transform.worldToObject, worldRay.direction) };
+				invdir = Vec3f(1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z);
+				scaledOrigin = ray.origin * invdir;
+				idx = transform.root;
+				continue;
+			}
+
+			for (auto i = node.leftIndex; i < node.rightIndex; i++)
+			{
+				Vec3f v0, e1, e2;
+				loadTriangle(i, instance, loads, v0, e1, e2);
+
+				float t;
+				Vec3f baryCoord;
+
+				if (!rayTriangleIntersection(ray, v0, e1, e2, t, baryCoord) || t <= EPSILON || t >= distance)
+					continue;
+
+				const auto material = mBVH.mOpacityFlags ? loadMaterial(i, instance, loads) : 0u;
+
+				if (material & BVHWrapper::MASKED_TRIANGLE)
+				{
+					if (alphaCutout(material))
+						continue;
+				}
+				else if (material & BVHWrapper::TRANSMISSIVE_TRIANGLE)
+				{
+					const auto offset = ray.direction * t;
+					if (hitInLeaf(node, ray.origin + offset, offset))
+						visible *= toVec3f(mBVH.mOpacities[material & ~BVHWrapper::TRIANGLE_FLAGS].transmittance);
+
+					if (visible.x > 0.f || visible.y > 0.f || visible.z > 0.f)
+						continue;
+				}
+
+				return {};
+			}
+		}
+		else
+		{
+			const auto left = rayAABBEntry(load(tree[node.leftIndex]), scaledOrigin, invdir, distance);
+			const auto right = rayAABBEntry(load(tree[node.rightIndex]), scaledOrigin, invdir, distance);
+
+			if (left >= 0.f || right >= 0.f)
+			{
+				const auto leftFirst = left >= 0.f && (right < 0.f || left <= right);
+				idx = leftFirst ? node.leftIndex : node.rightIndex;
+				if (left >= 0.f && right >= 0.f && ptr < STACKSIZE)
+					stack[ptr++] = leftFirst ? node.rightIndex : node.leftIndex;
+
+				continue;
+			}
+		}
+
+		if (instance >= 0 && ptr == instanceDepth)
+		{
+			instance = -1;
+			ray = worldRay;
+			invdir = worldInvdir;
+			scaledOrigin = worldScaledOrigin;
+		}
+
+		idx = stack[--ptr];
+	}
+
+	return visible;
+}
+
+void CPUTraversal::loadTriangle(int index, int instance, std::vector<const void*>* loads, Vec3f& v0, Vec3f& e1, Vec3f& e2) const
+{
+	const auto load = [loads](const auto& data) -> const auto& { if (loads) loads->push_back(&data); return data; };
+
+	if (!mBVH.mTrianglePositions.empty())
+	{
+		const auto& positions = load(mPositions[index]);
+		v0 = toVec3f(positions.v0);
+		e1 = toVec3f(positions.e1);
+		e2 = toVec3f(positions.e2);
+	}
+	else if (mBVH.mCompressGeometry)
+	{
+		// vertex indices are local to the mesh of the instance
+		const auto& mesh = load(mBVH.mMeshGeometry[mBVH.mInstances[instance].mesh]);
+		const auto indices = BVHWrapper::unpack(load(mPackedTriangles[index]));
+		v0 = BVHWrapper::decodeVertex(mesh, load(mPackedVertices[mesh.vertexOffset + indices.x]));
+		e1 = BVHWrapper::decodeVertex(mesh, load(mPackedVertices[mesh.vertexOffset + indices.y])) - v0;
+		e2 = BVHWrapper::decodeVertex(mesh, load(mPackedVertices[mesh.vertexOffset + indices.z])) - v0;
+	}
+	else
+	{
+		const auto& indices = load(mTriangles[index]).indices;
+		v0 = load(mVertices[indices.x]);
+		e1 = load(mVertices[indices.y]) - v0;
+		e2 = load(mVertices[indices.z]) - v0;
+	}
+}
+
+uint32_t CPUTraversal::loadMaterial(int index, int instance, std::vector<const void*>* loads) const
+{
+	const auto load = [loads](const auto& data) -> const auto& { if (loads) loads->push_back(&data); return data; };
+
+	if (mBVH.mCompressGeometry)
+		return load(mBVH.mMeshGeometry[mBVH.mInstances[instance].mesh]).material;
+
+	return load(mTriangles[index]).index;
+}
+
+bool CPUTraversal::alphaCutout(uint32_t material) const
+{
+	const auto& opacity = mBVH.mOpacities[material & ~BVHWrapper::TRIANGLE_FLAGS];
+	return opacity.alpha < opacity.alphaCutoff;
+}
@@ -81,10 +81,6 @@ void Camera::update(float dt)
 		mCBuffer.iterationCounter = 0;
 		moveHysteresis = false;
 	}
-		
-	const auto rrr = []() { return rand() / static_cast<float>(RAND_MAX); };
-	
-	mCBuffer.randomSeed = { rrr(), rrr() };
 }
 
 void Camera::setRotation(float pitch, float yaw)
@@ -0,0 +1,498 @@
+﻿#include "EnvironmentMap.hpp"
+#include "ParamsParser.hpp"
+#include "spdlog/fmt/fmt.h"
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cctype>
+#include <cstdio>
+#include <cmath>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+	constexpr auto PI = 3.14159265358979f;
+	constexpr uint32_t CACHE_MAGIC = 0x31564E45; // ENV1
+	constexpr uint32_t CACHE_VERSION = 1;
+	constexpr auto SHARED_EXPONENT_MAX = 511.f / 512.f * 65536.f; // the largest R9G9B9E5 value
+
+	struct CacheHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		int64_t sourceTime;
+		uint32_t width;
+		uint32_t height;
+		uint32_t cellsX;
+		uint32_t cellsY;
+		uint32_t maxWidth;
+		uint32_t tableWidth;
+	};
+
+	float luminance(const DirectX::XMFLOAT3& color)
+	{
+		return 0.2126f * color.x + 0.7152f * color.y + 0.0722f * color.z;
+	}
+
+	// texture coordinates of the direction, v goes from the top, the same as environment.h
+	DirectX::XMFLOAT2 toUV(const Vec3f& direction, float rotation)
+	{
+		const auto u = std::atan2(direction.z, direction.x) / (2.f * PI) + 0.5f + rotation;
+		return { u - std::floor(u), std::acos(std::clamp(direction.y, -1.f, 1.f)) / PI };
+	}
+
+	Vec3f toDirection(const DirectX::XMFLOAT2& uv, float rotation)
+	{
+		const auto phi = 2.f * PI * (uv.x - 0.5f - rotation);
+		const auto theta = PI * uv.y;
+		return { std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi) };
+	}
+
+	[[noreturn]] void fail(const std::string& path, const std::string& message)
+	{
+		throw std::runtime_error(fmt::format("Failed to load environment map {}. ERR: {}", path, message));
+	}
+
+	// Radiance RGBE file with the rows from the top, the rows of the new run length encoding have the components one after
+	// another, a count over 128 repeats the next byte, otherwise that many bytes follow, the old one repeats the previous texel
+	template<typename Size, typename Row>
+	void readRadiance(std::string_view data, const std::string& path, Size&& size, Row&& row)
+	{
+		const auto bytes = reinterpret_cast<const uint8_t*>(data.data());
+		size_t position = 0;
+
+		const auto line = [&]
+		{
+			const auto end = data.find('\n', position);
+			if (end == std::string_view::npos)
+				fail(path, "truncated header");
+
+			const auto result = data.substr(position, end - position);
+			position = end + 1;
+			return result;
+		};
+
+		const auto byte = [&]
+		{
+			if (position >= data.size())
+				fail(path, "truncated texels");
+
+			return bytes[position++];
+		};
+
+		if (line().substr(0, 2) != "#?")
+			fail(path, "not a Radiance file");
+
+		for (auto l = line(); !l.empty(); l = line())
+			if (l.substr(0, 7) == "FORMAT=" && l != "FORMAT=32-bit_rle_rgbe")
+				fail(path, "only RGBE texels are supported");
+
+		int width = 0;
+		int height = 0;
+		const auto resolution = std::string(line());
+		if (std::sscanf(resolution.c_str(), "-Y %d +X %d", &height, &width) != 2 || width <= 0 || height <= 0)
+			fail(path, "unsupported resolution " + resolution);
+
+		size(static_cast<uint32_t>(width), static_cast<uint32_t>(height));
+
+		std::vector<uint8_t> rgbe(width * 4);
+		std::vector<DirectX::XMFLOAT3> texels(width);
+
+		for (int y = 0; y < height; ++y)
+		{
+			if (width >= 8 && width < 32768 && position + 4 <= data.size() && bytes[position] == 2 && bytes[position + 1] == 2
+				&& (bytes[position + 2] << 8 | bytes[position + 3]) == width)
+			{
+				position += 4;
+
+				for (int c = 0; c < 4; ++c)
+				{
+					for (int x = 0; x < width;)
+					{
+						int count = byte();
+						const auto run = count > 128;
+						count -= run ? 128 : 0;
+
+						if (count == 0 || x + count > width)
+							fail(path, "corrupted run length encoding");
+
+						if (run)
+						{
+							const auto value = byte();
+							for (int i = 0; i < count; ++i)
+								rgbe[(x++) * 4 + c] = value;
+						}
+						else
+						{
+							for (int i = 0; i < count; ++i)
+								rgbe[(x++) * 4 + c] = byte();
+						}
+					}
+				}
+			}
+			else
+			{
+				auto shift = 0;
+				for (int x = 0; x < width;)
+				{
+					uint8_t texel[4] = { byte(), byte(), byte(), byte() };
+
+					if (texel[0] == 1 && texel[1] == 1 && texel[2] == 1)
+					{
+						const auto count = texel[3] << shift;
+						if (x == 0 || x + count > width)
+							fail(path, "corrupted run length encoding");
+
+						for (int i = 0; i < count; ++i, ++x)
+							std::copy_n(&rgbe[(x - 1) * 4], 4, &rgbe[x * 4]);
+
+						shift += 8;
+					}
+					else
+					{
+						std::copy_n(texel, 4, &rgbe[(x++) * 4]);
+						shift = 0;
+					}
+				}
+			}
+
+			for (int x = 0; x < width; ++x)
+			{
+				const auto e = rgbe[x * 4 + 3];
+				const auto scale = e ? std::ldexp(1.f, e - 136) : 0.f;
+				texels[x] = { rgbe[x * 4] * scale, rgbe[x * 4 + 1] * scale, rgbe[x * 4 + 2] * scale };
+			}
+
+			row(texels.data());
+		}
+	}
+
+	// portable float map - PF (rgb) or Pf (gray), the size and the scale, negative for little endian, and the rows from the bottom
+	template<typename Size, typename Row>
+	void readPortableFloat(std::string_view data, const std::string& path, Size&& size, Row&& row)
+	{
+		size_t position = 0;
+		const auto token = [&]
+		{
+			while (position < data.size() && std::isspace(static_cast<unsigned char>(data[position])))
+				++position;
+
+			const auto begin = position;
+			while (position < data.size() && !std::isspace(static_cast<unsigned char>(data[position])))
+				++position;
+
+			return std::string(data.substr(begin, position - begin));
+		};
+
+		const auto type = token();
+		if (type != "PF" && type != "Pf")
+			fail(path, "not a portable float map");
+
+		const auto channels = type == "PF" ? 3u : 1u;
+		const auto width = std::strtoul(token().c_str(), nullptr, 10);
+		const auto height = std::strtoul(token().c_str(), nullptr, 10);
+		const auto scale = std::strtof(token().c_str(), nullptr);
+		++position; // single whitespace before the texels
+
+		const auto rowBytes = size_t(width) * channels * 4;
+		if (width == 0 || height == 0 || scale == 0.f || position + rowBytes * height > data.size())
+			fail(path, "corrupted header or truncated texels");
+
+		size(static_cast<uint32_t>(width), static_cast<uint32_t>(height));
+
+		std::vector<DirectX::XMFLOAT3> texels(width);
+		std::vector<float> values(size_t(width) * channels);
+
+		for (size_t y = 0; y < height; ++y)
+		{
+			std::memcpy(values.data(), data.data() + position + (height - 1 - y) * rowBytes, rowBytes);
+
+			if (scale > 0.f)
+			{
+				for (auto& value : values)
+				{
+					uint32_t bits;
+					std::memcpy(&bits, &value, 4);
+					bits = bits >> 24 | (bits >> 8 & 0xFF00) | (bits << 8 & 0xFF0000) | bits << 24;
+					std::memcpy(&value, &bits, 4);
+				}
+			}
+
+			for (size_t x = 0; x < width; ++x)
+			{
+				const auto v = &values[x * channels];
+				texels[x] = { v[0], v[channels == 3 ? 1 : 0], v[channels == 3 ? 2 : 0] };
+			}
+
+			row(texels.data());
+		}
+	}
+}
+
+// rows of the source from the top are box filtered down to the map, packed, and their luminance summed into the cells
+class EnvironmentMap::Builder
+{
+public:
+	Builder(EnvironmentMap& map, uint32_t width, uint32_t height)
+		: mMap(map)
+		, mSourceWidth(width)
+		, mFactor((width + ENVIRONMENT_MAX_WIDTH - 1) / ENVIRONMENT_MAX_WIDTH)
+	{
+		map.mWidth = std::max(width / mFactor, 1u);
+		map.mHeight = std::max(height / mFactor, 1u);
+		map.mCellsX = std::min(map.mWidth, ENVIRONMENT_TABLE_WIDTH);
+		map.mCellsY = std::min(map.mHeight, ENVIRONMENT_TABLE_WIDTH / 2);
+		map.mTexels.resize(size_t(map.mWidth) * map.mHeight);
+
+		mSum.resize(map.mWidth);
+		mCells.assign(size_t(map.mCellsX) * map.mCellsY, 0.0);
+		mCounts.assign(mCells.size(), 0);
+	}
+
+	void addRow(const DirectX::XMFLOAT3* row)
+	{
+		const auto y = mRow++ / mFactor;
+		if (y >= mMap.mHeight)
+			return;
+
+		for (uint32_t x = 0; x < mMap.mWidth; ++x)
+		{
+			for (uint32_t i = 0; i < mFactor; ++i)
+			{
+				const auto& texel = row[std::min(x * mFactor + i, mSourceWidth - 1)];
+				mSum[x].x += texel.x;
+				mSum[x].y += texel.y;
+				mSum[x].z += texel.z;
+			}
+		}
+
+		if (mRow % mFactor == 0)
+			flush(y);
+	}
+
+	// average luminance of the texels of every cell, packed the same as the texture has them
+	std::vector<double> cellLuminance() const
+	{
+		std::vector<double> luminance(mCells.size());
+		for (size_t i = 0; i < mCells.size(); ++i)
+			luminance[i] = mCounts[i] ? mCells[i] / mCounts[i] : 0.0;
+
+		return luminance;
+	}
+
+private:
+	void flush(uint32_t y)
+	{
+		const auto scale = 1.f / (mFactor * mFactor);
+		const auto cellY = size_t(y) * mMap.mCellsY / mMap.mHeight;
+
+		for (uint32_t x = 0; x < mMap.mWidth; ++x)
+		{
+			const auto packed = packSharedExponent({ mSum[x].x * scale, mSum[x].y * scale, mSum[x].z * scale });
+			const auto cell = cellY * mMap.mCellsX + size_t(x) * mMap.mCellsX / mMap.mWidth;
+
+			mMap.mTexels[size_t(y) * mMap.mWidth + x] = packed;
+			mCells[cell] += luminance(unpackSharedExponent(packed));
+			++mCounts[cell];
+			mSum[x] = {};
+		}
+	}
+
+private:
+	EnvironmentMap& mMap;
+	uint32_t mSourceWidth;
+	uint32_t mFactor; // source texels per side of a texel of the map
+	uint32_t mRow = 0;
+	std::vector<DirectX::XMFLOAT3> mSum;
+	std::vector<double> mCells;
+	std::vector<uint32_t> mCounts;
+};
+
+EnvironmentMap::EnvironmentMap(const std::string& path)
+{
+	const fs::path source(path);
+	const auto sourceTime = fs::last_write_time(source).time_since_epoch().count();
+	const auto cache = (source.parent_path() / VT_CACHE_DIR_NAME / source.filename()).string() + ".env";
+
+	// decoding of a large map takes seconds, the cache is read at the speed of the disk
+	if (loadCache(cache, sourceTime))
+	{
+		mFromCache = true;
+		return;
+	}
+
+	const MappedFile file(path);
+	std::optional<Builder> builder;
+	const auto size = [&](uint32_t width, uint32_t height) { builder.emplace(*this, width, height); };
+	const auto row = [&](const DirectX::XMFLOAT3* texels) { builder->addRow(texels); };
+
+	auto extension = source.extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return static_cast<char>(std::tolower(c)); });
+
+	if (extension == ".hdr")
+		readRadiance(file.data(), path, size, row);
+	else if (extension == ".pfm")
+		readPortableFloat(file.data(), path, size, row);
+	else
+		fail(path, "unsupported format " + extension);
+
+	buildTables(builder->cellLuminance());
+	saveCache(cache, sourceTime);
+}
+
+EnvironmentMap::EnvironmentMap(uint32_t width, uint32_t height, const std::vector<DirectX::XMFLOAT3>& texels)
+{
+	Builder builder(*this, width, height);
+	for (uint32_t y = 0; y < height; ++y)
+		builder.addRow(&texels[size_t(y) * width]);
+
+	buildTables(builder.cellLuminance());
+}
+
+Vec3f EnvironmentMap::radiance(const Vec3f& direction, float rotation) const
+{
+	const auto uv = toUV(direction, rotation);
+	const auto x = std::min(static_cast<uint32_t>(uv.x * mWidth), mWidth - 1);
+	const auto y = std::min(static_cast<uint32_t>(uv.y * mHeight), mHeight - 1);
+	const auto color = unpackSharedExponent(mTexels[size_t(y) * mWidth + x]);
+
+	return { color.x, color.y, color.z };
+}
+
+Vec3f EnvironmentMap::sample(float u, float u1, float u2, float& pdf, float rotation) const
+{
+	float rowPdf, cellPdf, remainder;
+	const auto y = AliasTable::sample(mTable.data(), mCellsY, u, rowPdf, remainder);
+	const auto x = AliasTable::sample(mTable.data() + mCellsY + y * mCellsX, mCellsX, u1, cellPdf, remainder);
+
+	// uniform point of the cell, the probability per area of the texture coordinates goes to the sphere by the sine
+	const DirectX::XMFLOAT2 uv = { (x + remainder) / mCellsX, (y + u2) / mCellsY };
+	const auto sine = std::sin(PI * uv.y);
+
+	pdf = sine > 0.f ? rowPdf * cellPdf * mCellsX * mCellsY / (2.f * PI * PI * sine) : 0.f;
+	return toDirection(uv, rotation);
+}
+
+float EnvironmentMap::pdf(const Vec3f& direction, float rotation) const
+{
+	if (mTable.empty())
+		return 0.f;
+
+	const auto uv = toUV(direction, rotation);
+	const auto x = std::min(static_cast<uint32_t>(uv.x * mCellsX), mCellsX - 1);
+	const auto y = std::min(static_cast<uint32_t>(uv.y * mCellsY), mCellsY - 1);
+	const auto sine = std::sin(PI * uv.y);
+
+	return sine > 0.f ? mTable[y].pdf * mTable[mCellsY + y * mCellsX + x].pdf * mCellsX * mCellsY / (2.f * PI * PI * sine) : 0.f;
+}
+
+// 9 bit mantissas of the three components with a shared 5 bit exponent, the largest component picks the exponent
+uint32_t EnvironmentMap::packSharedExponent(const DirectX::XMFLOAT3& color)
+{
+	const auto clamp = [](float value) { return value > 0.f ? std::min(value, SHARED_EXPONENT_MAX) : 0.f; }; // NaN too
+
+	const auto r = clamp(color.x);
+	const auto g = clamp(color.y);
+	const auto b = clamp(color.z);
+	const auto largest = std::max(r, std::max(g, b));
+
+	int exponent;
+	std::frexp(largest, &exponent);
+	exponent = std::max(exponent, -15) + 15; // largest < 2^(exponent - 15)
+
+	auto scale = std::ldexp(1.f, exponent - 15 - 9);
+	if (std::floor(largest / scale + 0.5f) >= 512.f)
+	{
+		scale *= 2.f;
+		++exponent;
+	}
+
+	const auto mantissa = [&](float value) { return std::min(static_cast<uint32_t>(value / scale + 0.5f), 511u); };
+	return mantissa(r) | mantissa(g) << 9 | mantissa(b) << 18 | static_cast<uint32_t>(exponent) << 27;
+}
+
+DirectX::XMFLOAT3 EnvironmentMap::unpackSharedExponent(uint32_t packed)
+{
+	const auto scale = std::ldexp(1.f, static_cast<int>(packed >> 27) - 15 - 9);
+	return { (packed & 511) * scale, (packed >> 9 & 511) * scale, (packed >> 18 & 511) * scale };
+}
+
+// the cells of the poles take less solid angle, the sine of the polar angle of their centers scales them,
+// all of them black leave the tables empty and nothing is sampled
+void EnvironmentMap::buildTables(const std::vector<double>& cellLuminance)
+{
+	std::vector<float> rows(mCellsY);
+	std::vector<float> cells(mCellsX);
+	mTable.assign(mCellsY + size_t(mCellsX) * mCellsY, {});
+
+	for (uint32_t y = 0; y < mCellsY; ++y)
+	{
+		const auto sine = std::sin(PI * (y + 0.5) / mCellsY);
+		auto sum = 0.0;
+
+		for (uint32_t x = 0; x < mCellsX; ++x)
+		{
+			cells[x] = static_cast<float>(cellLuminance[size_t(y) * mCellsX + x] * sine);
+			sum += cells[x];
+		}
+
+		rows[y] = static_cast<float>(sum);
+
+		const AliasTable row(cells);
+		std::copy(row.getEntries().begin(), row.getEntries().end(), mTable.begin() + mCellsY + size_t(y) * mCellsX);
+	}
+
+	const AliasTable marginal(rows);
+	if (marginal.getEntries().empty())
+	{
+		mTable.clear();
+		mCellsX = mCellsY = 0;
+		return;
+	}
+
+	std::copy(marginal.getEntries().begin(), marginal.getEntries().end(), mTable.begin());
+}
+
+bool EnvironmentMap::loadCache(const std::string& path, int64_t sourceTime)
+{
+	std::ifstream file(path, std::ios::binary);
+	CacheHeader header = {};
+
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+		|| header.magic != CACHE_MAGIC
+		|| header.version != CACHE_VERSION
+		|| header.sourceTime != sourceTime
+		|| header.maxWidth != ENVIRONMENT_MAX_WIDTH
+		|| header.tableWidth != ENVIRONMENT_TABLE_WIDTH)
+		return false;
+
+	mWidth = header.width;
+	mHeight = header.height;
+	mCellsX = header.cellsX;
+	mCellsY = header.cellsY;
+	mTexels.resize(size_t(mWidth) * mHeight);
+	mTable.resize(header.cellsY + size_t(header.cellsX) * header.cellsY);
+
+	file.read(reinterpret_cast<char*>(mTexels.data()), mTexels.size() * sizeof(uint32_t));
+	file.read(reinterpret_cast<char*>(mTable.data()), mTable.size() * sizeof(AliasTable::Entry));
+
+	return static_cast<bool>(file);
+}
+
+void EnvironmentMap::saveCache(const std::string& path, int64_t sourceTime) const
+{
+	fs::create_directories(fs::path(path).parent_path());
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		throw std::runtime_error(fmt::format("Failed to create environment cache {}", path));
+
+	const CacheHeader header = { CACHE_MAGIC, CACHE_VERSION, sourceTime, mWidth, mHeight, mCellsX, mCellsY, ENVIRONMENT_MAX_WIDTH, ENVIRONMENT_TABLE_WIDTH };
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(mTexels.data()), mTexels.size() * sizeof(uint32_t));
+	file.write(reinterpret_cast<const char*>(mTable.data()), mTable.size() * sizeof(AliasTable::Entry));
+}
@@ -31,6 +31,8 @@ void GUI::init(HWND hwnd, ID3D11Device* device, ID3D11DeviceContext* context)
 {
     ImGui_ImplWin32_Init(hwnd);
     ImGui_ImplDX11_Init(device, context);
+
+	mPickedScene = static_cast<int>(SceneCatalog::getInstance().getSceneIndex(DEFAULT_SCENE));
 }
 
 void GUI::update()
@@ -52,6 +54,13 @@ void GUI::update()
 
 		ImGui::Text("Light count %d", mRenderer.mScene.mCamera.getBuffer()->lightCount);
 
+		// the rendering stops once adaptive sampling has every tile under the target error
+		const auto& adaptive = mRenderer.mAdaptive;
+		if (adaptive.converged())
+			ImGui::Text("Converged after %lld iterations (%.3f GP)", mRenderer.mFrame, mRenderer.mFrame * (PATHCOUNT / 1e9));
+		else
+			ImGui::Text("Adaptive sampling %zu / %zu tiles, max error %.4f", adaptive.activeTiles(), adaptive.tileCount(), adaptive.maxError());
+
 		ImGui::Separator();
 
 		{
@@ -69,12 +78,46 @@ void GUI::update()
 				mRenderer.initResize(resolutions[mPickedResolution]);
 		}
 		
-		if (ImGui::Combo("Scene", &mPickedScene, SceneParams::instance.pathsReference.data(), SceneParams::instance.pathsReference.size()))
-			mRenderer.initScene(SceneParams::instance.pathNames[mPickedScene]);
+		const auto& sceneNames = SceneCatalog::getInstance().getNames();
+		if (ImGui::Combo("Scene", &mPickedScene, sceneNames.data(), sceneNames.size()))
+			mRenderer.initScene(SceneCatalog::getInstance().getName(mPickedScene));
+
+		{
+			// the scene is loaded again with the new builder
+			const char* items[] = { "SBVH (best)", "LBVH (fastest build)", "HLBVH (fast build)" };
+			const BVH::Builder builders[] = { BVH::SBVH, BVH::LBVH, BVH::HLBVH };
+
+			auto rebuild = ImGui::Combo("BVH builder", &mPickedBuilder, items, IM_ARRAYSIZE(items));
+			rebuild |= ImGui::Checkbox("Optimize BVH treelets", &mOptimizeTreelets);
+
+			if (rebuild)
+			{
+				mRenderer.mBVHParams.builder = builders[mPickedBuilder];
+				mRenderer.mBVHParams.treeletPasses = mOptimizeTreelets ? BVH_TREELET_PASSES : 0;
+				mRenderer.initScene(SceneCatalog::getInstance().getName(mPickedScene));
+			}
+		}
+
+		if (mRenderer.mSceneLoadToken)
+		{
+			ImGui::ProgressBar(mRenderer.mSceneLoadToken->progress, ImVec2(-80.0f, 0.0f), "Loading scene");
+			ImGui::SameLine();
+			if (ImGui::Button("Cancel", ImVec2(-FLT_MIN, 0.0f)))
+				mRenderer.mSceneLoadToken->cancelled = true;
+		}
 
 		ImGui::Separator();
 
-		ImGui::ColorEdit3("Environment color", reinterpret_cast<float*>(&mRenderer.mScene.mCamera.getBuffer()->envColor));
+		// the map of the scene replaces the constant color
+		auto camera = mRenderer.mScene.mCamera.getBuffer();
+		if (camera->environmentCells.x > 0)
+		{
+			if (ImGui::SliderFloat("Environment intensity", &camera->environmentIntensity, 0.f, 10.f, "%.2f", 2.f)
+				| ImGui::SliderFloat("Environment rotation", &camera->environmentRotation, 0.f, 1.f, "%.3f turns"))
+				camera->iterationCounter = 0;
+		}
+		else
+			ImGui::ColorEdit3("Environment color", reinterpret_cast<float*>(&camera->envColor));
 
 		ImGui::Separator();
 		
@@ -86,6 +129,71 @@ void GUI::update()
 			mRenderer.mScene.mCamera.getBuffer()->iterationCounter = 0;	
 		}
 
+		// path order of the kernels, the throughput above compares them
+		if (ImGui::Checkbox("Morton Order", &mMortonOrder))
+		{
+			mRenderer.mScene.mCamera.getBuffer()->mortonOrder = mMortonOrder;
+			mRenderer.mScene.mCamera.getBuffer()->iterationCounter = 0;
+		}
+		ImGui::SameLine();
+		if (ImGui::Checkbox("Coherent Queues", &mCoherentQueues))
+		{
+			mRenderer.mScene.mCamera.getBuffer()->coherentQueues = mCoherentQueues;
+			mRenderer.mScene.mCamera.getBuffer()->iterationCounter = 0;
+		}
+
+		// light samples through the glass instead of the refracted paths only
+		if (ImGui::Checkbox("Shadows through glass", &mTransmissiveShadows))
+		{
+			camera->transmissiveShadows = mTransmissiveShadows;
+			camera->iterationCounter = 0;
+		}
+
+		ImGui::Separator();
+
+		// Russian roulette, the path lengths and the samples finished per second below compare the settings
+		const char* rouletteModes[] = { "Off", "Throughput", "Luminance" };
+		auto rouletteMode = static_cast<int>(camera->rouletteMode);
+		auto restart = ImGui::Combo("Russian roulette", &rouletteMode, rouletteModes, IM_ARRAYSIZE(rouletteModes));
+		camera->rouletteMode = static_cast<RouletteMode>(rouletteMode);
+
+		if (camera->rouletteMode != RouletteMode::OFF)
+		{
+			restart |= ImGui::SliderInt("Roulette depth", reinterpret_cast<int*>(&camera->rouletteDepth), 0, 16);
+			restart |= ImGui::SliderFloat("Min survival", &camera->rouletteMinSurvival, 0.01f, 1.f, "%.2f");
+		}
+
+		restart |= ImGui::SliderInt("Max depth", reinterpret_cast<int*>(&camera->maxDepth), 0, 64, camera->maxDepth == 0 ? "unlimited" : "%d");
+		if (restart)
+			camera->iterationCounter = 0;
+
+		if (ImGui::Checkbox("Path statistics", &mPathStatistics))
+		{
+			camera->pathStatistics = mPathStatistics;
+			camera->iterationCounter = 0;
+		}
+
+		if (mPathStatistics)
+		{
+			// fractions of the paths ended at every length, the last bin has the longer ones too
+			const auto& lengths = mRenderer.mPathLengths;
+			std::array<float, PATH_LENGTH_BINS> histogram;
+			uint64_t paths = 0;
+			uint64_t bounces = 0;
+
+			for (size_t i = 0; i < lengths.size(); ++i)
+			{
+				paths += lengths[i];
+				bounces += lengths[i] * i;
+			}
+
+			for (size_t i = 0; i < lengths.size(); ++i)
+				histogram[i] = paths > 0 ? static_cast<float>(lengths[i]) / paths : 0.f;
+
+			ImGui::Text("%.1f M samples/s, mean path length %.2f", mRenderer.mSamplesPerSecond / 1e6, paths > 0 ? static_cast<double>(bounces) / paths : 0.0);
+			ImGui::PlotHistogram("Path lengths", histogram.data(), static_cast<int>(histogram.size()), 0, nullptr, 0.f, FLT_MAX, ImVec2(0.f, 80.f));
+		}
+
 		ImGui::Separator();
 
 		if (ImGui::Button("Restart"))
@@ -110,8 +218,10 @@ void GUI::update()
 		if (ImGui::Button("Add Light"))
 		{
 			ImGui::OpenPopup("Light Edit");
-			mEditingLight = mRenderer.mScene.mCamera.getBuffer()->lightCount++;
-			const auto& light = mRenderer.mScene.mLights[mEditingLight];
+			auto& lights = mRenderer.mScene.mLights;
+			lights.emplace_back(lights.empty() ? Light{ {}, 10.f, { 1.f, 1.f, 1.f }, 0.1f } : lights.back());
+			mEditingLight = static_cast<int>(lights.size()) - 1;
+			const auto& light = lights[mEditingLight];
         	const auto power = std::max(light.emission.x, std::max(light.emission.y, light.emission.z));
 			const DirectX::XMFLOAT3A color = { light.emission.x / power, light.emission.y / power, light.emission.z / power }; 
 
@@ -120,14 +230,9 @@ void GUI::update()
             mLightColor = color;
             mLightPower = power;
             mLightRadius = light.radius;
+        	mLightFalloff = light.falloff;
 
-			
-			mRenderer.mContext->UpdateSubresource(
-				mRenderer.mScene.mLightBuffer.buffer, 
-				0, nullptr, 
-				mRenderer.mScene.mLights.data(), 
-				0, 0
-			);
+			mRenderer.mScene.updateLights();
 			mRenderer.mScene.mCamera.getBuffer()->iterationCounter = 0;
 		}
 
@@ -187,12 +292,7 @@ void GUI::update()
         		light.radius = mLightRadius;
         		light.falloff = mLightFalloff;
 
-        		mRenderer.mContext->UpdateSubresource(
-					mRenderer.mScene.mLightBuffer.buffer, 
-					0, nullptr, 
-					mRenderer.mScene.mLights.data(), 
-					0, 0
-				);
+        		mRenderer.mScene.updateLight(mEditingLight);
 
         		static size_t counter = 0;
         		if (counter++ % 5 == 0)
@@ -207,12 +307,7 @@ void GUI::update()
         		light.radius = mLightRadius;
         		light.falloff = mLightFalloff;
 
-            	mRenderer.mContext->UpdateSubresource(
-					mRenderer.mScene.mLightBuffer.buffer, 
-					0, nullptr, 
-					mRenderer.mScene.mLights.data(), 
-					0, 0
-				);
+            	mRenderer.mScene.updateLights(); // rebuilt, refits of the live updates make the light BVH worse
 				mRenderer.mScene.mCamera.getBuffer()->iterationCounter = 0;
             	
                 ImGui::CloseCurrentPopup();
@@ -220,17 +315,8 @@ void GUI::update()
         	ImGui::SameLine();
         	if (ImGui::Button("Delete"))
         	{
-        		for (size_t i = mEditingLight; i < mRenderer.mScene.mCamera.getBuffer()->lightCount; i++)
-					mRenderer.mScene.mLights[i] = mRenderer.mScene.mLights[i + 1];
-
-        		mRenderer.mScene.mCamera.getBuffer()->lightCount--;
-        		
-				mRenderer.mContext->UpdateSubresource(
-					mRenderer.mScene.mLightBuffer.buffer, 
-					0, nullptr, 
-					mRenderer.mScene.mLights.data(), 
-					0, 0
-				);
+        		mRenderer.mScene.mLights.erase(mRenderer.mScene.mLights.begin() + mEditingLight);
+				mRenderer.mScene.updateLights();
 				mRenderer.mScene.mCamera.getBuffer()->iterationCounter = 0;
 
         		ImGui::CloseCurrentPopup();
@@ -0,0 +1,261 @@
+﻿#include "LightBVH.hpp"
+#include "Nvidia-SBVH/BVHNode.h"
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+
+namespace
+{
+	constexpr auto STACKSIZE = 64;
+
+	Vec3f toVec3f(const DirectX::XMFLOAT3& v)
+	{
+		return { v.x, v.y, v.z };
+	}
+
+	LightBVH::Node leaf(const Light& light, int index)
+	{
+		return { light.position, light.radius, lightPower(light), light.falloff, index, -1 };
+	}
+
+	// the smallest sphere around both
+	LightBVH::Node merge(const LightBVH::Node& a, const LightBVH::Node& b)
+	{
+		LightBVH::Node node = a;
+		node.power = a.power + b.power;
+		node.range = std::max(a.range, b.range);
+
+		auto offset = toVec3f(b.center) - toVec3f(a.center);
+		const auto distance = offset.length();
+
+		if (distance + b.radius <= a.radius)
+			return node;
+
+		if (distance + a.radius <= b.radius)
+		{
+			node.center = b.center;
+			node.radius = b.radius;
+			return node;
+		}
+
+		node.radius = (distance + a.radius + b.radius) * 0.5f * (1.f + 1e-6f); // rounding mustn't leave the children out
+		const auto center = toVec3f(a.center) + offset * ((node.radius - a.radius) / distance);
+		node.center = { center.x, center.y, center.z };
+
+		return node;
+	}
+
+	// importance of the node for the point - the falloff of the kernels by the distance of its center with the window
+	// at the nearest point of the bounding sphere and the cosine of the smallest angle between the normal and the sphere,
+	// zero only if no light of the node can reach the point, so the selection stays unbiased
+	float importance(const LightBVH::Node& node, const Vec3f& position, const Vec3f& normal)
+	{
+		const auto offset = toVec3f(node.center) - position;
+		const auto distance = std::sqrt(dot(offset, offset));
+		const auto nearest = std::max(distance - node.radius, 0.f);
+
+		if (nearest >= node.range)
+			return 0.f;
+
+		auto cosine = 1.f;
+		if (distance > node.radius)
+		{
+			const auto cosTheta = dot(offset, normal) / distance;
+			const auto sinTheta = std::sqrt(std::max(1.f - cosTheta * cosTheta, 0.f));
+			const auto sinAlpha = node.radius / distance;
+			const auto cosAlpha = std::sqrt(1.f - sinAlpha * sinAlpha);
+
+			// cosine of the angle to the center shrunk by the half angle of the sphere
+			cosine = cosTheta >= cosAlpha ? 1.f : cosTheta * cosAlpha + sinTheta * sinAlpha;
+			if (cosine <= 0.f)
+				return 0.f;
+		}
+
+		const auto ratio = nearest * nearest / (node.range * node.range);
+		const auto window = 1.f - ratio * ratio;
+		return node.power * cosine * window * window / (distance * distance + 1.f);
+	}
+}
+
+LightBVH::LightBVH(const std::vector<Light>& lights)
+{
+	if (lights.empty())
+		return;
+
+	std::vector<uint32_t> order(lights.size());
+	std::iota(order.begin(), order.end(), 0);
+
+	mNodes.reserve(2 * lights.size() - 1);
+	mParents.reserve(2 * lights.size() - 1);
+	mLeaves.resize(lights.size());
+	build(lights, order, 0, order.size(), -1);
+}
+
+size_t LightBVH::sample(const Vec3f& position, const Vec3f& normal, float u, float& pdf) const
+{
+	pdf = 0.f;
+	if (mNodes.empty() || importance(mNodes[0], position, normal) <= 0.f)
+		return 0;
+
+	// the random number is rescaled after every choice, so a single one is enough for the whole descent
+	float probability = 1.f;
+	int index = 0;
+
+	while (mNodes[index].rightIndex >= 0)
+	{
+		const auto& node = mNodes[index];
+		const auto left = importance(mNodes[node.leftIndex], position, normal);
+		const auto right = importance(mNodes[node.rightIndex], position, normal);
+
+		if (left + right <= 0.f)
+			return 0;
+
+		const auto p = left / (left + right);
+		if (u < p)
+		{
+			u /= p;
+			probability *= p;
+			index = node.leftIndex;
+		}
+		else
+		{
+			u = (u - p) / (1.f - p);
+			probability *= 1.f - p;
+			index = node.rightIndex;
+		}
+
+		u = std::min(u, 0x1.fffffep-1f);
+	}
+
+	pdf = probability;
+	return mNodes[index].leftIndex;
+}
+
+float LightBVH::pdf(const Vec3f& position, const Vec3f& normal, size_t light) const
+{
+	if (mNodes.empty() || importance(mNodes[0], position, normal) <= 0.f)
+		return 0.f;
+
+	float probability = 1.f;
+	for (auto index = mLeaves[light]; mParents[index] >= 0; index = mParents[index])
+	{
+		const auto& parent = mNodes[mParents[index]];
+		const auto left = importance(mNodes[parent.leftIndex], position, normal);
+		const auto right = importance(mNodes[parent.rightIndex], position, normal);
+
+		if (left + right <= 0.f)
+			return 0.f;
+
+		probability *= (parent.leftIndex == index ? left : right) / (left + right);
+	}
+
+	return probability;
+}
+
+int LightBVH::intersect(const Vec3f& origin, const Vec3f& direction, float& distance) const
+{
+	if (mNodes.empty())
+		return -1;
+
+	int light = -1;
+	int stack[STACKSIZE];
+	size_t ptr = 0;
+	stack[ptr++] = 0;
+
+	while (ptr > 0)
+	{
+		const auto& node = mNodes[stack[--ptr]];
+		const auto position = toVec3f(node.center) - origin;
+		const auto tca = dot(position, direction);
+
+		// distance of the center from the ray by the difference, not by |position|^2 - tca^2 which cancels for grazing rays,
+		// inner nodes get a margin for the rounding that grows along the ray, so they keep every hit of their lights
+		const auto offset = position - direction * tca;
+		const auto d2 = dot(offset, offset);
+		const auto radius = node.rightIndex < 0 ? node.radius : node.radius + 1e-5f * std::abs(tca);
+		const auto radius2 = radius * radius;
+
+		if (d2 > radius2)
+			continue;
+
+		const auto thc = std::sqrt(radius2 - d2);
+		auto t0 = tca - thc;
+		const auto t1 = tca + thc;
+
+		if (node.rightIndex < 0)
+		{
+			if (t0 < 0.f)
+				t0 = t1; // origin inside the light
+
+			if (t0 > 0.f && t0 < distance)
+			{
+				distance = t0;
+				light = node.leftIndex;
+			}
+		}
+		else if (t1 > 0.f && t0 < distance)
+		{
+			stack[ptr++] = node.leftIndex;
+			stack[ptr++] = node.rightIndex;
+		}
+	}
+
+	return light;
+}
+
+void LightBVH::refit(const std::vector<Light>& lights, size_t light, std::vector<int>& changed)
+{
+	auto index = mLeaves[light];
+	mNodes[index] = leaf(lights[light], static_cast<int>(light));
+	changed.push_back(index);
+
+	while ((index = mParents[index]) >= 0)
+	{
+		auto& node = mNodes[index];
+		const auto left = node.leftIndex;
+		const auto right = node.rightIndex;
+
+		node = merge(mNodes[left], mNodes[right]);
+		node.leftIndex = left;
+		node.rightIndex = right;
+		changed.push_back(index);
+	}
+}
+
+// median split along the widest axis of the light positions, depth stays logarithmic for any distribution
+int LightBVH::build(const std::vector<Light>& lights, std::vector<uint32_t>& order, size_t begin, size_t end, int parent)
+{
+	const auto index = static_cast<int>(mNodes.size());
+	mNodes.emplace_back();
+	mParents.push_back(parent);
+
+	if (end - begin == 1)
+	{
+		mNodes[index] = leaf(lights[order[begin]], static_cast<int>(order[begin]));
+		mLeaves[order[begin]] = index;
+
+		return index;
+	}
+
+	AABB bounds;
+	for (auto i = begin; i < end; ++i)
+		bounds.grow(toVec3f(lights[order[i]].position));
+
+	const auto extent = bounds.max() - bounds.min();
+	const auto axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+	const auto middle = begin + (end - begin) / 2;
+
+	std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end, [&](uint32_t a, uint32_t b)
+	{
+		return toVec3f(lights[a].position)._v[axis] < toVec3f(lights[b].position)._v[axis];
+	});
+
+	const auto left = build(lights, order, begin, middle, index);
+	const auto right = build(lights, order, middle, end, index);
+
+	mNodes[index] = merge(mNodes[left], mNodes[right]);
+	mNodes[index].leftIndex = left;
+	mNodes[index].rightIndex = right;
+
+	return index;
+}
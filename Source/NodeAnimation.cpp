@@ -0,0 +1,140 @@
+﻿#include "NodeAnimation.hpp"
+#include <assimp/scene.h>
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	// index of the key at or before the time, keys are sorted by time
+	template<typename Key>
+	size_t findKey(const std::vector<Key>& keys, double time)
+	{
+		const auto it = std::upper_bound(keys.begin(), keys.end(), time, [](double t, const Key& key) { return t < key.mTime; });
+		return it == keys.begin() ? 0 : (it - keys.begin()) - 1;
+	}
+
+	template<typename Key>
+	float blendFactor(const std::vector<Key>& keys, size_t key, double time)
+	{
+		const auto span = keys[key + 1].mTime - keys[key].mTime;
+		return span > 0.0 ? static_cast<float>(std::clamp((time - keys[key].mTime) / span, 0.0, 1.0)) : 0.f;
+	}
+
+	aiVector3D interpolate(const std::vector<aiVectorKey>& keys, double time, const aiVector3D& rest)
+	{
+		if (keys.empty())
+			return rest;
+
+		const auto key = findKey(keys, time);
+		if (key + 1 >= keys.size())
+			return keys[key].mValue;
+
+		const auto t = blendFactor(keys, key, time);
+		return keys[key].mValue + (keys[key + 1].mValue - keys[key].mValue) * t;
+	}
+
+	aiQuaternion interpolate(const std::vector<aiQuatKey>& keys, double time, const aiQuaternion& rest)
+	{
+		if (keys.empty())
+			return rest;
+
+		const auto key = findKey(keys, time);
+		if (key + 1 >= keys.size())
+			return keys[key].mValue;
+
+		aiQuaternion rotation;
+		aiQuaternion::Interpolate(rotation, keys[key].mValue, keys[key + 1].mValue, blendFactor(keys, key, time));
+		return rotation.Normalize();
+	}
+}
+
+NodeAnimation::NodeAnimation(const aiScene* scene)
+{
+	addNode(scene->mRootNode, 0);
+
+	if (!scene->HasAnimations())
+		return;
+
+	const auto& animation = *scene->mAnimations[0];
+	mDuration = animation.mDuration;
+	if (animation.mTicksPerSecond > 0.0)
+		mTicksPerSecond = animation.mTicksPerSecond;
+
+	for (size_t i = 0; i < animation.mNumChannels; ++i)
+	{
+		const auto& nodeAnim = *animation.mChannels[i];
+		const auto node = std::find(mNames.begin(), mNames.end(), nodeAnim.mNodeName);
+		if (node == mNames.end())
+			continue;
+
+		Channel channel;
+		channel.positions.assign(nodeAnim.mPositionKeys, nodeAnim.mPositionKeys + nodeAnim.mNumPositionKeys);
+		channel.rotations.assign(nodeAnim.mRotationKeys, nodeAnim.mRotationKeys + nodeAnim.mNumRotationKeys);
+		channel.scalings.assign(nodeAnim.mScalingKeys, nodeAnim.mScalingKeys + nodeAnim.mNumScalingKeys);
+		mNodes[node - mNames.begin()].local.Decompose(channel.restScaling, channel.restRotation, channel.restPosition);
+
+		mNodes[node - mNames.begin()].channel = static_cast<int>(mChannels.size());
+		mChannels.emplace_back(std::move(channel));
+	}
+
+	mNames.clear();
+}
+
+const std::vector<uint32_t>& NodeAnimation::update(float dt)
+{
+	mChanged.clear();
+	if (empty())
+		return mChanged;
+
+	mTime += dt * mTicksPerSecond;
+	if (mDuration > 0.0)
+		mTime = std::fmod(mTime, mDuration);
+
+	// parents precede their children, the change propagates down in a single pass
+	std::vector<bool> changed(mNodes.size(), false);
+
+	for (uint32_t i = 0; i < mNodes.size(); ++i)
+	{
+		auto& node = mNodes[i];
+
+		if (node.channel >= 0)
+		{
+			node.local = evaluate(mChannels[node.channel]);
+			changed[i] = true;
+		}
+		else if (i > 0)
+			changed[i] = changed[node.parent];
+
+		if (!changed[i])
+			continue;
+
+		node.world = i > 0 ? mNodes[node.parent].world * node.local : node.local;
+		mChanged.emplace_back(i);
+	}
+
+	return mChanged;
+}
+
+void NodeAnimation::addNode(const aiNode* node, uint32_t parent)
+{
+	const auto index = static_cast<uint32_t>(mNodes.size());
+
+	Node n;
+	n.parent = parent;
+	n.local = node->mTransformation;
+	n.world = index > 0 ? mNodes[parent].world * n.local : n.local;
+
+	mNodes.emplace_back(n);
+	mNames.emplace_back(node->mName);
+
+	for (size_t i = 0; i < node->mNumChildren; ++i)
+		addNode(node->mChildren[i], index);
+}
+
+aiMatrix4x4 NodeAnimation::evaluate(const Channel& channel) const
+{
+	return aiMatrix4x4(
+		interpolate(channel.scalings, mTime, channel.restScaling),
+		interpolate(channel.rotations, mTime, channel.restRotation),
+		interpolate(channel.positions, mTime, channel.restPosition));
+}
@@ -29,9 +29,13 @@
 
 #include "Nvidia-SBVH/BVH.h"
 #include "Nvidia-SBVH/SplitBVHBuilder.h"
+#include "Nvidia-SBVH/LBVHBuilder.h"
+#include "Nvidia-SBVH/OutOfCoreBuilder.h"
+#include "Nvidia-SBVH/TreeletOptimizer.h"
 
 
 BVH::BVH(GPUScene* scene, const Platform& platform, const BuildParams& params)
+	: m_peakBytes(0)
 {
 	FW_ASSERT(scene);
 	m_scene = scene;
@@ -40,25 +44,190 @@ BVH::BVH(GPUScene* scene, const Platform& platform, const BuildParams& params)
 	if (params.enablePrints)
 		printf("BVH builder: %d tris, %d vertices\n", scene->getNumTriangles(), scene->getNumVertices());
 
-	// SplitBVHBuilder() builds the actual BVH
-	m_root = SplitBVHBuilder(*this, params).run(m_numNodes);
+	// SplitBVHBuilder() builds the actual BVH, LBVHBuilder() the fast one for previews and edits,
+	// OutOfCoreBuilder() runs either of them by clusters when the whole build doesn't fit into the memory budget
+	const bool outOfCore = params.memoryBudget > 0 && OutOfCoreBuilder::estimateBytes(params, scene->getNumTriangles()) > params.memoryBudget;
+	const bool optimize = params.treeletPasses > 0 && !outOfCore;
 
+	// the treelet passes take the last part of the progress
+	const F32 buildShare = optimize ? 0.8f : 1.0f;
+	BuildParams buildParams = params;
+	if (params.progress)
+		buildParams.progress = [&params, buildShare](F32 done) { params.progress(done * buildShare); };
+
+	if (outOfCore)
+		OutOfCoreBuilder(*this, buildParams).run();
+	else if (params.builder == SBVH)
+		SplitBVHBuilder(*this, buildParams).run();
+	else
+		LBVHBuilder(*this, buildParams).run();
+
+	const BVHNode& root = m_nodes[0];
 	if (params.enablePrints)
-		printf("BVH: Scene bounds: (%.1f,%.1f,%.1f) - (%.1f,%.1f,%.1f)\n", m_root->m_bounds.min().x, m_root->m_bounds.min().y, m_root->m_bounds.min().z,
-		m_root->m_bounds.max().x, m_root->m_bounds.max().y, m_root->m_bounds.max().z);
+		printf("BVH: Scene bounds: (%.1f,%.1f,%.1f) - (%.1f,%.1f,%.1f)\n", root.m_bounds.min().x, root.m_bounds.min().y, root.m_bounds.min().z,
+		root.m_bounds.max().x, root.m_bounds.max().y, root.m_bounds.max().z);
 
-	float sah = 0.f;
-	m_root->computeSubtreeProbabilities(m_platform, 1.f, sah);
+	float sah = computeSAHCost();
 	if (params.enablePrints)
 		printf("top-down sah: %.2f\n", sah);
 
-	if (params.stats)
+	const float builtSah = sah;
+	// clusters of the out-of-core build are optimized by their own builds, the whole tree would take the memory again
+	if (optimize)
+	{
+		if (params.progress)
+			buildParams.progress = [&params, buildShare](F32 done) { params.progress(buildShare + done * (1.0f - buildShare)); };
+
+		TreeletOptimizer(*this, buildParams).run();
+		reorderDepthFirst();
+
+		sah = computeSAHCost();
+		if (params.enablePrints)
+			printf("optimized sah: %.2f\n", sah);
+	}
+
+	if (params.stats || params.enablePrints)
+	{
+		Stats stats;
+		computeStats(stats);
+		stats.SAHCost = sah;
+		stats.builtSAHCost = builtSah;
+
+		if (params.stats)
+			*params.stats = stats;
+		if (params.enablePrints)
+			stats.print();
+	}
+}
+
+//------------------------------------------------------------------------
+
+void BVH::Stats::print() const
+{
+	printf("Tree stats: [bfactor=%d] %d nodes (%d+%d), %.2f SAHCost (%.2f built), %.1f children/inner, %.1f tris/leaf\n",
+		branchingFactor, numLeafNodes + numInnerNodes, numLeafNodes, numInnerNodes, SAHCost, builtSAHCost,
+		1.f*numChildNodes / max1i(numInnerNodes, 1), 1.f*numTris / max1i(numLeafNodes, 1));
+	printf("Tree stats: %lld duplicates (%.1f%%), depth %d, %.1f MB peak build memory\n",
+		(long long)numDuplicates, 100.f*numDuplicates / max1i(numTris - (S32)numDuplicates, 1), maxDepth, peakBytes / 1e6);
+
+	printf("Leaves by depth:");
+	for (int i = 0; i < NumDepthBins; i++)
+		if (depthHistogram[i])
+			printf(" %d%s:%d", i, i == NumDepthBins - 1 ? "+" : "", depthHistogram[i]);
+
+	printf("\nLeaves by size: ");
+	for (int i = 0; i < NumLeafSizeBins; i++)
+		if (leafSizeHistogram[i])
+			printf(" %d%s:%d", i, i == NumLeafSizeBins - 1 ? "+" : "", leafSizeHistogram[i]);
+
+	printf("\n");
+}
+
+//------------------------------------------------------------------------
+
+void BVH::computeStats(Stats& stats) const
+{
+	stats.clear();
+	stats.branchingFactor = 2;
+	stats.numDuplicates = (S64)m_triIndices.getSize() - m_scene->getNumTriangles();
+	stats.peakBytes = m_peakBytes;
+
+	// parents precede their children, so their depth is known when the children are reached
+	Array<S32> depths;
+	depths.reset(m_nodes.getSize());
+	depths[0] = 0;
+
+	for (int i = 0; i < m_nodes.getSize(); i++)
+	{
+		const BVHNode& node = m_nodes[i];
+		stats.numChildNodes += node.getNumChildNodes();
+
+		if (!node.isLeaf())
+		{
+			stats.numInnerNodes++;
+			for (int c = 0; c < node.getNumChildNodes(); c++)
+				depths[node.getChildNode(c)] = depths[i] + 1;
+			continue;
+		}
+
+		stats.numLeafNodes++;
+		stats.numTris += node.getNumTriangles();
+		stats.maxDepth = max1i(stats.maxDepth, depths[i]);
+		stats.depthHistogram[min1i(depths[i], Stats::NumDepthBins - 1)]++;
+		stats.leafSizeHistogram[min1i(node.getNumTriangles(), Stats::NumLeafSizeBins - 1)]++;
+	}
+}
+
+//------------------------------------------------------------------------
+
+int BVH::getSubtreeSize(BVH_STAT stat) const  // counts some type of nodes (either leafnodes, innernodes, childnodes) or number of triangles of the whole tree
+{
+	int cnt = 0;
+
+	for (int i = 0; i < m_nodes.getSize(); i++)
 	{
-		params.stats->SAHCost = sah;
-		params.stats->branchingFactor = 2;
-		params.stats->numLeafNodes = m_root->getSubtreeSize(BVH_STAT_LEAF_COUNT);
-		params.stats->numInnerNodes = m_root->getSubtreeSize(BVH_STAT_INNER_COUNT);
-		params.stats->numTris = m_root->getSubtreeSize(BVH_STAT_TRIANGLE_COUNT);
-		params.stats->numChildNodes = m_root->getSubtreeSize(BVH_STAT_CHILDNODE_COUNT);
+		const BVHNode& node = m_nodes[i];
+
+		switch (stat)
+		{
+		default: FW_ASSERT(0);  // unknown mode
+		case BVH_STAT_NODE_COUNT:      cnt += 1; break; // counts all nodes including leafnodes
+		case BVH_STAT_LEAF_COUNT:      cnt += node.isLeaf() ? 1 : 0; break; // counts only leafnodes
+		case BVH_STAT_INNER_COUNT:     cnt += node.isLeaf() ? 0 : 1; break; // counts only innernodes
+		case BVH_STAT_TRIANGLE_COUNT:  cnt += node.getNumTriangles(); break; // counts all triangles
+		case BVH_STAT_CHILDNODE_COUNT: cnt += node.getNumChildNodes(); break; ///counts only childnodes
+		}
 	}
+
+	return cnt;
+}
+
+//------------------------------------------------------------------------
+
+float BVH::computeSAHCost(void) const
+{
+	// probability of coming to a node, parents precede their children so a single pass propagates it down
+	Array<float> probabilities;
+	probabilities.reset(m_nodes.getSize());
+	probabilities[0] = 1.0f;
+
+	float sah = 0.0f;
+	for (int i = 0; i < m_nodes.getSize(); i++)
+	{
+		const BVHNode& node = m_nodes[i];
+		sah += probabilities[i] * m_platform.getCost(node.getNumChildNodes(), node.getNumTriangles());
+
+		for (int c = 0; c < node.getNumChildNodes(); c++)
+			probabilities[node.getChildNode(c)] = probabilities[i] * m_nodes[node.getChildNode(c)].getArea() / node.getArea();
+	}
+
+	return sah;
+}
+
+//------------------------------------------------------------------------
+
+void BVH::reorderDepthFirst(void)
+{
+	Array<BVHNode> nodes;
+	nodes.setCapacity(m_nodes.getSize());
+
+	// stack of (old index, slot in the parent to patch)
+	Array<Vec2i> stack;
+	stack.add(Vec2i(0, -1));
+
+	while (stack.getSize())
+	{
+		const Vec2i item = stack.removeLast();
+		const S32 index = nodes.getSize();
+		nodes.add(m_nodes[item.x]);
+
+		if (item.y >= 0)
+			nodes[item.y >> 1].m_children[item.y & 1] = index;
+
+		if (!m_nodes[item.x].isLeaf())
+			for (int c = 1; c >= 0; c--)
+				stack.add(Vec2i(m_nodes[item.x].m_children[c], (index << 1) | c));
+	}
+
+	m_nodes = std::move(nodes);
 }
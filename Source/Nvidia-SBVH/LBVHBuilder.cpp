@@ -0,0 +1,354 @@
+#include "Nvidia-SBVH/LBVHBuilder.h"
+#include "Parallel.hpp"
+#include <algorithm>
+
+namespace
+{
+	// spreads the lowest 10 bits so there are two zero bits between every two of them
+	U32 expandBits(U32 v)
+	{
+		v = (v * 0x00010001u) & 0xFF0000FFu;
+		v = (v * 0x00000101u) & 0x0F00F00Fu;
+		v = (v * 0x00000011u) & 0xC30C30C3u;
+		v = (v * 0x00000005u) & 0x49249249u;
+		return v;
+	}
+
+	U32 quantize(float x)
+	{
+		return static_cast<U32>(std::min(std::max(x * 1024.0f, 0.0f), 1023.0f));
+	}
+}
+
+LBVHBuilder::LBVHBuilder(BVH& bvh, const BVH::BuildParams& params)
+	: m_bvh(bvh),
+	m_params(params),
+	m_numTopNodes(0)
+{
+}
+
+//------------------------------------------------------------------------
+
+void LBVHBuilder::run(void)
+{
+	Array<BVHNode>& nodes = m_bvh.getNodes();
+	nodes.clear();
+
+	const S32 numTris = m_bvh.getScene()->getNumTriangles();
+	if (numTris == 0)
+	{
+		nodes.add(BVHNode::leaf(AABB(), 0, 0));
+		return;
+	}
+
+	// the stages run on all the threads, the build is cancelled between them
+	computeCodes();
+	m_params.checkCancelled();
+	m_params.reportProgress(0.2f);
+
+	sortCodes();
+	m_params.checkCancelled();
+	m_params.reportProgress(0.4f);
+
+	// leaves refer to the triangles in the sorted order
+	Array<S32>& tris = m_bvh.getTriIndices();
+	tris.resize(numTris);
+	parallelFor(numTris, [&](size_t i) { tris[static_cast<S32>(i)] = static_cast<S32>(m_keys[i] & 0xFFFFFFFFu); });
+
+	createTreelets();
+
+	parallelFor(m_treelets.size(), [&](size_t i)
+	{
+		Treelet& treelet = m_treelets[i];
+		treelet.nodes.setCapacity(2 * (treelet.hi - treelet.lo) - 1);
+		buildTreelet(treelet.nodes, treelet.lo, treelet.hi, CodeBits - TreeletBits - 1);
+	}, 1);
+
+	m_params.checkCancelled();
+	m_params.reportProgress(0.8f);
+
+	// a binary top over the treelets has one inner node less than there are treelets
+	const S32 numTreelets = static_cast<S32>(m_treelets.size());
+	S32 numNodes = numTreelets - 1;
+	size_t treeletBytes = 0;
+	for (Treelet& treelet : m_treelets)
+	{
+		treelet.offset = numNodes;
+		numNodes += treelet.nodes.getSize();
+		treeletBytes += treelet.nodes.getCapacityBytes();
+	}
+
+	nodes.reset(numNodes);
+	m_bvh.updatePeakBytes(nodes.getCapacityBytes() + treeletBytes + tris.getCapacityBytes() + m_keys.capacity() * sizeof(uint64_t) + m_triBounds.capacity() * sizeof(AABB));
+
+	if (m_params.builder == BVH::HLBVH)
+		buildSAHTop(0, numTreelets);
+	else
+		buildMortonTop(0, numTreelets, CodeBits - 1);
+
+	FW_ASSERT(m_numTopNodes == numTreelets - 1);
+	parallelFor(m_treelets.size(), [&](size_t i) { copyTreelet(m_treelets[i]); }, 1);
+	m_params.reportProgress(1.0f);
+
+	if (m_params.enablePrints)
+		printf("LBVHBuilder: %d treelets, %d nodes\n", numTreelets, numNodes);
+}
+
+//------------------------------------------------------------------------
+
+void LBVHBuilder::computeCodes(void)
+{
+	GPUScene* scene = m_bvh.getScene();
+	const S32 numTris = scene->getNumTriangles();
+	const GPUScene::Triangle* tris = scene->getTrianglePtr();
+	const Vec3f* verts = scene->getVertexPtr();
+
+	m_triBounds.resize(numTris);
+	parallelFor(numTris, [&](size_t i)
+	{
+		AABB bounds;
+		for (int j = 0; j < 3; j++)
+			bounds.grow(verts[tris[i].vertices._v[j]]);
+
+		m_triBounds[i] = bounds;
+	});
+
+	AABB centroids;
+	for (const AABB& bounds : m_triBounds)
+		centroids.grow(bounds.midPoint());
+
+	// flat dimensions get zero in their bits
+	const Vec3f extent = centroids.max() - centroids.min();
+	const Vec3f scale(extent.x > 0.0f ? 1.0f / extent.x : 0.0f, extent.y > 0.0f ? 1.0f / extent.y : 0.0f, extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+
+	m_keys.resize(numTris);
+	parallelFor(numTris, [&](size_t i)
+	{
+		const Vec3f p = (m_triBounds[i].midPoint() - centroids.min()) * scale;
+		const U32 code = (expandBits(quantize(p.x)) << 2) | (expandBits(quantize(p.y)) << 1) | expandBits(quantize(p.z));
+		m_keys[i] = (static_cast<uint64_t>(code) << 32) | static_cast<U32>(i);
+	});
+}
+
+//------------------------------------------------------------------------
+
+void LBVHBuilder::sortCodes(void)
+{
+	// least significant digit radix sort of the codes, every block of keys is counted and scattered by one thread
+	constexpr size_t BlockSize = 1 << 16;
+	constexpr size_t NumDigits = 1 << RadixBits;
+
+	const size_t numKeys = m_keys.size();
+	const size_t numBlocks = (numKeys + BlockSize - 1) / BlockSize;
+
+	std::vector<uint64_t> sorted(numKeys);
+	std::vector<size_t> offsets(numBlocks * NumDigits);
+	m_bvh.updatePeakBytes((m_keys.capacity() + sorted.capacity()) * sizeof(uint64_t) + offsets.capacity() * sizeof(size_t) + m_triBounds.capacity() * sizeof(AABB));
+
+	for (int shift = 32; shift < 32 + CodeBits; shift += RadixBits)
+	{
+		parallelFor(numBlocks, [&](size_t block)
+		{
+			size_t* counts = &offsets[block * NumDigits];
+			std::fill(counts, counts + NumDigits, 0);
+
+			for (size_t i = block * BlockSize; i < std::min(numKeys, (block + 1) * BlockSize); i++)
+				counts[(m_keys[i] >> shift) & (NumDigits - 1)]++;
+		}, 1);
+
+		// digits go first, blocks second so the sort stays stable
+		size_t sum = 0;
+		for (size_t digit = 0; digit < NumDigits; digit++)
+		{
+			for (size_t block = 0; block < numBlocks; block++)
+			{
+				const size_t count = offsets[block * NumDigits + digit];
+				offsets[block * NumDigits + digit] = sum;
+				sum += count;
+			}
+		}
+
+		parallelFor(numBlocks, [&](size_t block)
+		{
+			size_t* next = &offsets[block * NumDigits];
+
+			for (size_t i = block * BlockSize; i < std::min(numKeys, (block + 1) * BlockSize); i++)
+				sorted[next[(m_keys[i] >> shift) & (NumDigits - 1)]++] = m_keys[i];
+		}, 1);
+
+		m_keys.swap(sorted);
+	}
+}
+
+//------------------------------------------------------------------------
+
+void LBVHBuilder::createTreelets(void)
+{
+	const S32 numKeys = static_cast<S32>(m_keys.size());
+	const int shift = CodeBits - TreeletBits;
+
+	for (S32 lo = 0; lo < numKeys; )
+	{
+		const U32 code = getCode(lo) >> shift;
+
+		S32 hi = lo + 1;
+		while (hi < numKeys && (getCode(hi) >> shift) == code)
+			hi++;
+
+		m_treelets.emplace_back();
+		m_treelets.back().lo = lo;
+		m_treelets.back().hi = hi;
+		m_treelets.back().code = code << shift;
+		lo = hi;
+	}
+}
+
+//------------------------------------------------------------------------
+
+S32 LBVHBuilder::buildTreelet(Array<BVHNode>& nodes, S32 lo, S32 hi, int bit)
+{
+	if (hi - lo <= m_params.maxLeafSize)
+	{
+		nodes.add(createLeaf(lo, hi));
+		return nodes.getSize() - 1;
+	}
+
+	// codes of the range are sorted and share all the bits above, the first one with the bit set starts the right child
+	S32 split = lo;
+	for (; bit >= 0; bit--)
+	{
+		const U32 mask = 1u << bit;
+		split = static_cast<S32>(std::partition_point(m_keys.begin() + lo, m_keys.begin() + hi, [&](uint64_t key) { return !((key >> 32) & mask); }) - m_keys.begin());
+
+		if (split != lo && split != hi)
+			break;
+	}
+
+	// all the codes are the same
+	if (bit < 0)
+		split = (lo + hi) / 2;
+
+	const S32 index = nodes.getSize();
+	nodes.add();
+
+	const S32 left = buildTreelet(nodes, lo, split, bit - 1);
+	const S32 right = buildTreelet(nodes, split, hi, bit - 1);
+	nodes[index] = BVHNode::inner(nodes[left].m_bounds + nodes[right].m_bounds, left, right);
+	return index;
+}
+
+//------------------------------------------------------------------------
+
+S32 LBVHBuilder::buildMortonTop(S32 lo, S32 hi, int bit)
+{
+	if (hi - lo == 1)
+		return m_treelets[lo].offset;
+
+	const S32 index = m_numTopNodes++;
+
+	// treelets have distinct codes, some bit above the treelet ones has to differ
+	S32 split = lo;
+	for (; bit >= CodeBits - TreeletBits; bit--)
+	{
+		const U32 mask = 1u << bit;
+		split = static_cast<S32>(std::partition_point(m_treelets.begin() + lo, m_treelets.begin() + hi, [&](const Treelet& treelet) { return !(treelet.code & mask); }) - m_treelets.begin());
+
+		if (split != lo && split != hi)
+			break;
+	}
+
+	const S32 left = buildMortonTop(lo, split, bit - 1);
+	const S32 right = buildMortonTop(split, hi, bit - 1);
+
+	Array<BVHNode>& nodes = m_bvh.getNodes();
+	nodes[index] = BVHNode::inner(getBounds(m_treelets[lo]), left, right);
+	for (S32 i = lo + 1; i < hi; i++)
+		nodes[index].m_bounds.grow(getBounds(m_treelets[i]));
+
+	return index;
+}
+
+//------------------------------------------------------------------------
+
+S32 LBVHBuilder::buildSAHTop(S32 lo, S32 hi)
+{
+	if (hi - lo == 1)
+		return m_treelets[lo].offset;
+
+	const S32 index = m_numTopNodes++;
+
+	// sweep of the treelets sorted along the widest axis of their centroids
+	AABB centroids;
+	for (S32 i = lo; i < hi; i++)
+		centroids.grow(getBounds(m_treelets[i]).midPoint());
+
+	const Vec3f extent = centroids.max() - centroids.min();
+	const int dim = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+	std::sort(m_treelets.begin() + lo, m_treelets.begin() + hi, [&](const Treelet& a, const Treelet& b)
+	{
+		return getBounds(a).midPoint()._v[dim] < getBounds(b).midPoint()._v[dim];
+	});
+
+	std::vector<F32> rightArea(hi - lo);
+	AABB right;
+	for (S32 i = hi - 1; i > lo; i--)
+	{
+		right.grow(getBounds(m_treelets[i]));
+		rightArea[i - lo] = right.area();
+	}
+
+	// treelets are weighted by their triangle count, the same as the SAH of the whole tree would
+	std::vector<S32> rightCount(hi - lo + 1, 0);
+	for (S32 i = hi - 1; i >= lo; i--)
+		rightCount[i - lo] = rightCount[i - lo + 1] + m_treelets[i].hi - m_treelets[i].lo;
+
+	AABB left;
+	S32 split = lo + 1;
+	F32 bestCost = FW_F32_MAX;
+	for (S32 i = lo + 1; i < hi; i++)
+	{
+		left.grow(getBounds(m_treelets[i - 1]));
+		const F32 cost = left.area() * (rightCount[0] - rightCount[i - lo]) + rightArea[i - lo] * rightCount[i - lo];
+
+		if (cost < bestCost)
+		{
+			bestCost = cost;
+			split = i;
+		}
+	}
+
+	left.grow(right);
+
+	const S32 leftNode = buildSAHTop(lo, split);
+	const S32 rightNode = buildSAHTop(split, hi);
+	m_bvh.getNodes()[index] = BVHNode::inner(left, leftNode, rightNode);
+	return index;
+}
+
+//------------------------------------------------------------------------
+
+BVHNode LBVHBuilder::createLeaf(S32 lo, S32 hi)
+{
+	AABB bounds;
+	for (S32 i = lo; i < hi; i++)
+		bounds.grow(m_triBounds[m_keys[i] & 0xFFFFFFFFu]);
+
+	return BVHNode::leaf(bounds, lo, hi);
+}
+
+//------------------------------------------------------------------------
+
+void LBVHBuilder::copyTreelet(const Treelet& treelet)
+{
+	BVHNode* nodes = m_bvh.getNodes().getPtr(treelet.offset);
+
+	for (S32 i = 0; i < treelet.nodes.getSize(); i++)
+	{
+		nodes[i] = treelet.nodes[i];
+		if (!nodes[i].isLeaf())
+		{
+			nodes[i].m_children[0] += treelet.offset;
+			nodes[i].m_children[1] += treelet.offset;
+		}
+	}
+}
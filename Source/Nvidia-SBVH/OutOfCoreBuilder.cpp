@@ -0,0 +1,404 @@
+#include "Nvidia-SBVH/OutOfCoreBuilder.h"
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <stdexcept>
+
+OutOfCoreBuilder::TempFile::TempFile(const char* directory)
+{
+	// the process part keeps concurrent runs apart, the counter the files of one run
+	static std::atomic<U32> counter(0);
+	static const U32 process = std::random_device()();
+
+	const std::filesystem::path base = directory ? std::filesystem::path(directory) : std::filesystem::temp_directory_path();
+	m_path = (base / ("bvh-" + std::to_string(process) + "-" + std::to_string(counter++) + ".tmp")).string();
+}
+
+//------------------------------------------------------------------------
+
+OutOfCoreBuilder::TempFile::~TempFile(void)
+{
+	clear();
+}
+
+//------------------------------------------------------------------------
+
+void OutOfCoreBuilder::TempFile::write(const void* data, size_t bytes)
+{
+	if (!m_stream.is_open())
+		m_stream.open(m_path, std::ios::binary | std::ios::out | std::ios::app);
+
+	if (!m_stream.write(static_cast<const char*>(data), bytes))
+		throw std::runtime_error("Out-of-core BVH build failed to write " + m_path);
+}
+
+//------------------------------------------------------------------------
+
+void OutOfCoreBuilder::TempFile::read(void* data, size_t bytes)
+{
+	if (!m_stream.is_open())
+		m_stream.open(m_path, std::ios::binary | std::ios::in);
+
+	if (!m_stream.read(static_cast<char*>(data), bytes))
+		throw std::runtime_error("Out-of-core BVH build failed to read " + m_path);
+}
+
+//------------------------------------------------------------------------
+
+void OutOfCoreBuilder::TempFile::close(void)
+{
+	if (m_stream.is_open())
+		m_stream.close();
+
+	m_stream.clear();
+}
+
+//------------------------------------------------------------------------
+
+void OutOfCoreBuilder::TempFile::clear(void)
+{
+	close();
+	std::remove(m_path.c_str());
+}
+
+//------------------------------------------------------------------------
+
+OutOfCoreBuilder::OutOfCoreBuilder(BVH& bvh, const BVH::BuildParams& params)
+	: m_bvh(bvh),
+	m_params(params),
+	m_clusterSize(0),
+	m_numTopNodes(0)
+{
+}
+
+//------------------------------------------------------------------------
+
+size_t OutOfCoreBuilder::estimateBytes(const BVH::BuildParams& params, S32 numTris)
+{
+	// 2n - 1 nodes and the triangle indices are the output of every builder,
+	// SBVH keeps the references with room for the duplicates of its budget and the bounds of the right sweep,
+	// LBVH the keys, the triangle bounds and the treelet nodes before they are copied into the arena
+	const F64 duplicates = params.duplicationBudget >= 0.0f ? params.duplicationBudget : 1.0;
+	const size_t tree = 2 * sizeof(BVHNode) + sizeof(S32);
+	const size_t builder = params.builder == BVH::SBVH
+		? (size_t)((1.0 + duplicates) * (sizeof(S32) + sizeof(AABB))) + sizeof(AABB)
+		: sizeof(U64) + sizeof(AABB) + 2 * sizeof(BVHNode);
+
+	return (size_t)numTris * (tree + builder);
+}
+
+//------------------------------------------------------------------------
+
+void OutOfCoreBuilder::run(void)
+{
+	// a cluster in memory has its triangle indices and their vertex indices besides the build
+	const size_t clusterBytes = estimateBytes(m_params, 1) + sizeof(S32) + sizeof(GPUScene::Triangle);
+	m_clusterSize = (S32)std::min(std::max(m_params.memoryBudget / clusterBytes, (size_t)MinClusterSize), (size_t)INT_MAX);
+
+	partition();
+	m_params.checkCancelled();
+
+	// one cluster at a time, the in-core builders are parallel themselves and check the cancel in their loops
+	for (size_t i = 0; i < m_clusters.size(); i++)
+	{
+		buildCluster(m_clusters[i]);
+		m_params.reportProgress((F32)(i + 1) / m_clusters.size());
+	}
+
+	// a binary top over the clusters has one inner node less than there are clusters
+	const S32 numClusters = (S32)m_clusters.size();
+	S64 numNodes = numClusters - 1;
+	S64 numRefs = 0;
+	for (Cluster& cluster : m_clusters)
+	{
+		cluster.offset = (S32)numNodes;
+		cluster.triOffset = (S32)numRefs;
+		numNodes += cluster.numNodes;
+		numRefs += cluster.numTris;
+	}
+
+	if (numNodes > INT_MAX || numRefs > INT_MAX)
+		throw std::runtime_error("Out-of-core BVH build has over 2^31 nodes or triangle references");
+
+	Array<BVHNode>& nodes = m_bvh.getNodes();
+	Array<S32>& tris = m_bvh.getTriIndices();
+	nodes.reset((int)numNodes);
+	tris.reset((int)numRefs);
+	m_bvh.updatePeakBytes(nodes.getCapacityBytes() + tris.getCapacityBytes());
+
+	buildTop(0, numClusters);
+	FW_ASSERT(m_numTopNodes == numClusters - 1);
+
+	for (Cluster& cluster : m_clusters)
+		copyCluster(cluster);
+
+	if (m_params.enablePrints)
+		printf("OutOfCoreBuilder: %d clusters of up to %d triangles, %d nodes\n", numClusters, m_clusterSize, nodes.getSize());
+
+	m_clusters.clear();
+}
+
+//------------------------------------------------------------------------
+
+void OutOfCoreBuilder::partition(void)
+{
+	// the whole mesh is the first cluster, it's in memory already so it isn't spilled
+	Cluster root(m_params.tempDirectory);
+	root.file.reset();
+	root.numTris = m_bvh.getScene()->getNumTriangles();
+
+	for (S32 i = 0; i < root.numTris; i++)
+	{
+		const AABB bounds = getBounds(i);
+		root.bounds.grow(bounds);
+		root.centroids.grow(bounds.midPoint());
+	}
+
+	std::vector<Cluster> pending;
+	split(root, pending);
+
+	while (!pending.empty())
+	{
+		m_params.checkCancelled();
+
+		Cluster cluster = std::move(pending.back());
+		pending.pop_back();
+
+		if (cluster.numTris > m_clusterSize)
+			split(cluster, pending);
+		else
+			m_clusters.push_back(std::move(cluster));
+	}
+
+	// a block for every octant and one being read
+	m_bvh.updatePeakBytes((8 + 1) * BlockSize * sizeof(S32) + (m_clusters.capacity() + pending.capacity()) * sizeof(Cluster));
+}
+
+//------------------------------------------------------------------------
+
+void OutOfCoreBuilder::split(Cluster& cluster, std::vector<Cluster>& children)
+{
+	const Vec3f center = cluster.centroids.midPoint();
+
+	// octants of the centroid bounds first, halves of the file order when all the centroids fall into one octant
+	for (int byOrder = 0; byOrder < 2; byOrder++)
+	{
+		std::vector<Cluster> parts;
+		for (int i = 0; i < (byOrder ? 2 : 8); i++)
+			parts.emplace_back(m_params.tempDirectory);
+		Array<S32> blocks[8];
+		Array<S32> input;
+
+		for (S32 lo = 0; lo < cluster.numTris; lo += BlockSize)
+		{
+			input.resize(std::min((S32)BlockSize, cluster.numTris - lo));
+
+			if (cluster.file)
+				cluster.file->read(input.getPtr(), input.getNumBytes());
+			else
+				for (S32 i = 0; i < input.getSize(); i++)
+					input[i] = lo + i;
+
+			for (S32 i = 0; i < input.getSize(); i++)
+			{
+				int part;
+				if (byOrder)
+					part = (S64)(lo + i) * 2 >= cluster.numTris ? 1 : 0;
+				else
+				{
+					const Vec3f centroid = getBounds(input[i]).midPoint();
+					part = (centroid.x >= center.x ? 1 : 0) | (centroid.y >= center.y ? 2 : 0) | (centroid.z >= center.z ? 4 : 0);
+				}
+
+				append(parts[part], blocks[part], input[i]);
+			}
+		}
+
+		if (cluster.file)
+			cluster.file->close();
+
+		bool progress = true;
+		for (size_t i = 0; i < parts.size(); i++)
+		{
+			flush(parts[i], blocks[i]);
+			parts[i].file->close();
+			progress &= parts[i].numTris < cluster.numTris;
+		}
+
+		if (!progress && !byOrder)
+			continue;
+
+		for (Cluster& part : parts)
+			if (part.numTris > 0)
+				children.push_back(std::move(part));
+
+		break;
+	}
+}
+
+//------------------------------------------------------------------------
+
+void OutOfCoreBuilder::append(Cluster& cluster, Array<S32>& block, S32 tri)
+{
+	const AABB bounds = getBounds(tri);
+	cluster.bounds.grow(bounds);
+	cluster.centroids.grow(bounds.midPoint());
+	cluster.numTris++;
+
+	block.add(tri);
+	if (block.getSize() == BlockSize)
+		flush(cluster, block);
+}
+
+//------------------------------------------------------------------------
+
+void OutOfCoreBuilder::flush(Cluster& cluster, Array<S32>& block)
+{
+	if (block.getSize() > 0)
+		cluster.file->write(block.getPtr(), block.getNumBytes());
+
+	block.clear();
+}
+
+//------------------------------------------------------------------------
+
+void OutOfCoreBuilder::buildCluster(Cluster& cluster)
+{
+	GPUScene* scene = m_bvh.getScene();
+
+	Array<S32> tris;
+	tris.resize(cluster.numTris);
+	cluster.file->read(tris.getPtr(), tris.getNumBytes());
+	cluster.file->clear();
+
+	// the cluster is built as a scene of its own over the vertices of the mesh
+	Array<GPUScene::Triangle> local;
+	local.resize(cluster.numTris);
+	for (S32 i = 0; i < cluster.numTris; i++)
+		local[i] = scene->getTriangle(tris[i]);
+
+	GPUScene clusterScene(local.getSize(), scene->getNumVertices(), local.getPtr(), scene->getVertexPtr());
+
+	BVH::BuildParams params = m_params;
+	params.stats = NULL;
+	params.enablePrints = false;
+	params.memoryBudget = 0;
+	params.progress = nullptr;
+	// every cluster gets its share of the absolute duplication limit, the relative one holds by itself
+	if (m_params.maxDuplicates >= 0)
+		params.maxDuplicates = (S64)((F64)m_params.maxDuplicates * cluster.numTris / m_bvh.getScene()->getNumTriangles());
+
+	BVH bvh(&clusterScene, m_bvh.getPlatform(), params);
+	m_bvh.updatePeakBytes(bvh.getPeakBytes() + tris.getCapacityBytes() + local.getCapacityBytes());
+
+	// leaves refer to the cluster triangles, the mesh ones are written with the nodes
+	Array<S32>& order = bvh.getTriIndices();
+	for (S32 i = 0; i < order.getSize(); i++)
+		order[i] = tris[order[i]];
+
+	cluster.numNodes = bvh.getNumNodes();
+	cluster.numTris = order.getSize();
+	cluster.bounds = bvh.getNode(0).m_bounds;
+
+	cluster.file->write(bvh.getNodes().getPtr(), bvh.getNodes().getNumBytes());
+	cluster.file->write(order.getPtr(), order.getNumBytes());
+	cluster.file->close();
+}
+
+//------------------------------------------------------------------------
+
+S32 OutOfCoreBuilder::buildTop(S32 lo, S32 hi)
+{
+	if (hi - lo == 1)
+		return m_clusters[lo].offset;
+
+	const S32 index = m_numTopNodes++;
+
+	// sweep of the clusters sorted along the widest axis of their centroids
+	AABB centroids;
+	for (S32 i = lo; i < hi; i++)
+		centroids.grow(m_clusters[i].bounds.midPoint());
+
+	const Vec3f extent = centroids.max() - centroids.min();
+	const int dim = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+	std::sort(m_clusters.begin() + lo, m_clusters.begin() + hi, [&](const Cluster& a, const Cluster& b)
+	{
+		return a.bounds.midPoint()._v[dim] < b.bounds.midPoint()._v[dim];
+	});
+
+	std::vector<F32> rightArea(hi - lo);
+	AABB right;
+	for (S32 i = hi - 1; i > lo; i--)
+	{
+		right.grow(m_clusters[i].bounds);
+		rightArea[i - lo] = right.area();
+	}
+
+	// clusters are weighted by their triangle count, the same as the SAH of the whole tree would
+	std::vector<S64> rightCount(hi - lo + 1, 0);
+	for (S32 i = hi - 1; i >= lo; i--)
+		rightCount[i - lo] = rightCount[i - lo + 1] + m_clusters[i].numTris;
+
+	AABB left;
+	S32 split = lo + 1;
+	F32 bestCost = FW_F32_MAX;
+	for (S32 i = lo + 1; i < hi; i++)
+	{
+		left.grow(m_clusters[i - 1].bounds);
+		const F32 cost = left.area() * (rightCount[0] - rightCount[i - lo]) + rightArea[i - lo] * rightCount[i - lo];
+
+		if (cost < bestCost)
+		{
+			bestCost = cost;
+			split = i;
+		}
+	}
+
+	left.grow(right);
+
+	const S32 leftNode = buildTop(lo, split);
+	const S32 rightNode = buildTop(split, hi);
+	m_bvh.getNodes()[index] = BVHNode::inner(left, leftNode, rightNode);
+	return index;
+}
+
+//------------------------------------------------------------------------
+
+void OutOfCoreBuilder::copyCluster(Cluster& cluster)
+{
+	BVHNode* nodes = m_bvh.getNodes().getPtr(cluster.offset);
+	cluster.file->read(nodes, cluster.numNodes * sizeof(BVHNode));
+	cluster.file->read(m_bvh.getTriIndices().getPtr(cluster.triOffset), cluster.numTris * sizeof(S32));
+	cluster.file->clear();
+
+	for (S32 i = 0; i < cluster.numNodes; i++)
+	{
+		if (nodes[i].isLeaf())
+		{
+			nodes[i].m_lo += cluster.triOffset;
+			nodes[i].m_hi += cluster.triOffset;
+		}
+		else
+		{
+			nodes[i].m_children[0] += cluster.offset;
+			nodes[i].m_children[1] += cluster.offset;
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+
+AABB OutOfCoreBuilder::getBounds(S32 tri) const
+{
+	GPUScene* scene = m_bvh.getScene();
+	const Vec3i& vertices = scene->getTriangle(tri).vertices;
+
+	AABB bounds;
+	for (int j = 0; j < 3; j++)
+		bounds.grow(scene->getVertex(vertices._v[j]));
+
+	return bounds;
+}
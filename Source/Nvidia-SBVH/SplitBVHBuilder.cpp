@@ -37,8 +37,7 @@ SplitBVHBuilder::SplitBVHBuilder(BVH& bvh, const BVH::BuildParams& params)
 	m_platform(bvh.getPlatform()),
 	m_params(params),
 	m_minOverlap(0.0f),   /// overlap of AABBs
-	m_sortDim(-1),
-	m_numNodes(0)
+	m_sortDim(-1)
 {
 }
 
@@ -50,7 +49,7 @@ SplitBVHBuilder::~SplitBVHBuilder(void)
 
 //------------------------------------------------------------------------
 
-BVHNode* SplitBVHBuilder::run(int &numNodes)  /// returns the rootnode
+void SplitBVHBuilder::run(void)  /// builds the nodes into the BVH arena, the root is the first one
 {
 
 	// See SBVH paper by Martin Stich for details
@@ -84,18 +83,36 @@ BVHNode* SplitBVHBuilder::run(int &numNodes)  /// returns the rootnode
 	m_numDuplicates = 0;
 	m_progressTimer.start();
 
+	// The references are indexed by S32, the duplicates can't take them over that either.
+	m_maxDuplicates = (S64)INT_MAX - rootSpec.numRef;
+	if (m_params.duplicationBudget >= 0.0f)
+		m_maxDuplicates = std::min(m_maxDuplicates, (S64)((F64)rootSpec.numRef * m_params.duplicationBudget));
+	if (m_params.maxDuplicates >= 0)
+		m_maxDuplicates = std::min(m_maxDuplicates, m_params.maxDuplicates);
+
+	// A binary tree over n triangles has 2n-1 nodes, duplicates grow the arena like any other Array.
+	Array<BVHNode>& nodes = m_bvh.getNodes();
+	nodes.clear();
+	nodes.setCapacity((int)std::min(std::max(2 * (S64)rootSpec.numRef - 1, (S64)1), (S64)INT_MAX));
+	m_bvh.getTriIndices().setCapacity(rootSpec.numRef);
+
 	// Build recursively.
-	BVHNode* root = buildNode(rootSpec, 0, 0.0f, 1.0f);  /// actual building of splitBVH
-	numNodes = m_numNodes;
+	buildNode(rootSpec, 0, 0.0f, 1.0f);  /// actual building of splitBVH
+
+	m_bvh.updatePeakBytes(nodes.getCapacityBytes() + m_bvh.getTriIndices().getCapacityBytes() + m_refStack.getCapacityBytes() + m_rightBounds.getCapacityBytes());
+	nodes.compact();
 	m_bvh.getTriIndices().compact();   // removes unused memoryspace from triIndices array
 
 	// Done.
 
+	m_params.reportProgress(1.0f);
+
 	if (m_params.enablePrints)
 		printf("SplitBVHBuilder: progress %.0f%%, duplicates %.0f%%\n",
 		100.0f, (F32)m_numDuplicates / (F32)m_bvh.getScene()->getNumTriangles() * 100.0f);
 
-	return root;
+	if (m_params.enablePrints && m_numDuplicates >= m_maxDuplicates)
+		printf("SplitBVHBuilder: duplication budget of %lld references used up\n", (long long)m_maxDuplicates);
 }
 
 //------------------------------------------------------------------------
@@ -123,7 +140,7 @@ void SplitBVHBuilder::sortSwap(void* data, int idxA, int idxB)
 
 inline float min1f3(const float& a, const float& b, const float& c){ return min1f(min1f(a, b), c); }
 
-BVHNode* SplitBVHBuilder::buildNode(const NodeSpec& spec, int level, F32 progressStart, F32 progressEnd)
+S32 SplitBVHBuilder::buildNode(const NodeSpec& spec, int level, F32 progressStart, F32 progressEnd)
 {
 	// Display progress.
 
@@ -133,7 +150,10 @@ BVHNode* SplitBVHBuilder::buildNode(const NodeSpec& spec, int level, F32 progres
 			progressStart * 100.0f, (F32)m_numDuplicates / (F32)m_bvh.getScene()->getNumTriangles() * 100.0f);
 		m_progressTimer.start();
 	}
-	 m_numNodes++;
+
+	m_params.checkCancelled();
+	if (level < ProgressLevels)
+		m_params.reportProgress(progressStart);
 
 	// Small enough or too deep => create leaf.
 
@@ -150,7 +170,7 @@ BVHNode* SplitBVHBuilder::buildNode(const NodeSpec& spec, int level, F32 progres
 	ObjectSplit object = findObjectSplit(spec, nodeSAH);
 
 	SpatialSplit spatial;
-	if (level < MaxSpatialDepth)
+	if (level < MaxSpatialDepth && m_numDuplicates < m_maxDuplicates)
 	{
 		AABB overlap = object.leftBounds;
 		overlap.intersect(object.rightBounds);
@@ -178,23 +198,30 @@ BVHNode* SplitBVHBuilder::buildNode(const NodeSpec& spec, int level, F32 progres
 
 	// Create inner node.
 
+	// The slot is taken before the children so that the parent precedes them in the arena.
+
 	m_numDuplicates += left.numRef + right.numRef - spec.numRef;
+	S32 index = m_bvh.getNodes().getSize();
+	m_bvh.getNodes().add();
+
 	F32 progressMid = lerp(progressStart, progressEnd, (F32)right.numRef / (F32)(left.numRef + right.numRef));
-	BVHNode* rightNode = buildNode(right, level + 1, progressStart, progressMid);
-	BVHNode* leftNode = buildNode(left, level + 1, progressMid, progressEnd);
-	return new InnerNode(spec.bounds, leftNode, rightNode);
+	S32 rightNode = buildNode(right, level + 1, progressStart, progressMid);
+	S32 leftNode = buildNode(left, level + 1, progressMid, progressEnd);
+	m_bvh.getNodes()[index] = BVHNode::inner(spec.bounds, leftNode, rightNode);
+	return index;
 }
 
 //------------------------------------------------------------------------
 
-BVHNode* SplitBVHBuilder::createLeaf(const NodeSpec& spec)
+S32 SplitBVHBuilder::createLeaf(const NodeSpec& spec)
 {
 	Array<S32>& tris = m_bvh.getTriIndices();
 	
 	for (int i = 0; i < spec.numRef; i++)
 		tris.add(m_refStack.removeLast().triIdx); // take a triangle from the stack and add it to tris array
 
-	return new LeafNode(spec.bounds, tris.size() - spec.numRef, tris.size());
+	m_bvh.getNodes().add(BVHNode::leaf(spec.bounds, tris.size() - spec.numRef, tris.size()));
+	return m_bvh.getNodes().getSize() - 1;
 }
 
 //------------------------------------------------------------------------
@@ -379,8 +406,9 @@ void SplitBVHBuilder::performSpatialSplit(NodeSpec& left, NodeSpec& right, const
 		}
 	}
 
-	// Duplicate or unsplit references intersecting both sides.
+	// Duplicate or unsplit references intersecting both sides, the duplicates within the budget.
 
+	S64 duplicatesLeft = m_maxDuplicates - m_numDuplicates;
 	while (leftEnd < rightStart)
 	{
 		// Split reference.
@@ -406,7 +434,7 @@ void SplitBVHBuilder::performSpatialSplit(NodeSpec& left, NodeSpec& right, const
 
 		F32 unsplitLeftSAH = lub.area() * lbc + right.bounds.area() * rac;
 		F32 unsplitRightSAH = left.bounds.area() * lac + rub.area() * rbc;
-		F32 duplicateSAH = ldb.area() * lbc + rdb.area() * rbc;
+		F32 duplicateSAH = duplicatesLeft > 0 ? ldb.area() * lbc + rdb.area() * rbc : FW_F32_MAX;
 		F32 minSAH = min1f3(unsplitLeftSAH, unsplitRightSAH, duplicateSAH);
 
 		// Unsplit to left?
@@ -433,6 +461,7 @@ void SplitBVHBuilder::performSpatialSplit(NodeSpec& left, NodeSpec& right, const
 			right.bounds = rdb;
 			refs[leftEnd++] = lref;
 			refs.add(rref);
+			duplicatesLeft--;
 		}
 	}
 
@@ -0,0 +1,197 @@
+#include "Nvidia-SBVH/TreeletOptimizer.h"
+#include "Parallel.hpp"
+
+namespace
+{
+	// index of the only leaf in a single leaf subset
+	int leafIndex(int set)
+	{
+		int index = 0;
+		while (!(set & 1))
+		{
+			set >>= 1;
+			index++;
+		}
+
+		return index;
+	}
+}
+
+TreeletOptimizer::TreeletOptimizer(BVH& bvh, const BVH::BuildParams& params)
+	: m_nodes(bvh.getNodes()),
+	m_platform(bvh.getPlatform()),
+	m_params(params),
+	m_numRestructured(0)
+{
+}
+
+//------------------------------------------------------------------------
+
+void TreeletOptimizer::run(void)
+{
+	// restructuring doesn't move the nodes in the arena, so the costs stay indexed by their slots
+	m_costs.resize(m_nodes.getSize());
+
+	for (S32 pass = 0; pass < m_params.treeletPasses; pass++)
+	{
+		// the top is restructured as well, subtrees of the previous pass don't have to be disjoint anymore
+		std::vector<S32> subtrees;
+		collectSubtrees(0, 0, subtrees);
+
+		// the subtrees skip their work once the build is cancelled, it's thrown on the thread of the build
+		parallelFor(subtrees.size(), [&](size_t i) { if (!m_params.isCancelled()) optimizeSubtree(subtrees[i]); }, 1);
+		m_params.checkCancelled();
+
+		optimizeTop(0, 0);
+		m_params.reportProgress((F32)(pass + 1) / m_params.treeletPasses);
+	}
+
+	if (m_params.enablePrints)
+		printf("TreeletOptimizer: %d passes, %d treelets restructured\n", m_params.treeletPasses, m_numRestructured.load());
+}
+
+//------------------------------------------------------------------------
+
+void TreeletOptimizer::optimizeSubtree(S32 node)
+{
+	for (int i = 0; i < m_nodes[node].getNumChildNodes(); i++)
+		optimizeSubtree(m_nodes[node].getChildNode(i));
+
+	updateCost(node);
+
+	if (!m_nodes[node].isLeaf())
+		optimizeTreelet(node);
+}
+
+//------------------------------------------------------------------------
+
+void TreeletOptimizer::optimizeTop(S32 node, int depth)
+{
+	// nodes of the parallel subtrees are done, restructuring above them can't change their roots
+	if (depth == ParallelDepth || m_nodes[node].isLeaf())
+		return;
+
+	for (int i = 0; i < m_nodes[node].getNumChildNodes(); i++)
+		optimizeTop(m_nodes[node].getChildNode(i), depth + 1);
+
+	updateCost(node);
+	optimizeTreelet(node);
+}
+
+//------------------------------------------------------------------------
+
+void TreeletOptimizer::collectSubtrees(S32 node, int depth, std::vector<S32>& subtrees)
+{
+	if (depth == ParallelDepth || m_nodes[node].isLeaf())
+	{
+		subtrees.push_back(node);
+		return;
+	}
+
+	for (int i = 0; i < m_nodes[node].getNumChildNodes(); i++)
+		collectSubtrees(m_nodes[node].getChildNode(i), depth + 1, subtrees);
+}
+
+//------------------------------------------------------------------------
+
+void TreeletOptimizer::updateCost(S32 node)
+{
+	const BVHNode& n = m_nodes[node];
+	F32 cost = n.getArea() * m_platform.getCost(n.getNumChildNodes(), n.getNumTriangles());
+
+	for (int i = 0; i < n.getNumChildNodes(); i++)
+		cost += m_costs[n.getChildNode(i)];
+
+	m_costs[node] = cost;
+}
+
+//------------------------------------------------------------------------
+
+void TreeletOptimizer::optimizeTreelet(S32 root)
+{
+	// grow the treelet by the leaf with the largest area, the one most likely to be improved
+	S32 leaves[TreeletLeaves] = { m_nodes[root].m_children[0], m_nodes[root].m_children[1] };
+	S32 inner[TreeletLeaves - 1] = { root };
+	int numLeaves = 2;
+	int numInner = 1;
+
+	while (numLeaves < TreeletLeaves)
+	{
+		int largest = -1;
+		for (int i = 0; i < numLeaves; i++)
+			if (!m_nodes[leaves[i]].isLeaf() && (largest < 0 || m_nodes[leaves[i]].getArea() > m_nodes[leaves[largest]].getArea()))
+				largest = i;
+
+		if (largest < 0)
+			break;
+
+		const S32 node = leaves[largest];
+		inner[numInner++] = node;
+		leaves[largest] = m_nodes[node].m_children[0];
+		leaves[numLeaves++] = m_nodes[node].m_children[1];
+	}
+
+	// two leaves have just one topology
+	if (numLeaves < 3)
+		return;
+
+	// optimal cost of every subset of the leaves, subsets of a set are smaller numbers so they are ready before it
+	AABB bounds[NumSubsets];
+	F32 costs[NumSubsets];
+	U8 partitions[NumSubsets];
+	const int full = (1 << numLeaves) - 1;
+
+	for (int set = 1; set <= full; set++)
+	{
+		const int lowest = set & -set;
+
+		if (set == lowest)
+		{
+			const S32 leaf = leaves[leafIndex(set)];
+			bounds[set] = m_nodes[leaf].m_bounds;
+			costs[set] = m_costs[leaf];
+			continue;
+		}
+
+		bounds[set] = bounds[lowest] + bounds[set ^ lowest];
+
+		// every partition once, the part with the lowest leaf is the left one
+		F32 best = FW_F32_MAX;
+		for (int part = (set - 1) & set; part > 0; part = (part - 1) & set)
+		{
+			if (!(part & lowest))
+				continue;
+
+			const F32 cost = costs[part] + costs[set ^ part];
+			if (cost < best)
+			{
+				best = cost;
+				partitions[set] = static_cast<U8>(part);
+			}
+		}
+
+		costs[set] = bounds[set].area() * m_platform.getCost(2, 0) + best;
+	}
+
+	if (costs[full] >= m_costs[root] * (1.0f - 1e-5f))
+		return;
+
+	// root gets the whole set first, so it stays the root of the treelet
+	int nextInner = 0;
+	auto build = [&](auto& self, int set) -> S32
+	{
+		if ((set & (set - 1)) == 0)
+			return leaves[leafIndex(set)];
+
+		const S32 node = inner[nextInner++];
+		const S32 left = self(self, partitions[set]);
+		const S32 right = self(self, set ^ partitions[set]);
+		m_nodes[node] = BVHNode::inner(bounds[set], left, right);
+		m_costs[node] = costs[set];
+
+		return node;
+	};
+
+	build(build, full);
+	m_numRestructured++;
+}
@@ -0,0 +1,250 @@
+﻿#include "ParamsParser.hpp"
+#include "spdlog/fmt/fmt.h"
+#include <Windows.h>
+#include <charconv>
+#include <cmath>
+#include <algorithm>
+#include <fstream>
+
+namespace
+{
+	constexpr const char* CAMERA_FIELDS[] = { "x", "y", "z", "pitch", "yaw" };
+	constexpr const char* LIGHT_FIELDS[] = { "x", "y", "z", "falloff", "emission r", "emission g", "emission b", "radius" };
+	constexpr const char* BVH_FIELDS[] = { "node cost", "triangle cost", "min leaf size", "max leaf size", "split alpha" };
+
+	constexpr auto UNBOUNDED_LEAF_SIZE = 0x7FFFFFF; // default of Platform
+}
+
+MappedFile::MappedFile(const std::string& path)
+{
+	mFile = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (mFile == INVALID_HANDLE_VALUE)
+	{
+		mFile = nullptr;
+		throw std::runtime_error(fmt::format("Failed to open {}", path));
+	}
+
+	LARGE_INTEGER size;
+	GetFileSizeEx(mFile, &size);
+	mSize = static_cast<size_t>(size.QuadPart);
+
+	if (mSize == 0)
+		return; // empty file can't be mapped
+
+	mMapping = CreateFileMapping(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mMapping)
+		mData = static_cast<const char*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+
+	if (!mData)
+	{
+		close();
+		throw std::runtime_error(fmt::format("Failed to map {}", path));
+	}
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+void MappedFile::close()
+{
+	if (mData)
+		UnmapViewOfFile(mData);
+	if (mMapping)
+		CloseHandle(mMapping);
+	if (mFile)
+		CloseHandle(mFile);
+
+	mData = nullptr;
+	mMapping = nullptr;
+	mFile = nullptr;
+}
+
+ParseError::ParseError(const std::string& source, size_t line, size_t column, const std::string& message)
+	: std::runtime_error(fmt::format("{}:{}:{}: {}", source, line, column, message))
+	, line(line)
+	, column(column)
+{}
+
+ParamsParser::ParamsParser(std::string_view data, std::string_view source)
+	: mData(data)
+	, mSource(source)
+{}
+
+SceneCatalog::SceneParams ParamsParser::parseFile(const std::string& path)
+{
+	MappedFile file(path);
+	return ParamsParser(file.data(), path).parse();
+}
+
+void ParamsParser::parseBVHFile(const std::string& path, BVH::BuildParams& params)
+{
+	MappedFile file(path);
+	ParamsParser(file.data(), path).parseBVH(params);
+}
+
+void ParamsParser::writeBVHFile(const std::string& path, const BVH::BuildParams& params)
+{
+	std::ofstream file(path, std::ios::trunc);
+	if (!file.is_open())
+		throw std::runtime_error(fmt::format("Failed to write {}", path));
+
+	const auto& platform = params.platform;
+	const auto maxLeafSize = platform.getMaxLeafSize() >= UNBOUNDED_LEAF_SIZE ? 0 : platform.getMaxLeafSize();
+
+	file << "# node cost, triangle cost, min leaf size, max leaf size (0 is unbounded), split alpha\n";
+	file << fmt::format("{}, {}, {}, {}, {}\n", platform.getSAHNodeCost(), platform.getSAHTriangleCost(), platform.getMinLeafSize(), maxLeafSize, params.splitAlpha);
+
+	if (!file)
+		throw std::runtime_error(fmt::format("Failed to write {}", path));
+}
+
+SceneCatalog::SceneParams ParamsParser::parse()
+{
+	SceneCatalog::SceneParams params;
+
+	if (!nextRow())
+		fail("missing camera row");
+
+	float camera[std::size(CAMERA_FIELDS)];
+	size_t cameraColumns[std::size(CAMERA_FIELDS)];
+	parseRow(camera, cameraColumns, CAMERA_FIELDS, "camera");
+
+	params.camera = { { camera[0], camera[1], camera[2] }, camera[3], camera[4] };
+
+	while (nextRow())
+	{
+		float light[std::size(LIGHT_FIELDS)];
+		size_t lightColumns[std::size(LIGHT_FIELDS)];
+		parseRow(light, lightColumns, LIGHT_FIELDS, "light");
+
+		if (light[7] < 0.f)
+			fail("light radius must not be negative", lightColumns[7]);
+
+		params.lights.emplace_back(Light{ { light[0], light[1], light[2] }, light[3], { light[4], light[5], light[6] }, light[7] });
+	}
+
+	return params;
+}
+
+void ParamsParser::parseBVH(BVH::BuildParams& params)
+{
+	if (!nextRow())
+		fail("missing bvh row");
+
+	float bvh[std::size(BVH_FIELDS)];
+	size_t bvhColumns[std::size(BVH_FIELDS)];
+	parseRow(bvh, bvhColumns, BVH_FIELDS, "bvh");
+
+	for (size_t i = 0; i < 2; ++i)
+		if (bvh[i] <= 0.f)
+			fail(fmt::format("bvh {} must be positive", BVH_FIELDS[i]), bvhColumns[i]);
+
+	for (size_t i = 2; i < 4; ++i)
+		if (bvh[i] < 0.f || bvh[i] >= UNBOUNDED_LEAF_SIZE || bvh[i] != std::floor(bvh[i]))
+			fail(fmt::format("bvh {} must be a non-negative integer", BVH_FIELDS[i]), bvhColumns[i]);
+
+	const auto minLeafSize = std::max(static_cast<S32>(bvh[2]), 1);
+	const auto maxLeafSize = bvh[3] > 0.f ? static_cast<S32>(bvh[3]) : UNBOUNDED_LEAF_SIZE;
+
+	if (minLeafSize > maxLeafSize)
+		fail("bvh min leaf size is larger than max leaf size", bvhColumns[2]);
+
+	if (bvh[4] < 0.f || bvh[4] > 1.f)
+		fail("bvh split alpha must be between 0 and 1", bvhColumns[4]);
+
+	if (nextRow())
+		fail("bvh params have a single row");
+
+	params.platform = Platform(params.platform.getName(), bvh[0], bvh[1], params.platform.getNodeBatchSize(), params.platform.getTriangleBatchSize());
+	params.platform.setLeafPreferences(minLeafSize, maxLeafSize);
+	params.splitAlpha = bvh[4];
+
+	// LBVH and HLBVH leaves take the bounded size
+	if (maxLeafSize < UNBOUNDED_LEAF_SIZE)
+		params.maxLeafSize = maxLeafSize;
+}
+
+template<size_t N>
+void ParamsParser::parseRow(float (&values)[N], size_t (&columns)[N], const char* const (&names)[N], const char* row)
+{
+	for (size_t i = 0; i < N; ++i)
+	{
+		if (i > 0)
+		{
+			skipSpaces();
+			if (mPosition >= mData.size() || mData[mPosition] != ',')
+				fail(fmt::format("expected ',' before {} {}, {} has {} values", row, names[i], row, N));
+
+			++mPosition;
+		}
+
+		skipSpaces();
+		columns[i] = mPosition - mLineStart + 1;
+		values[i] = parseFloat(names[i], row);
+	}
+
+	skipSpaces();
+	if (mPosition < mData.size() && mData[mPosition] == '\r')
+		++mPosition;
+
+	if (mPosition < mData.size() && mData[mPosition] != '\n')
+		fail(fmt::format("expected end of line after {} {}, {} has {} values", row, names[N - 1], row, N));
+
+	++mPosition;
+}
+
+bool ParamsParser::nextRow()
+{
+	while (mPosition < mData.size())
+	{
+		++mLine;
+		mLineStart = mPosition;
+		skipSpaces();
+
+		if (mPosition >= mData.size())
+			return false;
+
+		const auto c = mData[mPosition];
+		if (c != '\r' && c != '\n' && c != '#')
+			return true;
+
+		// empty line or comment
+		while (mPosition < mData.size() && mData[mPosition++] != '\n');
+	}
+
+	return false;
+}
+
+float ParamsParser::parseFloat(const char* name, const char* row)
+{
+	float value;
+	const auto begin = mData.data() + mPosition;
+	const auto [end, error] = std::from_chars(begin, mData.data() + mData.size(), value);
+
+	if (error != std::errc())
+		fail(fmt::format("expected number for {} {}", row, name));
+
+	if (!std::isfinite(value))
+		fail(fmt::format("{} {} is not finite", row, name));
+
+	mPosition += end - begin;
+	return value;
+}
+
+void ParamsParser::skipSpaces()
+{
+	while (mPosition < mData.size() && (mData[mPosition] == ' ' || mData[mPosition] == '\t'))
+		++mPosition;
+}
+
+void ParamsParser::fail(const std::string& message) const
+{
+	fail(message, mPosition - mLineStart + 1);
+}
+
+void ParamsParser::fail(const std::string& message, size_t column) const
+{
+	throw ParseError(std::string(mSource), std::max<size_t>(mLine, 1), column, message);
+}
@@ -14,6 +14,8 @@
 #include <thread>
 #include "lodepng/lodepng.h"
 #include <filesystem>
+#include <algorithm>
+#include <chrono>
 
 namespace fs = std::filesystem;
 using namespace DirectX;
@@ -45,14 +47,71 @@ Renderer::Renderer(HWND hwnd, Resolution resolution)
 
 	mContext->RSSetViewports(1, &viewport);
 	
-	initScene(DEFAULT_SCENE);
+	mBVHParams.memoryBudget = BVH_MEMORY_BUDGET;
+	mScene = Scene(mDevice, std::string(R"(Assets\Models\)") + DEFAULT_SCENE, nullptr, mBVHParams); // first scene is loaded in place, there is nothing to render meanwhile
 	
 	mGUI.init(hwnd, mDevice, mContext);
 }
 
+Renderer::~Renderer()
+{
+	// loads notice the cancel in the import, the BVH build, the tile caching and between their stages,
+	// they create resources on the device, so they end while it's still there
+	if (mSceneLoadToken)
+		mSceneLoadToken->cancelled = true;
+
+	if (mSceneLoad.valid())
+		mSceneLoad.wait();
+
+	for (const auto& load : mCancelledLoads)
+		load.wait();
+}
+
 void Renderer::initScene(const std::string& name)
 {
-	mScene = Scene(mDevice, std::string(R"(Assets\Models\)" + name));
+	// load in flight is cancelled, it's dropped once its thread finishes
+	if (mSceneLoad.valid())
+	{
+		mSceneLoadToken->cancelled = true;
+		mCancelledLoads.emplace_back(std::move(mSceneLoad));
+	}
+
+	mSceneLoadToken = std::make_shared<SceneLoadToken>();
+	mSceneLoad = std::async(std::launch::async, [device = static_cast<ID3D11Device*>(mDevice), path = std::string(R"(Assets\Models\)" + name), token = mSceneLoadToken, params = mBVHParams]()
+	{
+		return Scene(device, path, token.get(), params);
+	});
+}
+
+void Renderer::swapScene()
+{
+	const auto isReady = [](const std::future<Scene>& load)
+	{
+		return load.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+	};
+
+	mCancelledLoads.erase(std::remove_if(mCancelledLoads.begin(), mCancelledLoads.end(), isReady), mCancelledLoads.end());
+
+	if (!mSceneLoad.valid() || !isReady(mSceneLoad))
+		return;
+
+	try
+	{
+		// swap happens between frames, so the old scene isn't used by any dispatch anymore
+		mScene = mSceneLoad.get();
+		
+		const auto resolution = Input::getInstance().getResolution();
+		mScene.mCamera.updateResolution(resolution.first, resolution.second);
+	}
+	catch (const SceneLoadCancelled&)
+	{
+	}
+	catch (const std::exception& e)
+	{
+		OutputDebugString(fmt::format("Failed to load scene. Continuing with the current one.\n {}", e.what()).c_str());
+	}
+
+	mSceneLoadToken.reset();
 }
 
 void Renderer::createBuffers()
@@ -82,7 +141,7 @@ void Renderer::createBuffers()
 
 	D3D11_BUFFER_DESC queueCountersDescriptor = {};
 	queueCountersDescriptor.Usage = D3D11_USAGE_DEFAULT;
-	queueCountersDescriptor.ByteWidth = 32;
+	queueCountersDescriptor.ByteWidth = 32 + PATH_LENGTH_BINS * sizeof(uint32_t); // the counters of the queues and the path lengths of structs.h
 	queueCountersDescriptor.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
 	queueCountersDescriptor.CPUAccessFlags = 0;
 	queueCountersDescriptor.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
@@ -91,6 +150,16 @@ void Renderer::createBuffers()
 	mDevice->CreateBuffer(&queueDescriptor, nullptr, &mQueueBuffer);
 	mDevice->CreateBuffer(&queueCountersDescriptor, nullptr, &mQueueCountersBuffer);
 
+	// the path lengths are read back with the counters
+	D3D11_BUFFER_DESC stagingDescriptor = queueCountersDescriptor;
+	stagingDescriptor.Usage = D3D11_USAGE_STAGING;
+	stagingDescriptor.BindFlags = 0;
+	stagingDescriptor.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	stagingDescriptor.MiscFlags = 0;
+
+	for (auto& staging : mPathLengthStaging)
+		mDevice->CreateBuffer(&stagingDescriptor, nullptr, &staging);
+
 	// views
 	D3D11_UNORDERED_ACCESS_VIEW_DESC UAVDescriptor = {};
 	UAVDescriptor.Format = DXGI_FORMAT_R32_TYPELESS;
@@ -103,7 +172,7 @@ void Renderer::createBuffers()
 	UAVDescriptor.Buffer.NumElements = queueDescriptor.ByteWidth / 4;
 	mDevice->CreateUnorderedAccessView(mQueueBuffer, &UAVDescriptor, &mQueueUAV);
 
-	UAVDescriptor.Buffer.NumElements = 8;
+	UAVDescriptor.Buffer.NumElements = queueCountersDescriptor.ByteWidth / 4;
 	mDevice->CreateUnorderedAccessView(mQueueCountersBuffer, &UAVDescriptor, &mQueueCountersUAV);
 }
 
@@ -113,7 +182,7 @@ void Renderer::createRenderTexture(Resolution res)
 	renderTextureDescriptor.Width = res.first;
 	renderTextureDescriptor.Height = res.second;
 	renderTextureDescriptor.MipLevels = 1;
-	renderTextureDescriptor.ArraySize = 1;
+	renderTextureDescriptor.ArraySize = 2; // second moment of the pixels for adaptive sampling in the second one
 	renderTextureDescriptor.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
 	renderTextureDescriptor.SampleDesc.Count = 1;
 	renderTextureDescriptor.SampleDesc.Quality = 0;
@@ -131,7 +200,7 @@ void Renderer::createRenderTexture(Resolution res)
 	D3D11_UNORDERED_ACCESS_VIEW_DESC renderTextureUAVDesc = {};
 	renderTextureUAVDesc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
 	renderTextureUAVDesc.ViewDimension = D3D11_UAV_DIMENSION_TEXTURE2DARRAY;
-	renderTextureUAVDesc.Texture2DArray.ArraySize = 1;
+	renderTextureUAVDesc.Texture2DArray.ArraySize = 2;
 
 	mRenderTexture.reset();
 	mRenderTextureSRV.reset();
@@ -139,10 +208,137 @@ void Renderer::createRenderTexture(Resolution res)
 	mDevice->CreateTexture2D(&renderTextureDescriptor, nullptr, &mRenderTexture);
 	mDevice->CreateShaderResourceView(mRenderTexture, &renderTextureSRVDesc, &mRenderTextureSRV);
 	mDevice->CreateUnorderedAccessView(mRenderTexture, &renderTextureUAVDesc, &mRenderTextureUAV);
+
+	// adaptive sampling - samples of the pixels, errors of the tiles read back through staging buffers and the schedule
+	mAdaptive.reset(res.first, res.second, mScene.mCamera.getBuffer()->mortonOrder);
+	mTileErrorFrame = { -1, -1 };
+	mScheduleDirty = true;
+
+	D3D11_BUFFER_DESC pixelSamplesDescriptor = {};
+	pixelSamplesDescriptor.Usage = D3D11_USAGE_DEFAULT;
+	pixelSamplesDescriptor.ByteWidth = res.first * res.second * sizeof(uint32_t);
+	pixelSamplesDescriptor.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+	pixelSamplesDescriptor.CPUAccessFlags = 0;
+	pixelSamplesDescriptor.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
+
+	D3D11_BUFFER_DESC tileErrorDescriptor = pixelSamplesDescriptor;
+	tileErrorDescriptor.ByteWidth = static_cast<UINT>(mAdaptive.tileCount() * sizeof(AdaptiveSampling::TileError));
+
+	D3D11_BUFFER_DESC stagingDescriptor = tileErrorDescriptor;
+	stagingDescriptor.Usage = D3D11_USAGE_STAGING;
+	stagingDescriptor.BindFlags = 0;
+	stagingDescriptor.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	stagingDescriptor.MiscFlags = 0;
+
+	D3D11_UNORDERED_ACCESS_VIEW_DESC UAVDescriptor = {};
+	UAVDescriptor.Format = DXGI_FORMAT_R32_TYPELESS;
+	UAVDescriptor.Buffer.Flags = D3D11_BUFFER_UAV_FLAG_RAW;
+	UAVDescriptor.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+
+	mPixelSamplesBuffer.reset();
+	mPixelSamplesUAV.reset();
+	mTileErrorBuffer.reset();
+	mTileErrorUAV.reset();
+	mDevice->CreateBuffer(&pixelSamplesDescriptor, nullptr, &mPixelSamplesBuffer);
+	mDevice->CreateBuffer(&tileErrorDescriptor, nullptr, &mTileErrorBuffer);
+
+	UAVDescriptor.Buffer.NumElements = pixelSamplesDescriptor.ByteWidth / 4;
+	mDevice->CreateUnorderedAccessView(mPixelSamplesBuffer, &UAVDescriptor, &mPixelSamplesUAV);
+
+	UAVDescriptor.Buffer.NumElements = tileErrorDescriptor.ByteWidth / 4;
+	mDevice->CreateUnorderedAccessView(mTileErrorBuffer, &UAVDescriptor, &mTileErrorUAV);
+
+	for (auto& staging : mTileErrorStaging)
+	{
+		staging.reset();
+		mDevice->CreateBuffer(&stagingDescriptor, nullptr, &staging);
+	}
+
+	// the schedule is the longest when every tile takes the most passes
+	mScheduleBuffer = createBuffer(mDevice, sizeof(AdaptiveSampling::Pass), std::vector<AdaptiveSampling::Pass>(mAdaptive.tileCount() * ADAPTIVE_MAX_WEIGHT));
+}
+
+void Renderer::updateAdaptiveSampling()
+{
+	auto& camera = *mScene.mCamera.getBuffer();
+
+	if (camera.iterationCounter == 0)
+	{
+		// cleared image starts with every tile once, the errors read back before are stale
+		D3D11_TEXTURE2D_DESC descriptor;
+		mRenderTexture->GetDesc(&descriptor);
+
+		mAdaptive.reset(descriptor.Width, descriptor.Height, camera.mortonOrder);
+		mTileErrorFrame = { -1, -1 };
+		mFrame = 0;
+		mScheduleDirty = true;
+	}
+	else if (ADAPTIVE_SAMPLING && !mAdaptive.converged() && mFrame > 0 && mFrame % ADAPTIVE_INTERVAL == 0)
+	{
+		// staging buffers are used in turns, so the one being read was copied a whole interval ago
+		const auto index = (mFrame / ADAPTIVE_INTERVAL) % mTileErrorStaging.size();
+
+		D3D11_MAPPED_SUBRESOURCE subresource;
+		if (mTileErrorFrame[index] == mFrame - 1 - ADAPTIVE_INTERVAL && mContext->Map(mTileErrorStaging[index], 0, D3D11_MAP_READ, {}, &subresource) == S_OK)
+		{
+			mAdaptive.update(reinterpret_cast<const AdaptiveSampling::TileError*>(subresource.pData), mAdaptive.tileCount());
+			mContext->Unmap(mTileErrorStaging[index], 0);
+			mScheduleDirty = true;
+		}
+	}
+
+	if (mScheduleDirty)
+		updateBuffer(mContext, mScheduleBuffer.buffer, sizeof(AdaptiveSampling::Pass), mAdaptive.getSchedule(), 0, mAdaptive.getSchedule().size());
+
+	mScheduleDirty = false;
+	camera.scheduleLength = static_cast<uint32_t>(mAdaptive.getSchedule().size());
+	camera.schedulePaths = mAdaptive.schedulePaths();
+}
+
+void Renderer::updatePathStatistics()
+{
+	const auto& camera = *mScene.mCamera.getBuffer();
+
+	if (camera.iterationCounter == 0 || !camera.pathStatistics)
+	{
+		mPathLengths = {};
+		mPathLengthFrame = { -1, -1 };
+		mSamplesPerSecond = 0.0;
+		mPathLengthTime = std::chrono::steady_clock::now();
+		return;
+	}
+
+	// the copy of two frames ago is read, so it doesn't wait for the last one
+	const auto index = mFrame % mPathLengthStaging.size();
+
+	D3D11_MAPPED_SUBRESOURCE subresource;
+	if (mPathLengthFrame[index] != mFrame - 2 || mContext->Map(mPathLengthStaging[index], 0, D3D11_MAP_READ, {}, &subresource) != S_OK)
+		return;
+
+	const auto counters = reinterpret_cast<const uint32_t*>(subresource.pData) + 8;
+	uint64_t ended = 0;
+	for (size_t i = 0; i < PATH_LENGTH_BINS; ++i)
+	{
+		mPathLengths[i] += counters[i];
+		ended += counters[i];
+	}
+
+	mContext->Unmap(mPathLengthStaging[index], 0);
+	mPathLengthFrame[index] = -1;
+
+	// the copies are a frame apart, so the paths ended by a frame over the time of a frame, smoothed over a few of them
+	const auto now = std::chrono::steady_clock::now();
+	const auto seconds = std::chrono::duration<double>(now - mPathLengthTime).count();
+	mPathLengthTime = now;
+
+	if (seconds > 0.0)
+		mSamplesPerSecond = mSamplesPerSecond > 0.0 ? 0.9 * mSamplesPerSecond + 0.1 * ended / seconds : ended / seconds;
 }
 
 void Renderer::update(float dt)
 {
+	swapScene();
+
 	if (Input::getInstance().hasResized())
 		resize(Input::getInstance().getResolution());
 	
@@ -156,7 +352,11 @@ void Renderer::update(float dt)
 		captureScreen();
 	
 	mScene.update(dt);
+	mScene.updateBuffers(mContext);
+	mScene.mVirtualTexture->update(mContext);
 	mGUI.update();
+	updateAdaptiveSampling();
+	updatePathStatistics();
 	
 	mContext->UpdateSubresource(mCameraBuffer, 0, nullptr, mScene.mCamera.getBuffer(), 0, 0);
 }
@@ -164,21 +364,49 @@ void Renderer::update(float dt)
 void Renderer::draw()
 {
 	std::array<ID3D11Buffer*, 2> uniforms = { mCameraBuffer, mScene.mMaterialPropertyBuffer };
-	std::array<ID3D11ShaderResourceView*, 8> SRVs = {
-		mScene.mBVHBuffer.srv,
-		mScene.mIndexBuffer.srv,
-		mScene.mVertexBuffer.srv,
+	std::array<ID3D11ShaderResourceView*, 9 + 4 * (GEOMETRY_CHUNKS - 1) + GEOMETRY_CHUNKS + 9> SRVs = {
+		mScene.mBVHBuffer.srv(0),
+		mScene.mIndexBuffer.srv(0),
+		mScene.mVertexBuffer.srv(0),
 		mScene.mLightBuffer.srv,
-		mScene.mTriangleProperties.srv,
-		mScene.mDiffuse.srv,
-		mScene.mMetallicRoughness.srv,
-		mScene.mNormal.srv,
+		mScene.mTriangleProperties.srv(0),
+		mScene.mVirtualTexture->poolSRV(),
+		mScene.mVirtualTexture->pageTableSRV(),
+		mScene.mVirtualTexture->descriptorSRV(),
+		mScene.mInstanceBuffer.srv,
 	};
-	std::array<ID3D11UnorderedAccessView*, 4> UAVs = {
+
+	// other chunks of the geometry follow in the order of geometry.h
+	const std::array<ChunkedBuffer*, 4> chunked = { &mScene.mBVHBuffer, &mScene.mIndexBuffer, &mScene.mVertexBuffer, &mScene.mTriangleProperties };
+	for (size_t i = 0; i < chunked.size(); ++i)
+		for (size_t chunk = 1; chunk < GEOMETRY_CHUNKS; ++chunk)
+			SRVs[9 + i * (GEOMETRY_CHUNKS - 1) + chunk - 1] = chunked[i]->srv(chunk);
+
+	// precomputed triangles after them, all their chunks are bound only if the scene has them
+	for (size_t chunk = 0; chunk < GEOMETRY_CHUNKS; ++chunk)
+		SRVs[9 + 4 * (GEOMETRY_CHUNKS - 1) + chunk] = mScene.mTrianglePositions.srv(chunk);
+
+	// decoding of the compressed geometry, the light selection, the schedule of adaptive sampling, the emissive triangles,
+	// the environment map and the opacity of the materials come last
+	SRVs[SRVs.size() - 9] = mScene.mMeshGeometryBuffer.srv;
+	SRVs[SRVs.size() - 8] = mScene.mLightTreeBuffer.srv;
+	SRVs[SRVs.size() - 7] = mScene.mLightTableBuffer.srv;
+	SRVs[SRVs.size() - 6] = mScheduleBuffer.srv;
+	SRVs[SRVs.size() - 5] = mScene.mEmissiveBuffer.srv;
+	SRVs[SRVs.size() - 4] = mScene.mEmissiveTableBuffer.srv;
+	SRVs[SRVs.size() - 3] = mScene.mEnvironmentTexture.srv;
+	SRVs[SRVs.size() - 2] = mScene.mEnvironmentTableBuffer.srv;
+	SRVs[SRVs.size() - 1] = mScene.mOpacityBuffer.srv;
+
+	std::array<ID3D11UnorderedAccessView*, 8> UAVs = {
 		mRenderTextureUAV,
 		mPathStateUAV,
 		mQueueUAV,
 		mQueueCountersUAV,
+		mScene.mVirtualTexture->feedbackUAV(),
+		nullptr, // u5 is kept for the NVAPI extensions, see NV_SHADER_EXTN_SLOT
+		mTileErrorUAV,
+		mPixelSamplesUAV,
 	};
 	std::array<ID3D11ShaderResourceView*, SRVs.max_size()> nullSRV = {};
 	std::array<ID3D11UnorderedAccessView*, UAVs.max_size()> nullUAV = {};
@@ -192,27 +420,62 @@ void Renderer::draw()
 	mContext->CSSetSamplers(0, 1, &mScene.mSampler);
 	
 
-	mContext->CSSetShader(mShaderLogic, nullptr, 0);
-	mContext->Dispatch(NUM_GROUPS, 1, 1);
-	
-	mContext->CSSetShader(mShaderNewPath, nullptr, 0);
-	mContext->Dispatch(NUM_GROUPS, 1, 1);
-	
-	mContext->CSSetShader(mShaderMaterialUE4, nullptr, 0);
-	mContext->Dispatch(NUM_GROUPS, 1, 1);
-	
-	mContext->CSSetShader(mShaderMaterialGlass, nullptr, 0);
-	mContext->Dispatch(NUM_GROUPS, 1, 1); 
+	// nothing is traced once adaptive sampling has every tile under the target error
+	const auto tracing = !mAdaptive.converged();
+	const auto tileErrors = tracing && ADAPTIVE_SAMPLING && (mFrame + 1) % ADAPTIVE_INTERVAL == 0;
 
-	mContext->CSSetShader(mShaderExtensionRay, nullptr, 0);
-	mContext->Dispatch(NUM_GROUPS, 1, 1);
-	
-	mContext->CSSetShader(mShaderShadowRay, nullptr, 0);
-	mContext->Dispatch(NUM_GROUPS, 1, 1);
+	if (tracing)
+	{
+		mContext->CSSetShader(mShaderLogic, nullptr, 0);
+		mContext->Dispatch(NUM_GROUPS, 1, 1);
+		
+		mContext->CSSetShader(mShaderNewPath, nullptr, 0);
+		mContext->Dispatch(NUM_GROUPS, 1, 1);
+		
+		mContext->CSSetShader(mShaderMaterialUE4, nullptr, 0);
+		mContext->Dispatch(NUM_GROUPS, 1, 1);
+		
+		mContext->CSSetShader(mShaderMaterialGlass, nullptr, 0);
+		mContext->Dispatch(NUM_GROUPS, 1, 1); 
 
+		mContext->CSSetShader(mShaderExtensionRay, nullptr, 0);
+		mContext->Dispatch(NUM_GROUPS, 1, 1);
+		
+		mContext->CSSetShader(mShaderShadowRay, nullptr, 0);
+		mContext->Dispatch(NUM_GROUPS, 1, 1);
+	}
+
+	if (tileErrors)
+	{
+		mContext->CSSetShader(mShaderAdaptive, nullptr, 0);
+		mContext->Dispatch(static_cast<UINT>((mAdaptive.tileCount() + NUM_THREADS - 1) / NUM_THREADS), 1, 1);
+	}
 	
 	mContext->CSSetShaderResources(0, SRVs.size(), nullSRV.data());
 	mContext->CSSetUnorderedAccessViews(0, UAVs.size(), nullUAV.data(), nullptr);
+
+	// errors of the tiles are read back by updateAdaptiveSampling an interval later
+	if (tileErrors)
+	{
+		const auto index = (mFrame / ADAPTIVE_INTERVAL) % mTileErrorStaging.size();
+		mContext->CopyResource(mTileErrorStaging[index], mTileErrorBuffer);
+		mTileErrorFrame[index] = mFrame;
+	}
+
+	// the path lengths of the frame are read back by updatePathStatistics and counted again from zero
+	if (tracing && mScene.mCamera.getBuffer()->pathStatistics)
+	{
+		const auto index = mFrame % mPathLengthStaging.size();
+		mContext->CopyResource(mPathLengthStaging[index], mQueueCountersBuffer);
+		mPathLengthFrame[index] = mFrame;
+
+		const std::array<uint32_t, PATH_LENGTH_BINS> zeros = {};
+		const D3D11_BOX lengths = { 32, 0, 0, 32 + PATH_LENGTH_BINS * sizeof(uint32_t), 1, 1 };
+		mContext->UpdateSubresource(mQueueCountersBuffer, 0, &lengths, zeros.data(), 0, 0);
+	}
+
+	if (tracing)
+		++mFrame;
 	
 	mContext->ClearRenderTargetView(mRenderTarget, std::array<float, 4>({ 0, 0, 0, 0.0f }).data());
 
@@ -325,6 +588,7 @@ void Renderer::reloadComputeShaders()
 		{ mShaderMaterialGlass, LR"(Assets\Shaders\materialGlass.hlsl)" },
 		{ mShaderExtensionRay, LR"(Assets\Shaders\extensionRayCast.hlsl)" },
 		{ mShaderShadowRay, LR"(Assets\Shaders\shadowRayCast.hlsl)" },
+		{ mShaderAdaptive, LR"(Assets\Shaders\adaptive.hlsl)" },
 	};
 	
 	std::vector<std::thread> workers;
@@ -469,14 +733,40 @@ T Renderer::createShader(const std::wstring& path, const std::string& target)
 	auto numGroups = std::to_string(NUM_GROUPS);
 	auto numThreads = std::to_string(NUM_THREADS);
 	auto iterations = std::to_string(ITERATIONS);
-	auto maxLights = std::to_string(MAX_LIGHTS);
+	auto maxMaterials = std::to_string(MAX_MATERIALS);
+	auto vtTileSize = std::to_string(VT_TILE_SIZE);
+	auto vtTileBorder = std::to_string(VT_TILE_BORDER);
+	auto vtPoolTiles = std::to_string(VT_POOL_TILES);
+	auto nodeChunkBits = std::to_string(geometryChunkBits(sizeof(BVHWrapper::BVHNode)));
+	auto triangleChunkBits = std::to_string(geometryChunkBits(COMPRESSED_GEOMETRY ? sizeof(BVHWrapper::PackedTriangle) : sizeof(BVHWrapper::Triangle)));
+	auto vertexChunkBits = std::to_string(geometryChunkBits(COMPRESSED_GEOMETRY ? sizeof(BVHWrapper::PackedVertex) : sizeof(Vec3f)));
+	auto propertiesChunkBits = std::to_string(geometryChunkBits(COMPRESSED_GEOMETRY ? sizeof(BVHWrapper::PackedProperties) : sizeof(BVHWrapper::TriangleProperties)));
+	auto positionChunkBits = std::to_string(geometryChunkBits(sizeof(BVHWrapper::TrianglePositions)));
+	auto adaptiveTileSize = std::to_string(ADAPTIVE_TILE_SIZE);
+	auto pathLengthBins = std::to_string(PATH_LENGTH_BINS);
+	auto stackSize = std::to_string(BVH_STACK_SIZE);
 	
-	const std::array<D3D_SHADER_MACRO, 6> defines = {
+	const std::array<D3D_SHADER_MACRO, 21> defines = {
 		"PATHCOUNT", pathcount.c_str(),
 		"NUM_GROUPS", numGroups.c_str(),
 		"NUM_THREADS", numThreads.c_str(),
 		"ITERATIONS", iterations.c_str(),
-		"MAX_LIGHTS", maxLights.c_str(),
+		"MAX_MATERIALS", maxMaterials.c_str(),
+		"VT_TILE_SIZE", vtTileSize.c_str(),
+		"VT_TILE_BORDER", vtTileBorder.c_str(),
+		"VT_POOL_TILES", vtPoolTiles.c_str(),
+		"NODE_CHUNK_BITS", nodeChunkBits.c_str(),
+		"TRIANGLE_CHUNK_BITS", triangleChunkBits.c_str(),
+		"VERTEX_CHUNK_BITS", vertexChunkBits.c_str(),
+		"PROPERTIES_CHUNK_BITS", propertiesChunkBits.c_str(),
+		"POSITION_CHUNK_BITS", positionChunkBits.c_str(),
+		"PRECOMPUTED_TRIANGLES", PRECOMPUTED_TRIANGLES && !COMPRESSED_GEOMETRY ? "1" : "0",
+		"COMPRESSED_GEOMETRY", COMPRESSED_GEOMETRY ? "1" : "0",
+		"LIGHT_TREE_SELECTION", LIGHT_TREE_SELECTION ? "1" : "0",
+		"SOBOL_SAMPLER", SOBOL_SAMPLER ? "1" : "0",
+		"ADAPTIVE_TILE_SIZE", adaptiveTileSize.c_str(),
+		"PATH_LENGTH_BINS", pathLengthBins.c_str(),
+		"STACKSIZE", stackSize.c_str(), // top level and mesh BVH share the stack
 		nullptr, nullptr
 	};
 	
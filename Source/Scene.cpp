@@ -3,112 +3,209 @@
 #include <stdexcept>
 #include "spdlog/fmt/fmt.h"
 #include <assimp/SceneCombiner.h>
+#include <assimp/ProgressHandler.hpp>
 #include <assimp/scene.h>
 #include "assimp/pbrmaterial.h"
-#include "lodepng/lodepng.h"
-#include "avir/avir.h"
-#include "avir/avir_float8_avx.h"
-#include <thread>
+#include <future>
 #include "Constants.hpp"
+#include "ParamsParser.hpp"
 #include <filesystem>
-#include <fstream>
-#include "CsvParser.hpp"
+#include <numeric>
 
 namespace fs = std::filesystem;
 using namespace DirectX;
 
-SceneParams SceneParams::instance = SceneParams();
-
-void SceneParams::loadScenes()
+namespace
 {
-	for (const auto& f : fs::recursive_directory_iterator(R"(Assets\Models\)"))
+	// importer takes the first part of the progress, aborts the import once the load is cancelled
+	class ImportProgress : public Assimp::ProgressHandler
 	{
-		if (f.is_regular_file())
+	public:
+		explicit ImportProgress(SceneLoadToken* token) : mToken(token) {}
+
+		bool Update(float percentage) override
 		{
-			if (f.path().filename().extension().string() == ".gltf")
-			{
-				pathNames.emplace_back(f.path().string().substr(14)); // length of assets\models
-				lights.emplace_back();
-				cameraParams.emplace_back();
-
-				auto paramsPath = f.path().string().substr(0, pathNames.back().length() + 9) + ".params";
-				std::ifstream file(paramsPath);
-				if (file.is_open())
-				{
-					CSVIterator params(file);
-
-					for (size_t i = 0; i < sizeof(CameraParam) / 4; i++) // todo add some error checking for file integrity
-						reinterpret_cast<float*>(&cameraParams.back())[i] = std::stof(params->operator[](i));
-
-					auto getLight = [](const CSVRow& row) -> Light
-					{
-						Light light;
-
-						for (size_t i = 0; i < sizeof(Light) / 4; i++)
-							reinterpret_cast<float*>(&light)[i] = std::stof(row[i]);
-
-						return light;
-					};
-
-					for (++params; params; ++params)
-						lights.back().emplace_back(getLight(*params));
-				}
-				else
-				{
-					// default params
-					cameraParams.back() = { {1.0, 3.0, 8.0}, 0, 270 };
-					lights.back().emplace_back(Light{ {13.0f, 4.5f, 4.5f}, 100.0f, {80.0f, 80.0f, 40.0f}, 0.5f });
-					lights.back().emplace_back(Light{ {0.0, 4.5, 2.0}, 100.0, {80.0, 80.0, 40.0}, 0.5 });
-				}
-			}
+			if (percentage >= 0.f)
+				mToken->progress = percentage * IMPORT_SHARE;
+
+			return !mToken->cancelled;
 		}
+
+		static constexpr float IMPORT_SHARE = 0.4f;
+
+	private:
+		SceneLoadToken* mToken;
+	};
+
+	void setProgress(SceneLoadToken* token, float progress)
+	{
+		if (token)
+			token->progress = progress;
 	}
 
-	for (const auto& p : pathNames)
-		pathsReference.emplace_back(p.c_str());
-	
-	instance = *this;
-}
+	bool isCancelled(SceneLoadToken* token)
+	{
+		return token && token->cancelled;
+	}
 
-size_t SceneParams::getSceneIndex(const std::string& name)
-{
-	for (int i = 0; i < pathNames.size(); ++i)
-		if (name == pathNames[i])
-			return i;
+	// the stages of the load are separated by it
+	void checkCancelled(SceneLoadToken* token, const std::string& name)
+	{
+		if (isCancelled(token))
+			throw SceneLoadCancelled(fmt::format("Loading of {} cancelled", name));
+	}
+
+	// shares of the progress after the import, the BVH build runs along the texture caching
+	constexpr float BVH_SHARE = 0.35f;
+	constexpr float TEXTURE_SHARE = 0.15f;
 
-	throw std::runtime_error(fmt::format("Non existing scene {}", name));
+	// emission of the materials is compared by it, the same as the power of the lights
+	float maxComponent(const XMFLOAT3& color)
+	{
+		return std::max(color.x, std::max(color.y, color.z));
+	}
 }
 
-Scene::Scene(ID3D11Device* device, const std::string& path)
+Scene::Scene(ID3D11Device* device, const std::string& path, SceneLoadToken* token, const BVH::BuildParams& bvhParams)
 	: mDevice(device)
 	, mPath(path.substr(0, path.find_last_of('\\') + 1))
 	, mSceneName(path.substr(14)) // offset of Assets\\Models\\ 
+	, mBVHParams(bvhParams)
 {	
-	loadScene(path);
-	
-	std::thread worker(&Scene::createBVH, this);
-	// createBVH();
-	loadTextures();
-	createSampler();
-	createLights();
+	// settings tuned for the scene replace the defaults of the renderer
+	const auto bvhParamsPath = SceneCatalog::getBVHParamsPath(mSceneName);
+	if (fs::exists(bvhParamsPath))
+		ParamsParser::parseBVHFile(bvhParamsPath, mBVHParams);
+
+	loadScene(path, token);
+
+	if (isCancelled(token))
+	{
+		delete mScene;
+		throw SceneLoadCancelled(fmt::format("Loading of {} cancelled", mSceneName));
+	}
+
+	if (!mScene)
+		throw std::runtime_error(fmt::format("Failed to import scene {}", path));
+
+	// the build and the texture caching report from their threads, the load shows the sum of both
+	std::atomic<float> bvhDone = 0.f, texturesDone = 0.f;
+	const auto reportLoad = [&]() { setProgress(token, ImportProgress::IMPORT_SHARE + BVH_SHARE * bvhDone + TEXTURE_SHARE * texturesDone); };
+
+	mBVHParams.cancelled = token ? &token->cancelled : nullptr;
+	if (token)
+		mBVHParams.progress = [&](float done) { bvhDone = done; reportLoad(); };
+
+	// errors of the build are thrown on its thread, get() rethrows them here
+	auto bvhBuild = std::async(std::launch::async, &Scene::createBVH, this);
+
+	// the build uses the import, it has to end before it's deleted, whatever throws meanwhile
+	try
+	{
+		loadTextures(token, [&](float done) { texturesDone = done; reportLoad(); });
+		checkCancelled(token, mSceneName);
+		createSampler();
+
+		const auto params = SceneCatalog::getInstance().getParams(mSceneName);
+		createLights(params.lights);
+		checkCancelled(token, mSceneName);
+
+		createEnvironment();
+		checkCancelled(token, mSceneName);
+
+		mCamera.getBuffer()->position = XMLoadFloat3(&params.camera.position);
+		mCamera.setRotation(params.camera.pitch, params.camera.yaw);
 
-	const auto& cameraParams = SceneParams::instance.cameraParams[SceneParams::instance.getSceneIndex(mSceneName)];
-	mCamera.getBuffer()->position = XMLoadFloat3(&cameraParams.position);
-	mCamera.setRotation(cameraParams.pitch, cameraParams.yaw);
+		mAnimation = NodeAnimation(mScene);
 
-	worker.join();
+		bvhBuild.get();
+		checkCancelled(token, mSceneName);
+		setProgress(token, 0.95f);
+
+		// the ray kernels skip the tests of the flags the scene doesn't have
+		mCamera.getBuffer()->opacityFlags = mBVH.mOpacityFlags;
+		createEmissives();
+	}
+	catch (...)
+	{
+		if (bvhBuild.valid())
+			bvhBuild.wait();
+
+		delete mScene;
+
+		// the build and the caching stop with their own errors, the load reports them as cancelled
+		checkCancelled(token, mSceneName);
+		throw;
+	}
 
 	delete mScene; // won't be needed anymore
+	mBVHParams.cancelled = nullptr;
+	mBVHParams.progress = nullptr;
+
+	checkCancelled(token, mSceneName);
+	setProgress(token, 1.f);
 }
 
 void Scene::update(float dt)
 {
+	const auto& changed = mAnimation.update(dt);
+
+	if (!changed.empty())
+	{
+		for (const auto node : changed)
+			mBVH.setNodeTransform(node, mAnimation.getTransform(node));
+
+		mBVH.refit();
+		updateEmissives(mBVH.mDirtyInstances);
+		mCamera.getBuffer()->iterationCounter = -1; // accumulated image is no longer valid
+	}
+
 	mCamera.update(dt);
 }
 
-void Scene::loadScene(const std::string& path)
+void Scene::updateBuffers(ID3D11DeviceContext* context)
+{
+	updateBuffer(context, mBVHBuffer, sizeof(BVHWrapper::BVHNode), mBVH.mGPUTree, mBVH.mDirtyNodes.begin, mBVH.mDirtyNodes.end);
+	updateBuffer(context, mInstanceBuffer.buffer, sizeof(BVHWrapper::Instance), mBVH.mInstances, mBVH.mDirtyInstances.begin, mBVH.mDirtyInstances.end);
+	updateBuffer(context, mTrianglePositions, sizeof(BVHWrapper::TrianglePositions), mBVH.mTrianglePositions, mBVH.mDirtyPositions.begin, mBVH.mDirtyPositions.end);
+
+	if (COMPRESSED_GEOMETRY)
+	{
+		updateBuffer(context, mVertexBuffer, sizeof(BVHWrapper::PackedVertex), mBVH.mPackedVertices, mBVH.mDirtyVertices.begin, mBVH.mDirtyVertices.end);
+		updateBuffer(context, mTriangleProperties, sizeof(BVHWrapper::PackedProperties), mBVH.mPackedProperties, mBVH.mDirtyProperties.begin, mBVH.mDirtyProperties.end);
+		updateBuffer(context, mMeshGeometryBuffer.buffer, sizeof(BVHWrapper::MeshGeometry), mBVH.mMeshGeometry, mBVH.mDirtyMeshes.begin, mBVH.mDirtyMeshes.end);
+	}
+	else
+	{
+		updateBuffer(context, mVertexBuffer, sizeof(Vec3f), mBVH.mVertices, mBVH.mDirtyVertices.begin, mBVH.mDirtyVertices.end);
+		updateBuffer(context, mTriangleProperties, sizeof(BVHWrapper::TriangleProperties), mBVH.mTriangleProperties, mBVH.mDirtyProperties.begin, mBVH.mDirtyProperties.end);
+	}
+
+	mBVH.mDirtyNodes = mBVH.mDirtyInstances = mBVH.mDirtyVertices = mBVH.mDirtyProperties = mBVH.mDirtyPositions = mBVH.mDirtyMeshes = {};
+
+	// nodes of the light BVH changed by refits lie on paths to the root, they are uploaded one by one
+	updateBuffer(context, mLightBuffer.buffer, sizeof(Light), mLights, mDirtyLights.begin, mDirtyLights.end);
+	for (const auto node : mDirtyLightNodes)
+		updateBuffer(context, mLightTreeBuffer.buffer, sizeof(LightBVH::Node), mLightBVH.getNodes(), node, node + 1);
+
+	if (mLightTableDirty)
+		updateBuffer(context, mLightTableBuffer.buffer, sizeof(AliasTable::Entry), mLightTable.getEntries(), 0, mLightTable.getEntries().size());
+
+	if (mEmissiveTableDirty)
+		updateBuffer(context, mEmissiveTableBuffer.buffer, sizeof(AliasTable::Entry), mEmissiveTable.getEntries(), 0, mEmissiveTable.getEntries().size());
+
+	mDirtyLights = {};
+	mDirtyLightNodes.clear();
+	mLightTableDirty = false;
+	mEmissiveTableDirty = false;
+}
+
+void Scene::loadScene(const std::string& path, SceneLoadToken* token)
 {
 	Assimp::Importer importer;
+
+	if (token)
+		importer.SetProgressHandler(new ImportProgress(token)); // importer owns the handler
 	
 	importer.ReadFile(path.c_str(), 
 		aiProcess_Triangulate
@@ -116,16 +213,23 @@ void Scene::loadScene(const std::string& path)
 		| aiProcess_SortByPType
 		| aiProcess_GenSmoothNormals
 		| aiProcess_FlipUVs
-		| aiProcess_PreTransformVertices 
 		//| aiProcess_FixInfacingNormals
 	);
 
 	mScene = importer.GetOrphanedScene();
 }
 
-void Scene::loadTextures()
+void Scene::loadTextures(SceneLoadToken* token, const std::function<void(float)>& progress)
 {
 	std::vector<MaterialProperty> materialProperties;
+	std::vector<BVHWrapper::MaterialOpacity> opacities;
+	mVirtualTexture = std::make_unique<VirtualTexture>(mDevice);
+
+	const std::array<std::pair<aiTextureType, MaterialProperty::Indices>, 3> textureTypes = { {
+		{ aiTextureType_DIFFUSE, MaterialProperty::DIFFUSE },
+		{ aiTextureType_UNKNOWN, MaterialProperty::METALLICROUGHNESS },
+		{ aiTextureType_NORMALS, MaterialProperty::NORMAL },
+	} };
 
 	for (size_t i = 0; i < mScene->mNumMaterials; i++)
 	{
@@ -134,47 +238,79 @@ void Scene::loadTextures()
 		mScene->mMaterials[i]->Get(AI_MATKEY_GLTF_PBRMETALLICROUGHNESS_METALLIC_FACTOR, matProperty.metallic);
 		mScene->mMaterials[i]->Get(AI_MATKEY_GLTF_PBRMETALLICROUGHNESS_ROUGHNESS_FACTOR, matProperty.roughness);
 
-		aiString str;
-		mScene->mMaterials[i]->Get(AI_MATKEY_GLTF_ALPHAMODE, str);
-		if (str == aiString("BLEND"))
+		mScene->mMaterials[i]->Get(AI_MATKEY_COLOR_EMISSIVE, reinterpret_cast<aiColor3D&>(matProperty.emission));
+
+		const auto flags = BVHWrapper::opacityFlags(*mScene->mMaterials[i]);
+		if (flags & BVHWrapper::TRANSMISSIVE_TRIANGLE)
 		{
 			matProperty.materialType = MaterialProperty::GLASS;
 			matProperty.refractIndex = 1.458; // glass refraction TODO remove
 		}
+
+		for (const auto& [type, index] : textureTypes)
+		{
+			aiString path;
+			mScene->mMaterials[i]->GetTexture(type, 0, &path);
+			
+			if (path.length)
+				matProperty.textureIndices[index] = mVirtualTexture->addTexture(mPath + path.C_Str());
+		}
+
+		// the texture only modulates the factor, without it the material doesn't emit
+		aiString emissionPath;
+		mScene->mMaterials[i]->GetTexture(aiTextureType_EMISSIVE, 0, &emissionPath);
+
+		if (emissionPath.length && maxComponent(matProperty.emission) > 0.f)
+			matProperty.emissionIndex = mVirtualTexture->addTexture(mPath + emissionPath.C_Str());
 		
+		// the masked triangles are cut out by the alpha of the diffuse texture
+		auto opacity = BVHWrapper::opacity(*mScene->mMaterials[i]);
+		if (flags & BVHWrapper::MASKED_TRIANGLE)
+			opacity.alphaIndex = matProperty.textureIndices[MaterialProperty::DIFFUSE];
+
 		materialProperties.emplace_back(matProperty);
+		opacities.emplace_back(opacity);
+		mEmissions.emplace_back(matProperty.emission);
 	}
 
-	auto work = [&](aiTextureType type, MaterialProperty::Indices index, Texture& resource)
-	{
-		createTextures(loadSpecificTexture(type, materialProperties, index), resource);
-	};
-	
-	std::thread diffWorker(work, aiTextureType_DIFFUSE, MaterialProperty::DIFFUSE, std::ref(mDiffuse));
-	std::thread mtrWorker(work, aiTextureType_UNKNOWN, MaterialProperty::METALLICROUGHNESS, std::ref(mMetallicRoughness));
-	std::thread normWorker(work, aiTextureType_NORMALS, MaterialProperty::NORMAL, std::ref(mNormal));
-	
-	// createTextures(loadSpecificTexture(aiTextureType_DIFFUSE, materialProperties, MaterialProperty::DIFFUSE), mDiffuse);
-	// createTextures(loadSpecificTexture(aiTextureType_UNKNOWN, materialProperties, MaterialProperty::METALLICROUGHNESS), mMetallicRoughness);
-	// createTextures(loadSpecificTexture(aiTextureType_NORMALS, materialProperties, MaterialProperty::NORMAL), mNormal);
-	
-	diffWorker.join();
-	mtrWorker.join();
-	normWorker.join();
+	// only the coarsest mips are loaded here, the rest is streamed in on demand
+	mVirtualTexture->finalize(token ? &token->cancelled : nullptr, progress);
 	
 	createPropertyBuffer(materialProperties);
+	mOpacityBuffer = createBuffer(mDevice, sizeof(BVHWrapper::MaterialOpacity), opacities);
 }
 
 void Scene::createBVH()
 {
-	// build BVH
-	BVHWrapper bvh(mScene);
-
-	// create buffers and upload data
-	mBVHBuffer = createBuffer(mDevice, sizeof(BVHWrapper::BVHNode), bvh.mGPUTree);
-	mIndexBuffer = createBuffer(mDevice, sizeof(BVHWrapper::Triangle), bvh.mIndices);
-	mVertexBuffer = createBuffer(mDevice, sizeof(Vec3f), bvh.mVertices, DXGI_FORMAT_R32G32B32_FLOAT, {});
-	mTriangleProperties = createBuffer(mDevice, sizeof(BVHWrapper::TriangleProperties), bvh.mTriangleProperties);
+	// build BVH per mesh and the top level one over the node instances
+	mBVH = BVHWrapper(mScene, mBVHParams, PRECOMPUTED_TRIANGLES, COMPRESSED_GEOMETRY);
+
+	// the geometry is copied into the BVH buffers, only the materials and the nodes of the import are used from now on
+	for (size_t i = 0; i < mScene->mNumMeshes; ++i)
+	{
+		delete mScene->mMeshes[i];
+		mScene->mMeshes[i] = nullptr;
+	}
+
+	// create buffers and upload data, the geometry is split into chunks for scenes over the buffer size limit
+	mBVHBuffer = createChunkedBuffer(mDevice, sizeof(BVHWrapper::BVHNode), mBVH.mGPUTree);
+	mTrianglePositions = createChunkedBuffer(mDevice, sizeof(BVHWrapper::TrianglePositions), mBVH.mTrianglePositions);
+	mInstanceBuffer = createBuffer(mDevice, sizeof(BVHWrapper::Instance), mBVH.mInstances);
+
+	// compressed geometry takes the same registers, the full precision copies stay on the CPU for refits
+	if (COMPRESSED_GEOMETRY)
+	{
+		mIndexBuffer = createChunkedBuffer(mDevice, sizeof(BVHWrapper::PackedTriangle), mBVH.mPackedTriangles);
+		mVertexBuffer = createChunkedBuffer(mDevice, sizeof(BVHWrapper::PackedVertex), mBVH.mPackedVertices, DXGI_FORMAT_R32G32_UINT, {});
+		mTriangleProperties = createChunkedBuffer(mDevice, sizeof(BVHWrapper::PackedProperties), mBVH.mPackedProperties);
+		mMeshGeometryBuffer = createBuffer(mDevice, sizeof(BVHWrapper::MeshGeometry), mBVH.mMeshGeometry);
+	}
+	else
+	{
+		mIndexBuffer = createChunkedBuffer(mDevice, sizeof(BVHWrapper::Triangle), mBVH.mIndices);
+		mVertexBuffer = createChunkedBuffer(mDevice, sizeof(Vec3f), mBVH.mVertices, DXGI_FORMAT_R32G32B32_FLOAT, {});
+		mTriangleProperties = createChunkedBuffer(mDevice, sizeof(BVHWrapper::TriangleProperties), mBVH.mTriangleProperties);
+	}
 }
 
 void Scene::createSampler()
@@ -206,124 +342,146 @@ void Scene::createPropertyBuffer(const std::vector<MaterialProperty>& data)
 	mDevice->CreateBuffer(&materialPropDescriptor, &bufferData, &mMaterialPropertyBuffer);
 }
 
-Scene::LoadedTextures Scene::loadSpecificTexture(aiTextureType type, std::vector<MaterialProperty>& properties, MaterialProperty::Indices index) const
+void Scene::createLights(const std::vector<Light>& lights)
 {
-	RawTextureData textures;
-	std::set<unsigned> median;
+	mLights = lights;
+	updateLights();
+}
 
-	for (size_t i = 0; i < mScene->mNumMaterials; i++)
+void Scene::updateLights()
+{
+	// the whole tree is rebuilt, it takes a few milliseconds even for tens of thousands of lights
+	mLightBVH = LightBVH(mLights);
+
+	mLightBuffer = createBuffer(mDevice, sizeof(Light), mLights);
+	mLightTreeBuffer = createBuffer(mDevice, sizeof(LightBVH::Node), mLightBVH.getNodes());
+	mCamera.getBuffer()->lightCount = static_cast<uint32_t>(mLights.size());
+
+	if (!LIGHT_TREE_SELECTION)
 	{
-		const auto& material = mScene->mMaterials[i];
-		
-		aiString path;
-		material->GetTexture(type, 0, &path);
-		
-		if (path.length)
-		{
-			std::vector<unsigned char> texture;
-			properties[i].textureIndices[index] = textures.size();
+		std::vector<float> powers(mLights.size());
+		std::transform(mLights.begin(), mLights.end(), powers.begin(), lightPower);
 
-			unsigned width, height;
-			lodepng::decode(texture, width, height, mPath + path.C_Str());
-			textures.emplace_back(std::move(texture));
+		mLightTable = AliasTable(powers);
+		mLightTableBuffer = createBuffer(mDevice, sizeof(AliasTable::Entry), mLightTable.getEntries());
+	}
 
-			median.emplace(textures.back().size());
-			assert(width == height);
-		}
+	mDirtyLights = {};
+	mDirtyLightNodes.clear();
+	mLightTableDirty = false;
+}
+
+void Scene::updateLight(size_t index)
+{
+	// the refit takes only the nodes up to the root so the lights can be edited live,
+	// the alias table is rebuilt whole in place, only if the power changed
+	mLightBVH.refit(mLights, index, mDirtyLightNodes);
+	mDirtyLights.add(index, index + 1);
+
+	// all zero powers leave the table empty, the buffer is created again once it's filled
+	if (!LIGHT_TREE_SELECTION && mLightTable.setWeight(index, lightPower(mLights[index])))
+	{
+		if (mLightTableBuffer.buffer && !mLightTable.getEntries().empty())
+			mLightTableDirty = true;
+		else
+			mLightTableBuffer = createBuffer(mDevice, sizeof(AliasTable::Entry), mLightTable.getEntries());
 	}
+}
+
+void Scene::createEmissives()
+{
+	// instances of the meshes are separate lights, the same as they are separate in the top level BVH
+	std::vector<bool> emissive(mEmissions.size());
+	for (size_t i = 0; i < mEmissions.size(); ++i)
+		emissive[i] = maxComponent(mEmissions[i]) > 0.f;
+
+	mEmissives = mBVH.getTriangles(emissive);
 
-	unsigned medianVal = 0;
+	// the kernels pick a triangle by its power, so a point of any emissive triangle is sampled with the probability
+	// of the emission of its material over the total power, the same one the emitters hit by extension rays get
+	mEmissivePowers.resize(mEmissives.size());
+	auto total = 0.f;
 
-	if (!median.empty())
+	for (size_t i = 0; i < mEmissives.size(); ++i)
 	{
-		auto it = median.begin();
-		std::advance(it, median.size() / 2);
-		medianVal = static_cast<unsigned>(sqrt(*it / 4)); // gets width as median
+		mEmissivePowers[i] = emissivePower(mEmissives[i]);
+		total += mEmissivePowers[i];
 	}
 
-	return std::make_pair(std::move(textures), medianVal);
+	mEmissiveTable = AliasTable(mEmissivePowers);
+	mEmissiveBuffer = createBuffer(mDevice, sizeof(BVHWrapper::InstanceTriangle), mEmissives);
+	mEmissiveTableBuffer = createBuffer(mDevice, sizeof(AliasTable::Entry), mEmissiveTable.getEntries());
+
+	// all of them black leave the table empty and nothing is sampled
+	mCamera.getBuffer()->emissiveCount = static_cast<uint32_t>(mEmissiveTable.getEntries().empty() ? 0 : mEmissives.size());
+	mCamera.getBuffer()->emissivePower = total;
 }
 
-void Scene::createTextures(LoadedTextures rawTextures, Texture& resource)
+void Scene::updateEmissives(const BVHWrapper::Range& instances)
 {
-	auto& textures = rawTextures.first;
-	const auto dimension = rawTextures.second;
-
-	if (textures.empty())
-		return;
-	
-	D3D11_TEXTURE2D_DESC textureDescriptor = {};
-	textureDescriptor.Width = dimension;
-	textureDescriptor.Height = dimension;
-	textureDescriptor.MipLevels = 1;
-	textureDescriptor.ArraySize = textures.size();
-	textureDescriptor.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-	textureDescriptor.SampleDesc.Count = 1;
-	textureDescriptor.SampleDesc.Quality = 0;
-	textureDescriptor.Usage = D3D11_USAGE_DEFAULT;
-	textureDescriptor.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-	textureDescriptor.CPUAccessFlags = 0;
-	textureDescriptor.MiscFlags = 0;
-
-	std::vector<D3D11_SUBRESOURCE_DATA> initData;
-	avir::CImageResizer<avir::fpclass_float8_dil> textureResizer(8);
-	const auto textureSize = dimension * dimension * 4;
-
-	for (auto& texture : textures)
+	// a scaled instance changes the areas of its triangles, moves and rotations leave them to the rounding
+	auto changed = false;
+	for (size_t i = 0; i < mEmissives.size(); ++i)
 	{
-		if (texture.size() != textureSize)
-		{
-			std::vector<unsigned char> newTexture(textureSize);
-			const auto oldDimension = static_cast<unsigned>(sqrt(texture.size() >> 2));
-			
-			textureResizer.resizeImage(
-				texture.data(), oldDimension, oldDimension, 0, 
-				newTexture.data(), dimension, dimension, 4, 0
-			);
-			
-			texture.swap(newTexture);
-		}
-		
-		D3D11_SUBRESOURCE_DATA textureData;
-		textureData.pSysMem = texture.data();
-		textureData.SysMemPitch = dimension * 4;
-		textureData.SysMemSlicePitch = textureSize;
-		
-		initData.emplace_back(textureData);
+		if (mEmissives[i].instance < instances.begin || mEmissives[i].instance >= instances.end)
+			continue;
+
+		const auto power = emissivePower(mEmissives[i]);
+		changed |= power != mEmissivePowers[i];
+		mEmissivePowers[i] = power;
 	}
-	
-	D3D11_SHADER_RESOURCE_VIEW_DESC srvDescriptor = {};
-	srvDescriptor.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-	srvDescriptor.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
-	srvDescriptor.Texture2DArray.ArraySize = textures.size();
-	srvDescriptor.Texture2DArray.MipLevels = 1;
-	
-	mDevice->CreateTexture2D(&textureDescriptor, initData.data(), &resource.texture);
-	mDevice->CreateShaderResourceView(resource.texture, &srvDescriptor, &resource.srv);
+
+	if (!changed)
+		return;
+
+	// all zero powers leave the table empty, the buffer is created again once it's filled
+	mEmissiveTable = AliasTable(mEmissivePowers);
+	if (mEmissiveTableBuffer.buffer && !mEmissiveTable.getEntries().empty())
+		mEmissiveTableDirty = true;
+	else
+		mEmissiveTableBuffer = createBuffer(mDevice, sizeof(AliasTable::Entry), mEmissiveTable.getEntries());
+
+	mCamera.getBuffer()->emissiveCount = static_cast<uint32_t>(mEmissiveTable.getEntries().empty() ? 0 : mEmissives.size());
+	mCamera.getBuffer()->emissivePower = std::accumulate(mEmissivePowers.begin(), mEmissivePowers.end(), 0.f);
 }
 
-void Scene::createLights()
+float Scene::emissivePower(const BVHWrapper::InstanceTriangle& triangle) const
 {
-	D3D11_BUFFER_DESC lightDescriptor = {};
-	lightDescriptor.Usage = D3D11_USAGE_DEFAULT;
-	lightDescriptor.ByteWidth = MAX_LIGHTS * sizeof(Light);
-	lightDescriptor.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-	lightDescriptor.CPUAccessFlags = 0;
-	lightDescriptor.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
-	lightDescriptor.StructureByteStride = sizeof(Light);
-
-	const auto& lights = SceneParams::instance.lights[SceneParams::instance.getSceneIndex(mSceneName)];
-	for (size_t i = 0; i < lights.size(); ++i)
-		mLights[i] = lights[i];
-	
-	D3D11_SUBRESOURCE_DATA dataInit = {};
-	dataInit.pSysMem = mLights.data();
+	return mBVH.getArea(triangle) * maxComponent(mEmissions[mBVH.mIndices[triangle.triangle].index & ~BVHWrapper::TRIANGLE_FLAGS]);
+}
+
+void Scene::createEnvironment()
+{
+	const auto path = SceneCatalog::getEnvironmentPath(mSceneName);
+	if (path.empty())
+		return;
+
+	const EnvironmentMap environment(path);
+	if (environment.getCells().x == 0)
+		return; // black map, the environment color is used instead
+
+	// shared exponent floats take 4 B per texel, the same as the RGBE source
+	D3D11_TEXTURE2D_DESC descriptor = {};
+	descriptor.Width = environment.getWidth();
+	descriptor.Height = environment.getHeight();
+	descriptor.MipLevels = 1;
+	descriptor.ArraySize = 1;
+	descriptor.Format = DXGI_FORMAT_R9G9B9E5_SHAREDEXP;
+	descriptor.SampleDesc.Count = 1;
+	descriptor.Usage = D3D11_USAGE_IMMUTABLE;
+	descriptor.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+
+	D3D11_SUBRESOURCE_DATA data = {};
+	data.pSysMem = environment.getTexels().data();
+	data.SysMemPitch = environment.getWidth() * sizeof(uint32_t);
+
+	if (mDevice->CreateTexture2D(&descriptor, &data, &mEnvironmentTexture.texture) != S_OK)
+		throw std::runtime_error(fmt::format("Failed to create environment map texture of {} x {}", descriptor.Width, descriptor.Height));
+
+	if (mDevice->CreateShaderResourceView(mEnvironmentTexture.texture, nullptr, &mEnvironmentTexture.srv) != S_OK)
+		throw std::runtime_error("Failed to create shader resource view of the environment map");
 
-	D3D11_SHADER_RESOURCE_VIEW_DESC SRVDescriptor = {};
-	SRVDescriptor.Format = DXGI_FORMAT_UNKNOWN;
-	SRVDescriptor.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
-	SRVDescriptor.Buffer.NumElements = MAX_LIGHTS;
+	mEnvironmentTableBuffer = createBuffer(mDevice, sizeof(AliasTable::Entry), environment.getTable());
 
-	mDevice->CreateBuffer(&lightDescriptor, &dataInit, &mLightBuffer.buffer);
-	mDevice->CreateShaderResourceView(mLightBuffer.buffer, &SRVDescriptor, &mLightBuffer.srv);
+	mCamera.getBuffer()->environmentCells = environment.getCells();
 }
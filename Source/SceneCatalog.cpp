@@ -0,0 +1,306 @@
+﻿#include "SceneCatalog.hpp"
+#include "ParamsParser.hpp"
+#include "spdlog/fmt/fmt.h"
+#include <Windows.h>
+#include <filesystem>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+	constexpr auto MODELS_DIR = R"(Assets\Models\)";
+	constexpr auto INDEX_PATH = R"(Assets\scenes.index)";
+	constexpr uint32_t INDEX_MAGIC = 0x54414353; // SCAT
+	constexpr uint32_t INDEX_VERSION = 1;
+
+	int64_t lastWriteTime(const fs::path& path)
+	{
+		std::error_code error;
+		const auto time = fs::last_write_time(path, error);
+		return error ? 0 : time.time_since_epoch().count();
+	}
+
+	template<typename T>
+	void write(std::ostream& stream, const T& value)
+	{
+		stream.write(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	void write(std::ostream& stream, const std::string& value)
+	{
+		write(stream, static_cast<uint32_t>(value.size()));
+		stream.write(value.data(), value.size());
+	}
+
+	void write(std::ostream& stream, const std::vector<std::string>& values)
+	{
+		write(stream, static_cast<uint32_t>(values.size()));
+		for (const auto& v : values)
+			write(stream, v);
+	}
+
+	template<typename T>
+	T read(std::istream& stream)
+	{
+		T value = {};
+		if (!stream.read(reinterpret_cast<char*>(&value), sizeof(T)))
+			throw std::runtime_error("Truncated scene index");
+
+		return value;
+	}
+
+	template<>
+	std::string read<std::string>(std::istream& stream)
+	{
+		std::string value(read<uint32_t>(stream), '\0');
+		if (!stream.read(value.data(), value.size()))
+			throw std::runtime_error("Truncated scene index");
+
+		return value;
+	}
+
+	template<>
+	std::vector<std::string> read<std::vector<std::string>>(std::istream& stream)
+	{
+		std::vector<std::string> values(read<uint32_t>(stream));
+		for (auto& v : values)
+			v = read<std::string>(stream);
+
+		return values;
+	}
+}
+
+SceneCatalog& SceneCatalog::getInstance()
+{
+	static SceneCatalog catalog;
+	return catalog;
+}
+
+SceneCatalog::SceneCatalog()
+{
+	std::unordered_map<std::string, Directory> directories;
+	std::unordered_map<std::string, Entry> entries;
+
+	if (!load(directories, entries))
+	{
+		directories.clear();
+		entries.clear();
+	}
+
+	scanDirectory("", directories, entries);
+
+	// scenes which disappeared
+	if (!entries.empty())
+		mDirty = true;
+
+	std::sort(mEntries.begin(), mEntries.end(), [](const Entry& a, const Entry& b) { return a.name < b.name; });
+
+	for (size_t i = 0; i < mEntries.size(); ++i)
+	{
+		mIndices.emplace(mEntries[i].name, i);
+		mNames.emplace_back(mEntries[i].name.c_str());
+	}
+
+	if (mDirty)
+		save();
+}
+
+SceneCatalog::SceneParams SceneCatalog::getParams(const std::string& name)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	auto& entry = mEntries[getSceneIndex(name)];
+	const auto paramsPath = getParamsPath(name);
+	const auto time = lastWriteTime(paramsPath);
+
+	if (!entry.parsed || entry.paramsTime != time)
+	{
+		entry.params = time ? ParamsParser::parseFile(paramsPath) : defaultParams();
+		entry.paramsTime = time;
+		entry.parsed = true;
+
+		save();
+	}
+
+	return entry.params;
+}
+
+size_t SceneCatalog::getSceneIndex(const std::string& name) const
+{
+	auto it = mIndices.find(name);
+	if (it == mIndices.end())
+		throw std::runtime_error(fmt::format("Non existing scene {}", name));
+
+	return it->second;
+}
+
+std::string SceneCatalog::getParamsPath(const std::string& name)
+{
+	return MODELS_DIR + name.substr(0, name.find_last_of('.')) + ".params";
+}
+
+std::string SceneCatalog::getBVHParamsPath(const std::string& name)
+{
+	return MODELS_DIR + name.substr(0, name.find_last_of('.')) + ".bvhparams";
+}
+
+std::string SceneCatalog::getEnvironmentPath(const std::string& name)
+{
+	for (const auto extension : { ".hdr", ".pfm" })
+	{
+		const auto path = MODELS_DIR + name.substr(0, name.find_last_of('.')) + extension;
+		if (fs::exists(path))
+			return path;
+	}
+
+	return {};
+}
+
+bool SceneCatalog::load(std::unordered_map<std::string, Directory>& directories, std::unordered_map<std::string, Entry>& entries) const
+{
+	std::ifstream file(INDEX_PATH, std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	try
+	{
+		if (read<uint32_t>(file) != INDEX_MAGIC || read<uint32_t>(file) != INDEX_VERSION)
+			return false;
+
+		const auto directoryCount = read<uint32_t>(file);
+		for (uint32_t i = 0; i < directoryCount; ++i)
+		{
+			auto path = read<std::string>(file);
+
+			Directory directory;
+			directory.time = read<int64_t>(file);
+			directory.subdirectories = read<std::vector<std::string>>(file);
+			directory.scenes = read<std::vector<std::string>>(file);
+
+			directories.emplace(std::move(path), std::move(directory));
+		}
+
+		const auto entryCount = read<uint32_t>(file);
+		for (uint32_t i = 0; i < entryCount; ++i)
+		{
+			Entry entry;
+			entry.name = read<std::string>(file);
+			entry.paramsTime = read<int64_t>(file);
+			entry.parsed = read<uint8_t>(file);
+
+			if (entry.parsed)
+			{
+				entry.params.camera = read<CameraParam>(file);
+				entry.params.lights.resize(read<uint32_t>(file));
+				for (auto& light : entry.params.lights)
+					light = read<Light>(file);
+			}
+
+			entries.emplace(entry.name, std::move(entry));
+		}
+	}
+	catch (const std::runtime_error& e)
+	{
+		OutputDebugString(fmt::format("{}, rebuilding it.\n", e.what()).c_str());
+		return false;
+	}
+
+	return true;
+}
+
+void SceneCatalog::save() const
+{
+	std::ofstream file(INDEX_PATH, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		return; // catalog works without the index, it's only rebuilt on the next start
+
+	write(file, INDEX_MAGIC);
+	write(file, INDEX_VERSION);
+
+	write(file, static_cast<uint32_t>(mDirectories.size()));
+	for (const auto& [path, directory] : mDirectories)
+	{
+		write(file, path);
+		write(file, directory.time);
+		write(file, directory.subdirectories);
+		write(file, directory.scenes);
+	}
+
+	write(file, static_cast<uint32_t>(mEntries.size()));
+	for (const auto& entry : mEntries)
+	{
+		write(file, entry.name);
+		write(file, entry.paramsTime);
+		write(file, static_cast<uint8_t>(entry.parsed));
+
+		if (entry.parsed)
+		{
+			write(file, entry.params.camera);
+			write(file, static_cast<uint32_t>(entry.params.lights.size()));
+			for (const auto& light : entry.params.lights)
+				write(file, light);
+		}
+	}
+}
+
+void SceneCatalog::scanDirectory(const std::string& relative, std::unordered_map<std::string, Directory>& cached, std::unordered_map<std::string, Entry>& entries)
+{
+	const auto path = fs::path(MODELS_DIR) / relative;
+	const auto time = lastWriteTime(path);
+
+	// unchanged directory has the same listing, only its subdirectories need a check
+	Directory directory;
+	auto it = cached.find(relative);
+
+	if (it != cached.end() && it->second.time == time)
+		directory = std::move(it->second);
+	else
+	{
+		mDirty = true;
+		directory.time = time;
+
+		for (const auto& f : fs::directory_iterator(path))
+		{
+			const auto name = (fs::path(relative) / f.path().filename()).string();
+
+			if (f.is_directory())
+				directory.subdirectories.emplace_back(name);
+			else if (f.is_regular_file() && f.path().extension().string() == ".gltf")
+				directory.scenes.emplace_back(name);
+		}
+	}
+
+	for (const auto& scene : directory.scenes)
+	{
+		auto entry = entries.find(scene);
+		if (entry != entries.end())
+		{
+			mEntries.emplace_back(std::move(entry->second));
+			entries.erase(entry);
+		}
+		else
+		{
+			mEntries.emplace_back();
+			mEntries.back().name = scene;
+			mDirty = true;
+		}
+	}
+
+	for (const auto& subdirectory : directory.subdirectories)
+		scanDirectory(subdirectory, cached, entries);
+
+	mDirectories.emplace(relative, std::move(directory));
+}
+
+SceneCatalog::SceneParams SceneCatalog::defaultParams()
+{
+	SceneParams params;
+	params.camera = { {1.0, 3.0, 8.0}, 0, 270 };
+	params.lights.emplace_back(Light{ {13.0f, 4.5f, 4.5f}, 100.0f, {80.0f, 80.0f, 40.0f}, 0.5f });
+	params.lights.emplace_back(Light{ {0.0, 4.5, 2.0}, 100.0, {80.0, 80.0, 40.0}, 0.5 });
+
+	return params;
+}
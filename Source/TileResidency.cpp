@@ -0,0 +1,220 @@
+﻿#include "TileResidency.hpp"
+#include "Constants.hpp"
+#include "spdlog/fmt/fmt.h"
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+
+namespace
+{
+	uint32_t log2u(uint32_t value)
+	{
+		uint32_t result = 0;
+		while (value >>= 1)
+			++result;
+
+		return result;
+	}
+}
+
+// x and y of the slot in the pool take 8 bits each of the entry, a larger pool would overwrite the mip
+static_assert(VT_POOL_TILES <= 256, "Page table entries can't address a pool over 256 x 256 tiles");
+
+uint32_t TileResidency::makeEntry(uint32_t slot, uint32_t mip)
+{
+	return (slot % VT_POOL_TILES) | (slot / VT_POOL_TILES) << 8 | mip << 16 | ENTRY_VALID;
+}
+
+uint32_t TileResidency::mipOffset(const TextureLayout& layout, uint32_t mip)
+{
+	const auto tiles = layout.tiles;
+	const auto mipTiles = tiles >> mip;
+	return (tiles * tiles - mipTiles * mipTiles) * 4 / 3; // geometric series of pow2 squares
+}
+
+uint32_t TileResidency::requestPage(const TextureLayout& layout, float u, float v, float lod)
+{
+	u -= std::floor(u);
+	v -= std::floor(v);
+
+	const auto mip = std::min(static_cast<uint32_t>(std::max(lod, 0.f)), layout.mipCount - 1);
+	const auto tiles = layout.tiles >> mip;
+	const auto x = std::min(static_cast<uint32_t>(u * tiles), tiles - 1);
+	const auto y = std::min(static_cast<uint32_t>(v * tiles), tiles - 1);
+
+	return layout.pageOffset + mipOffset(layout, mip) + y * tiles + x;
+}
+
+void TileResidency::init(uint32_t textureCount, const uint32_t* sizes, uint32_t slotCount)
+{
+	mLayouts.clear();
+
+	uint32_t pageCount = 0;
+	for (uint32_t i = 0; i < textureCount; ++i)
+	{
+		TextureLayout layout;
+		layout.pageOffset = pageCount;
+		layout.size = sizes[i];
+		layout.tiles = sizes[i] / VT_TILE_SIZE;
+		layout.mipCount = log2u(layout.tiles) + 1;
+
+		pageCount += mipOffset(layout, layout.mipCount);
+		mLayouts.emplace_back(layout);
+	}
+
+	mPageTable.assign(pageCount, 0);
+	mPageSlot.assign(pageCount, -1);
+	mSlots.assign(slotCount, {});
+	mFreeSlots.clear();
+
+	for (uint32_t i = slotCount; i > 0; --i)
+		mFreeSlots.emplace_back(i - 1);
+
+	mResidentCount = 0;
+	dirty = true;
+}
+
+uint32_t TileResidency::addPinned(uint32_t page)
+{
+	const auto slot = allocate(page);
+	if (slot < 0)
+		throw std::runtime_error("Virtual texture pool is too small for the coarsest mips.");
+
+	mSlots[slot].pinned = true;
+	return static_cast<uint32_t>(slot);
+}
+
+std::vector<uint32_t> TileResidency::process(const uint32_t* feedback, size_t count)
+{
+	std::vector<uint32_t> missing;
+
+	for (size_t i = 0; i < std::min(count, mPageSlot.size()); ++i)
+	{
+		if (!feedback[i])
+			continue;
+
+		if (mPageSlot[i] >= 0)
+			mSlots[mPageSlot[i]].lastUsed = mFrame;
+		else if (mPageSlot[i] == -1)
+			missing.emplace_back(static_cast<uint32_t>(i));
+	}
+
+	// coarse tiles first, the image refines from them
+	std::stable_sort(missing.begin(), missing.end(), [this](uint32_t a, uint32_t b)
+	{
+		return decode(a).mip > decode(b).mip;
+	});
+
+	return missing;
+}
+
+int64_t TileResidency::allocate(uint32_t page)
+{
+	int64_t slot = -1;
+
+	if (!mFreeSlots.empty())
+	{
+		slot = mFreeSlots.back();
+		mFreeSlots.pop_back();
+	}
+	else
+	{
+		// least recently used tile, which wasn't requested in this frame
+		uint64_t oldest = mFrame;
+		for (size_t i = 0; i < mSlots.size(); ++i)
+		{
+			const auto& s = mSlots[i];
+			if (!s.pinned && !s.loading && s.lastUsed < oldest)
+			{
+				oldest = s.lastUsed;
+				slot = i;
+			}
+		}
+
+		if (slot < 0)
+			return -1;
+
+		evict(static_cast<uint32_t>(slot));
+	}
+
+	mSlots[slot].page = page;
+	mSlots[slot].loading = true;
+	mPageSlot[page] = -2; // in flight
+
+	return slot;
+}
+
+void TileResidency::commit(uint32_t page, uint32_t slot)
+{
+	mSlots[slot].loading = false;
+	mSlots[slot].lastUsed = mFrame;
+	mPageSlot[page] = static_cast<int32_t>(slot);
+	++mResidentCount;
+
+	refresh(decode(page));
+}
+
+void TileResidency::evict(uint32_t slot)
+{
+	const auto page = static_cast<uint32_t>(mSlots[slot].page);
+	mSlots[slot] = {};
+	mPageSlot[page] = -1;
+	--mResidentCount;
+
+	refresh(decode(page));
+}
+
+void TileResidency::refresh(const Page& page)
+{
+	const auto& layout = mLayouts[page.texture];
+	const auto index = encode(page);
+
+	uint32_t entry = 0;
+	if (mPageSlot[index] >= 0)
+		entry = makeEntry(mPageSlot[index], page.mip);
+	else if (page.mip + 1 < layout.mipCount)
+		entry = mPageTable[encode({ page.texture, page.mip + 1, page.x / 2, page.y / 2 })];
+
+	if (mPageTable[index] == entry)
+		return; // finer pages inherit the same entry, nothing changes below
+
+	mPageTable[index] = entry;
+	dirty = true;
+
+	if (page.mip == 0)
+		return;
+
+	for (uint32_t y = 0; y < 2; ++y)
+		for (uint32_t x = 0; x < 2; ++x)
+			refresh({ page.texture, page.mip - 1, page.x * 2 + x, page.y * 2 + y });
+}
+
+TileResidency::Page TileResidency::decode(uint32_t page) const
+{
+	auto it = std::upper_bound(mLayouts.begin(), mLayouts.end(), page, [](uint32_t p, const TextureLayout& layout)
+	{
+		return p < layout.pageOffset;
+	});
+
+	const auto texture = static_cast<uint32_t>(std::distance(mLayouts.begin(), it) - 1);
+	const auto& layout = mLayouts[texture];
+
+	auto local = page - layout.pageOffset;
+	uint32_t mip = 0;
+	for (; mip < layout.mipCount; ++mip)
+	{
+		const auto tiles = layout.tiles >> mip;
+		if (local < tiles * tiles)
+			return { texture, mip, local % tiles, local / tiles };
+
+		local -= tiles * tiles;
+	}
+
+	throw std::runtime_error(fmt::format("Invalid virtual texture page {}", page));
+}
+
+uint32_t TileResidency::encode(const Page& page) const
+{
+	const auto& layout = mLayouts[page.texture];
+	return layout.pageOffset + mipOffset(layout, page.mip) + page.y * (layout.tiles >> page.mip) + page.x;
+}
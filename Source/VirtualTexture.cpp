@@ -0,0 +1,430 @@
+﻿#include "VirtualTexture.hpp"
+#include "Constants.hpp"
+#include "spdlog/fmt/fmt.h"
+#include "lodepng/lodepng.h"
+#include "avir/avir.h"
+#include "avir/avir_float8_avx.h"
+#include <filesystem>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+	constexpr auto TILE_STRIDE = VT_TILE_SIZE + 2 * VT_TILE_BORDER;
+	constexpr auto TILE_BYTES = TILE_STRIDE * TILE_STRIDE * 4;
+	constexpr uint32_t CACHE_MAGIC = 0x31545456; // VTT1
+	constexpr uint32_t CACHE_VERSION = 1;
+
+	struct CacheHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		int64_t sourceTime;
+		uint32_t size;
+		uint32_t mipCount;
+		uint32_t tileSize;
+		uint32_t border;
+	};
+
+	uint32_t log2u(uint32_t value)
+	{
+		uint32_t result = 0;
+		while (value >>= 1)
+			++result;
+
+		return result;
+	}
+}
+
+////////////////////////////////////////////
+// VirtualTexture
+////////////////////////////////////////////
+
+VirtualTexture::VirtualTexture(ID3D11Device* device)
+	: mDevice(device)
+{}
+
+VirtualTexture::~VirtualTexture()
+{
+	mRunning = false;
+	mCondition.notify_all();
+
+	if (mStreamer.joinable())
+		mStreamer.join();
+}
+
+int32_t VirtualTexture::addTexture(const std::string& path)
+{
+	auto it = mTextureIndices.find(path);
+	if (it != mTextureIndices.end())
+		return it->second;
+
+	const fs::path source(path);
+	CachedTexture texture;
+	texture.source = path;
+	texture.cache = (source.parent_path() / VT_CACHE_DIR_NAME / source.filename()).string() + ".vt";
+
+	mTextures.emplace_back(texture);
+	mTextureIndices.emplace(path, static_cast<int32_t>(mTextures.size() - 1));
+
+	return static_cast<int32_t>(mTextures.size() - 1);
+}
+
+void VirtualTexture::finalize(const std::atomic<bool>* cancelled, const std::function<void(float)>& progress)
+{
+	if (mTextures.empty())
+		return;
+
+	// tile caches are built only for new or modified textures, the workers stop taking them once cancelled
+	std::atomic<size_t> next = 0, done = 0;
+	std::mutex exceptionMutex;
+	std::exception_ptr deferredException;
+	auto work = [&]()
+	{
+		try
+		{
+			for (auto i = next++; i < mTextures.size() && !(cancelled && *cancelled); i = next++)
+			{
+				buildCache(mTextures[i]);
+				if (progress)
+					progress(static_cast<float>(++done) / mTextures.size());
+			}
+		}
+		catch (...)
+		{
+			// the first failure is reported, the other workers finish their textures
+			std::lock_guard<std::mutex> lock(exceptionMutex);
+			if (!deferredException)
+				deferredException = std::current_exception();
+		}
+	};
+
+	// hardware_concurrency may be unknown and return 0
+	const auto threads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), mTextures.size());
+
+	std::vector<std::thread> workers;
+	for (size_t i = 0; i < threads; ++i)
+		workers.emplace_back(work);
+
+	for (auto& t : workers)
+		t.join();
+
+	if (deferredException)
+		std::rethrow_exception(deferredException);
+
+	if (cancelled && *cancelled)
+		throw std::runtime_error("Tile caching cancelled");
+
+	std::vector<uint32_t> sizes;
+	for (const auto& t : mTextures)
+		sizes.emplace_back(t.size);
+
+	mResidency.init(static_cast<uint32_t>(sizes.size()), sizes.data(), VT_POOL_TILES * VT_POOL_TILES);
+
+	// physical pool
+	D3D11_TEXTURE2D_DESC poolDescriptor = {};
+	poolDescriptor.Width = VT_POOL_TILES * TILE_STRIDE;
+	poolDescriptor.Height = VT_POOL_TILES * TILE_STRIDE;
+	poolDescriptor.MipLevels = 1;
+	poolDescriptor.ArraySize = 1;
+	poolDescriptor.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	poolDescriptor.SampleDesc.Count = 1;
+	poolDescriptor.SampleDesc.Quality = 0;
+	poolDescriptor.Usage = D3D11_USAGE_DEFAULT;
+	poolDescriptor.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	poolDescriptor.CPUAccessFlags = 0;
+	poolDescriptor.MiscFlags = 0;
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC poolSRVDescriptor = {};
+	poolSRVDescriptor.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	poolSRVDescriptor.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+	poolSRVDescriptor.Texture2D.MipLevels = 1;
+
+	mDevice->CreateTexture2D(&poolDescriptor, nullptr, &mPool.texture);
+	mDevice->CreateShaderResourceView(mPool.texture, &poolSRVDescriptor, &mPool.srv);
+
+	// page table and texture descriptors
+	std::vector<Descriptor> descriptors;
+	for (uint32_t i = 0; i < mTextures.size(); ++i)
+	{
+		const auto& layout = mResidency.layout(i);
+		descriptors.emplace_back(Descriptor{ layout.pageOffset, layout.tiles, layout.mipCount, layout.size });
+	}
+
+	mPageTable = createBuffer(mDevice, sizeof(uint32_t), mResidency.pageTable());
+	mDescriptors = createBuffer(mDevice, sizeof(Descriptor), descriptors);
+
+	// feedback - one flag per page, read back through staging buffers
+	D3D11_BUFFER_DESC feedbackDescriptor = {};
+	feedbackDescriptor.Usage = D3D11_USAGE_DEFAULT;
+	feedbackDescriptor.ByteWidth = static_cast<UINT>(mResidency.pageCount() * sizeof(uint32_t));
+	feedbackDescriptor.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+	feedbackDescriptor.CPUAccessFlags = 0;
+	feedbackDescriptor.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
+
+	D3D11_BUFFER_DESC stagingDescriptor = feedbackDescriptor;
+	stagingDescriptor.Usage = D3D11_USAGE_STAGING;
+	stagingDescriptor.BindFlags = 0;
+	stagingDescriptor.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	stagingDescriptor.MiscFlags = 0;
+
+	std::vector<uint32_t> zeros(mResidency.pageCount());
+	D3D11_SUBRESOURCE_DATA feedbackData = {};
+	feedbackData.pSysMem = zeros.data();
+
+	D3D11_UNORDERED_ACCESS_VIEW_DESC UAVDescriptor = {};
+	UAVDescriptor.Format = DXGI_FORMAT_R32_TYPELESS;
+	UAVDescriptor.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+	UAVDescriptor.Buffer.Flags = D3D11_BUFFER_UAV_FLAG_RAW;
+	UAVDescriptor.Buffer.NumElements = static_cast<UINT>(mResidency.pageCount());
+
+	mDevice->CreateBuffer(&feedbackDescriptor, &feedbackData, &mFeedback);
+	mDevice->CreateUnorderedAccessView(mFeedback, &UAVDescriptor, &mFeedbackUAV);
+	for (auto& staging : mFeedbackStaging)
+		mDevice->CreateBuffer(&stagingDescriptor, nullptr, &staging);
+
+	// coarsest mips are always resident, so the first frame has something to show
+	for (const auto& t : mTextures)
+		mFiles.emplace_back(t.cache, std::ios::binary);
+
+	for (uint32_t i = 0; i < mTextures.size(); ++i)
+	{
+		const TileResidency::Page page = { i, mResidency.layout(i).mipCount - 1, 0, 0 };
+		const auto index = mResidency.encode(page);
+		const auto slot = mResidency.addPinned(index);
+
+		mLoaded.emplace_back(LoadedTile{ index, slot, readTile(page) });
+	}
+
+	mRunning = true;
+	mStreamer = std::thread(&VirtualTexture::streamTiles, this);
+}
+
+void VirtualTexture::update(ID3D11DeviceContext* context)
+{
+	if (mTextures.empty())
+		return;
+
+	// upload streamed tiles, the pinned ones all at once in the first frame
+	std::deque<LoadedTile> loaded;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		const auto count = mFrame == 0 ? mLoaded.size() : std::min<size_t>(mLoaded.size(), VT_MAX_UPLOADS);
+		std::move(mLoaded.begin(), mLoaded.begin() + count, std::back_inserter(loaded));
+		mLoaded.erase(mLoaded.begin(), mLoaded.begin() + count);
+	}
+
+	for (const auto& tile : loaded)
+	{
+		uploadTile(context, tile);
+		mResidency.commit(tile.page, tile.slot);
+	}
+
+	if (mFrame % VT_FEEDBACK_INTERVAL == 0)
+		readFeedback(context);
+
+	if (mResidency.dirty)
+	{
+		context->UpdateSubresource(mPageTable.buffer, 0, nullptr, mResidency.pageTable().data(), 0, 0);
+		mResidency.dirty = false;
+	}
+
+	mResidency.nextFrame();
+	++mFrame;
+}
+
+void VirtualTexture::buildCache(CachedTexture& texture) const
+{
+	const auto sourceTime = fs::last_write_time(texture.source).time_since_epoch().count();
+
+	{
+		std::ifstream file(texture.cache, std::ios::binary);
+		CacheHeader header = {};
+
+		if (file.read(reinterpret_cast<char*>(&header), sizeof(header))
+			&& header.magic == CACHE_MAGIC
+			&& header.version == CACHE_VERSION
+			&& header.sourceTime == sourceTime
+			&& header.tileSize == VT_TILE_SIZE
+			&& header.border == VT_TILE_BORDER)
+		{
+			texture.size = header.size;
+			texture.mipCount = header.mipCount;
+			return;
+		}
+	}
+
+	std::vector<unsigned char> image;
+	unsigned width, height;
+
+	if (auto error = lodepng::decode(image, width, height, texture.source))
+		throw std::runtime_error(fmt::format("Failed to load texture {}. ERR: {}", texture.source, lodepng_error_text(error)));
+
+	// cache keeps pow2 squares, so every mip splits to whole tiles
+	uint32_t size = VT_TILE_SIZE;
+	while (size < std::max(width, height))
+		size <<= 1;
+
+	if (width != size || height != size)
+	{
+		std::vector<unsigned char> resized(size * size * 4);
+		avir::CImageResizer<avir::fpclass_float8_dil> textureResizer(8);
+		textureResizer.resizeImage(image.data(), width, height, 0, resized.data(), size, size, 4, 0);
+		image.swap(resized);
+	}
+
+	texture.size = size;
+	texture.mipCount = log2u(size / VT_TILE_SIZE) + 1;
+
+	fs::create_directories(fs::path(texture.cache).parent_path());
+	std::ofstream file(texture.cache, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		throw std::runtime_error(fmt::format("Failed to create tile cache {}", texture.cache));
+
+	const CacheHeader header = { CACHE_MAGIC, CACHE_VERSION, sourceTime, size, texture.mipCount, VT_TILE_SIZE, VT_TILE_BORDER };
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	std::vector<unsigned char> tile(TILE_BYTES);
+	for (uint32_t mip = 0; mip < texture.mipCount; ++mip)
+	{
+		const auto mipSize = size >> mip;
+		const auto tiles = mipSize / VT_TILE_SIZE;
+
+		for (uint32_t ty = 0; ty < tiles; ++ty)
+		{
+			for (uint32_t tx = 0; tx < tiles; ++tx)
+			{
+				// border is taken from neighbouring tiles with wrapping, as the sampler wraps
+				for (uint32_t y = 0; y < TILE_STRIDE; ++y)
+				{
+					const auto sy = (ty * VT_TILE_SIZE + y + mipSize - VT_TILE_BORDER) % mipSize;
+					for (uint32_t x = 0; x < TILE_STRIDE; ++x)
+					{
+						const auto sx = (tx * VT_TILE_SIZE + x + mipSize - VT_TILE_BORDER) % mipSize;
+						std::copy_n(&image[(sy * mipSize + sx) * 4], 4, &tile[(y * TILE_STRIDE + x) * 4]);
+					}
+				}
+
+				file.write(reinterpret_cast<const char*>(tile.data()), tile.size());
+			}
+		}
+
+		if (mip + 1 == texture.mipCount)
+			break;
+
+		// box filter to the next mip
+		const auto nextSize = mipSize >> 1;
+		std::vector<unsigned char> next(nextSize * nextSize * 4);
+
+		for (uint32_t y = 0; y < nextSize; ++y)
+			for (uint32_t x = 0; x < nextSize; ++x)
+				for (uint32_t c = 0; c < 4; ++c)
+				{
+					const auto at = [&](uint32_t dx, uint32_t dy) -> unsigned
+					{
+						return image[((2 * y + dy) * mipSize + 2 * x + dx) * 4 + c];
+					};
+
+					next[(y * nextSize + x) * 4 + c] = static_cast<unsigned char>((at(0, 0) + at(1, 0) + at(0, 1) + at(1, 1) + 2) / 4);
+				}
+
+		image.swap(next);
+	}
+}
+
+std::vector<unsigned char> VirtualTexture::readTile(const TileResidency::Page& page)
+{
+	const auto& layout = mResidency.layout(page.texture);
+	const auto local = mResidency.encode(page) - layout.pageOffset;
+
+	std::vector<unsigned char> data(TILE_BYTES);
+	auto& file = mFiles[page.texture];
+	file.seekg(sizeof(CacheHeader) + static_cast<std::streamoff>(local) * TILE_BYTES);
+
+	if (!file.read(reinterpret_cast<char*>(data.data()), data.size()))
+		throw std::runtime_error(fmt::format("Corrupted tile cache {}", mTextures[page.texture].cache));
+
+	return data;
+}
+
+void VirtualTexture::streamTiles()
+{
+	while (true)
+	{
+		LoadedTile tile;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mCondition.wait(lock, [this] { return !mRequests.empty() || !mRunning; });
+
+			if (!mRunning)
+				return;
+
+			tile = std::move(mRequests.front());
+			mRequests.pop_front();
+		}
+
+		try
+		{
+			tile.data = readTile(mResidency.decode(tile.page));
+		}
+		catch (std::runtime_error& e)
+		{
+			OutputDebugString(fmt::format("{}\n", e.what()).c_str());
+			tile.data.assign(TILE_BYTES, 0);
+		}
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		mLoaded.emplace_back(std::move(tile));
+	}
+}
+
+void VirtualTexture::readFeedback(ID3D11DeviceContext* context)
+{
+	// staging buffers are used in turns, so the one being read was copied a whole interval ago
+	const auto index = (mFrame / VT_FEEDBACK_INTERVAL) % mFeedbackStaging.size();
+	auto& staging = mFeedbackStaging[index];
+
+	if (mFeedbackFrame[index] >= 0)
+	{
+		D3D11_MAPPED_SUBRESOURCE subresource;
+		if (context->Map(staging, 0, D3D11_MAP_READ, {}, &subresource) == S_OK)
+		{
+			auto missing = mResidency.process(reinterpret_cast<const uint32_t*>(subresource.pData), mResidency.pageCount());
+			context->Unmap(staging, 0);
+
+			std::lock_guard<std::mutex> lock(mMutex);
+			for (size_t i = 0; i < std::min<size_t>(missing.size(), VT_MAX_UPLOADS * VT_FEEDBACK_INTERVAL); ++i)
+			{
+				const auto slot = mResidency.allocate(missing[i]);
+				if (slot < 0)
+					break; // pool is full of tiles requested in this frame
+
+				mRequests.emplace_back(LoadedTile{ missing[i], static_cast<uint32_t>(slot) });
+			}
+		}
+
+		mCondition.notify_one();
+	}
+
+	const std::array<UINT, 4> zeros = {};
+	context->CopyResource(staging, mFeedback);
+	context->ClearUnorderedAccessViewUint(mFeedbackUAV, zeros.data());
+	mFeedbackFrame[index] = mFrame;
+}
+
+void VirtualTexture::uploadTile(ID3D11DeviceContext* context, const LoadedTile& tile)
+{
+	D3D11_BOX box;
+	box.left = (tile.slot % VT_POOL_TILES) * TILE_STRIDE;
+	box.top = (tile.slot / VT_POOL_TILES) * TILE_STRIDE;
+	box.front = 0;
+	box.right = box.left + TILE_STRIDE;
+	box.bottom = box.top + TILE_STRIDE;
+	box.back = 1;
+
+	context->UpdateSubresource(mPool.texture, 0, &box, tile.data.data(), TILE_STRIDE * 4, 0);
+}